@@ -0,0 +1,34 @@
+# - Try to find libdeflate
+# Once done this will define
+#
+# LIBDEFLATE_FOUND - system has libdeflate
+# LIBDEFLATE_INCLUDE_DIR - the libdeflate include directory
+# LIBDEFLATE_LIBRARIES - Link these to use libdeflate
+#
+
+IF(LIBDEFLATE_INCLUDE_DIR AND LIBDEFLATE_LIBRARIES)
+	# Already in cache, be silent
+	SET(LIBDEFLATE_FIND_QUIETLY TRUE)
+ENDIF()
+
+FIND_PATH(LIBDEFLATE_INCLUDE_DIR libdeflate.h)
+FIND_LIBRARY(LIBDEFLATE_LIBRARIES NAMES deflate libdeflate)
+
+IF(LIBDEFLATE_INCLUDE_DIR AND LIBDEFLATE_LIBRARIES)
+	SET(LIBDEFLATE_FOUND TRUE)
+ENDIF()
+
+IF(LIBDEFLATE_FOUND)
+	IF(NOT LIBDEFLATE_FIND_QUIETLY)
+		MESSAGE(STATUS "Found libdeflate: ${LIBDEFLATE_LIBRARIES}")
+	ENDIF()
+ELSE()
+	IF(Libdeflate_FIND_REQUIRED)
+		MESSAGE(FATAL_ERROR "Could not find libdeflate")
+	ENDIF()
+ENDIF()
+
+MARK_AS_ADVANCED(
+	LIBDEFLATE_INCLUDE_DIR
+	LIBDEFLATE_LIBRARIES
+)
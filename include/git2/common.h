@@ -143,8 +143,33 @@ typedef enum {
 	GIT_OPT_GET_TEMPLATE_PATH,
 	GIT_OPT_SET_TEMPLATE_PATH,
 	GIT_OPT_SET_SSL_CERT_LOCATIONS,
+	GIT_OPT_GET_CACHE_STATS,
+	GIT_OPT_ENABLE_MWINDOW_FULL_MAP,
+	GIT_OPT_SET_MWINDOW_ADVICE,
+	GIT_OPT_SET_PACK_CACHE_MAX_SIZE,
+	GIT_OPT_GET_PACK_CACHED_MEMORY,
+	GIT_OPT_GET_PACK_CACHE_STATS,
+	GIT_OPT_ENABLE_PACK_CACHE_INTERMEDIATES,
+	GIT_OPT_ENABLE_PACK_OBJINFO,
+	GIT_OPT_ENABLE_ODB_NEGATIVE_CACHE,
+	GIT_OPT_SET_DELTA_INDEX_CACHE_MAX_SIZE,
+	GIT_OPT_GET_DELTA_INDEX_CACHED_MEMORY,
+	GIT_OPT_GET_DELTA_INDEX_CACHE_STATS,
 } git_libgit2_opt_t;
 
+/**
+ * How the library will read the packfiles it maps, as a hint for the
+ * kernel.  Used with `GIT_OPT_SET_MWINDOW_ADVICE`.
+ */
+typedef enum {
+	/** No particular pattern, the default */
+	GIT_MWINDOW_ADVICE_NORMAL = 0,
+	/** Objects are read in no particular order; don't read ahead */
+	GIT_MWINDOW_ADVICE_RANDOM = 1,
+	/** Start reading the whole mapping in now */
+	GIT_MWINDOW_ADVICE_WILLNEED = 2,
+} git_mwindow_advice_t;
+
 /**
  * Set or query a library global option
  *
@@ -238,6 +263,87 @@ typedef enum {
  *		>
  * 		> Either parameter may be `NULL`, but not both.
  *
+ *	* opts(GIT_OPT_GET_CACHE_STATS, size_t *hits, size_t *misses, size_t *evictions)
+ *
+ *		> Get the number of lookups which found an object in the cache,
+ *		> the number of those which did not, and the number of objects
+ *		> evicted from the cache, across all repositories since the
+ *		> library was loaded.
+ *
+ *	* opts(GIT_OPT_ENABLE_MWINDOW_FULL_MAP, int enabled)
+ *
+ *		> Map each packfile in full the first time it is read, instead of
+ *		> in windows of `GIT_OPT_SET_MWINDOW_SIZE` bytes.  Such maps
+ *		> are only released with the packfile.  This is ignored on 32-bit
+ *		> hosts, which lack the address space for it.  Disabled by
+ *		> default.
+ *
+ *	* opts(GIT_OPT_SET_MWINDOW_ADVICE, git_mwindow_advice_t advice)
+ *
+ *		> Set the hint given to the kernel for the packfiles and pack
+ *		> indexes mapped from now on.  Platforms without `madvise()`
+ *		> ignore it.
+ *
+ *	* opts(GIT_OPT_SET_PACK_CACHE_MAX_SIZE, size_t max_storage)
+ *
+ *		> Set the maximum memory used by the inflated delta bases kept
+ *		> from every packfile, across all repositories.  The least
+ *		> recently used bases are evicted to stay under it.  The default
+ *		> is 96MB.
+ *
+ *	* opts(GIT_OPT_GET_PACK_CACHED_MEMORY, size_t *current, size_t *allowed)
+ *
+ *		> Get the memory used by the delta bases and its maximum.
+ *
+ *	* opts(GIT_OPT_GET_PACK_CACHE_STATS, size_t *hits, size_t *misses, size_t *evictions)
+ *
+ *		> Get the number of delta bases found in the cache, the number
+ *		> of those which were not, and the number of bases evicted,
+ *		> since the library was loaded.
+ *
+ *	* opts(GIT_OPT_ENABLE_PACK_CACHE_INTERMEDIATES, int enabled)
+ *
+ *		> Keep every object produced while applying a chain of deltas
+ *		> in the delta base cache, not only the object at the start of
+ *		> the chain, so that the objects sharing a part of the chain
+ *		> don't apply it again.  Disabling it saves an allocation for
+ *		> each delta applied.  Enabled by default.
+ *
+ *	* opts(GIT_OPT_ENABLE_PACK_OBJINFO, int enabled)
+ *
+ *		> Write an `.objinfo` file, with the type and size of every
+ *		> object, for the packs received into the object database, so
+ *		> that reading the header of a packed object is a single lookup.
+ *		> Disabled by default.
+ *
+ *	* opts(GIT_OPT_ENABLE_ODB_NEGATIVE_CACHE, int enabled)
+ *
+ *		> Answer `git_odb_exists` for missing objects without any I/O:
+ *		> the packed backend keeps a Bloom filter of the ids in its
+ *		> packs, and the loose backend remembers the ids it did not
+ *		> find.  Objects added by other processes are then only seen
+ *		> after `git_odb_refresh`.  Disabled by default.
+ *
+ *	* opts(GIT_OPT_SET_DELTA_INDEX_CACHE_MAX_SIZE, size_t max_storage)
+ *
+ *		> Set the maximum memory used to keep the indexes which the
+ *		> packbuilders build to search for deltas against an object,
+ *		> along with the object, for the packbuilders that come after
+ *		> them.  A server which packs the same recent objects for each
+ *		> fetch then indexes them only once.  The least recently used
+ *		> indexes are evicted to stay under it.  The default is 0,
+ *		> which keeps none.
+ *
+ *	* opts(GIT_OPT_GET_DELTA_INDEX_CACHED_MEMORY, size_t *current, size_t *allowed)
+ *
+ *		> Get the memory used by the delta indexes and its maximum.
+ *
+ *	* opts(GIT_OPT_GET_DELTA_INDEX_CACHE_STATS, size_t *hits, size_t *misses, size_t *evictions)
+ *
+ *		> Get the number of delta indexes found in the cache, the number
+ *		> of those which were not, and the number of indexes evicted,
+ *		> since the library was loaded.
+ *
  * @param option Option key
  * @param ... value to set the option
  * @return 0 on success, <0 on failure
@@ -35,6 +35,51 @@ GIT_EXTERN(int) git_indexer_new(
 		git_transfer_progress_cb progress_cb,
 		void *progress_cb_payload);
 
+/**
+ * Set number of threads to spawn when resolving the deltas
+ *
+ * By default, libgit2 won't spawn any threads at all;
+ * when set to 0, libgit2 will autodetect the number of
+ * CPUs.
+ *
+ * With more than one thread, the ids of the small objects
+ * which are not deltas are also computed on the threads,
+ * in batches, while the pack is being appended.
+ *
+ * @param idx The indexer
+ * @param n Number of threads to spawn
+ * @return number of actual threads to be used
+ */
+GIT_EXTERN(unsigned int) git_indexer_set_threads(git_indexer *idx, unsigned int n);
+
+/**
+ * Resolve deltas while the pack is being appended
+ *
+ * By default every delta is resolved in `git_indexer_commit`. When
+ * enabled, the offset deltas whose base has already been seen are
+ * resolved and hashed in `git_indexer_append` instead, so the work
+ * overlaps with receiving the rest of the pack.
+ *
+ * @param idx The indexer
+ * @param enabled whether to resolve the deltas eagerly
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_indexer_set_eager_deltas(git_indexer *idx, int enabled);
+
+/**
+ * Write an `.objinfo` file along with the index
+ *
+ * The file records the type and the inflated size of every object in
+ * the pack, so that reading their headers later does not need to go
+ * through the delta chains. See `git_pack_objinfo_write` to write one
+ * for an existing pack. Disabled by default.
+ *
+ * @param idx The indexer
+ * @param enabled whether to write the `.objinfo` file
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_indexer_set_objinfo(git_indexer *idx, int enabled);
+
 /**
  * Add data to the indexer
  *
@@ -25,6 +25,11 @@ GIT_BEGIN_DECL
  */
 typedef int (*git_odb_foreach_cb)(const git_oid *id, void *payload);
 
+/**
+ * Function type for callbacks from git_odb_read_many.
+ */
+typedef int (*git_odb_read_many_cb)(git_odb_object *obj, void *payload);
+
 /**
  * Create a new object database with no backends.
  *
@@ -98,6 +103,34 @@ GIT_EXTERN(void) git_odb_free(git_odb *db);
  */
 GIT_EXTERN(int) git_odb_read(git_odb_object **out, git_odb *db, const git_oid *id);
 
+/**
+ * Read several objects from the database.
+ *
+ * The objects are not read in the order of `ids`, but in the order
+ * which is cheapest for the backends, such as by position in their
+ * packfiles.  Each object is passed to the callback, and freed once
+ * it returns; use `git_odb_object_dup` to keep it.
+ *
+ * The objects which are found are all read before an error is
+ * returned for the ones which are not.
+ *
+ * @param db database to search for the objects in.
+ * @param ids the ids of the objects to read
+ * @param count the number of ids
+ * @param cb the callback to call for each object
+ * @param payload data to pass to the callback
+ * @return
+ * - 0 if every object was read;
+ * - GIT_ENOTFOUND if an object is not in the database;
+ * - the non-zero return value of the callback, which stops the read.
+ */
+GIT_EXTERN(int) git_odb_read_many(
+	git_odb *db,
+	const git_oid *ids,
+	size_t count,
+	git_odb_read_many_cb cb,
+	void *payload);
+
 /**
  * Read an object from the database, given a prefix
  * of its identifier.
@@ -53,6 +53,27 @@ typedef enum {
 	GIT_PACKBUILDER_DELTAFICATION = 1,
 } git_packbuilder_stage_t;
 
+/**
+ * How the packbuilder hashes the names of the objects, which it sorts
+ * them by to find which ones to try deltas between.
+ */
+typedef enum {
+	/**
+	 * Hash the last sixteen characters of the name, so that files with
+	 * the same name or extension are tried against each other.
+	 */
+	GIT_PACKBUILDER_NAME_HASH_FILENAME = 1,
+
+	/**
+	 * Mix the hash of the directories into that of the name, so that
+	 * files with the same name are still close to each other, but the
+	 * ones at the same path come first. This finds better deltas in
+	 * deep trees with many files of the same name, but needs the whole
+	 * path of the objects.
+	 */
+	GIT_PACKBUILDER_NAME_HASH_PATH = 2,
+} git_packbuilder_name_hash_t;
+
 /**
  * Initialize a new packbuilder
  *
@@ -76,6 +97,73 @@ GIT_EXTERN(int) git_packbuilder_new(git_packbuilder **out, git_repository *repo)
  */
 GIT_EXTERN(unsigned int) git_packbuilder_set_threads(git_packbuilder *pb, unsigned int n);
 
+/**
+ * Set whether to reuse the data of existing packfiles
+ *
+ * By default, objects that are already stored in a packfile are copied
+ * from it without being inflated and deflated again, and objects that
+ * are stored there as a delta against another object of the pack being
+ * built keep that delta instead of going through the delta search.
+ *
+ * @param pb The packbuilder
+ * @param enabled 0 to always recompress the objects and search for
+ * deltas, 1 to reuse the existing data
+ */
+GIT_EXTERN(void) git_packbuilder_set_reuse(git_packbuilder *pb, int enabled);
+
+/**
+ * Set whether to write deltas against the offset of their base
+ *
+ * By default, a delta whose base is earlier in the pack names it by
+ * the distance back to it (an "ofs-delta"), which is shorter than its
+ * id and saves readers an index lookup. A push turns this off when the
+ * remote does not advertise the `ofs-delta` capability.
+ *
+ * @param pb The packbuilder
+ * @param enabled 0 to name the base of every delta by its id, 1 to use
+ * offset deltas
+ */
+GIT_EXTERN(void) git_packbuilder_set_ofs_delta(git_packbuilder *pb, int enabled);
+
+/**
+ * Set how to hash the names given with the objects
+ *
+ * This only applies to the objects inserted after the call. Objects
+ * found with the reachability bitmaps of the repository keep the hash
+ * stored with them. The default is the `pack.nameHashVersion`
+ * configuration, or `GIT_PACKBUILDER_NAME_HASH_FILENAME`.
+ *
+ * @param pb The packbuilder
+ * @param name_hash The hash to use
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_packbuilder_set_name_hash(
+	git_packbuilder *pb, git_packbuilder_name_hash_t name_hash);
+
+/**
+ * Add a pattern to sort the refs of the repository into delta islands
+ *
+ * Each ref whose name matches the extended regular expression is in an
+ * island named by what the capture groups of the pattern matched, or
+ * in a single unnamed island if it has none; when several patterns
+ * match, the last one added wins. An object is in the islands of every
+ * ref it is reachable from, and is only stored as a delta against a
+ * base which is in all of them, so that a pack of the objects of one
+ * island never needs a base from another one. This is how a server
+ * storing many forks in one repository keeps the deltas of each fork
+ * within it, for example with `refs/virtual/([0-9]+)/`.
+ *
+ * The patterns of the `pack.island` configuration are added when the
+ * packbuilder is created. Finding the islands walks the whole history
+ * of the matching refs when the pack is written.
+ *
+ * @param pb The packbuilder
+ * @param pattern The pattern to match ref names against
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_packbuilder_add_island(
+	git_packbuilder *pb, const char *pattern);
+
 /**
  * Insert a single object
  *
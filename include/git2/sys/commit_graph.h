@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_sys_git_commit_graph_h__
+#define INCLUDE_sys_git_commit_graph_h__
+
+#include "git2/common.h"
+#include "git2/types.h"
+#include "git2/buffer.h"
+
+/**
+ * @file git2/sys/commit_graph.h
+ * @brief Git commit-graph routines
+ * @defgroup git_commit_graph Git commit-graph routines
+ * @ingroup Git
+ * @{
+ */
+GIT_BEGIN_DECL
+
+/**
+ * Create a new writer for `commit-graph` files.
+ *
+ * A commit-graph stores the parents, the commit time and the generation
+ * number of a set of commits so that history traversals do not need to
+ * read and parse the commit objects themselves.
+ *
+ * @param out location to store the writer pointer.
+ * @param objects_info_dir the `objects/info` directory of the repository.
+ * The `commit-graph` file will be written in this directory.
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_commit_graph_writer_new(
+		git_commit_graph_writer **out,
+		const char *objects_info_dir);
+
+/**
+ * Free the commit-graph writer and its resources.
+ *
+ * @param w the writer to free. If NULL no action is taken.
+ */
+GIT_EXTERN(void) git_commit_graph_writer_free(git_commit_graph_writer *w);
+
+/**
+ * Add all the commits in an `.idx` file to the writer.
+ *
+ * The ancestors of these commits are added too, since a commit-graph
+ * must be closed under reachability.
+ *
+ * @param w the writer
+ * @param repo the repository the packfile belongs to
+ * @param idx_path the path of an `.idx` file
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_commit_graph_writer_add_index_file(
+		git_commit_graph_writer *w,
+		git_repository *repo,
+		const char *idx_path);
+
+/**
+ * Add all the commits returned by a revision walk to the writer.
+ *
+ * This consumes the walk; to add every reachable commit, push all the
+ * references into it first.
+ *
+ * @param w the writer
+ * @param walk the revision walk
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_commit_graph_writer_add_revwalk(
+		git_commit_graph_writer *w,
+		git_revwalk *walk);
+
+/**
+ * Write a `commit-graph` file for all the added commits to the writer's
+ * `objects/info` directory, replacing any existing one atomically.
+ *
+ * @param w the writer
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_commit_graph_writer_commit(
+		git_commit_graph_writer *w);
+
+/**
+ * Dump the contents of the `commit-graph` to an in-memory buffer.
+ *
+ * @param cgraph Buffer where to store the contents of the `commit-graph`.
+ * @param w the writer
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_commit_graph_writer_dump(
+		git_buf *cgraph,
+		git_commit_graph_writer *w);
+
+/** @} */
+GIT_END_DECL
+#endif
@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_sys_git_midx_h__
+#define INCLUDE_sys_git_midx_h__
+
+#include "git2/common.h"
+#include "git2/types.h"
+#include "git2/buffer.h"
+
+/**
+ * @file git2/sys/midx.h
+ * @brief Git multi-pack-index routines
+ * @defgroup git_midx Git multi-pack-index routines
+ * @ingroup Git
+ * @{
+ */
+GIT_BEGIN_DECL
+
+/**
+ * Create a new writer for `multi-pack-index` files.
+ *
+ * A multi-pack-index maps every object in a set of packfiles to the
+ * packfile and offset where it can be found, so that the packed object
+ * backend can locate an object with a single binary search instead of
+ * one search per packfile.
+ *
+ * @param out location to store the writer pointer.
+ * @param pack_dir the directory where the `.pack` and `.idx` files are. The
+ * `multi-pack-index` file will be written in this directory, too.
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_midx_writer_new(
+		git_midx_writer **out,
+		const char *pack_dir);
+
+/**
+ * Free the multi-pack-index writer and its resources.
+ *
+ * @param w the writer to free. If NULL no action is taken.
+ */
+GIT_EXTERN(void) git_midx_writer_free(git_midx_writer *w);
+
+/**
+ * Add an `.idx` file to the writer.
+ *
+ * @param w the writer
+ * @param idx_path the path of an `.idx` file. Relative paths are
+ * interpreted relative to the writer's `pack_dir`.
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_midx_writer_add(
+		git_midx_writer *w,
+		const char *idx_path);
+
+/**
+ * Write a `multi-pack-index` file for all the added packfiles to the
+ * writer's `pack_dir`, replacing any existing one atomically.
+ *
+ * @param w the writer
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_midx_writer_commit(
+		git_midx_writer *w);
+
+/**
+ * Dump the contents of the `multi-pack-index` to an in-memory buffer.
+ *
+ * @param midx Buffer where to store the contents of the `multi-pack-index`.
+ * @param w the writer
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_midx_writer_dump(
+		git_buf *midx,
+		git_midx_writer *w);
+
+/**
+ * Verify the `multi-pack-index` file in `pack_dir`.
+ *
+ * This checks the trailing checksum of the file and makes sure that
+ * every object it lists can be found at the recorded offset of the
+ * recorded packfile.
+ *
+ * @param pack_dir the directory where the `.pack`, `.idx` and
+ * `multi-pack-index` files are.
+ * @return 0 if the file is valid, GIT_ENOTFOUND if there is no such
+ * file, or an error code if it is corrupted.
+ */
+GIT_EXTERN(int) git_midx_verify(const char *pack_dir);
+
+/** @} */
+GIT_END_DECL
+#endif
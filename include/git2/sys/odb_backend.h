@@ -21,6 +21,15 @@
  */
 GIT_BEGIN_DECL
 
+/**
+ * Callback given to the `read_many` function of a backend, once for
+ * each object it has.  `idx` is the position of the object's id in the
+ * array the backend was given, and `data` is allocated as for `read`,
+ * with libgit2 taking it over.
+ */
+typedef int (*git_odb_backend_read_many_cb)(
+	size_t idx, void *data, size_t len, git_otype type, void *payload);
+
 /**
  * An instance for a custom backend
  */
@@ -83,6 +92,17 @@ struct git_odb_backend {
 		git_odb_writepack **, git_odb_backend *, git_odb *odb,
 		git_transfer_progress_cb progress_cb, void *progress_payload);
 
+	/**
+	 * Read several objects at once, in whatever order is cheapest for
+	 * the backend, and pass each one it has to the callback.  The ids
+	 * it doesn't have are skipped.  A non-zero return from the callback
+	 * must stop the read and be returned.  Backends without it are read
+	 * one object at a time.
+	 */
+	int (* read_many)(
+		git_odb_backend *, const git_oid *ids, size_t count,
+		git_odb_backend_read_many_cb cb, void *payload);
+
 	/**
 	 * Frees any resources held by the odb (including the `git_odb_backend`
 	 * itself). An odb backend implementation must provide this function.
@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_sys_git_pack_bitmap_h__
+#define INCLUDE_sys_git_pack_bitmap_h__
+
+#include "git2/common.h"
+#include "git2/types.h"
+#include "git2/buffer.h"
+#include "git2/oid.h"
+
+/**
+ * @file git2/sys/pack_bitmap.h
+ * @brief Git reachability bitmap routines
+ * @defgroup git_pack_bitmap Git reachability bitmap routines
+ * @ingroup Git
+ * @{
+ */
+GIT_BEGIN_DECL
+
+/**
+ * Create a new writer for the `.bitmap` file of a packfile.
+ *
+ * A reachability bitmap stores, for a selection of commits, the set of
+ * objects in the packfile that can be reached from them. The packbuilder
+ * uses it to find the objects to send without walking every tree.
+ *
+ * Every object reachable from the pushed commits must be in the packfile.
+ *
+ * @param out location to store the writer pointer.
+ * @param repo the repository the packfile belongs to
+ * @param idx_path the path of the `.idx` file of the packfile. The bitmap
+ * will be written next to it, with the `.bitmap` extension.
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_pack_bitmap_writer_new(
+		git_pack_bitmap_writer **out,
+		git_repository *repo,
+		const char *idx_path);
+
+/**
+ * Free the bitmap writer and its resources.
+ *
+ * @param w the writer to free. If NULL no action is taken.
+ */
+GIT_EXTERN(void) git_pack_bitmap_writer_free(git_pack_bitmap_writer *w);
+
+/**
+ * Add a commit that must get a bitmap, usually the tip of a reference.
+ *
+ * Bitmaps are also stored for some of its ancestors, so that walks
+ * that start from older commits can use them.
+ *
+ * @param w the writer
+ * @param commit_id the id of the commit
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_pack_bitmap_writer_push(
+		git_pack_bitmap_writer *w,
+		const git_oid *commit_id);
+
+/**
+ * Write the `.bitmap` file of the packfile, replacing any existing one
+ * atomically.
+ *
+ * @param w the writer
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_pack_bitmap_writer_commit(
+		git_pack_bitmap_writer *w);
+
+/**
+ * Dump the contents of the `.bitmap` file to an in-memory buffer.
+ *
+ * @param bitmap Buffer where to store the contents of the `.bitmap` file.
+ * @param w the writer
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_pack_bitmap_writer_dump(
+		git_buf *bitmap,
+		git_pack_bitmap_writer *w);
+
+/** @} */
+GIT_END_DECL
+#endif
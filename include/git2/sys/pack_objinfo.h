@@ -0,0 +1,43 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_sys_git_pack_objinfo_h__
+#define INCLUDE_sys_git_pack_objinfo_h__
+
+#include "git2/common.h"
+#include "git2/types.h"
+
+/**
+ * @file git2/sys/pack_objinfo.h
+ * @brief Git packfile object information routines
+ * @defgroup git_pack_objinfo Git packfile object information routines
+ * @ingroup Git
+ * @{
+ */
+GIT_BEGIN_DECL
+
+/**
+ * Write the `.objinfo` file of a packfile.
+ *
+ * The file stores the type and the inflated size of every object in
+ * the packfile, in the order of the `.idx` file. With it, reading the
+ * header of a packed object (e.g. with `git_odb_read_header`) is a
+ * lookup in a table, instead of a walk down the object's delta chain.
+ *
+ * The indexer can write it along with the `.idx` file, see
+ * `git_indexer_set_objinfo`. The file is used by the packfiles opened
+ * after it was written.
+ *
+ * @param idx_path the path of the `.idx` file of the packfile. The file
+ * will be written next to it, with the `.objinfo` extension, replacing
+ * any existing one atomically.
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_pack_objinfo_write(const char *idx_path);
+
+/** @} */
+GIT_END_DECL
+#endif
@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_sys_git_repack_h__
+#define INCLUDE_sys_git_repack_h__
+
+#include "git2/common.h"
+#include "git2/types.h"
+
+/**
+ * @file git2/sys/repack.h
+ * @brief Git packfile maintenance routines
+ * @defgroup git_repack Git packfile maintenance routines
+ * @ingroup Git
+ * @{
+ */
+GIT_BEGIN_DECL
+
+/**
+ * Options for `git_repository_repack`.
+ */
+typedef struct {
+	unsigned int version;
+
+	/**
+	 * Once the repack is done, every pack has at least `factor` times
+	 * as many objects as the next smaller one. Defaults to 2.
+	 */
+	unsigned int factor;
+
+	/**
+	 * The number of threads to search for deltas with, as given to
+	 * `git_packbuilder_set_threads`. Defaults to 1.
+	 */
+	unsigned int threads;
+} git_repack_options;
+
+#define GIT_REPACK_OPTIONS_VERSION 1
+#define GIT_REPACK_OPTIONS_INIT {GIT_REPACK_OPTIONS_VERSION, 2, 1}
+
+/**
+ * Initializes a `git_repack_options` with default values. Equivalent to
+ * creating an instance with GIT_REPACK_OPTIONS_INIT.
+ *
+ * @param opts the `git_repack_options` struct to initialize
+ * @param version Version of struct; pass `GIT_REPACK_OPTIONS_VERSION`
+ * @return Zero on success; -1 on failure.
+ */
+GIT_EXTERN(int) git_repack_init_options(
+	git_repack_options *opts,
+	unsigned int version);
+
+/**
+ * Roll the small packfiles of a repository up into a larger one.
+ *
+ * The packs are sorted by their number of objects, and the smallest
+ * ones are written into a single new pack until the packs that are
+ * left, the new one included, form a geometric progression: each one
+ * has at least `factor` times as many objects as the one before it.
+ * With a steady stream of small packs, as left by fetches, the number
+ * of packs then only grows with the logarithm of the number of objects,
+ * and each object is only written again a few times.
+ *
+ * The compressed data and the deltas of the objects are copied from
+ * the old packs. Packs with a `.keep` file are left alone. The new pack
+ * and its index are in place, and the `multi-pack-index` rewritten if
+ * there is one, before the old packs are removed, so that readers can
+ * always find every object. Readers which already opened an old pack
+ * keep reading from it, except on Windows, where such a pack cannot be
+ * removed and is left behind to be rolled up again next time.
+ *
+ * @param repo the repository
+ * @param opts the options, or NULL for the defaults
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_repository_repack(
+	git_repository *repo,
+	const git_repack_options *opts);
+
+/** @} */
+GIT_END_DECL
+#endif
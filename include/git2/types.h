@@ -152,6 +152,15 @@ typedef struct git_note git_note;
 /** Representation of a git packbuilder */
 typedef struct git_packbuilder git_packbuilder;
 
+/** A writer for multi-pack-index files */
+typedef struct git_midx_writer git_midx_writer;
+
+/** A writer for commit-graph files */
+typedef struct git_commit_graph_writer git_commit_graph_writer;
+
+/** A writer for reachability bitmap files */
+typedef struct git_pack_bitmap_writer git_pack_bitmap_writer;
+
 /** Time in a signature */
 typedef struct git_time {
 	git_time_t time; /**< time in seconds from epoch */
@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_bloom_h__
+#define INCLUDE_bloom_h__
+
+#include "common.h"
+#include "git2/oid.h"
+
+/*
+ * A Bloom filter of object ids: it can tell for sure that an id was
+ * never added, and otherwise that it probably was. With ten bits per
+ * id and seven probes, about one lookup in a hundred is a false
+ * positive.
+ *
+ * Object ids are already uniformly distributed, so the probes are
+ * derived from the bytes of the id instead of hashing it again.
+ */
+#define GIT_BLOOM_BITS_PER_ID 10
+#define GIT_BLOOM_PROBES 7
+
+typedef struct {
+	uint64_t *words;
+	size_t mask; /* the number of bits, minus one */
+} git_bloom;
+
+GIT_INLINE(int) git_bloom_init(git_bloom *bloom, size_t nr_ids)
+{
+	size_t bits;
+
+	memset(bloom, 0x0, sizeof(*bloom));
+
+	GITERR_CHECK_ALLOC_MULTIPLY(&bits, nr_ids, GIT_BLOOM_BITS_PER_ID);
+	bits = git__size_t_powerof2(bits < 64 ? 64 : bits);
+
+	bloom->words = git__calloc(bits / 64, sizeof(uint64_t));
+	GITERR_CHECK_ALLOC(bloom->words);
+
+	bloom->mask = bits - 1;
+	return 0;
+}
+
+#define GIT_BLOOM__PROBE(ID, H1, H2) \
+	memcpy(&H1, (ID)->id, sizeof(uint32_t)); \
+	memcpy(&H2, (ID)->id + sizeof(uint32_t), sizeof(uint32_t)); \
+	H2 |= 1
+
+GIT_INLINE(void) git_bloom_add(git_bloom *bloom, const git_oid *id)
+{
+	uint32_t h1, h2;
+	size_t bit;
+	int i;
+
+	GIT_BLOOM__PROBE(id, h1, h2);
+
+	for (i = 0; i < GIT_BLOOM_PROBES; i++) {
+		bit = ((size_t)h1 + (size_t)i * h2) & bloom->mask;
+		bloom->words[bit / 64] |= (uint64_t)1 << (bit % 64);
+	}
+}
+
+GIT_INLINE(bool) git_bloom_contains(const git_bloom *bloom, const git_oid *id)
+{
+	uint32_t h1, h2;
+	size_t bit;
+	int i;
+
+	GIT_BLOOM__PROBE(id, h1, h2);
+
+	for (i = 0; i < GIT_BLOOM_PROBES; i++) {
+		bit = ((size_t)h1 + (size_t)i * h2) & bloom->mask;
+		if (!(bloom->words[bit / 64] & ((uint64_t)1 << (bit % 64))))
+			return false;
+	}
+
+	return true;
+}
+
+GIT_INLINE(void) git_bloom_free(git_bloom *bloom)
+{
+	git__free(bloom->words);
+	memset(bloom, 0x0, sizeof(*bloom));
+}
+
+#endif
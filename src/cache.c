@@ -43,103 +43,189 @@ int git_cache_set_max_object_size(git_otype type, size_t size)
 	return 0;
 }
 
-void git_cache_dump_stats(git_cache *cache)
+/*
+ * The statistics are counted per shard, so that threads working on
+ * different objects do not fight over the same counter.
+ */
+static git_atomic_ssize cache_hits[GIT_CACHE_SHARDS];
+static git_atomic_ssize cache_misses[GIT_CACHE_SHARDS];
+static git_atomic_ssize cache_evictions[GIT_CACHE_SHARDS];
+
+void git_cache__stats(size_t *hits, size_t *misses, size_t *evictions)
 {
-	git_cached_obj *object;
+	size_t i;
 
-	if (kh_size(cache->map) == 0)
-		return;
+	*hits = *misses = *evictions = 0;
 
-	printf("Cache %p: %d items cached, %"PRIdZ" bytes\n",
-		cache, kh_size(cache->map), cache->used_memory);
-
-	kh_foreach_value(cache->map, object, {
-		char oid_str[9];
-		printf(" %s%c %s (%"PRIuZ")\n",
-			git_object_type2string(object->type),
-			object->flags == GIT_CACHE_STORE_PARSED ? '*' : ' ',
-			git_oid_tostr(oid_str, sizeof(oid_str), &object->oid),
-			object->size
-		);
-	});
+	for (i = 0; i < GIT_CACHE_SHARDS; i++) {
+		*hits += (size_t)cache_hits[i].val;
+		*misses += (size_t)cache_misses[i].val;
+		*evictions += (size_t)cache_evictions[i].val;
+	}
+}
+
+GIT_INLINE(size_t) shard_index(const git_oid *oid)
+{
+	return oid->id[0] % GIT_CACHE_SHARDS;
+}
+
+void git_cache_dump_stats(git_cache *cache)
+{
+	git_cached_obj *object;
+	size_t i;
+
+	for (i = 0; i < GIT_CACHE_SHARDS; i++) {
+		git_cache_shard *shard = &cache->shards[i];
+
+		if (kh_size(shard->map) == 0)
+			continue;
+
+		printf("Cache %p, shard %"PRIuZ": %d items cached, %"PRIdZ" bytes\n",
+			cache, i, kh_size(shard->map), shard->used_memory);
+
+		kh_foreach_value(shard->map, object, {
+			char oid_str[9];
+			printf(" %s%c %s (%"PRIuZ")\n",
+				git_object_type2string(object->type),
+				object->flags == GIT_CACHE_STORE_PARSED ? '*' : ' ',
+				git_oid_tostr(oid_str, sizeof(oid_str), &object->oid),
+				object->size
+			);
+		});
+	}
 }
 
 int git_cache_init(git_cache *cache)
 {
+	size_t i;
+
 	memset(cache, 0, sizeof(*cache));
-	cache->map = git_oidmap_alloc();
-	GITERR_CHECK_ALLOC(cache->map);
-	if (git_rwlock_init(&cache->lock)) {
-		giterr_set(GITERR_OS, "Failed to initialize cache rwlock");
-		return -1;
+
+	for (i = 0; i < GIT_CACHE_SHARDS; i++) {
+		git_cache_shard *shard = &cache->shards[i];
+
+		shard->map = git_oidmap_alloc();
+		GITERR_CHECK_ALLOC(shard->map);
+		if (git_rwlock_init(&shard->lock)) {
+			giterr_set(GITERR_OS, "Failed to initialize cache rwlock");
+			return -1;
+		}
 	}
+
 	return 0;
 }
 
 /* called with lock */
-static void clear_cache(git_cache *cache)
+static void clear_shard(git_cache_shard *shard)
 {
 	git_cached_obj *evict = NULL;
 
-	if (kh_size(cache->map) == 0)
+	if (kh_size(shard->map) == 0)
 		return;
 
-	kh_foreach_value(cache->map, evict, {
+	kh_foreach_value(shard->map, evict, {
 		git_cached_obj_decref(evict);
 	});
 
-	kh_clear(oid, cache->map);
-	git_atomic_ssize_add(&git_cache__current_storage, -cache->used_memory);
-	cache->used_memory = 0;
+	kh_clear(oid, shard->map);
+	git_array_clear(shard->clock);
+	shard->hand = 0;
+
+	git_atomic_ssize_add(&git_cache__current_storage, -shard->used_memory);
+	shard->used_memory = 0;
 }
 
 void git_cache_clear(git_cache *cache)
 {
-	if (git_rwlock_wrlock(&cache->lock) < 0)
-		return;
+	size_t i;
+
+	for (i = 0; i < GIT_CACHE_SHARDS; i++) {
+		git_cache_shard *shard = &cache->shards[i];
 
-	clear_cache(cache);
+		if (git_rwlock_wrlock(&shard->lock) < 0)
+			continue;
 
-	git_rwlock_wrunlock(&cache->lock);
+		clear_shard(shard);
+
+		git_rwlock_wrunlock(&shard->lock);
+	}
 }
 
 void git_cache_free(git_cache *cache)
 {
+	size_t i;
+
 	git_cache_clear(cache);
-	git_oidmap_free(cache->map);
-	git_rwlock_free(&cache->lock);
+
+	for (i = 0; i < GIT_CACHE_SHARDS; i++) {
+		git_oidmap_free(cache->shards[i].map);
+		git_rwlock_free(&cache->shards[i].lock);
+	}
+
 	git__memzero(cache, sizeof(*cache));
 }
 
-/* Called with lock */
-static void cache_evict_entries(git_cache *cache)
+/*
+ * Called with lock. This is the CLOCK algorithm: the hand goes over the
+ * entries in the order they were stored, giving a second chance to the
+ * ones that were looked up since the hand last passed them.
+ */
+static void cache_evict_entries(git_cache_shard *shard, size_t index)
 {
-	uint32_t seed = rand();
 	size_t evict_count = 8;
 	ssize_t evicted_memory = 0;
 
 	/* do not infinite loop if there's not enough entries to evict  */
-	if (evict_count > kh_size(cache->map)) {
-		clear_cache(cache);
+	if (evict_count > kh_size(shard->map)) {
+		git_atomic_ssize_add(&cache_evictions[index], (ssize_t)kh_size(shard->map));
+		clear_shard(shard);
 		return;
 	}
 
 	while (evict_count > 0) {
-		khiter_t pos = seed++ % kh_end(cache->map);
-
-		if (kh_exist(cache->map, pos)) {
-			git_cached_obj *evict = kh_val(cache->map, pos);
+		git_oid *oid, *last;
+		git_cached_obj *evict;
+		khiter_t pos;
+
+		if (shard->hand >= git_array_size(shard->clock))
+			shard->hand = 0;
+
+		oid = git_array_get(shard->clock, shard->hand);
+		pos = kh_get(oid, shard->map, oid);
+		assert(pos != kh_end(shard->map));
+		evict = kh_val(shard->map, pos);
+
+		if (evict->referenced.val) {
+			git_atomic_set(&evict->referenced, 0);
+			shard->hand++;
+			continue;
+		}
 
-			evict_count--;
-			evicted_memory += evict->size;
-			git_cached_obj_decref(evict);
+		evict_count--;
+		evicted_memory += evict->size;
+		kh_del(oid, shard->map, pos);
+		git_cached_obj_decref(evict);
 
-			kh_del(oid, cache->map, pos);
-		}
+		/* the last one takes its place, and is looked at next */
+		last = git_array_pop(shard->clock);
+		if (last != oid)
+			git_oid_cpy(oid, last);
 	}
 
-	cache->used_memory -= evicted_memory;
+	shard->used_memory -= evicted_memory;
 	git_atomic_ssize_add(&git_cache__current_storage, -evicted_memory);
+	git_atomic_ssize_add(&cache_evictions[index], 8);
+}
+
+static ssize_t cache_used_memory(git_cache *cache)
+{
+	ssize_t used_memory = 0;
+	size_t i;
+
+	for (i = 0; i < GIT_CACHE_SHARDS; i++)
+		used_memory += cache->shards[i].used_memory;
+
+	return used_memory;
 }
 
 static bool cache_should_store(git_otype object_type, size_t object_size)
@@ -152,22 +238,30 @@ static void *cache_get(git_cache *cache, const git_oid *oid, unsigned int flags)
 {
 	khiter_t pos;
 	git_cached_obj *entry = NULL;
+	size_t index = shard_index(oid);
+	git_cache_shard *shard = &cache->shards[index];
 
-	if (!git_cache__enabled || git_rwlock_rdlock(&cache->lock) < 0)
+	if (!git_cache__enabled || git_rwlock_rdlock(&shard->lock) < 0)
 		return NULL;
 
-	pos = kh_get(oid, cache->map, oid);
-	if (pos != kh_end(cache->map)) {
-		entry = kh_val(cache->map, pos);
+	pos = kh_get(oid, shard->map, oid);
+	if (pos != kh_end(shard->map)) {
+		entry = kh_val(shard->map, pos);
 
 		if (flags && entry->flags != flags) {
 			entry = NULL;
 		} else {
 			git_cached_obj_incref(entry);
+
+			/* avoid writing to a shared line on every hit */
+			if (!entry->referenced.val)
+				git_atomic_set(&entry->referenced, 1);
 		}
 	}
 
-	git_rwlock_rdunlock(&cache->lock);
+	git_rwlock_rdunlock(&shard->lock);
+
+	git_atomic_ssize_add(entry ? &cache_hits[index] : &cache_misses[index], 1);
 
 	return entry;
 }
@@ -175,10 +269,12 @@ static void *cache_get(git_cache *cache, const git_oid *oid, unsigned int flags)
 static void *cache_store(git_cache *cache, git_cached_obj *entry)
 {
 	khiter_t pos;
+	size_t index = shard_index(&entry->oid);
+	git_cache_shard *shard = &cache->shards[index];
 
 	git_cached_obj_incref(entry);
 
-	if (!git_cache__enabled && cache->used_memory > 0) {
+	if (!git_cache__enabled && cache_used_memory(cache) > 0) {
 		git_cache_clear(cache);
 		return entry;
 	}
@@ -186,31 +282,39 @@ static void *cache_store(git_cache *cache, git_cached_obj *entry)
 	if (!cache_should_store(entry->type, entry->size))
 		return entry;
 
-	if (git_rwlock_wrlock(&cache->lock) < 0)
+	if (git_rwlock_wrlock(&shard->lock) < 0)
 		return entry;
 
 	/* soften the load on the cache */
 	if (git_cache__current_storage.val > git_cache__max_storage)
-		cache_evict_entries(cache);
+		cache_evict_entries(shard, index);
 
-	pos = kh_get(oid, cache->map, &entry->oid);
+	pos = kh_get(oid, shard->map, &entry->oid);
 
 	/* not found */
-	if (pos == kh_end(cache->map)) {
+	if (pos == kh_end(shard->map)) {
+		git_oid *clock_oid;
 		int rval;
 
-		pos = kh_put(oid, cache->map, &entry->oid, &rval);
-		if (rval >= 0) {
-			kh_key(cache->map, pos) = &entry->oid;
-			kh_val(cache->map, pos) = entry;
-			git_cached_obj_incref(entry);
-			cache->used_memory += entry->size;
-			git_atomic_ssize_add(&git_cache__current_storage, (ssize_t)entry->size);
+		if ((clock_oid = git_array_alloc(shard->clock)) != NULL) {
+			pos = kh_put(oid, shard->map, &entry->oid, &rval);
+			if (rval >= 0) {
+				git_oid_cpy(clock_oid, &entry->oid);
+				git_atomic_set(&entry->referenced, 0);
+
+				kh_key(shard->map, pos) = &entry->oid;
+				kh_val(shard->map, pos) = entry;
+				git_cached_obj_incref(entry);
+				shard->used_memory += entry->size;
+				git_atomic_ssize_add(&git_cache__current_storage, (ssize_t)entry->size);
+			} else {
+				git_array_pop(shard->clock);
+			}
 		}
 	}
 	/* found */
 	else {
-		git_cached_obj *stored_entry = kh_val(cache->map, pos);
+		git_cached_obj *stored_entry = kh_val(shard->map, pos);
 
 		if (stored_entry->flags == entry->flags) {
 			git_cached_obj_decref(entry);
@@ -221,14 +325,14 @@ static void *cache_store(git_cache *cache, git_cached_obj *entry)
 			git_cached_obj_decref(stored_entry);
 			git_cached_obj_incref(entry);
 
-			kh_key(cache->map, pos) = &entry->oid;
-			kh_val(cache->map, pos) = entry;
+			kh_key(shard->map, pos) = &entry->oid;
+			kh_val(shard->map, pos) = entry;
 		} else {
 			/* NO OP */
 		}
 	}
 
-	git_rwlock_wrunlock(&cache->lock);
+	git_rwlock_wrunlock(&shard->lock);
 	return entry;
 }
 
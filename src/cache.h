@@ -13,6 +13,7 @@
 
 #include "thread-utils.h"
 #include "oidmap.h"
+#include "array.h"
 
 enum {
 	GIT_CACHE_STORE_ANY = 0,
@@ -26,18 +27,33 @@ typedef struct {
 	uint16_t   flags; /* GIT_CACHE_STORE value */
 	size_t     size;
 	git_atomic refcount;
+	git_atomic referenced; /* set on every hit, for the eviction */
 } git_cached_obj;
 
+/* The cache is split by the first bits of the ids, each part with its own lock */
+#define GIT_CACHE_SHARDS 16
+
 typedef struct {
 	git_oidmap *map;
 	git_rwlock  lock;
 	ssize_t     used_memory;
+
+	/* the ids of the cached objects, which the CLOCK hand goes over */
+	git_array_t(git_oid) clock;
+	size_t      hand;
+} git_cache_shard;
+
+typedef struct {
+	git_cache_shard shards[GIT_CACHE_SHARDS];
 } git_cache;
 
 extern bool git_cache__enabled;
 extern ssize_t git_cache__max_storage;
 extern git_atomic_ssize git_cache__current_storage;
 
+/* Get the hits, misses and evictions of every cache */
+extern void git_cache__stats(size_t *hits, size_t *misses, size_t *evictions);
+
 int git_cache_set_max_object_size(git_otype type, size_t size);
 
 int git_cache_init(git_cache *cache);
@@ -53,7 +69,12 @@ void *git_cache_get_any(git_cache *cache, const git_oid *oid);
 
 GIT_INLINE(size_t) git_cache_size(git_cache *cache)
 {
-	return (size_t)kh_size(cache->map);
+	size_t i, size = 0;
+
+	for (i = 0; i < GIT_CACHE_SHARDS; i++)
+		size += (size_t)kh_size(cache->shards[i].map);
+
+	return size;
 }
 
 GIT_INLINE(void) git_cached_obj_incref(void *_obj)
@@ -0,0 +1,1071 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "commit_graph.h"
+
+#include "array.h"
+#include "buffer.h"
+#include "commit.h"
+#include "filebuf.h"
+#include "hash.h"
+#include "oid.h"
+#include "oidmap.h"
+#include "pack.h"
+#include "path.h"
+#include "revwalk.h"
+#include "sha1_lookup.h"
+#include "vector.h"
+
+#include "git2/revwalk.h"
+
+GIT__USE_OIDMAP
+
+#define COMMIT_GRAPH_SIGNATURE 0x43475048 /* "CGPH" */
+#define COMMIT_GRAPH_VERSION 1
+#define COMMIT_GRAPH_OBJECT_ID_VERSION 1 /* SHA-1 */
+
+#define COMMIT_GRAPH_OID_FANOUT_ID 0x4f494446 /* "OIDF" */
+#define COMMIT_GRAPH_OID_LOOKUP_ID 0x4f49444c /* "OIDL" */
+#define COMMIT_GRAPH_COMMIT_DATA_ID 0x43444154 /* "CDAT" */
+#define COMMIT_GRAPH_EXTRA_EDGE_LIST_ID 0x45444745 /* "EDGE" */
+
+#define COMMIT_GRAPH_EXTRA_EDGE_NEEDED 0x80000000
+#define COMMIT_GRAPH_LAST_EDGE 0x80000000
+
+/* The size of an entry in the Commit Data table. */
+#define COMMIT_GRAPH_DATA_SIZE (GIT_OID_RAWSZ + 16)
+
+struct git_commit_graph_header {
+	uint32_t signature;
+	uint8_t version;
+	uint8_t object_id_version;
+	uint8_t chunks;
+	uint8_t base_graph_files;
+};
+
+struct git_commit_graph_chunk {
+	git_off_t offset;
+	size_t length;
+};
+
+static int commit_graph_error(const char *message)
+{
+	giterr_set(GITERR_ODB, "Invalid commit-graph file - %s", message);
+	return -1;
+}
+
+static uint64_t commit_graph_get_be64(const unsigned char *data)
+{
+	return (((uint64_t)ntohl(*((uint32_t *)(data + 0)))) << 32) |
+		ntohl(*((uint32_t *)(data + 4)));
+}
+
+static int commit_graph_parse_oid_fanout(
+		git_commit_graph_file *file,
+		const unsigned char *data,
+		struct git_commit_graph_chunk *chunk_oid_fanout)
+{
+	uint32_t i, nr;
+
+	if (chunk_oid_fanout->offset == 0)
+		return commit_graph_error("missing OID Fanout chunk");
+	if (chunk_oid_fanout->length == 0)
+		return commit_graph_error("empty OID Fanout chunk");
+	if (chunk_oid_fanout->length != 256 * 4)
+		return commit_graph_error("OID Fanout chunk has wrong length");
+
+	file->oid_fanout = (const uint32_t *)(data + chunk_oid_fanout->offset);
+	nr = 0;
+	for (i = 0; i < 256; ++i) {
+		uint32_t n = ntohl(file->oid_fanout[i]);
+		if (n < nr)
+			return commit_graph_error("index is non-monotonic");
+		nr = n;
+	}
+	file->num_commits = nr;
+
+	return 0;
+}
+
+static int commit_graph_parse_oid_lookup(
+		git_commit_graph_file *file,
+		const unsigned char *data,
+		struct git_commit_graph_chunk *chunk_oid_lookup)
+{
+	uint32_t i;
+	const git_oid *oid, *prev_oid;
+
+	if (chunk_oid_lookup->offset == 0)
+		return commit_graph_error("missing OID Lookup chunk");
+	if (chunk_oid_lookup->length != file->num_commits * GIT_OID_RAWSZ)
+		return commit_graph_error("OID Lookup chunk has wrong length");
+
+	file->oid_lookup = oid = (const git_oid *)(data + chunk_oid_lookup->offset);
+	prev_oid = oid++;
+	for (i = 1; i < file->num_commits; ++i, ++oid, ++prev_oid) {
+		if (git_oid_cmp(prev_oid, oid) >= 0)
+			return commit_graph_error("OID Lookup index is non-monotonic");
+	}
+
+	return 0;
+}
+
+static int commit_graph_parse_commit_data(
+		git_commit_graph_file *file,
+		const unsigned char *data,
+		struct git_commit_graph_chunk *chunk_commit_data)
+{
+	if (chunk_commit_data->offset == 0)
+		return commit_graph_error("missing Commit Data chunk");
+	if (chunk_commit_data->length != file->num_commits * COMMIT_GRAPH_DATA_SIZE)
+		return commit_graph_error("Commit Data chunk has wrong length");
+
+	file->commit_data = data + chunk_commit_data->offset;
+
+	return 0;
+}
+
+static int commit_graph_parse_extra_edge_list(
+		git_commit_graph_file *file,
+		const unsigned char *data,
+		struct git_commit_graph_chunk *chunk_extra_edge_list)
+{
+	if (chunk_extra_edge_list->length == 0)
+		return 0;
+	if (chunk_extra_edge_list->length % 4 != 0)
+		return commit_graph_error("malformed Extra Edge List chunk");
+
+	file->extra_edge_list = data + chunk_extra_edge_list->offset;
+	file->num_extra_edge_list = chunk_extra_edge_list->length / 4;
+
+	return 0;
+}
+
+int git_commit_graph_file_parse(
+		git_commit_graph_file *file,
+		const unsigned char *data,
+		size_t size)
+{
+	struct git_commit_graph_header *hdr;
+	const unsigned char *chunk_hdr;
+	struct git_commit_graph_chunk *last_chunk;
+	uint32_t i;
+	git_off_t last_chunk_offset, chunk_offset, trailer_offset;
+	int error;
+	struct git_commit_graph_chunk chunk_oid_fanout = {0},
+					 chunk_oid_lookup = {0},
+					 chunk_commit_data = {0},
+					 chunk_extra_edge_list = {0};
+
+	assert(file);
+
+	if (size < sizeof(struct git_commit_graph_header) + GIT_OID_RAWSZ)
+		return commit_graph_error("commit-graph is too short");
+
+	hdr = ((struct git_commit_graph_header *)data);
+
+	if (hdr->signature != htonl(COMMIT_GRAPH_SIGNATURE) ||
+		hdr->version != COMMIT_GRAPH_VERSION ||
+		hdr->object_id_version != COMMIT_GRAPH_OBJECT_ID_VERSION)
+		return commit_graph_error("unsupported commit-graph version");
+	if (hdr->chunks == 0)
+		return commit_graph_error("no chunks in commit-graph");
+	if (hdr->base_graph_files != 0)
+		return commit_graph_error("split commit-graphs are not supported");
+
+	/*
+	 * The very first chunk's offset should be after the header, all the chunk
+	 * headers, and a special zero chunk.
+	 */
+	last_chunk_offset =
+			sizeof(struct git_commit_graph_header) +
+			(1 + hdr->chunks) * 12;
+	trailer_offset = size - GIT_OID_RAWSZ;
+	if (trailer_offset < last_chunk_offset)
+		return commit_graph_error("wrong commit-graph size");
+	git_oid_fromraw(&file->checksum, data + trailer_offset);
+
+	chunk_hdr = data + sizeof(struct git_commit_graph_header);
+	last_chunk = NULL;
+	for (i = 0; i < hdr->chunks; ++i, chunk_hdr += 12) {
+		chunk_offset = (git_off_t)commit_graph_get_be64(chunk_hdr + 4);
+		if (chunk_offset < last_chunk_offset)
+			return commit_graph_error("chunks are non-monotonic");
+		if (chunk_offset >= trailer_offset)
+			return commit_graph_error("chunks extend beyond the trailer");
+		if (last_chunk != NULL)
+			last_chunk->length = (size_t)(chunk_offset - last_chunk_offset);
+		last_chunk_offset = chunk_offset;
+
+		switch (ntohl(*((uint32_t *)(chunk_hdr + 0)))) {
+		case COMMIT_GRAPH_OID_FANOUT_ID:
+			chunk_oid_fanout.offset = last_chunk_offset;
+			last_chunk = &chunk_oid_fanout;
+			break;
+
+		case COMMIT_GRAPH_OID_LOOKUP_ID:
+			chunk_oid_lookup.offset = last_chunk_offset;
+			last_chunk = &chunk_oid_lookup;
+			break;
+
+		case COMMIT_GRAPH_COMMIT_DATA_ID:
+			chunk_commit_data.offset = last_chunk_offset;
+			last_chunk = &chunk_commit_data;
+			break;
+
+		case COMMIT_GRAPH_EXTRA_EDGE_LIST_ID:
+			chunk_extra_edge_list.offset = last_chunk_offset;
+			last_chunk = &chunk_extra_edge_list;
+			break;
+
+		default:
+			/* unknown chunks (e.g. Bloom filters) are ignored */
+			last_chunk = NULL;
+			break;
+		}
+	}
+	if (last_chunk != NULL)
+		last_chunk->length = (size_t)(trailer_offset - last_chunk_offset);
+
+	if ((error = commit_graph_parse_oid_fanout(file, data, &chunk_oid_fanout)) < 0)
+		return error;
+	if ((error = commit_graph_parse_oid_lookup(file, data, &chunk_oid_lookup)) < 0)
+		return error;
+	if ((error = commit_graph_parse_commit_data(file, data, &chunk_commit_data)) < 0)
+		return error;
+	if ((error = commit_graph_parse_extra_edge_list(file, data, &chunk_extra_edge_list)) < 0)
+		return error;
+
+	return 0;
+}
+
+int git_commit_graph_new(git_commit_graph **cgraph_out, const char *objects_dir)
+{
+	git_commit_graph *cgraph = NULL;
+
+	assert(cgraph_out && objects_dir);
+
+	cgraph = git__calloc(1, sizeof(git_commit_graph));
+	GITERR_CHECK_ALLOC(cgraph);
+
+	if (git_buf_joinpath(&cgraph->filename, objects_dir, "info/" GIT_COMMIT_GRAPH_FILE) < 0) {
+		git__free(cgraph);
+		return -1;
+	}
+
+	*cgraph_out = cgraph;
+	return 0;
+}
+
+int git_commit_graph_file_open(
+		git_commit_graph_file **file_out,
+		const char *path)
+{
+	git_commit_graph_file *file;
+	git_file fd = -1;
+	size_t cgraph_size;
+	struct stat st;
+	int error;
+
+	fd = git_futils_open_ro(path);
+	if (fd < 0)
+		return fd;
+
+	if (p_fstat(fd, &st) < 0) {
+		p_close(fd);
+		giterr_set(GITERR_ODB, "commit-graph file not found - '%s'", path);
+		return GIT_ENOTFOUND;
+	}
+
+	if (!S_ISREG(st.st_mode) || !git__is_sizet(st.st_size)) {
+		p_close(fd);
+		giterr_set(GITERR_ODB, "invalid commit-graph file '%s'", path);
+		return -1;
+	}
+	cgraph_size = (size_t)st.st_size;
+
+	file = git__calloc(1, sizeof(git_commit_graph_file));
+	GITERR_CHECK_ALLOC(file);
+
+	if ((file->filename = git__strdup(path)) == NULL) {
+		p_close(fd);
+		git_commit_graph_file_free(file);
+		return -1;
+	}
+
+	error = git_futils_mmap_ro(&file->graph_map, fd, 0, cgraph_size);
+	p_close(fd);
+	if (error < 0) {
+		git_commit_graph_file_free(file);
+		return error;
+	}
+
+	if ((error = git_commit_graph_file_parse(file, file->graph_map.data, cgraph_size)) < 0) {
+		git_commit_graph_file_free(file);
+		return error;
+	}
+
+	git_futils_filestamp_set_from_stat(&file->stamp, &st);
+
+	*file_out = file;
+	return 0;
+}
+
+int git_commit_graph_get_file(git_commit_graph_file **file_out, git_commit_graph *cgraph)
+{
+	if (!cgraph->checked) {
+		int error = 0;
+		git_commit_graph_file *result = NULL;
+
+		/* We only check once, no matter the result. */
+		cgraph->checked = 1;
+
+		/* Best effort */
+		if (git_path_exists(git_buf_cstr(&cgraph->filename)))
+			error = git_commit_graph_file_open(&result, git_buf_cstr(&cgraph->filename));
+
+		if (error < 0 || result == NULL) {
+			giterr_clear();
+			return GIT_ENOTFOUND;
+		}
+
+		cgraph->file = result;
+	}
+	if (!cgraph->file)
+		return GIT_ENOTFOUND;
+
+	*file_out = cgraph->file;
+	return 0;
+}
+
+void git_commit_graph_refresh(git_commit_graph *cgraph)
+{
+	if (!cgraph->checked)
+		return;
+
+	if (cgraph->file &&
+		!git_commit_graph_file_needs_refresh(cgraph->file, git_buf_cstr(&cgraph->filename)))
+		return;
+
+	/*
+	 * Another thread may still be walking the old file, so it is kept
+	 * until the commit-graph is freed. The next time the file is
+	 * requested, it will be re-loaded.
+	 */
+	if (cgraph->file && git_vector_insert(&cgraph->old_files, cgraph->file) < 0)
+		return;
+	cgraph->file = NULL;
+	cgraph->checked = 0;
+}
+
+bool git_commit_graph_file_needs_refresh(
+		const git_commit_graph_file *file,
+		const char *path)
+{
+	git_futils_filestamp stamp;
+
+	git_futils_filestamp_set(&stamp, &file->stamp);
+
+	return git_futils_filestamp_check(&stamp, path) != 0;
+}
+
+int git_commit_graph_entry_get_byindex(
+		git_commit_graph_entry *e,
+		const git_commit_graph_file *file,
+		size_t pos)
+{
+	const unsigned char *commit_data;
+
+	assert(e && file);
+
+	if (pos >= file->num_commits) {
+		giterr_set(GITERR_INVALID, "commit index %" PRIuZ " does not exist", pos);
+		return GIT_ENOTFOUND;
+	}
+
+	commit_data = file->commit_data + pos * COMMIT_GRAPH_DATA_SIZE;
+	git_oid_fromraw(&e->tree_oid, commit_data);
+	e->parent_indices[0] = ntohl(*((uint32_t *)(commit_data + GIT_OID_RAWSZ)));
+	e->parent_indices[1] = ntohl(*((uint32_t *)(commit_data + GIT_OID_RAWSZ + sizeof(uint32_t))));
+	e->parent_count = (e->parent_indices[0] != GIT_COMMIT_GRAPH_MISSING_PARENT)
+			+ (e->parent_indices[1] != GIT_COMMIT_GRAPH_MISSING_PARENT);
+	e->generation = ntohl(*((uint32_t *)(commit_data + GIT_OID_RAWSZ + 2 * sizeof(uint32_t))));
+	e->commit_time = ntohl(*((uint32_t *)(commit_data + GIT_OID_RAWSZ + 3 * sizeof(uint32_t))));
+
+	e->commit_time |= (git_time_t)(e->generation & 0x3) << 32;
+	e->generation >>= 2u;
+	e->extra_parents_index = 0;
+
+	if (e->parent_indices[1] & COMMIT_GRAPH_EXTRA_EDGE_NEEDED) {
+		size_t extra_edge_list_pos = e->parent_indices[1] & ~COMMIT_GRAPH_EXTRA_EDGE_NEEDED;
+
+		/* Make sure we're not being sent out of bounds */
+		if (extra_edge_list_pos >= file->num_extra_edge_list) {
+			giterr_set(GITERR_INVALID, "commit %u does not exist", (unsigned)extra_edge_list_pos);
+			return GIT_ENOTFOUND;
+		}
+
+		e->extra_parents_index = extra_edge_list_pos;
+		while (extra_edge_list_pos < file->num_extra_edge_list &&
+			(ntohl(*((uint32_t *)(file->extra_edge_list + extra_edge_list_pos * sizeof(uint32_t)))) &
+				COMMIT_GRAPH_LAST_EDGE) == 0) {
+			extra_edge_list_pos++;
+			e->parent_count++;
+		}
+	}
+
+	git_oid_cpy(&e->sha1, &file->oid_lookup[pos]);
+	e->position = pos;
+	return 0;
+}
+
+int git_commit_graph_entry_find(
+		git_commit_graph_entry *e,
+		const git_commit_graph_file *file,
+		const git_oid *short_oid,
+		size_t len)
+{
+	int pos, found = 0;
+	uint32_t hi, lo;
+	const git_oid *current = NULL;
+
+	assert(e && file && short_oid);
+
+	hi = ntohl(file->oid_fanout[(int)short_oid->id[0]]);
+	lo = ((short_oid->id[0] == 0x0) ? 0 : ntohl(file->oid_fanout[(int)short_oid->id[0] - 1]));
+
+	pos = sha1_position(file->oid_lookup, GIT_OID_RAWSZ, lo, hi, short_oid->id);
+
+	if (pos >= 0) {
+		/* An object matching exactly the oid was found */
+		found = 1;
+		current = file->oid_lookup + pos;
+	} else {
+		/* No object was found */
+		/* pos refers to the object with the "closest" oid to short_oid */
+		pos = -1 - pos;
+		if (pos < (int)file->num_commits) {
+			current = file->oid_lookup + pos;
+
+			if (!git_oid_ncmp(short_oid, current, len))
+				found = 1;
+		}
+	}
+
+	if (found && len != GIT_OID_HEXSZ && pos + 1 < (int)file->num_commits) {
+		/* Check for ambiguousity */
+		const git_oid *next = current + 1;
+
+		if (!git_oid_ncmp(short_oid, next, len)) {
+			found = 2;
+		}
+	}
+
+	if (!found)
+		return git_odb__error_notfound("failed to find offset for commit-graph index entry", short_oid);
+	if (found > 1)
+		return git_odb__error_ambiguous("found multiple offsets for commit-graph index entry");
+
+	return git_commit_graph_entry_get_byindex(e, file, pos);
+}
+
+int git_commit_graph_entry_parent(
+		git_commit_graph_entry *parent,
+		const git_commit_graph_file *file,
+		const git_commit_graph_entry *entry,
+		size_t n)
+{
+	assert(parent && file);
+
+	if (n >= entry->parent_count) {
+		giterr_set(GITERR_INVALID, "parent index %" PRIuZ " does not exist", n);
+		return GIT_ENOTFOUND;
+	}
+
+	if (n == 0 || (n == 1 && entry->parent_count == 2))
+		return git_commit_graph_entry_get_byindex(parent, file, entry->parent_indices[n]);
+
+	return git_commit_graph_entry_get_byindex(
+			parent,
+			file,
+			ntohl(
+				*(uint32_t *)(file->extra_edge_list
+					+ (entry->extra_parents_index + n - 1) * sizeof(uint32_t)))
+				& ~COMMIT_GRAPH_LAST_EDGE);
+}
+
+int git_commit_graph_file_close(git_commit_graph_file *file)
+{
+	assert(file);
+
+	if (file->graph_map.data)
+		git_futils_mmap_free(&file->graph_map);
+
+	return 0;
+}
+
+void git_commit_graph_free(git_commit_graph *cgraph)
+{
+	git_commit_graph_file *file;
+	size_t i;
+
+	if (!cgraph)
+		return;
+
+	git_vector_foreach(&cgraph->old_files, i, file)
+		git_commit_graph_file_free(file);
+	git_vector_free(&cgraph->old_files);
+
+	git_buf_free(&cgraph->filename);
+	git_commit_graph_file_free(cgraph->file);
+	git__free(cgraph);
+}
+
+void git_commit_graph_file_free(git_commit_graph_file *file)
+{
+	if (!file)
+		return;
+
+	git__free(file->filename);
+	git_commit_graph_file_close(file);
+	git__free(file);
+}
+
+/***********************************************************
+ *
+ * COMMIT-GRAPH WRITER
+ *
+ ***********************************************************/
+
+typedef git_array_t(git_oid) git_oid_array;
+
+typedef struct packed_commit {
+	size_t index;
+	git_oid sha1;
+	git_oid tree_oid;
+	uint32_t generation;
+	git_time_t commit_time;
+	git_oid_array parents;
+	git_array_t(struct packed_commit *) parent_commits;
+} packed_commit;
+
+struct git_commit_graph_writer {
+	git_buf objects_info_dir;
+	git_vector commits;
+	git_oidmap *commit_map;
+};
+
+static void packed_commit_free(packed_commit *p)
+{
+	if (!p)
+		return;
+
+	git_array_clear(p->parents);
+	git_array_clear(p->parent_commits);
+	git__free(p);
+}
+
+static int packed_commit__cmp(const void *a_, const void *b_)
+{
+	const packed_commit *a = a_;
+	const packed_commit *b = b_;
+
+	return git_oid__cmp(&a->sha1, &b->sha1);
+}
+
+static packed_commit *packed_commit_new(const git_commit *commit)
+{
+	unsigned int i, parentcount = git_commit_parentcount(commit);
+	packed_commit *p = git__calloc(1, sizeof(packed_commit));
+
+	if (!p)
+		return NULL;
+
+	git_array_init_to_size(p->parents, parentcount);
+	if (parentcount && !p->parents.ptr) {
+		git__free(p);
+		return NULL;
+	}
+
+	git_oid_cpy(&p->sha1, git_commit_id(commit));
+	git_oid_cpy(&p->tree_oid, git_commit_tree_id(commit));
+	p->commit_time = git_commit_time(commit);
+
+	for (i = 0; i < parentcount; ++i) {
+		git_oid *parent_id = git_array_alloc(p->parents);
+		if (!parent_id) {
+			packed_commit_free(p);
+			return NULL;
+		}
+		git_oid_cpy(parent_id, git_commit_parent_id(commit, i));
+	}
+
+	return p;
+}
+
+int git_commit_graph_writer_new(
+		git_commit_graph_writer **out,
+		const char *objects_info_dir)
+{
+	git_commit_graph_writer *w = git__calloc(1, sizeof(git_commit_graph_writer));
+	GITERR_CHECK_ALLOC(w);
+
+	if (git_buf_sets(&w->objects_info_dir, objects_info_dir) < 0) {
+		git__free(w);
+		return -1;
+	}
+
+	if (git_vector_init(&w->commits, 0, packed_commit__cmp) < 0) {
+		git_buf_free(&w->objects_info_dir);
+		git__free(w);
+		return -1;
+	}
+
+	w->commit_map = git_oidmap_alloc();
+	if (!w->commit_map) {
+		git_vector_free(&w->commits);
+		git_buf_free(&w->objects_info_dir);
+		git__free(w);
+		return -1;
+	}
+
+	*out = w;
+	return 0;
+}
+
+void git_commit_graph_writer_free(git_commit_graph_writer *w)
+{
+	packed_commit *packed_commit;
+	size_t i;
+
+	if (!w)
+		return;
+
+	git_vector_foreach(&w->commits, i, packed_commit)
+		packed_commit_free(packed_commit);
+	git_vector_free(&w->commits);
+	git_oidmap_free(w->commit_map);
+	git_buf_free(&w->objects_info_dir);
+	git__free(w);
+}
+
+/*
+ * Add a commit and all of its ancestors that are not yet in the writer,
+ * since a commit-graph has to be closed under reachability.
+ */
+static int commit_graph_writer_add(
+		git_commit_graph_writer *w,
+		git_repository *repo,
+		const git_oid *id)
+{
+	git_oid_array pending = GIT_ARRAY_INIT;
+	git_oid *pending_id, current_id;
+	git_commit *commit;
+	packed_commit *p;
+	size_t i;
+	int error = 0;
+
+	if ((pending_id = git_array_alloc(pending)) == NULL)
+		return -1;
+	git_oid_cpy(pending_id, id);
+
+	while ((pending_id = git_array_pop(pending)) != NULL) {
+		git_oid_cpy(&current_id, pending_id);
+
+		if (git_oidmap_valid_index(w->commit_map,
+				git_oidmap_lookup_index(w->commit_map, &current_id)))
+			continue;
+
+		if ((error = git_commit_lookup(&commit, repo, &current_id)) < 0)
+			goto done;
+
+		p = packed_commit_new(commit);
+		git_commit_free(commit);
+		if (!p) {
+			error = -1;
+			goto done;
+		}
+
+		if ((error = git_vector_insert(&w->commits, p)) < 0) {
+			packed_commit_free(p);
+			goto done;
+		}
+
+		git_oidmap_insert(w->commit_map, &p->sha1, p, error);
+		if (error < 0)
+			goto done;
+		error = 0;
+
+		for (i = 0; i < git_array_size(p->parents); ++i) {
+			git_oid *parent_id = git_array_get(p->parents, i);
+
+			if (git_oidmap_valid_index(w->commit_map,
+					git_oidmap_lookup_index(w->commit_map, parent_id)))
+				continue;
+
+			if ((pending_id = git_array_alloc(pending)) == NULL) {
+				error = -1;
+				goto done;
+			}
+			git_oid_cpy(pending_id, parent_id);
+		}
+	}
+
+done:
+	git_array_clear(pending);
+	return error;
+}
+
+typedef struct {
+	struct git_pack_file *pack;
+	git_oid_array *commits;
+} commit_graph_collect_data;
+
+static int commit_graph_collect_commit(const git_oid *id, git_off_t offset, void *payload)
+{
+	commit_graph_collect_data *data = payload;
+	git_otype type;
+	size_t size;
+	git_oid *commit_id;
+	int error;
+
+	if ((error = git_packfile_resolve_header(&size, &type, data->pack, offset)) < 0)
+		return error;
+
+	if (type != GIT_OBJ_COMMIT)
+		return 0;
+
+	commit_id = git_array_alloc(*data->commits);
+	GITERR_CHECK_ALLOC(commit_id);
+	git_oid_cpy(commit_id, id);
+
+	return 0;
+}
+
+int git_commit_graph_writer_add_index_file(
+		git_commit_graph_writer *w,
+		git_repository *repo,
+		const char *idx_path)
+{
+	int error;
+	struct git_pack_file *p = NULL;
+	git_oid_array ids = GIT_ARRAY_INIT;
+	commit_graph_collect_data data;
+	size_t i;
+
+	assert(w && repo && idx_path);
+
+	if ((error = git_mwindow_get_pack(&p, idx_path)) < 0)
+		return error;
+
+	if (p->mwf.fd == -1 && (error = git_packfile_open(p)) < 0)
+		goto cleanup;
+
+	data.pack = p;
+	data.commits = &ids;
+	if ((error = git_pack_foreach_entry_offset(p, commit_graph_collect_commit, &data)) < 0)
+		goto cleanup;
+
+	for (i = 0; i < git_array_size(ids); ++i) {
+		if ((error = commit_graph_writer_add(w, repo, git_array_get(ids, i))) < 0)
+			goto cleanup;
+	}
+
+cleanup:
+	git_array_clear(ids);
+	git_mwindow_put_pack(p);
+	return error;
+}
+
+int git_commit_graph_writer_add_revwalk(
+		git_commit_graph_writer *w,
+		git_revwalk *walk)
+{
+	int error;
+	git_oid id;
+	git_repository *repo = git_revwalk_repository(walk);
+
+	assert(w && walk);
+
+	while ((error = git_revwalk_next(&id, walk)) == 0) {
+		if ((error = commit_graph_writer_add(w, repo, &id)) < 0)
+			return error;
+	}
+
+	if (error == GIT_ITEROVER)
+		error = 0;
+
+	return error;
+}
+
+/*
+ * Compute the generation number of every commit: one more than the
+ * largest generation number of its parents, or one for root commits.
+ */
+static int compute_generations(git_commit_graph_writer *w)
+{
+	git_array_t(packed_commit *) stack = GIT_ARRAY_INIT;
+	packed_commit *commit, **top;
+	size_t i, j;
+
+	git_vector_foreach(&w->commits, i, commit) {
+		if (commit->generation)
+			continue;
+
+		if ((top = git_array_alloc(stack)) == NULL)
+			goto on_error;
+		*top = commit;
+
+		while ((top = git_array_last(stack)) != NULL) {
+			packed_commit *current = *top;
+			uint32_t generation = 0;
+			bool pending = false;
+
+			for (j = 0; j < git_array_size(current->parent_commits); ++j) {
+				packed_commit **parent = git_array_get(current->parent_commits, j);
+
+				if (!(*parent)->generation) {
+					packed_commit **next = git_array_alloc(stack);
+					if (!next)
+						goto on_error;
+					*next = *parent;
+					pending = true;
+				} else if ((*parent)->generation > generation) {
+					generation = (*parent)->generation;
+				}
+			}
+
+			if (pending)
+				continue;
+
+			if (generation < GIT_COMMIT_GRAPH_GENERATION_NUMBER_MAX)
+				generation++;
+			current->generation = generation;
+			git_array_pop(stack);
+		}
+	}
+
+	git_array_clear(stack);
+	return 0;
+
+on_error:
+	git_array_clear(stack);
+	return -1;
+}
+
+static int commit_graph_write_chunk_header(git_buf *out, uint32_t id, git_off_t offset)
+{
+	uint32_t word[3];
+
+	word[0] = htonl(id);
+	word[1] = htonl((uint32_t)((uint64_t)offset >> 32));
+	word[2] = htonl((uint32_t)((uint64_t)offset & 0xffffffff));
+
+	return git_buf_put(out, (const char *)word, sizeof(word));
+}
+
+static int commit_graph_write_be32(git_buf *out, uint32_t value)
+{
+	value = htonl(value);
+	return git_buf_put(out, (const char *)&value, sizeof(value));
+}
+
+static int commit_graph_write(git_buf *out, git_commit_graph_writer *w)
+{
+	git_buf oid_fanout = GIT_BUF_INIT,
+		oid_lookup = GIT_BUF_INIT,
+		commit_data = GIT_BUF_INIT,
+		extra_edge_list = GIT_BUF_INIT;
+	struct git_commit_graph_header hdr = {0};
+	uint32_t fanout[256] = {0}, num_extra_edges = 0;
+	packed_commit *commit;
+	git_off_t offset;
+	git_oid checksum;
+	size_t i, j;
+	int error = 0;
+
+	if (git_vector_length(&w->commits) >= GIT_COMMIT_GRAPH_MISSING_PARENT) {
+		giterr_set(GITERR_INVALID, "too many commits for a commit-graph");
+		return -1;
+	}
+
+	git_vector_sort(&w->commits);
+
+	/* Resolve the parents to their position in the graph */
+	git_vector_foreach(&w->commits, i, commit) {
+		commit->index = i;
+		git_array_clear(commit->parent_commits);
+	}
+	git_vector_foreach(&w->commits, i, commit) {
+		for (j = 0; j < git_array_size(commit->parents); ++j) {
+			packed_commit **parent;
+			khiter_t pos = git_oidmap_lookup_index(
+					w->commit_map, git_array_get(commit->parents, j));
+
+			if (!git_oidmap_valid_index(w->commit_map, pos)) {
+				giterr_set(GITERR_INVALID, "commit-graph is missing a parent commit");
+				error = -1;
+				goto cleanup;
+			}
+
+			if ((parent = git_array_alloc(commit->parent_commits)) == NULL) {
+				error = -1;
+				goto cleanup;
+			}
+			*parent = git_oidmap_value_at(w->commit_map, pos);
+		}
+
+		commit->generation = 0;
+	}
+
+	if ((error = compute_generations(w)) < 0)
+		goto cleanup;
+
+	git_vector_foreach(&w->commits, i, commit) {
+		size_t parentcount = git_array_size(commit->parent_commits);
+		uint64_t commit_time = (uint64_t)commit->commit_time;
+
+		fanout[commit->sha1.id[0]]++;
+		git_buf_put(&oid_lookup, (const char *)commit->sha1.id, GIT_OID_RAWSZ);
+
+		git_buf_put(&commit_data, (const char *)commit->tree_oid.id, GIT_OID_RAWSZ);
+
+		if (parentcount == 0)
+			commit_graph_write_be32(&commit_data, GIT_COMMIT_GRAPH_MISSING_PARENT);
+		else
+			commit_graph_write_be32(&commit_data,
+				(uint32_t)(*git_array_get(commit->parent_commits, 0))->index);
+
+		if (parentcount < 2) {
+			commit_graph_write_be32(&commit_data, GIT_COMMIT_GRAPH_MISSING_PARENT);
+		} else if (parentcount == 2) {
+			commit_graph_write_be32(&commit_data,
+				(uint32_t)(*git_array_get(commit->parent_commits, 1))->index);
+		} else {
+			commit_graph_write_be32(&commit_data,
+				COMMIT_GRAPH_EXTRA_EDGE_NEEDED | num_extra_edges);
+
+			for (j = 1; j < parentcount; ++j) {
+				uint32_t edge = (uint32_t)(*git_array_get(commit->parent_commits, j))->index;
+
+				if (j == parentcount - 1)
+					edge |= COMMIT_GRAPH_LAST_EDGE;
+
+				commit_graph_write_be32(&extra_edge_list, edge);
+				num_extra_edges++;
+			}
+		}
+
+		commit_graph_write_be32(&commit_data,
+			(commit->generation << 2) | (uint32_t)((commit_time >> 32) & 0x3));
+		commit_graph_write_be32(&commit_data, (uint32_t)(commit_time & 0xffffffff));
+	}
+
+	for (i = 0; i < 256; ++i) {
+		if (i > 0)
+			fanout[i] += fanout[i - 1];
+		commit_graph_write_be32(&oid_fanout, fanout[i]);
+	}
+
+	if (git_buf_oom(&oid_fanout) || git_buf_oom(&oid_lookup) ||
+		git_buf_oom(&commit_data) || git_buf_oom(&extra_edge_list)) {
+		error = -1;
+		goto cleanup;
+	}
+
+	/* Write the header */
+	hdr.signature = htonl(COMMIT_GRAPH_SIGNATURE);
+	hdr.version = COMMIT_GRAPH_VERSION;
+	hdr.object_id_version = COMMIT_GRAPH_OBJECT_ID_VERSION;
+	hdr.chunks = num_extra_edges ? 4 : 3;
+	hdr.base_graph_files = 0;
+
+	if ((error = git_buf_put(out, (const char *)&hdr, sizeof(hdr))) < 0)
+		goto cleanup;
+
+	/* Write the chunk lookup table */
+	offset = sizeof(hdr) + (hdr.chunks + 1) * 12;
+	if ((error = commit_graph_write_chunk_header(out, COMMIT_GRAPH_OID_FANOUT_ID, offset)) < 0)
+		goto cleanup;
+	offset += git_buf_len(&oid_fanout);
+	if ((error = commit_graph_write_chunk_header(out, COMMIT_GRAPH_OID_LOOKUP_ID, offset)) < 0)
+		goto cleanup;
+	offset += git_buf_len(&oid_lookup);
+	if ((error = commit_graph_write_chunk_header(out, COMMIT_GRAPH_COMMIT_DATA_ID, offset)) < 0)
+		goto cleanup;
+	offset += git_buf_len(&commit_data);
+	if (num_extra_edges) {
+		if ((error = commit_graph_write_chunk_header(out, COMMIT_GRAPH_EXTRA_EDGE_LIST_ID, offset)) < 0)
+			goto cleanup;
+		offset += git_buf_len(&extra_edge_list);
+	}
+	if ((error = commit_graph_write_chunk_header(out, 0, offset)) < 0)
+		goto cleanup;
+
+	/* Write the chunks and the trailing checksum */
+	git_buf_put(out, git_buf_cstr(&oid_fanout), git_buf_len(&oid_fanout));
+	git_buf_put(out, git_buf_cstr(&oid_lookup), git_buf_len(&oid_lookup));
+	git_buf_put(out, git_buf_cstr(&commit_data), git_buf_len(&commit_data));
+	git_buf_put(out, git_buf_cstr(&extra_edge_list), git_buf_len(&extra_edge_list));
+
+	if (git_buf_oom(out)) {
+		error = -1;
+		goto cleanup;
+	}
+
+	if ((error = git_hash_buf(&checksum, git_buf_cstr(out), git_buf_len(out))) < 0)
+		goto cleanup;
+
+	error = git_buf_put(out, (const char *)checksum.id, GIT_OID_RAWSZ);
+
+cleanup:
+	git_buf_free(&oid_fanout);
+	git_buf_free(&oid_lookup);
+	git_buf_free(&commit_data);
+	git_buf_free(&extra_edge_list);
+	return error;
+}
+
+int git_commit_graph_writer_commit(
+		git_commit_graph_writer *w)
+{
+	git_buf cgraph = GIT_BUF_INIT, path = GIT_BUF_INIT;
+	git_filebuf output = GIT_FILEBUF_INIT;
+	int error;
+
+	assert(w);
+
+	if ((error = git_buf_joinpath(&path, w->objects_info_dir.ptr, GIT_COMMIT_GRAPH_FILE)) < 0 ||
+		(error = commit_graph_write(&cgraph, w)) < 0)
+		goto cleanup;
+
+	if ((error = git_futils_mkpath2file(path.ptr, GIT_OBJECT_DIR_MODE)) < 0)
+		goto cleanup;
+
+	if ((error = git_filebuf_open(&output, path.ptr, 0, GIT_OBJECT_FILE_MODE)) < 0 ||
+		(error = git_filebuf_write(&output, cgraph.ptr, cgraph.size)) < 0)
+		goto cleanup;
+
+	error = git_filebuf_commit(&output);
+
+cleanup:
+	git_filebuf_cleanup(&output);
+	git_buf_free(&cgraph);
+	git_buf_free(&path);
+	return error;
+}
+
+int git_commit_graph_writer_dump(
+		git_buf *cgraph,
+		git_commit_graph_writer *w)
+{
+	assert(cgraph && w);
+
+	git_buf_sanitize(cgraph);
+
+	return commit_graph_write(cgraph, w);
+}
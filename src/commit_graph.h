@@ -0,0 +1,183 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#ifndef INCLUDE_commit_graph_h__
+#define INCLUDE_commit_graph_h__
+
+#include "common.h"
+
+#include "git2/oid.h"
+#include "git2/types.h"
+#include "git2/sys/commit_graph.h"
+
+#include "map.h"
+#include "fileops.h"
+#include "vector.h"
+
+#define GIT_COMMIT_GRAPH_FILE "commit-graph"
+
+#define GIT_COMMIT_GRAPH_MISSING_PARENT 0x70000000
+#define GIT_COMMIT_GRAPH_GENERATION_NUMBER_MAX 0x3FFFFFFF
+
+/*
+ * The generation number of the commits that are not in the commit-graph.
+ * Since a commit-graph is closed under reachability, such commits can
+ * never be ancestors of a commit that is in it.
+ */
+#define GIT_COMMIT_GRAPH_GENERATION_NUMBER_INFINITY 0xFFFFFFFF
+
+/*
+ * A commit-graph file.
+ *
+ * This file contains metadata about commits, particularly the generation
+ * number for each one. This can help speed up graph operations without
+ * requiring a full graph traversal.
+ *
+ * The format is documented in git.git as
+ * Documentation/technical/commit-graph-format.txt; only version 1 using
+ * SHA-1 object names is supported, and split commit-graphs are not.
+ */
+typedef struct git_commit_graph_file {
+	git_map graph_map;
+
+	/* The OID Fanout table. */
+	const uint32_t *oid_fanout;
+	/* The total number of commits in the graph. */
+	uint32_t num_commits;
+
+	/* The OID Lookup table. */
+	const git_oid *oid_lookup;
+
+	/*
+	 * The Commit Data table. Each entry contains the OID of the commit
+	 * followed by two 8-byte fields in network byte order:
+	 * - The indices of the first two parents (32 bits each).
+	 * - The generation number (first 30 bits) and commit time in seconds
+	 *   since UNIX epoch (34 bits).
+	 */
+	const unsigned char *commit_data;
+
+	/*
+	 * The Extra Edge List table. Each 4-byte entry is a network byte order
+	 * index of one of the commit's extra parents (when there are more than
+	 * two parents).
+	 */
+	const unsigned char *extra_edge_list;
+	size_t num_extra_edge_list;
+
+	/* The trailer of the file. Contains the SHA1-checksum of the whole file. */
+	git_oid checksum;
+
+	/* Stat information used to detect that the file was rewritten. */
+	git_futils_filestamp stamp;
+
+	/* something like ".git/objects/info/commit-graph". */
+	char *filename;
+} git_commit_graph_file;
+
+/*
+ * An entry in the commit-graph file. Provides a subset of the information
+ * that can be obtained from the commit header.
+ */
+typedef struct git_commit_graph_entry {
+	/* The generation number of the commit within the graph */
+	size_t generation;
+
+	/* Time in seconds from UNIX epoch. */
+	git_time_t commit_time;
+
+	/* The number of parents of the commit. */
+	size_t parent_count;
+
+	/*
+	 * The indices of the parent commits within the Commit Data table. The
+	 * value of `GIT_COMMIT_GRAPH_MISSING_PARENT` indicates that no parent is
+	 * in that position.
+	 */
+	size_t parent_indices[2];
+
+	/* The index within the Extra Edge List of any parent after the first two. */
+	size_t extra_parents_index;
+
+	/* The SHA-1 hash of the root tree of the commit. */
+	git_oid tree_oid;
+
+	/* The index within the Commit Data table of the commit. */
+	size_t position;
+
+	/* The SHA-1 hash of the requested commit. */
+	git_oid sha1;
+} git_commit_graph_entry;
+
+/*
+ * The lazily-opened commit-graph of an object database. The file is only
+ * read the first time it is needed and is re-read when it changes.
+ */
+typedef struct git_commit_graph {
+	/* The path to the commit-graph file. Something like ".git/objects/info/commit-graph". */
+	git_buf filename;
+
+	/* The underlying commit-graph file, or NULL if it was not opened yet. */
+	git_commit_graph_file *file;
+
+	/*
+	 * The files a refresh replaced. Revwalks may still be reading them,
+	 * so they are only freed with the commit-graph.
+	 */
+	git_vector old_files;
+
+	/* Whether the commit-graph file was already checked for validity. */
+	unsigned int checked:1;
+} git_commit_graph;
+
+/* Create a lazy commit-graph for the given `objects` directory. */
+int git_commit_graph_new(git_commit_graph **cgraph_out, const char *objects_dir);
+
+/*
+ * Get the commit-graph file, opening it if needed. Returns GIT_ENOTFOUND
+ * (without setting an error) when there is no usable commit-graph.
+ */
+int git_commit_graph_get_file(git_commit_graph_file **file_out, git_commit_graph *cgraph);
+
+/*
+ * Forget the commit-graph file if it was rewritten since it was opened.
+ * The file stays valid until the commit-graph is freed.
+ */
+void git_commit_graph_refresh(git_commit_graph *cgraph);
+
+void git_commit_graph_free(git_commit_graph *cgraph);
+
+int git_commit_graph_file_open(
+		git_commit_graph_file **file_out,
+		const char *path);
+bool git_commit_graph_file_needs_refresh(
+		const git_commit_graph_file *file,
+		const char *path);
+int git_commit_graph_entry_find(
+		git_commit_graph_entry *e,
+		const git_commit_graph_file *file,
+		const git_oid *short_oid,
+		size_t len);
+int git_commit_graph_entry_get_byindex(
+		git_commit_graph_entry *e,
+		const git_commit_graph_file *file,
+		size_t pos);
+int git_commit_graph_entry_parent(
+		git_commit_graph_entry *parent,
+		const git_commit_graph_file *file,
+		const git_commit_graph_entry *entry,
+		size_t n);
+int git_commit_graph_file_close(git_commit_graph_file *file);
+void git_commit_graph_file_free(git_commit_graph_file *file);
+
+/* This is exposed for use in the tests. */
+int git_commit_graph_file_parse(
+		git_commit_graph_file *file,
+		const unsigned char *data,
+		size_t size);
+
+#endif
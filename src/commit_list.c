@@ -19,6 +19,23 @@ int git_commit_list_time_cmp(const void *a, const void *b)
 	return (commit_a->time < commit_b->time);
 }
 
+/*
+ * Order by generation number and then by date, so that a commit is always
+ * popped from a priority queue before its parents even with clock skew.
+ */
+int git_commit_list_generation_cmp(const void *a, const void *b)
+{
+	const git_commit_list_node *commit_a = a;
+	const git_commit_list_node *commit_b = b;
+
+	if (commit_a->generation < commit_b->generation)
+		return 1;
+	if (commit_a->generation > commit_b->generation)
+		return -1;
+
+	return git_commit_list_time_cmp(a, b);
+}
+
 git_commit_list *git_commit_list_insert(git_commit_list_node *item, git_commit_list **list_p)
 {
 	git_commit_list *new_list = git__malloc(sizeof(git_commit_list));
@@ -170,6 +187,36 @@ static int commit_quick_parse(
 		return commit_error(commit, "cannot parse commit time");
 
 	commit->time = (time_t)commit_time;
+	commit->generation = GIT_COMMIT_GRAPH_GENERATION_NUMBER_INFINITY;
+	commit->parsed = 1;
+	return 0;
+}
+
+static int commit_quick_parse_graph(
+	git_revwalk *walk,
+	git_commit_list_node *commit,
+	git_commit_graph_file *cgraph_file,
+	const git_commit_graph_entry *e)
+{
+	git_commit_graph_entry parent;
+	size_t i;
+	int error;
+
+	commit->parents = alloc_parents(walk, commit, e->parent_count);
+	GITERR_CHECK_ALLOC(commit->parents);
+
+	for (i = 0; i < e->parent_count; ++i) {
+		if ((error = git_commit_graph_entry_parent(&parent, cgraph_file, e, i)) < 0)
+			return error;
+
+		commit->parents[i] = git_revwalk__commit_lookup(walk, &parent.sha1);
+		if (commit->parents[i] == NULL)
+			return -1;
+	}
+
+	commit->out_degree = (unsigned short)e->parent_count;
+	commit->time = (uint32_t)e->commit_time;
+	commit->generation = (uint32_t)e->generation;
 	commit->parsed = 1;
 	return 0;
 }
@@ -177,11 +224,21 @@ static int commit_quick_parse(
 int git_commit_list_parse(git_revwalk *walk, git_commit_list_node *commit)
 {
 	git_odb_object *obj;
+	git_commit_graph_file *cgraph_file;
+	git_commit_graph_entry e;
 	int error;
 
 	if (commit->parsed)
 		return 0;
 
+	/* Use the commit-graph when the commit is in it, to avoid reading the object */
+	if (git_odb__get_commit_graph_file(&cgraph_file, walk->odb) == 0) {
+		if (git_commit_graph_entry_find(&e, cgraph_file, &commit->oid, GIT_OID_HEXSZ) == 0)
+			return commit_quick_parse_graph(walk, commit, cgraph_file, &e);
+
+		giterr_clear();
+	}
+
 	if ((error = git_odb_read(&obj, walk->odb, &commit->oid)) < 0)
 		return error;
 
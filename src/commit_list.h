@@ -23,6 +23,7 @@
 typedef struct git_commit_list_node {
 	git_oid oid;
 	uint32_t time;
+	uint32_t generation;
 	unsigned int seen:1,
 			 uninteresting:1,
 			 topo_delay:1,
@@ -42,6 +43,7 @@ typedef struct git_commit_list {
 
 git_commit_list_node *git_commit_list_alloc_node(git_revwalk *walk);
 int git_commit_list_time_cmp(const void *a, const void *b);
+int git_commit_list_generation_cmp(const void *a, const void *b);
 void git_commit_list_free(git_commit_list **list_p);
 git_commit_list *git_commit_list_insert(git_commit_list_node *item, git_commit_list **list_p);
 git_commit_list *git_commit_list_insert_by_date(git_commit_list_node *item, git_commit_list **list_p);
@@ -49,57 +49,101 @@ int git__delta_read_header(
 	return 0;
 }
 
-int git__delta_apply(
-	git_rawobj *out,
-	const unsigned char *base,
-	size_t base_len,
-	const unsigned char *delta,
-	size_t delta_len)
+static int delta_sizes(
+	size_t *res_sz,
+	const unsigned char **delta,
+	const unsigned char *delta_end,
+	size_t base_len)
 {
-	const unsigned char *delta_end = delta + delta_len;
-	size_t base_sz, res_sz, alloc_sz;
-	unsigned char *res_dp;
+	size_t base_sz;
 
 	/* Check that the base size matches the data we were given;
 	 * if not we would underflow while accessing data from the
 	 * base object, resulting in data corruption or segfault.
 	 */
-	if ((hdr_sz(&base_sz, &delta, delta_end) < 0) || (base_sz != base_len)) {
+	if ((hdr_sz(&base_sz, delta, delta_end) < 0) || (base_sz != base_len)) {
 		giterr_set(GITERR_INVALID, "Failed to apply delta. Base size does not match given data");
 		return -1;
 	}
 
-	if (hdr_sz(&res_sz, &delta, delta_end) < 0) {
+	if (hdr_sz(res_sz, delta, delta_end) < 0) {
 		giterr_set(GITERR_INVALID, "Failed to apply delta. Base size does not match given data");
 		return -1;
 	}
 
-	GITERR_CHECK_ALLOC_ADD(&alloc_sz, res_sz, 1);
-	res_dp = git__malloc(alloc_sz);
-	GITERR_CHECK_ALLOC(res_dp);
+	return 0;
+}
 
-	res_dp[res_sz] = '\0';
-	out->data = res_dp;
-	out->len = res_sz;
+/*
+ * Read the offset and length of the copy instruction `cmd`, whose
+ * arguments follow at `*delta`.
+ */
+GIT_INLINE(int) read_copy(
+	size_t *off_out,
+	size_t *len_out,
+	unsigned char cmd,
+	const unsigned char **delta,
+	const unsigned char *delta_end)
+{
+	static const unsigned char bits[16] = {
+		0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4
+	};
+	const unsigned char *d = *delta;
+	size_t off = 0, len = 0;
+
+	/* one byte of argument for each of the seven low bits */
+	if (delta_end - d < bits[cmd & 0x0f] + bits[(cmd >> 4) & 0x07])
+		return -1;
+
+	if (cmd & 0x01) off = *d++;
+	if (cmd & 0x02) off |= *d++ << 8;
+	if (cmd & 0x04) off |= *d++ << 16;
+	if (cmd & 0x08) off |= (size_t)*d++ << 24;
+
+	if (cmd & 0x10) len = *d++;
+	if (cmd & 0x20) len |= *d++ << 8;
+	if (cmd & 0x40) len |= *d++ << 16;
+	if (!len)		len = 0x10000;
 
+	*delta = d;
+	*off_out = off;
+	*len_out = len;
+	return 0;
+}
+
+/* Write the `res_sz` bytes of the result of the delta to `res_dp` */
+static int delta_patch(
+	unsigned char *res_dp,
+	size_t res_sz,
+	const unsigned char *base,
+	size_t base_len,
+	const unsigned char *delta,
+	const unsigned char *delta_end)
+{
 	while (delta < delta_end) {
 		unsigned char cmd = *delta++;
 		if (cmd & 0x80) {
 			/* cmd is a copy instruction; copy from the base.
 			 */
-			size_t off = 0, len = 0;
+			const unsigned char *next;
+			size_t off, len, next_off, next_len;
 
-			if (cmd & 0x01) off = *delta++;
-			if (cmd & 0x02) off |= *delta++ << 8;
-			if (cmd & 0x04) off |= *delta++ << 16;
-			if (cmd & 0x08) off |= *delta++ << 24;
-
-			if (cmd & 0x10) len = *delta++;
-			if (cmd & 0x20) len |= *delta++ << 8;
-			if (cmd & 0x40) len |= *delta++ << 16;
-			if (!len)		len = 0x10000;
+			if (read_copy(&off, &len, cmd, &delta, delta_end) < 0)
+				goto fail;
 
-			if (base_len < off + len || res_sz < len)
+			/* A copy longer than 64KB is written as copies of
+			 * consecutive parts of the base; do them at once.
+			 */
+			while (delta < delta_end && (*delta & 0x80)) {
+				next = delta + 1;
+				if (read_copy(&next_off, &next_len, *delta, &next, delta_end) < 0 ||
+					next_off != off + len || len > res_sz)
+					break;
+				len += next_len;
+				delta = next;
+			}
+
+			if (off > base_len || len > base_len - off || res_sz < len)
 				goto fail;
 			memcpy(res_dp, base + off, len);
 			res_dp += len;
@@ -128,8 +172,65 @@ int git__delta_apply(
 	return 0;
 
 fail:
-	git__free(out->data);
-	out->data = NULL;
 	giterr_set(GITERR_INVALID, "Failed to apply delta");
 	return -1;
 }
+
+int git__delta_apply(
+	git_rawobj *out,
+	const unsigned char *base,
+	size_t base_len,
+	const unsigned char *delta,
+	size_t delta_len)
+{
+	const unsigned char *delta_end = delta + delta_len;
+	size_t res_sz, alloc_sz;
+	unsigned char *res_dp;
+
+	if (delta_sizes(&res_sz, &delta, delta_end, base_len) < 0)
+		return -1;
+
+	GITERR_CHECK_ALLOC_ADD(&alloc_sz, res_sz, 1);
+	res_dp = git__malloc(alloc_sz);
+	GITERR_CHECK_ALLOC(res_dp);
+
+	res_dp[res_sz] = '\0';
+	out->data = res_dp;
+	out->len = res_sz;
+
+	if (delta_patch(res_dp, res_sz, base, base_len, delta, delta_end) < 0) {
+		git__free(out->data);
+		out->data = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+int git__delta_apply_buf(
+	git_buf *out,
+	const unsigned char *base,
+	size_t base_len,
+	const unsigned char *delta,
+	size_t delta_len)
+{
+	const unsigned char *delta_end = delta + delta_len;
+	size_t res_sz, alloc_sz;
+
+	git_buf_clear(out);
+
+	if (delta_sizes(&res_sz, &delta, delta_end, base_len) < 0)
+		return -1;
+
+	GITERR_CHECK_ALLOC_ADD(&alloc_sz, res_sz, 1);
+	if (git_buf_grow(out, alloc_sz) < 0)
+		return -1;
+
+	if (delta_patch((unsigned char *)out->ptr, res_sz,
+			base, base_len, delta, delta_end) < 0)
+		return -1;
+
+	out->size = res_sz;
+	out->ptr[res_sz] = '\0';
+	return 0;
+}
@@ -8,6 +8,7 @@
 #define INCLUDE_delta_apply_h__
 
 #include "odb.h"
+#include "buffer.h"
 
 /**
  * Apply a git binary delta to recover the original content.
@@ -30,6 +31,29 @@ extern int git__delta_apply(
 	const unsigned char *delta,
 	size_t delta_len);
 
+/**
+ * Apply a git binary delta like `git__delta_apply`, but into `out`,
+ * whose memory is reused when it is large enough.  This lets a chain
+ * of deltas be applied with two buffers, one holding the base and the
+ * other the result.
+ *
+ * @param out the buffer to receive the original data; it is cleared
+ *		on error.
+ * @param base the base to copy from during copy instructions.
+ * @param base_len number of bytes available at base.
+ * @param delta the delta to execute copy/insert instructions from.
+ * @param delta_len total number of bytes in the delta.
+ * @return
+ * - 0 on a successful delta unpack.
+ * - GIT_ERROR if the delta is corrupt or doesn't match the base.
+ */
+extern int git__delta_apply_buf(
+	git_buf *out,
+	const unsigned char *base,
+	size_t base_len,
+	const unsigned char *delta,
+	size_t delta_len);
+
 /**
  * Read the header of a git binary delta.
  *
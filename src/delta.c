@@ -7,6 +7,11 @@
 
 #include "delta.h"
 
+#ifdef GIT_DELTA_SIMD
+# include <cpuid.h>
+# include <immintrin.h>
+#endif
+
 /* maximum hash entry list for the same hash bucket */
 #define HASH_LIMIT 64
 
@@ -259,6 +264,137 @@ unsigned long git_delta_sizeof_index(struct git_delta_index *index)
 		return 0;
 }
 
+/*
+ * How many of the first `len` bytes of `a` and `b` are the same. The
+ * delta search spends its time here on similar objects, whose matches
+ * run for thousands of bytes, so the vector kernels compare 16 or 32
+ * bytes at once and only look for the first difference in the block
+ * that has one.
+ */
+static size_t match_length_portable(
+	const unsigned char *a, const unsigned char *b, size_t len)
+{
+	size_t n = 0, x, y;
+
+	while (len - n >= sizeof(size_t)) {
+		memcpy(&x, a + n, sizeof(x));
+		memcpy(&y, b + n, sizeof(y));
+		if (x != y)
+			break;
+		n += sizeof(size_t);
+	}
+
+	while (n < len && a[n] == b[n])
+		n++;
+
+	return n;
+}
+
+#ifdef GIT_DELTA_SIMD
+
+__attribute__((target("sse2")))
+static size_t match_length_sse2(
+	const unsigned char *a, const unsigned char *b, size_t len)
+{
+	size_t n = 0;
+	unsigned int mask;
+
+	while (len - n >= 16) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(a + n));
+		__m128i y = _mm_loadu_si128((const __m128i *)(b + n));
+
+		mask = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(x, y));
+		if (mask != 0xffff)
+			return n + __builtin_ctz(~mask);
+		n += 16;
+	}
+
+	return n + match_length_portable(a + n, b + n, len - n);
+}
+
+__attribute__((target("avx2")))
+static size_t match_length_avx2(
+	const unsigned char *a, const unsigned char *b, size_t len)
+{
+	size_t n = 0;
+	unsigned int mask;
+
+	while (len - n >= 32) {
+		__m256i x = _mm256_loadu_si256((const __m256i *)(a + n));
+		__m256i y = _mm256_loadu_si256((const __m256i *)(b + n));
+
+		mask = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y));
+		if (mask != 0xffffffff)
+			return n + __builtin_ctz(~mask);
+		n += 32;
+	}
+
+	return n + match_length_sse2(a + n, b + n, len - n);
+}
+
+static git_delta_kernel cpu_kernel(void)
+{
+	unsigned int eax, ebx, ecx, edx, xcr0;
+
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(edx & bit_SSE2))
+		return GIT_DELTA_KERNEL_PORTABLE;
+
+	/* AVX2 also needs the OS to save the YMM registers */
+	if (!(ecx & bit_OSXSAVE) || !(ecx & bit_AVX))
+		return GIT_DELTA_KERNEL_SSE2;
+
+	__asm__("xgetbv" : "=a" (xcr0), "=d" (edx) : "c" (0));
+	if ((xcr0 & 0x6) != 0x6 ||
+		!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) ||
+		!(ebx & bit_AVX2))
+		return GIT_DELTA_KERNEL_SSE2;
+
+	return GIT_DELTA_KERNEL_AVX2;
+}
+
+#else
+
+static git_delta_kernel cpu_kernel(void)
+{
+	return GIT_DELTA_KERNEL_PORTABLE;
+}
+
+#endif
+
+static size_t (*match_length)(
+	const unsigned char *, const unsigned char *, size_t) =
+	match_length_portable;
+
+git_delta_kernel git_delta__kernel(git_delta_kernel max)
+{
+	git_delta_kernel kernel = cpu_kernel();
+
+	if (kernel > max)
+		kernel = max;
+
+	switch (kernel) {
+#ifdef GIT_DELTA_SIMD
+	case GIT_DELTA_KERNEL_AVX2:
+		match_length = match_length_avx2;
+		break;
+	case GIT_DELTA_KERNEL_SSE2:
+		match_length = match_length_sse2;
+		break;
+#endif
+	default:
+		match_length = match_length_portable;
+		kernel = GIT_DELTA_KERNEL_PORTABLE;
+	}
+
+	return kernel;
+}
+
+int git_delta_global_init(void)
+{
+	git_delta__kernel(GIT_DELTA_KERNEL_AVX2);
+	return 0;
+}
+
 /*
  * The maximum size for any opcode sequence, including the initial header
  * plus rabin window plus biggest copy.
@@ -336,8 +472,7 @@ git_delta_create(
 					ref_size = (unsigned int)(top - src);
 				if (ref_size <= msize)
 					break;
-				while (ref_size-- && *src++ == *ref)
-					ref++;
+				ref += match_length(src, ref, ref_size);
 				if (msize < (unsigned int)(ref - entry->ptr)) {
 					/* this is our best match so far */
 					msize = (unsigned int)(ref - entry->ptr);
@@ -53,6 +53,26 @@ extern void *git_delta_create(
 	unsigned long *delta_size,
 	unsigned long max_delta_size);
 
+/*
+ * The code create_delta() compares the source and target buffers with,
+ * to find how far a match goes. The vector ones are only built when
+ * the compiler has GIT_DELTA_SIMD, and only used when the CPU has them.
+ */
+typedef enum {
+	GIT_DELTA_KERNEL_PORTABLE = 0,
+	GIT_DELTA_KERNEL_SSE2,
+	GIT_DELTA_KERNEL_AVX2,
+} git_delta_kernel;
+
+/* Pick the best kernel the CPU runs, which git_libgit2_init() does. */
+extern int git_delta_global_init(void);
+
+/*
+ * Use the best kernel up to `max` the CPU runs, and return it. This
+ * lets the tests and benchmarks compare them.
+ */
+extern git_delta_kernel git_delta__kernel(git_delta_kernel max);
+
 /*
  * diff_delta: create a delta from source buffer to target buffer
  *
@@ -0,0 +1,238 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "delta_index_cache.h"
+#include "global.h"
+#include "oidmap.h"
+
+GIT__USE_OIDMAP
+
+/*
+ * Like the delta base cache of the packs, the entries are kept in an
+ * LRU list and evicted from its tail, skipping those in use. All of it
+ * is under git__delta_index_cache_mutex.
+ */
+static struct {
+	git_oidmap *entries;
+	git_delta_index_cache_entry *head, *tail;
+	size_t memory_used;
+	size_t hits, misses, evictions;
+} index_cache;
+
+static size_t index_cache_max_storage = 0;
+
+static void free_entry(git_delta_index_cache_entry *entry)
+{
+	assert(entry->refcount.val == 0);
+
+	git_delta_free_index(entry->index);
+	git__free(entry->data);
+	git__free(entry);
+}
+
+/* These run with the cache lock held */
+static void lru_unlink(git_delta_index_cache_entry *entry)
+{
+	if (entry->prev)
+		entry->prev->next = entry->next;
+	else
+		index_cache.head = entry->next;
+
+	if (entry->next)
+		entry->next->prev = entry->prev;
+	else
+		index_cache.tail = entry->prev;
+
+	entry->prev = entry->next = NULL;
+}
+
+static void lru_push_head(git_delta_index_cache_entry *entry)
+{
+	entry->prev = NULL;
+	entry->next = index_cache.head;
+
+	if (index_cache.head)
+		index_cache.head->prev = entry;
+	else
+		index_cache.tail = entry;
+
+	index_cache.head = entry;
+}
+
+static void evict(git_delta_index_cache_entry *entry)
+{
+	khiter_t pos = git_oidmap_lookup_index(index_cache.entries, &entry->id);
+
+	assert(git_oidmap_valid_index(index_cache.entries, pos));
+	kh_del(oid, index_cache.entries, pos);
+
+	lru_unlink(entry);
+	index_cache.memory_used -= entry->size;
+	free_entry(entry);
+}
+
+/*
+ * Evict the least recently used indexes until `len` more bytes fit in
+ * the budget. Fails if only indexes in use are left.
+ */
+static int make_room(size_t len)
+{
+	git_delta_index_cache_entry *entry = index_cache.tail, *prev;
+
+	while (index_cache.memory_used + len > index_cache_max_storage) {
+		while (entry && entry->refcount.val)
+			entry = entry->prev;
+
+		if (!entry)
+			return -1;
+
+		prev = entry->prev;
+		evict(entry);
+		index_cache.evictions++;
+		entry = prev;
+	}
+
+	return 0;
+}
+
+static void index_cache_shutdown(void)
+{
+	if (git_mutex_lock(&git__delta_index_cache_mutex) < 0)
+		return;
+
+	while (index_cache.tail)
+		evict(index_cache.tail);
+
+	git_oidmap_free(index_cache.entries);
+
+	git_mutex_unlock(&git__delta_index_cache_mutex);
+}
+
+git_delta_index_cache_entry *git_delta_index_cache_get(const git_oid *id)
+{
+	git_delta_index_cache_entry *entry = NULL;
+	khiter_t pos;
+
+	if (git_mutex_lock(&git__delta_index_cache_mutex) < 0)
+		return NULL;
+
+	if (!index_cache.entries)
+		goto done;
+
+	pos = git_oidmap_lookup_index(index_cache.entries, id);
+
+	if (git_oidmap_valid_index(index_cache.entries, pos)) {
+		entry = git_oidmap_value_at(index_cache.entries, pos);
+		git_atomic_inc(&entry->refcount);
+
+		lru_unlink(entry);
+		lru_push_head(entry);
+		index_cache.hits++;
+	} else {
+		index_cache.misses++;
+	}
+
+done:
+	git_mutex_unlock(&git__delta_index_cache_mutex);
+	return entry;
+}
+
+git_delta_index_cache_entry *git_delta_index_cache_add(
+	const git_oid *id,
+	void *data,
+	size_t data_len,
+	struct git_delta_index *index)
+{
+	git_delta_index_cache_entry *entry = NULL;
+	size_t size = sizeof(*entry) + data_len + git_delta_sizeof_index(index);
+	int error;
+
+	if (git_mutex_lock(&git__delta_index_cache_mutex) < 0)
+		return NULL;
+
+	if (!index_cache_max_storage)
+		goto done;
+
+	if (!index_cache.entries) {
+		if ((index_cache.entries = git_oidmap_alloc()) == NULL)
+			goto done;
+
+		git__on_shutdown(index_cache_shutdown);
+	}
+
+	/* another thread may have added it, and it has to fit */
+	if (git_oidmap_valid_index(index_cache.entries,
+			git_oidmap_lookup_index(index_cache.entries, id)) ||
+		make_room(size) < 0 ||
+		(entry = git__calloc(1, sizeof(*entry))) == NULL)
+		goto done;
+
+	git_oid_cpy(&entry->id, id);
+	entry->data = data;
+	entry->index = index;
+	entry->size = size;
+	git_atomic_set(&entry->refcount, 1);
+
+	git_oidmap_insert(index_cache.entries, &entry->id, entry, error);
+	if (error < 0) {
+		git__free(entry);
+		entry = NULL;
+		goto done;
+	}
+
+	lru_push_head(entry);
+	index_cache.memory_used += size;
+
+done:
+	git_mutex_unlock(&git__delta_index_cache_mutex);
+	return entry;
+}
+
+void git_delta_index_cache_release(git_delta_index_cache_entry *entry)
+{
+	if (entry)
+		git_atomic_dec(&entry->refcount);
+}
+
+void git_delta_index_cache__set_max_storage(size_t max_storage)
+{
+	if (git_mutex_lock(&git__delta_index_cache_mutex) < 0)
+		return;
+
+	index_cache_max_storage = max_storage;
+	make_room(0);
+
+	git_mutex_unlock(&git__delta_index_cache_mutex);
+}
+
+void git_delta_index_cache__memory(size_t *current, size_t *allowed)
+{
+	if (git_mutex_lock(&git__delta_index_cache_mutex) < 0) {
+		*current = *allowed = 0;
+		return;
+	}
+
+	*current = index_cache.memory_used;
+	*allowed = index_cache_max_storage;
+
+	git_mutex_unlock(&git__delta_index_cache_mutex);
+}
+
+void git_delta_index_cache__stats(
+	size_t *hits, size_t *misses, size_t *evictions)
+{
+	if (git_mutex_lock(&git__delta_index_cache_mutex) < 0) {
+		*hits = *misses = *evictions = 0;
+		return;
+	}
+
+	*hits = index_cache.hits;
+	*misses = index_cache.misses;
+	*evictions = index_cache.evictions;
+
+	git_mutex_unlock(&git__delta_index_cache_mutex);
+}
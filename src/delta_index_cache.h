@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_delta_index_cache_h__
+#define INCLUDE_delta_index_cache_h__
+
+#include "common.h"
+#include "delta.h"
+#include "thread-utils.h"
+
+#include "git2/oid.h"
+
+/*
+ * The delta indexes the packbuilders built for their delta search, kept
+ * for the packbuilders that come after them in the process. A server
+ * packing the same recent objects for every fetch then only indexes
+ * them once. The indexes are shared by object id, so across repositories
+ * too, and the cache is empty unless given some memory with
+ * `GIT_OPT_SET_DELTA_INDEX_CACHE_MAX_SIZE`.
+ */
+
+typedef struct git_delta_index_cache_entry {
+	/* in the LRU list, most recently used first */
+	struct git_delta_index_cache_entry *prev, *next;
+	git_atomic refcount;
+
+	git_oid id;
+	void *data; /* of the object, which the index points into */
+	struct git_delta_index *index;
+	size_t size; /* the memory the entry takes */
+} git_delta_index_cache_entry;
+
+/*
+ * Find the index of an object. The entry stays valid until it is given
+ * back with `git_delta_index_cache_release`.
+ */
+extern git_delta_index_cache_entry *git_delta_index_cache_get(
+	const git_oid *id);
+
+/*
+ * Add the index of an object, and the data it was built from. When the
+ * cache takes them, it returns the entry holding them, as if from
+ * `git_delta_index_cache_get`; when they don't fit, or another thread
+ * added the object first, it returns NULL and they are left to the
+ * caller.
+ */
+extern git_delta_index_cache_entry *git_delta_index_cache_add(
+	const git_oid *id,
+	void *data,
+	size_t data_len,
+	struct git_delta_index *index);
+
+extern void git_delta_index_cache_release(git_delta_index_cache_entry *entry);
+
+extern void git_delta_index_cache__set_max_storage(size_t max_storage);
+extern void git_delta_index_cache__memory(size_t *current, size_t *allowed);
+extern void git_delta_index_cache__stats(
+	size_t *hits, size_t *misses, size_t *evictions);
+
+#endif
@@ -0,0 +1,493 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "delta_islands.h"
+#include "array.h"
+#include "buffer.h"
+#include "pool.h"
+#include "vector.h"
+
+#include "git2/commit.h"
+#include "git2/refs.h"
+#include "git2/revwalk.h"
+#include "git2/tag.h"
+#include "git2/tree.h"
+
+GIT__USE_OIDMAP
+
+/* the capture groups of a pattern which name the island */
+#define MAX_ISLAND_GROUPS 9
+
+typedef struct {
+	git_oid id;
+	uint32_t bits[GIT_FLEX_ARRAY];
+} island_marks;
+
+typedef struct {
+	git_oid id;
+	size_t island;
+} island_tip;
+
+struct git_delta_islands {
+	git_vector patterns;
+	git_vector names; /* the bit of an island is its position */
+	size_t nr_words;
+
+	git_oidmap *marks;
+	git_pool pool;
+};
+
+typedef git_array_t(island_tip) island_tips;
+typedef git_array_t(git_oid) island_trees;
+
+int git_delta_islands_new(git_delta_islands **out)
+{
+	git_delta_islands *islands;
+
+	islands = git__calloc(1, sizeof(git_delta_islands));
+	GITERR_CHECK_ALLOC(islands);
+
+	islands->marks = git_oidmap_alloc();
+	GITERR_CHECK_ALLOC(islands->marks);
+
+	*out = islands;
+	return 0;
+}
+
+int git_delta_islands_add(git_delta_islands *islands, const char *pattern)
+{
+	regex_t *regex;
+	int error;
+
+	assert(islands && pattern);
+
+	regex = git__malloc(sizeof(regex_t));
+	GITERR_CHECK_ALLOC(regex);
+
+	if ((error = regcomp(regex, pattern, REG_EXTENDED)) != 0) {
+		giterr_set_regex(regex, error);
+		regfree(regex);
+		git__free(regex);
+		return -1;
+	}
+
+	if (git_vector_insert(&islands->patterns, regex) < 0) {
+		regfree(regex);
+		git__free(regex);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Find the island of a ref: the last pattern it matches names it, with
+ * what its capture groups matched, so that later patterns can override
+ * earlier ones. Returns GIT_ENOTFOUND if the ref is in no island.
+ */
+static int find_island(
+	size_t *out, git_delta_islands *islands, const char *refname)
+{
+	regmatch_t matches[MAX_ISLAND_GROUPS + 1];
+	git_buf name = GIT_BUF_INIT;
+	regex_t *regex = NULL;
+	char *existing, *copy;
+	size_t i;
+	int error = 0;
+
+	for (i = islands->patterns.length; i > 0; i--) {
+		regex = git_vector_get(&islands->patterns, i - 1);
+
+		if (!regexec(regex, refname, ARRAY_SIZE(matches), matches, 0))
+			break;
+	}
+
+	if (i == 0)
+		return GIT_ENOTFOUND;
+
+	for (i = 1; i < ARRAY_SIZE(matches) && i <= regex->re_nsub; i++) {
+		if (matches[i].rm_so < 0)
+			continue;
+
+		if (name.size)
+			git_buf_putc(&name, '-');
+
+		git_buf_put(&name, refname + matches[i].rm_so,
+			matches[i].rm_eo - matches[i].rm_so);
+	}
+
+	if (git_buf_oom(&name))
+		return -1;
+
+	git_vector_foreach(&islands->names, i, existing) {
+		if (!strcmp(existing, name.ptr))
+			goto done;
+	}
+
+	if ((copy = git__strdup(name.ptr)) == NULL ||
+		(error = git_vector_insert(&islands->names, copy)) < 0) {
+		git__free(copy);
+		error = -1;
+	}
+
+done:
+	*out = i;
+	git_buf_free(&name);
+	return error;
+}
+
+static int load_tips(
+	island_tips *tips,
+	git_delta_islands *islands,
+	git_repository *repo)
+{
+	git_reference_iterator *iter;
+	const char *refname;
+	island_tip *tip;
+	size_t island;
+	int error;
+
+	if ((error = git_reference_iterator_new(&iter, repo)) < 0)
+		return error;
+
+	while ((error = git_reference_next_name(&refname, iter)) == 0) {
+		if ((error = find_island(&island, islands, refname)) == GIT_ENOTFOUND)
+			continue;
+		else if (error < 0)
+			break;
+
+		if ((tip = git_array_alloc(*tips)) == NULL) {
+			error = -1;
+			break;
+		}
+
+		tip->island = island;
+
+		/* a dangling symbolic ref is no tip */
+		if ((error = git_reference_name_to_id(&tip->id, repo, refname)) == GIT_ENOTFOUND) {
+			giterr_clear();
+			(void)git_array_pop(*tips);
+		} else if (error < 0) {
+			break;
+		}
+	}
+
+	git_reference_iterator_free(iter);
+	return error == GIT_ITEROVER ? 0 : error;
+}
+
+static island_marks *get_marks(git_delta_islands *islands, const git_oid *id)
+{
+	khiter_t pos = git_oidmap_lookup_index(islands->marks, id);
+
+	if (!git_oidmap_valid_index(islands->marks, pos))
+		return NULL;
+
+	return git_oidmap_value_at(islands->marks, pos);
+}
+
+/*
+ * Add the islands in `bits` to those of an object. Returns 1 if it was
+ * not in all of them yet, 0 if it was, or an error code.
+ */
+static int add_marks(
+	git_delta_islands *islands, const git_oid *id, const uint32_t *bits)
+{
+	island_marks *marks;
+	size_t i;
+	int changed = 0, error;
+
+	if ((marks = get_marks(islands, id)) == NULL) {
+		marks = git_pool_mallocz(&islands->pool, 1);
+		GITERR_CHECK_ALLOC(marks);
+
+		git_oid_cpy(&marks->id, id);
+
+		git_oidmap_insert(islands->marks, &marks->id, marks, error);
+		if (error < 0) {
+			giterr_set_oom();
+			return -1;
+		}
+	}
+
+	for (i = 0; i < islands->nr_words; i++) {
+		if (bits[i] & ~marks->bits[i]) {
+			marks->bits[i] |= bits[i];
+			changed = 1;
+		}
+	}
+
+	return changed;
+}
+
+
+/*
+ * Mark a tip with its island, and so the objects its tags point to,
+ * down to the commit to walk from or the tree to mark the content of.
+ */
+static int mark_tip(
+	git_delta_islands *islands,
+	git_repository *repo,
+	git_revwalk *walk,
+	island_trees *trees,
+	uint32_t *bits,
+	const island_tip *tip)
+{
+	git_object *obj = NULL;
+	git_oid id, *tree;
+	int error;
+
+	memset(bits, 0, islands->nr_words * sizeof(uint32_t));
+	bits[tip->island / 32] |= 1u << (tip->island % 32);
+
+	git_oid_cpy(&id, &tip->id);
+
+	for (;;) {
+		if ((error = add_marks(islands, &id, bits)) < 0 ||
+			(error = git_object_lookup(&obj, repo, &id, GIT_OBJ_ANY)) < 0)
+			return error;
+
+		if (git_object_type(obj) != GIT_OBJ_TAG)
+			break;
+
+		git_oid_cpy(&id, git_tag_target_id((git_tag *)obj));
+		git_object_free(obj);
+	}
+
+	error = 0;
+
+	switch (git_object_type(obj)) {
+	case GIT_OBJ_COMMIT:
+		error = git_revwalk_push(walk, &id);
+		break;
+	case GIT_OBJ_TREE:
+		if ((tree = git_array_alloc(*trees)) == NULL) {
+			error = -1;
+			break;
+		}
+		git_oid_cpy(tree, &id);
+		break;
+	default:
+		break;
+	}
+
+	git_object_free(obj);
+	return error;
+}
+
+/*
+ * Mark the parents and the tree of each commit with its islands. The
+ * walk returns every child of a commit before it, so its islands are
+ * all known by the time it comes up.
+ */
+static int mark_commits(
+	git_delta_islands *islands,
+	git_repository *repo,
+	git_revwalk *walk,
+	island_trees *trees)
+{
+	git_commit *commit;
+	island_marks *marks;
+	git_oid id, *tree;
+	unsigned int i;
+	int error;
+
+	while ((error = git_revwalk_next(&id, walk)) == 0) {
+		if ((marks = get_marks(islands, &id)) == NULL)
+			continue;
+
+		if ((error = git_commit_lookup(&commit, repo, &id)) < 0)
+			return error;
+
+		for (i = 0; i < git_commit_parentcount(commit); i++) {
+			if ((error = add_marks(islands,
+					git_commit_parent_id(commit, i), marks->bits)) < 0)
+				break;
+		}
+
+		if (error >= 0 && (error = add_marks(islands,
+				git_commit_tree_id(commit), marks->bits)) > 0) {
+			if ((tree = git_array_alloc(*trees)) != NULL)
+				git_oid_cpy(tree, git_commit_tree_id(commit));
+			else
+				error = -1;
+		}
+
+		git_commit_free(commit);
+
+		if (error < 0)
+			return error;
+	}
+
+	return error == GIT_ITEROVER ? 0 : error;
+}
+
+/*
+ * Mark the content of a tree with the islands in `bits`, which it was
+ * just added to. A subtree which already was in all of them does not
+ * need to be read again.
+ */
+static int mark_tree(
+	git_delta_islands *islands,
+	git_repository *repo,
+	git_oidmap *wanted,
+	const git_oid *id,
+	const uint32_t *bits)
+{
+	git_tree *tree;
+	const git_tree_entry *entry;
+	const git_oid *entry_id;
+	size_t i;
+	int error = 0;
+
+	if ((error = git_tree_lookup(&tree, repo, id)) < 0)
+		return error;
+
+	for (i = 0; i < git_tree_entrycount(tree) && error >= 0; i++) {
+		entry = git_tree_entry_byindex(tree, i);
+		entry_id = git_tree_entry_id(entry);
+
+		switch (git_tree_entry_type(entry)) {
+		case GIT_OBJ_TREE:
+			if ((error = add_marks(islands, entry_id, bits)) > 0)
+				error = mark_tree(islands, repo, wanted, entry_id, bits);
+			break;
+		case GIT_OBJ_BLOB:
+			if (git_oidmap_valid_index(wanted,
+					git_oidmap_lookup_index(wanted, entry_id)))
+				error = add_marks(islands, entry_id, bits);
+			break;
+		default:
+			/* it's a submodule, which is in no pack */
+			break;
+		}
+	}
+
+	git_tree_free(tree);
+	return error < 0 ? error : 0;
+}
+
+static void clear_marks(git_delta_islands *islands)
+{
+	git_oidmap_clear(islands->marks);
+	git_pool_clear(&islands->pool);
+	git_vector_free_deep(&islands->names);
+	islands->nr_words = 0;
+}
+
+int git_delta_islands_load(
+	git_delta_islands *islands, git_repository *repo, git_oidmap *wanted)
+{
+	island_tips tips = GIT_ARRAY_INIT;
+	island_trees trees = GIT_ARRAY_INIT;
+	git_revwalk *walk = NULL;
+	island_marks *marks;
+	uint32_t *bits = NULL;
+	size_t i;
+	int error;
+
+	assert(islands && repo && wanted);
+
+	clear_marks(islands);
+
+	if ((error = load_tips(&tips, islands, repo)) < 0 || !tips.size)
+		goto done;
+
+	islands->nr_words = (islands->names.length + 31) / 32;
+
+	if ((error = git_pool_init(&islands->pool, (uint32_t)(sizeof(island_marks) +
+			islands->nr_words * sizeof(uint32_t)), 0)) < 0)
+		goto done;
+
+	if ((bits = git__calloc(islands->nr_words, sizeof(uint32_t))) == NULL) {
+		error = -1;
+		goto done;
+	}
+
+	if ((error = git_revwalk_new(&walk, repo)) < 0)
+		goto done;
+
+	git_revwalk_sorting(walk, GIT_SORT_TOPOLOGICAL);
+
+	for (i = 0; i < tips.size; i++) {
+		if ((error = mark_tip(islands, repo, walk, &trees, bits,
+				git_array_get(tips, i))) < 0)
+			goto done;
+	}
+
+	if ((error = mark_commits(islands, repo, walk, &trees)) < 0)
+		goto done;
+
+	for (i = 0; i < trees.size; i++) {
+		const git_oid *id = git_array_get(trees, i);
+
+		marks = get_marks(islands, id);
+		assert(marks);
+
+		if ((error = mark_tree(islands, repo, wanted, id, marks->bits)) < 0)
+			goto done;
+	}
+
+done:
+	if (error < 0)
+		clear_marks(islands);
+
+	git_revwalk_free(walk);
+	git_array_clear(tips);
+	git_array_clear(trees);
+	git__free(bits);
+	return error;
+}
+
+const uint32_t *git_delta_islands_get(
+	git_delta_islands *islands, const git_oid *id)
+{
+	island_marks *marks;
+
+	if (!islands->nr_words || (marks = get_marks(islands, id)) == NULL)
+		return NULL;
+
+	return marks->bits;
+}
+
+bool git_delta_islands_allow(
+	git_delta_islands *islands, const uint32_t *trg, const uint32_t *src)
+{
+	size_t i;
+
+	if (!trg)
+		return true;
+
+	if (!src)
+		return false;
+
+	for (i = 0; i < islands->nr_words; i++) {
+		if (trg[i] & ~src[i])
+			return false;
+	}
+
+	return true;
+}
+
+void git_delta_islands_free(git_delta_islands *islands)
+{
+	regex_t *regex;
+	size_t i;
+
+	if (!islands)
+		return;
+
+	git_vector_foreach(&islands->patterns, i, regex) {
+		regfree(regex);
+		git__free(regex);
+	}
+
+	git_vector_free(&islands->patterns);
+	clear_marks(islands);
+	git_oidmap_free(islands->marks);
+	git__free(islands);
+}
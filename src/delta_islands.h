@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_delta_islands_h__
+#define INCLUDE_delta_islands_h__
+
+#include "common.h"
+#include "oidmap.h"
+
+/*
+ * Delta islands keep the deltas of a pack within groups of refs, like
+ * the forks of a project stored in a single repository. Each ref whose
+ * name matches one of the patterns belongs to an island, named by what
+ * the capture groups of the pattern matched, and so does every object
+ * it reaches. An object is then only stored as a delta against a base
+ * which is in every island it is in, so that a pack served to a fork
+ * never needs a base the fork does not have.
+ */
+
+typedef struct git_delta_islands git_delta_islands;
+
+extern int git_delta_islands_new(git_delta_islands **out);
+
+/* Add an extended regular expression to match ref names against. */
+extern int git_delta_islands_add(
+	git_delta_islands *islands, const char *pattern);
+
+/*
+ * Find the islands of the objects reachable from the refs of `repo`.
+ * Only the blobs in `wanted` are marked, as no delta is searched for
+ * the others.
+ */
+extern int git_delta_islands_load(
+	git_delta_islands *islands, git_repository *repo, git_oidmap *wanted);
+
+/* The islands an object is in, or NULL if no island ref reaches it. */
+extern const uint32_t *git_delta_islands_get(
+	git_delta_islands *islands, const git_oid *id);
+
+/*
+ * Whether an object in the islands `trg` may be stored as a delta
+ * against one in `src`. Objects no island ref reaches, which nobody
+ * fetches on their own, can be stored against anything.
+ */
+extern bool git_delta_islands_allow(
+	git_delta_islands *islands, const uint32_t *trg, const uint32_t *src);
+
+extern void git_delta_islands_free(git_delta_islands *islands);
+
+#endif
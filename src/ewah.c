@@ -0,0 +1,305 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "ewah.h"
+
+/*
+ * EWAH ("Enhanced Word-Aligned Hybrid") compresses a bitmap into a
+ * sequence of 64-bit words. Each "running length word" (RLW) describes
+ * a run of words that are all zeros or all ones, followed by a number
+ * of literal words that are copied verbatim:
+ *
+ *     bit 0         the value of the bits in the run
+ *     bits 1..32    the number of words in the run
+ *     bits 33..63   the number of literal words that follow the RLW
+ *
+ * The serialization used by git is the size of the bitmap in bits, the
+ * number of words, the words themselves and the position of the last
+ * RLW, all in network byte order.
+ */
+
+#define RLW_RUNNING_BITS 32
+#define RLW_LITERAL_BITS 31
+#define RLW_LARGEST_RUNNING_COUNT (((uint64_t)1 << RLW_RUNNING_BITS) - 1)
+#define RLW_LARGEST_LITERAL_COUNT (((uint64_t)1 << RLW_LITERAL_BITS) - 1)
+
+#define RLW_RUNNING_BIT(w) ((w) & 1)
+#define RLW_RUNNING_LEN(w) (((w) >> 1) & RLW_LARGEST_RUNNING_COUNT)
+#define RLW_LITERAL_WORDS(w) ((w) >> (1 + RLW_RUNNING_BITS))
+
+static int bitmap_grow(git_bitmap *bitmap, size_t words)
+{
+	uint64_t *new_words;
+	size_t new_alloc;
+
+	if (words <= bitmap->word_alloc)
+		return 0;
+
+	new_alloc = bitmap->word_alloc ? bitmap->word_alloc : 8;
+	while (new_alloc < words) {
+		GITERR_CHECK_ALLOC_MULTIPLY(&new_alloc, new_alloc, 2);
+	}
+
+	new_words = git__reallocarray(bitmap->words, new_alloc, sizeof(uint64_t));
+	GITERR_CHECK_ALLOC(new_words);
+
+	memset(new_words + bitmap->word_alloc, 0,
+		(new_alloc - bitmap->word_alloc) * sizeof(uint64_t));
+
+	bitmap->words = new_words;
+	bitmap->word_alloc = new_alloc;
+	return 0;
+}
+
+int git_bitmap_set(git_bitmap *bitmap, size_t pos)
+{
+	size_t block = pos / GIT_BITMAP_WORD_BITS;
+
+	if (block >= bitmap->word_alloc && bitmap_grow(bitmap, block + 1) < 0)
+		return -1;
+
+	bitmap->words[block] |= (uint64_t)1 << (pos % GIT_BITMAP_WORD_BITS);
+	return 0;
+}
+
+int git_bitmap_or(git_bitmap *bitmap, const git_bitmap *other)
+{
+	size_t i;
+
+	if (bitmap_grow(bitmap, other->word_alloc) < 0)
+		return -1;
+
+	for (i = 0; i < other->word_alloc; i++)
+		bitmap->words[i] |= other->words[i];
+
+	return 0;
+}
+
+int git_bitmap_xor(git_bitmap *bitmap, const git_bitmap *other)
+{
+	size_t i;
+
+	if (bitmap_grow(bitmap, other->word_alloc) < 0)
+		return -1;
+
+	for (i = 0; i < other->word_alloc; i++)
+		bitmap->words[i] ^= other->words[i];
+
+	return 0;
+}
+
+void git_bitmap_and_not(git_bitmap *bitmap, const git_bitmap *other)
+{
+	size_t i, count = min(bitmap->word_alloc, other->word_alloc);
+
+	for (i = 0; i < count; i++)
+		bitmap->words[i] &= ~other->words[i];
+}
+
+static size_t popcount64(uint64_t word)
+{
+	word = word - ((word >> 1) & 0x5555555555555555ULL);
+	word = (word & 0x3333333333333333ULL) + ((word >> 2) & 0x3333333333333333ULL);
+	word = (word + (word >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+	return (size_t)((word * 0x0101010101010101ULL) >> 56);
+}
+
+size_t git_bitmap_popcount(const git_bitmap *bitmap)
+{
+	size_t i, count = 0;
+
+	for (i = 0; i < bitmap->word_alloc; i++)
+		count += popcount64(bitmap->words[i]);
+
+	return count;
+}
+
+bool git_bitmap_next(size_t *out, const git_bitmap *bitmap, size_t pos)
+{
+	size_t block = pos / GIT_BITMAP_WORD_BITS;
+	uint64_t word;
+
+	if (block >= bitmap->word_alloc)
+		return false;
+
+	/* ignore the bits before `pos` in its word */
+	word = bitmap->words[block] & (~(uint64_t)0 << (pos % GIT_BITMAP_WORD_BITS));
+
+	while (!word) {
+		if (++block >= bitmap->word_alloc)
+			return false;
+		word = bitmap->words[block];
+	}
+
+	/* the lowest bit set of the word, `word & -word` isolates it */
+	*out = block * GIT_BITMAP_WORD_BITS + popcount64((word & (~word + 1)) - 1);
+	return true;
+}
+
+void git_bitmap_free(git_bitmap *bitmap)
+{
+	if (!bitmap)
+		return;
+
+	git__free(bitmap->words);
+	bitmap->words = NULL;
+	bitmap->word_alloc = 0;
+}
+
+static uint32_t ewah_get_be32(const unsigned char *data)
+{
+	return ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) |
+		((uint32_t)data[2] << 8) | (uint32_t)data[3];
+}
+
+static uint64_t ewah_get_be64(const unsigned char *data)
+{
+	return ((uint64_t)ewah_get_be32(data) << 32) | ewah_get_be32(data + 4);
+}
+
+static int ewah_error(const char *message)
+{
+	giterr_set(GITERR_ODB, "Invalid EWAH bitmap - %s", message);
+	return -1;
+}
+
+int git_ewah_read(
+	git_bitmap *out, const unsigned char *data, size_t len, size_t *read_len)
+{
+	git_bitmap bitmap = GIT_BITMAP_INIT;
+	const unsigned char *words;
+	size_t bit_size, buffer_size, pos = 0, out_pos = 0, total;
+	uint64_t i;
+
+	if (len < 8)
+		return ewah_error("truncated header");
+
+	bit_size = ewah_get_be32(data);
+	buffer_size = ewah_get_be32(data + 4);
+	words = data + 8;
+
+	if (GIT_MULTIPLY_SIZET_OVERFLOW(&total, buffer_size, 8) ||
+		GIT_ADD_SIZET_OVERFLOW(&total, total, 8 + 4) ||
+		total > len)
+		return ewah_error("truncated bitmap");
+
+	if (bitmap_grow(&bitmap, (bit_size + GIT_BITMAP_WORD_BITS - 1) / GIT_BITMAP_WORD_BITS) < 0)
+		return -1;
+
+	while (pos < buffer_size) {
+		uint64_t rlw = ewah_get_be64(words + pos * 8);
+		uint64_t run_len = RLW_RUNNING_LEN(rlw);
+		uint64_t literals = RLW_LITERAL_WORDS(rlw);
+
+		pos++;
+
+		if (literals > buffer_size - pos) {
+			git_bitmap_free(&bitmap);
+			return ewah_error("literal words extend beyond the bitmap");
+		}
+
+		if (bitmap_grow(&bitmap, out_pos + (size_t)run_len + (size_t)literals) < 0) {
+			git_bitmap_free(&bitmap);
+			return -1;
+		}
+
+		if (RLW_RUNNING_BIT(rlw)) {
+			for (i = 0; i < run_len; i++)
+				bitmap.words[out_pos + i] = ~(uint64_t)0;
+		}
+		out_pos += (size_t)run_len;
+
+		for (i = 0; i < literals; i++, pos++)
+			bitmap.words[out_pos++] = ewah_get_be64(words + pos * 8);
+	}
+
+	*out = bitmap;
+	if (read_len)
+		*read_len = total;
+
+	return 0;
+}
+
+static int ewah_put_be32(git_buf *out, uint32_t value)
+{
+	value = htonl(value);
+	return git_buf_put(out, (const char *)&value, sizeof(value));
+}
+
+static void ewah_set_be64(unsigned char *data, uint64_t value)
+{
+	uint32_t hi = htonl((uint32_t)(value >> 32)), lo = htonl((uint32_t)value);
+
+	memcpy(data, &hi, 4);
+	memcpy(data + 4, &lo, 4);
+}
+
+int git_ewah_write(git_buf *out, const git_bitmap *bitmap)
+{
+	git_buf words = GIT_BUF_INIT;
+	size_t nwords = bitmap->word_alloc, pos = 0, buffer_size = 0, last_rlw = 0;
+	unsigned char word[8];
+	int error = 0;
+
+	/* trailing empty words do not need to be stored */
+	while (nwords > 0 && bitmap->words[nwords - 1] == 0)
+		nwords--;
+
+	do {
+		uint64_t run_bit = 0, run_len = 0, literals = 0;
+		size_t literal_start;
+
+		if (pos < nwords &&
+			(bitmap->words[pos] == 0 || bitmap->words[pos] == ~(uint64_t)0)) {
+			uint64_t run_word = bitmap->words[pos];
+
+			run_bit = run_word ? 1 : 0;
+			while (pos < nwords && bitmap->words[pos] == run_word &&
+				run_len < RLW_LARGEST_RUNNING_COUNT) {
+				run_len++;
+				pos++;
+			}
+		}
+
+		literal_start = pos;
+		while (pos < nwords && bitmap->words[pos] != 0 &&
+			bitmap->words[pos] != ~(uint64_t)0 &&
+			literals < RLW_LARGEST_LITERAL_COUNT) {
+			literals++;
+			pos++;
+		}
+
+		last_rlw = buffer_size;
+		ewah_set_be64(word, run_bit | (run_len << 1) | (literals << (1 + RLW_RUNNING_BITS)));
+		git_buf_put(&words, (const char *)word, sizeof(word));
+		buffer_size++;
+
+		for (; literal_start < pos; literal_start++) {
+			ewah_set_be64(word, bitmap->words[literal_start]);
+			git_buf_put(&words, (const char *)word, sizeof(word));
+			buffer_size++;
+		}
+	} while (pos < nwords);
+
+	if (git_buf_oom(&words) ||
+		!git__is_uint32(nwords * GIT_BITMAP_WORD_BITS) ||
+		!git__is_uint32(buffer_size)) {
+		error = -1;
+		goto done;
+	}
+
+	if ((error = ewah_put_be32(out, (uint32_t)(nwords * GIT_BITMAP_WORD_BITS))) < 0 ||
+		(error = ewah_put_be32(out, (uint32_t)buffer_size)) < 0 ||
+		(error = git_buf_put(out, words.ptr, words.size)) < 0)
+		goto done;
+
+	error = ewah_put_be32(out, (uint32_t)last_rlw);
+
+done:
+	git_buf_free(&words);
+	return error;
+}
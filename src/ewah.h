@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_ewah_h__
+#define INCLUDE_ewah_h__
+
+#include "common.h"
+#include "buffer.h"
+
+/*
+ * An uncompressed, growable bit vector. Reachability bitmaps are stored
+ * on disk compressed with EWAH (see below) and are expanded into these
+ * to operate on them.
+ */
+typedef struct {
+	uint64_t *words;
+	size_t word_alloc;
+} git_bitmap;
+
+#define GIT_BITMAP_INIT { NULL, 0 }
+
+#define GIT_BITMAP_WORD_BITS 64
+
+GIT_INLINE(bool) git_bitmap_get(const git_bitmap *bitmap, size_t pos)
+{
+	size_t block = pos / GIT_BITMAP_WORD_BITS;
+
+	return block < bitmap->word_alloc &&
+		(bitmap->words[block] & ((uint64_t)1 << (pos % GIT_BITMAP_WORD_BITS))) != 0;
+}
+
+extern int git_bitmap_set(git_bitmap *bitmap, size_t pos);
+extern int git_bitmap_or(git_bitmap *bitmap, const git_bitmap *other);
+extern int git_bitmap_xor(git_bitmap *bitmap, const git_bitmap *other);
+extern void git_bitmap_and_not(git_bitmap *bitmap, const git_bitmap *other);
+extern size_t git_bitmap_popcount(const git_bitmap *bitmap);
+extern void git_bitmap_free(git_bitmap *bitmap);
+
+/*
+ * Find the first bit set at or after `pos`. Returns false when there is
+ * none, which allows iterating over the set bits with
+ *
+ *     for (pos = 0; git_bitmap_next(&pos, bitmap, pos); pos++)
+ */
+extern bool git_bitmap_next(size_t *out, const git_bitmap *bitmap, size_t pos);
+
+/*
+ * Read an EWAH-compressed bitmap as serialized by git into `out`. On
+ * success `read_len` is the number of bytes of `data` that were used.
+ */
+extern int git_ewah_read(
+	git_bitmap *out, const unsigned char *data, size_t len, size_t *read_len);
+
+/* Append the EWAH-compressed serialization of `bitmap` to `out`. */
+extern int git_ewah_write(git_buf *out, const git_bitmap *bitmap);
+
+#endif
@@ -6,6 +6,7 @@
  */
 #include "common.h"
 #include "global.h"
+#include "delta.h"
 #include "hash.h"
 #include "sysdir.h"
 #include "git2/global.h"
@@ -17,6 +18,8 @@
 #endif
 
 git_mutex git__mwindow_mutex;
+git_mutex git__pack_cache_mutex;
+git_mutex git__delta_index_cache_mutex;
 
 #define MAX_SHUTDOWN_CB 8
 
@@ -207,11 +210,14 @@ static int synchronized_threads_init(void)
 	int error;
 
 	_tls_index = TlsAlloc();
-	if (git_mutex_init(&git__mwindow_mutex))
+	if (git_mutex_init(&git__mwindow_mutex) ||
+		git_mutex_init(&git__pack_cache_mutex) ||
+		git_mutex_init(&git__delta_index_cache_mutex))
 		return -1;
 
 	/* Initialize any other subsystems that have global state */
-	if ((error = git_hash_global_init()) >= 0)
+	if ((error = git_hash_global_init()) >= 0 &&
+		(error = git_delta_global_init()) >= 0)
 		error = git_sysdir_global_init();
 
 	win32_pthread_initialize();
@@ -252,6 +258,8 @@ static void synchronized_threads_shutdown(void)
 
 	TlsFree(_tls_index);
 	git_mutex_free(&git__mwindow_mutex);
+	git_mutex_free(&git__pack_cache_mutex);
+	git_mutex_free(&git__delta_index_cache_mutex);
 }
 
 int git_libgit2_shutdown(void)
@@ -326,13 +334,16 @@ static void cb__free_status(void *st)
 
 static void init_once(void)
 {
-	if ((init_error = git_mutex_init(&git__mwindow_mutex)) != 0)
+	if ((init_error = git_mutex_init(&git__mwindow_mutex)) != 0 ||
+		(init_error = git_mutex_init(&git__pack_cache_mutex)) != 0 ||
+		(init_error = git_mutex_init(&git__delta_index_cache_mutex)) != 0)
 		return;
 	pthread_key_create(&_tls_key, &cb__free_status);
 
 
 	/* Initialize any other subsystems that have global state */
-	if ((init_error = git_hash_global_init()) >= 0)
+	if ((init_error = git_hash_global_init()) >= 0 &&
+		(init_error = git_delta_global_init()) >= 0)
 		init_error = git_sysdir_global_init();
 
 	/* OpenSSL needs to be initialized from the main thread */
@@ -372,6 +383,8 @@ int git_libgit2_shutdown(void)
 
 	pthread_key_delete(_tls_key);
 	git_mutex_free(&git__mwindow_mutex);
+	git_mutex_free(&git__pack_cache_mutex);
+	git_mutex_free(&git__delta_index_cache_mutex);
 	_once_init = new_once;
 
 	return 0;
@@ -402,6 +415,12 @@ static git_global_st __state;
 int git_libgit2_init(void)
 {
 	static int ssl_inited = 0;
+	int error;
+
+	/* Initialize any other subsystems that have global state */
+	if ((error = git_hash_global_init()) < 0 ||
+		(error = git_delta_global_init()) < 0)
+		return error;
 
 	if (!ssl_inited) {
 		init_ssl();
@@ -41,7 +41,7 @@ static int mark_parents(git_revwalk *walk, git_commit_list_node *one,
 		return 0;
 	}
 
-	if (git_pqueue_init(&list, 0, 2, git_commit_list_time_cmp) < 0)
+	if (git_pqueue_init(&list, 0, 2, git_commit_list_generation_cmp) < 0)
 		return -1;
 
 	if (git_commit_list_parse(walk, one) < 0)
@@ -174,19 +174,51 @@ on_error:
 
 int git_graph_descendant_of(git_repository *repo, const git_oid *commit, const git_oid *ancestor)
 {
-	git_oid merge_base;
+	git_revwalk *walk;
+	git_commit_list_node *commit_node, *ancestor_node;
+	git_commit_list *result = NULL;
+	git_vector list;
+	void *contents[1];
 	int error;
 
 	if (git_oid_equal(commit, ancestor))
 		return 0;
 
-	error = git_merge_base(&merge_base, repo, commit, ancestor);
-	/* No merge-base found, it's not a descendant */
-	if (error == GIT_ENOTFOUND)
-		return 0;
-
-	if (error < 0)
+	if ((error = git_revwalk_new(&walk, repo)) < 0)
 		return error;
 
-	return git_oid_equal(&merge_base, ancestor);
+	if ((commit_node = git_revwalk__commit_lookup(walk, commit)) == NULL ||
+		(ancestor_node = git_revwalk__commit_lookup(walk, ancestor)) == NULL) {
+		error = -1;
+		goto done;
+	}
+
+	if ((error = git_commit_list_parse(walk, commit_node)) < 0 ||
+		(error = git_commit_list_parse(walk, ancestor_node)) < 0)
+		goto done;
+
+	/* An ancestor always has a lower generation number than its descendants */
+	if (ancestor_node->generation > commit_node->generation)
+		goto done;
+
+	/* This is just one value, so we can do it on the stack */
+	memset(&list, 0x0, sizeof(git_vector));
+	contents[0] = ancestor_node;
+	list.length = 1;
+	list.contents = contents;
+
+	/*
+	 * Nothing below the ancestor's generation can lead to it, so there is
+	 * no need to walk further than that to know if it was painted.
+	 */
+	if ((error = git_merge__bases_many(&result, walk,
+			commit_node, &list, ancestor_node->generation)) < 0)
+		goto done;
+
+	error = (ancestor_node->flags & PARENT1) != 0;
+
+done:
+	git_commit_list_free(&result);
+	git_revwalk_free(walk);
+	return error;
 }
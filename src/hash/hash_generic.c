@@ -9,6 +9,11 @@
 #include "hash.h"
 #include "hash/hash_generic.h"
 
+#ifdef GIT_SHA1_SHANI
+# include <cpuid.h>
+# include <immintrin.h>
+#endif
+
 #if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
 
 /*
@@ -221,6 +226,126 @@ static void hash__block(git_hash_ctx *ctx, const unsigned int *data)
 	ctx->H[4] += E;
 }
 
+static void hash__blocks_portable(
+	git_hash_ctx *ctx, const unsigned char *data, size_t blocks)
+{
+	for (; blocks; blocks--, data += 64)
+		hash__block(ctx, (const unsigned int *)data);
+}
+
+#ifdef GIT_SHA1_SHANI
+
+/*
+ * The SHA extensions of x86 CPUs do four rounds of SHA-1 and compute
+ * four words of its message schedule per instruction. The message
+ * words are kept in four registers, which are rotated through.
+ */
+
+#define SHANI_SCHEDULE(w0, w1, w2, w3) \
+	w0 = _mm_sha1msg2_epu32( \
+		_mm_xor_si128(_mm_sha1msg1_epu32(w0, w1), w2), w3)
+
+#define SHANI_ROUNDS(f, e, e_next, w) do { \
+	e = _mm_sha1nexte_epu32(e, w); \
+	e_next = abcd; \
+	abcd = _mm_sha1rnds4_epu32(abcd, e, f); } while (0)
+
+#define SHANI_LOAD(w, n) \
+	w = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + (n) * 16)), mask)
+
+__attribute__((target("sha,ssse3,sse4.1")))
+static void hash__blocks_shani(
+	git_hash_ctx *ctx, const unsigned char *data, size_t blocks)
+{
+	const __m128i mask = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+	__m128i abcd, abcd_save, e0, e0_save, e1, w0, w1, w2, w3;
+
+	/* A is kept in the highest lane, and E in the highest lane of e0 */
+	abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)ctx->H), 0x1b);
+	e0 = _mm_set_epi32((int)ctx->H[4], 0, 0, 0);
+
+	for (; blocks; blocks--, data += 64) {
+		abcd_save = abcd;
+		e0_save = e0;
+
+		/* rounds 0-15 take their input from the block */
+		SHANI_LOAD(w0, 0);
+		e0 = _mm_add_epi32(e0, w0);
+		e1 = abcd;
+		abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+
+		SHANI_LOAD(w1, 1);
+		SHANI_ROUNDS(0, e1, e0, w1);
+		SHANI_LOAD(w2, 2);
+		SHANI_ROUNDS(0, e0, e1, w2);
+		SHANI_LOAD(w3, 3);
+		SHANI_ROUNDS(0, e1, e0, w3);
+
+		/* rounds 16-79 from the message schedule */
+		SHANI_SCHEDULE(w0, w1, w2, w3); SHANI_ROUNDS(0, e0, e1, w0);
+		SHANI_SCHEDULE(w1, w2, w3, w0); SHANI_ROUNDS(1, e1, e0, w1);
+		SHANI_SCHEDULE(w2, w3, w0, w1); SHANI_ROUNDS(1, e0, e1, w2);
+		SHANI_SCHEDULE(w3, w0, w1, w2); SHANI_ROUNDS(1, e1, e0, w3);
+
+		SHANI_SCHEDULE(w0, w1, w2, w3); SHANI_ROUNDS(1, e0, e1, w0);
+		SHANI_SCHEDULE(w1, w2, w3, w0); SHANI_ROUNDS(1, e1, e0, w1);
+		SHANI_SCHEDULE(w2, w3, w0, w1); SHANI_ROUNDS(2, e0, e1, w2);
+		SHANI_SCHEDULE(w3, w0, w1, w2); SHANI_ROUNDS(2, e1, e0, w3);
+
+		SHANI_SCHEDULE(w0, w1, w2, w3); SHANI_ROUNDS(2, e0, e1, w0);
+		SHANI_SCHEDULE(w1, w2, w3, w0); SHANI_ROUNDS(2, e1, e0, w1);
+		SHANI_SCHEDULE(w2, w3, w0, w1); SHANI_ROUNDS(2, e0, e1, w2);
+		SHANI_SCHEDULE(w3, w0, w1, w2); SHANI_ROUNDS(3, e1, e0, w3);
+
+		SHANI_SCHEDULE(w0, w1, w2, w3); SHANI_ROUNDS(3, e0, e1, w0);
+		SHANI_SCHEDULE(w1, w2, w3, w0); SHANI_ROUNDS(3, e1, e0, w1);
+		SHANI_SCHEDULE(w2, w3, w0, w1); SHANI_ROUNDS(3, e0, e1, w2);
+		SHANI_SCHEDULE(w3, w0, w1, w2); SHANI_ROUNDS(3, e1, e0, w3);
+
+		e0 = _mm_sha1nexte_epu32(e0, e0_save);
+		abcd = _mm_add_epi32(abcd, abcd_save);
+	}
+
+	_mm_storeu_si128((__m128i *)ctx->H, _mm_shuffle_epi32(abcd, 0x1b));
+	ctx->H[4] = (unsigned int)_mm_extract_epi32(e0, 3);
+}
+
+static bool hash__cpu_has_shani(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+
+	/* SSSE3 and SSE4.1 are needed around the SHA instructions */
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) ||
+		!(ecx & bit_SSSE3) || !(ecx & bit_SSE4_1))
+		return false;
+
+	return __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) &&
+		(ebx & bit_SHA);
+}
+
+#endif
+
+static void (*hash__blocks)(git_hash_ctx *, const unsigned char *, size_t) =
+	hash__blocks_portable;
+
+#ifdef GIT_SHA1_SHANI
+bool git_hash__shani(bool enabled)
+{
+	hash__blocks = (enabled && hash__cpu_has_shani()) ?
+		hash__blocks_shani : hash__blocks_portable;
+
+	return (hash__blocks == hash__blocks_shani);
+}
+#endif
+
+int git_hash_global_init(void)
+{
+#ifdef GIT_SHA1_SHANI
+	git_hash__shani(true);
+#endif
+	return 0;
+}
+
 int git_hash_init(git_hash_ctx *ctx)
 {
 	ctx->size = 0;
@@ -252,12 +377,12 @@ int git_hash_update(git_hash_ctx *ctx, const void *data, size_t len)
 		data = ((const char *)data + left);
 		if (lenW)
 			return 0;
-		hash__block(ctx, ctx->W);
+		hash__blocks(ctx, (const unsigned char *)ctx->W, 1);
 	}
-	while (len >= 64) {
-		hash__block(ctx, data);
-		data = ((const char *)data + 64);
-		len -= 64;
+	if (len >= 64) {
+		hash__blocks(ctx, data, len / 64);
+		data = ((const char *)data + (len & ~(size_t)63));
+		len &= 63;
 	}
 	if (len)
 		memcpy(ctx->W, data, len);
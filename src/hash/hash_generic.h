@@ -16,7 +16,14 @@ struct git_hash_ctx {
 	unsigned int W[16];
 };
 
-#define git_hash_global_init() 0
+#ifdef GIT_SHA1_SHANI
+/*
+ * Hash with the SHA instructions of the CPU, if it has them, or with
+ * the portable code. Returns whether the SHA instructions are used.
+ */
+extern bool git_hash__shani(bool enabled);
+#endif
+
 #define git_hash_ctx_init(ctx) git_hash_init(ctx)
 #define git_hash_ctx_cleanup(ctx)
 
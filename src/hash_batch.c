@@ -0,0 +1,323 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "hash_batch.h"
+
+#include "hash.h"
+#include "odb.h"
+#include "git2/object.h"
+
+/* The least amount of data that is worth a thread of its own */
+#define HASH_BATCH_THREAD_BYTES (256 * 1024)
+
+void git_hash_batch_init(git_hash_batch *batch, unsigned int nr_threads)
+{
+	memset(batch, 0x0, sizeof(*batch));
+
+	git_buf_init(&batch->data, 0);
+	batch->nr_threads = nr_threads;
+}
+
+int git_hash_batch_new(git_hash_batch *batch, git_otype type)
+{
+	git_hash_batch_object *obj;
+
+	if (!git_object_typeisloose(type)) {
+		giterr_set(GITERR_INVALID, "invalid object type for hashing");
+		return -1;
+	}
+
+	obj = git_array_alloc(batch->objects);
+	GITERR_CHECK_ALLOC(obj);
+
+	memset(obj, 0x0, sizeof(*obj));
+	obj->type = type;
+	obj->offset = batch->data.size;
+	return 0;
+}
+
+int git_hash_batch_put(git_hash_batch *batch, const void *data, size_t len)
+{
+	git_hash_batch_object *obj = git_array_last(batch->objects);
+
+	assert(obj);
+
+	if (git_buf_put(&batch->data, data, len) < 0)
+		return -1;
+
+	obj->len += len;
+	return 0;
+}
+
+int git_hash_batch_add(
+	git_hash_batch *batch, const void *data, size_t len, git_otype type)
+{
+	int error;
+
+	if ((error = git_hash_batch_new(batch, type)) < 0 ||
+		(error = git_hash_batch_put(batch, data, len)) < 0)
+		return error;
+
+	return 0;
+}
+
+static int hash_objects(git_hash_batch *batch, size_t start, size_t end)
+{
+	git_hash_ctx ctx;
+	git_hash_batch_object *obj;
+	char header[64];
+	size_t hdrlen;
+	int error = 0;
+
+	if ((error = git_hash_ctx_init(&ctx)) < 0)
+		return error;
+
+	for (; start < end && !error; start++) {
+		obj = git_array_get(batch->objects, start);
+		hdrlen = git_odb__format_object_header(header, sizeof(header),
+			obj->len, obj->type);
+
+		if ((error = git_hash_init(&ctx)) < 0 ||
+			(error = git_hash_update(&ctx, header, hdrlen)) < 0 ||
+			(error = git_hash_update(&ctx, batch->data.ptr + obj->offset, obj->len)) < 0)
+			break;
+
+		error = git_hash_final(&obj->id, &ctx);
+	}
+
+	git_hash_ctx_cleanup(&ctx);
+	return error;
+}
+
+#ifdef GIT_THREADS
+
+struct hash_worker {
+	git_thread thread;
+	struct git_hash_batch_pool *pool;
+	git_cond wake;
+	bool busy; /* with a range it has not hashed yet */
+	size_t start, end;
+	git_error_state error;
+};
+
+/*
+ * The threads of a batch, which wait for the ranges of objects of each
+ * run. A worker has a condition of its own to be woken with, since
+ * condition variables cannot be broadcast to everywhere.
+ */
+struct git_hash_batch_pool {
+	git_hash_batch *batch;
+	git_mutex lock;
+	git_cond done;
+	unsigned int pending; /* workers still hashing the current run */
+	unsigned int nr_workers, max_workers;
+	bool shutdown;
+	struct hash_worker workers[GIT_FLEX_ARRAY];
+};
+
+static void *hash_worker_thread(void *arg)
+{
+	struct hash_worker *worker = arg;
+	struct git_hash_batch_pool *pool = worker->pool;
+	int error;
+
+	git_mutex_lock(&pool->lock);
+
+	while (1) {
+		while (!pool->shutdown && !worker->busy)
+			git_cond_wait(&worker->wake, &pool->lock);
+
+		if (pool->shutdown)
+			break;
+
+		git_mutex_unlock(&pool->lock);
+
+		/* the error message is ours, so hand it to the calling thread */
+		error = hash_objects(pool->batch, worker->start, worker->end);
+		giterr_state_capture(&worker->error, error);
+
+		git_mutex_lock(&pool->lock);
+		worker->busy = false;
+
+		if (--pool->pending == 0)
+			git_cond_signal(&pool->done);
+	}
+
+	git_mutex_unlock(&pool->lock);
+	return NULL;
+}
+
+static int pool_init(git_hash_batch *batch, unsigned int max_workers)
+{
+	struct git_hash_batch_pool *pool;
+	size_t alloclen;
+
+	GITERR_CHECK_ALLOC_MULTIPLY(&alloclen, max_workers, sizeof(struct hash_worker));
+	GITERR_CHECK_ALLOC_ADD(&alloclen, alloclen, sizeof(struct git_hash_batch_pool));
+	pool = git__calloc(1, alloclen);
+	GITERR_CHECK_ALLOC(pool);
+
+	pool->batch = batch;
+	pool->max_workers = max_workers;
+	git_mutex_init(&pool->lock);
+	git_cond_init(&pool->done);
+
+	batch->pool = pool;
+	return 0;
+}
+
+/* Start workers until there are `nr_workers`, or as many as we can */
+static void pool_grow(struct git_hash_batch_pool *pool, unsigned int nr_workers)
+{
+	struct hash_worker *worker;
+
+	nr_workers = min(nr_workers, pool->max_workers);
+
+	for (; pool->nr_workers < nr_workers; pool->nr_workers++) {
+		worker = &pool->workers[pool->nr_workers];
+		worker->pool = pool;
+		git_cond_init(&worker->wake);
+
+		if (git_thread_create(&worker->thread, NULL,
+				hash_worker_thread, worker) != 0) {
+			git_cond_free(&worker->wake);
+			pool->max_workers = pool->nr_workers;
+			break;
+		}
+	}
+}
+
+static void pool_free(struct git_hash_batch_pool *pool)
+{
+	unsigned int i;
+
+	if (!pool)
+		return;
+
+	git_mutex_lock(&pool->lock);
+	pool->shutdown = true;
+	for (i = 0; i < pool->nr_workers; i++)
+		git_cond_signal(&pool->workers[i].wake);
+	git_mutex_unlock(&pool->lock);
+
+	for (i = 0; i < pool->nr_workers; i++) {
+		git_thread_join(&pool->workers[i].thread, NULL);
+		git_cond_free(&pool->workers[i].wake);
+	}
+
+	git_cond_free(&pool->done);
+	git_mutex_free(&pool->lock);
+	git__free(pool);
+}
+
+/*
+ * Give each thread a contiguous range of objects with about the same
+ * amount of data; the calling thread hashes the first one, and the
+ * workers of the batch's pool the others.
+ */
+static int hash_threaded(
+	git_hash_batch *batch, unsigned int nr_threads, unsigned int max_threads)
+{
+	struct git_hash_batch_pool *pool;
+	struct hash_worker *worker;
+	size_t count = git_array_size(batch->objects);
+	size_t share, start, first_end = 0, i = 0, bytes = 0;
+	unsigned int n;
+	int error;
+
+	if (!batch->pool && (error = pool_init(batch, max_threads - 1)) < 0)
+		return error;
+
+	pool = batch->pool;
+	pool_grow(pool, nr_threads - 1);
+
+	/* whatever could not get a thread is hashed here */
+	if (!pool->nr_workers)
+		return hash_objects(batch, 0, count);
+
+	nr_threads = min(nr_threads, pool->nr_workers + 1);
+	share = batch->data.size / nr_threads;
+
+	for (n = 0; n < nr_threads; n++) {
+		start = i;
+
+		for (; i < count && (n + 1 == nr_threads || bytes < share * (n + 1)); i++)
+			bytes += git_array_get(batch->objects, i)->len;
+
+		if (n == 0) {
+			first_end = i;
+		} else {
+			pool->workers[n - 1].start = start;
+			pool->workers[n - 1].end = i;
+		}
+	}
+
+	git_mutex_lock(&pool->lock);
+	pool->pending = nr_threads - 1;
+	for (n = 0; n < nr_threads - 1; n++) {
+		pool->workers[n].busy = true;
+		git_cond_signal(&pool->workers[n].wake);
+	}
+	git_mutex_unlock(&pool->lock);
+
+	error = hash_objects(batch, 0, first_end);
+
+	git_mutex_lock(&pool->lock);
+	while (pool->pending > 0)
+		git_cond_wait(&pool->done, &pool->lock);
+	git_mutex_unlock(&pool->lock);
+
+	for (n = 0; n < nr_threads - 1; n++) {
+		worker = &pool->workers[n];
+
+		if (!error && worker->error.error_code < 0) {
+			error = worker->error.error_code;
+			giterr_state_restore(&worker->error);
+		} else {
+			giterr_state_free(&worker->error);
+		}
+	}
+
+	return error;
+}
+
+#endif
+
+int git_hash_batch_run(git_hash_batch *batch)
+{
+	size_t count = git_array_size(batch->objects);
+#ifdef GIT_THREADS
+	size_t max_threads = batch->nr_threads ?
+		batch->nr_threads : (size_t)git_online_cpus();
+	size_t nr_threads = max_threads;
+
+	nr_threads = min(nr_threads, batch->data.size / HASH_BATCH_THREAD_BYTES);
+	nr_threads = min(nr_threads, count);
+
+	if (nr_threads > 1)
+		return hash_threaded(batch,
+			(unsigned int)nr_threads, (unsigned int)max_threads);
+#endif
+
+	return hash_objects(batch, 0, count);
+}
+
+void git_hash_batch_clear(git_hash_batch *batch)
+{
+	git_buf_clear(&batch->data);
+	batch->objects.size = 0;
+}
+
+void git_hash_batch_free(git_hash_batch *batch)
+{
+#ifdef GIT_THREADS
+	pool_free(batch->pool);
+	batch->pool = NULL;
+#endif
+	git_buf_free(&batch->data);
+	git_array_clear(batch->objects);
+}
@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_hash_batch_h__
+#define INCLUDE_hash_batch_h__
+
+#include "common.h"
+#include "array.h"
+#include "buffer.h"
+#include "git2/oid.h"
+
+/*
+ * A batch of objects to compute the ids of. Hashing a stream of small
+ * objects one at a time is serial work; a batch collects them and then
+ * hashes them all at once, split over several threads when there is
+ * enough data to keep them busy.
+ *
+ * The data of each object is copied into the batch, so callers can
+ * reuse their buffers as soon as they have added it.
+ */
+
+typedef struct {
+	git_otype type;
+	size_t offset; /* of the data in the batch's buffer */
+	size_t len;
+	git_oid id;
+} git_hash_batch_object;
+
+typedef struct {
+	git_buf data;
+	git_array_t(git_hash_batch_object) objects;
+	unsigned int nr_threads;
+#ifdef GIT_THREADS
+	struct git_hash_batch_pool *pool;
+#endif
+} git_hash_batch;
+
+/*
+ * Initialize a batch, which will hash on up to `nr_threads` threads, or
+ * on as many threads as there are CPUs if it is 0. The threads are
+ * started when a run first needs them, and then wait for the next runs
+ * until the batch is freed.
+ */
+extern void git_hash_batch_init(git_hash_batch *batch, unsigned int nr_threads);
+
+/*
+ * Start a new object, whose data is then added with `git_hash_batch_put`.
+ */
+extern int git_hash_batch_new(git_hash_batch *batch, git_otype type);
+
+/* Add data to the object started last */
+extern int git_hash_batch_put(git_hash_batch *batch, const void *data, size_t len);
+
+/* Add a whole object */
+extern int git_hash_batch_add(
+	git_hash_batch *batch, const void *data, size_t len, git_otype type);
+
+/*
+ * Compute the id of every object in the batch. Afterwards, the `id`
+ * of each entry of `batch->objects` is set.
+ */
+extern int git_hash_batch_run(git_hash_batch *batch);
+
+/* Forget the objects in the batch, but keep its memory for reuse */
+extern void git_hash_batch_clear(git_hash_batch *batch);
+
+extern void git_hash_batch_free(git_hash_batch *batch);
+
+GIT_INLINE(size_t) git_hash_batch_count(const git_hash_batch *batch)
+{
+	return git_array_size(batch->objects);
+}
+
+/* The amount of object data in the batch */
+GIT_INLINE(size_t) git_hash_batch_size(const git_hash_batch *batch)
+{
+	return batch->data.size;
+}
+
+#endif
@@ -17,36 +17,64 @@
 #include "oid.h"
 #include "oidmap.h"
 #include "zstream.h"
+#include "delta-apply.h"
+#include "array.h"
+#include "hash_batch.h"
 
 GIT__USE_OIDMAP
+GIT__USE_OFFMAP
 
 extern git_mutex git__mwindow_mutex;
 
 #define UINT31_MAX (0x7FFFFFFF)
 
+/*
+ * With more than one thread, the ids of the small whole objects are
+ * computed in batches, which spreads the hashing over the threads.
+ */
+#define INDEXER_BATCH_OBJECT_MAX (64 * 1024)
+#define INDEXER_BATCH_BYTES (4 * 1024 * 1024)
+
 struct entry {
 	git_oid oid;
 	uint32_t crc;
 	uint32_t offset;
 	uint64_t offset_long;
+	uint64_t info; /* type and size, for the `.objinfo` file */
+};
+
+struct batched_entry {
+	git_off_t start, end;
 };
 
 struct git_indexer {
 	unsigned int parsed_header :1,
 		opened_pack :1,
 		have_stream :1,
-		have_delta :1;
+		have_delta :1,
+		eager_deltas :1,
+		write_objinfo :1,
+		batching :1;
 	struct git_pack_header hdr;
 	struct git_pack_file *pack;
 	unsigned int mode;
 	git_off_t off;
 	git_off_t entry_start;
+	git_otype entry_type;
+	size_t entry_size;
+	git_off_t delta_base;
 	git_packfile_stream stream;
 	size_t nr_objects;
+	unsigned int nr_threads;
 	git_vector objects;
 	git_vector deltas;
+	/* the offsets of the objects we know the id of, for eager resolution */
+	git_offmap *resolved;
 	unsigned int fanout[256];
 	git_hash_ctx hash_ctx;
+	/* objects waiting for their id, and where they are in the pack */
+	git_hash_batch batch;
+	git_array_t(struct batched_entry) batched;
 	git_oid hash;
 	git_transfer_progress_cb progress_cb;
 	void *progress_payload;
@@ -122,8 +150,10 @@ int git_indexer_new(
 	idx->progress_cb = progress_cb;
 	idx->progress_payload = progress_payload;
 	idx->mode = mode ? mode : GIT_PACK_FILE_MODE;
+	idx->nr_threads = 1; /* do not spawn any thread by default */
 	git_hash_ctx_init(&idx->hash_ctx);
 	git_hash_ctx_init(&idx->trailer);
+	git_hash_batch_init(&idx->batch, idx->nr_threads);
 
 	error = git_buf_joinpath(&path, prefix, suff);
 	if (error < 0)
@@ -157,6 +187,42 @@ cleanup:
 	return -1;
 }
 
+unsigned int git_indexer_set_threads(git_indexer *idx, unsigned int n)
+{
+	assert(idx);
+
+#ifdef GIT_THREADS
+	idx->nr_threads = n;
+	idx->batch.nr_threads = n;
+#else
+	GIT_UNUSED(n);
+	assert(1 == idx->nr_threads);
+#endif
+
+	return idx->nr_threads;
+}
+
+int git_indexer_set_eager_deltas(git_indexer *idx, int enabled)
+{
+	assert(idx);
+
+	if (enabled && !idx->resolved) {
+		idx->resolved = git_offmap_alloc();
+		GITERR_CHECK_ALLOC(idx->resolved);
+	}
+
+	idx->eager_deltas = !!enabled;
+	return 0;
+}
+
+int git_indexer_set_objinfo(git_indexer *idx, int enabled)
+{
+	assert(idx);
+
+	idx->write_objinfo = !!enabled;
+	return 0;
+}
+
 /* Try to store the delta so we can try to resolve it later */
 static int store_delta(git_indexer *idx)
 {
@@ -200,6 +266,25 @@ static int hash_object_stream(git_indexer*idx, git_packfile_stream *stream)
 	return 0;
 }
 
+/* Copy the inflated object into the batch, to be hashed later on */
+static int batch_object_stream(git_indexer *idx, git_packfile_stream *stream)
+{
+	ssize_t read;
+
+	do {
+		if ((read = git_packfile_stream_read(stream, idx->objbuf, sizeof(idx->objbuf))) < 0)
+			break;
+
+		if (git_hash_batch_put(&idx->batch, idx->objbuf, read) < 0)
+			return -1;
+	} while (read > 0);
+
+	if (read < 0)
+		return (int)read;
+
+	return 0;
+}
+
 /* In order to create the packfile stream, we need to skip over the delta base description */
 static int advance_delta_offset(git_indexer *idx, git_otype type)
 {
@@ -209,11 +294,14 @@ static int advance_delta_offset(git_indexer *idx, git_otype type)
 
 	if (type == GIT_OBJ_REF_DELTA) {
 		idx->off += GIT_OID_RAWSZ;
+		idx->delta_base = 0;
 	} else {
 		git_off_t base_off = get_delta_base(idx->pack, &w, &idx->off, type, idx->entry_start);
 		git_mwindow_close(&w);
 		if (base_off < 0)
 			return (int)base_off;
+
+		idx->delta_base = base_off;
 	}
 
 	return 0;
@@ -260,15 +348,35 @@ static int crc_object(uint32_t *crc_out, git_mwindow_file *mwf, git_off_t start,
 	return 0;
 }
 
-static int store_object(git_indexer *idx)
+static int mark_resolved(git_indexer *idx, git_off_t offset)
+{
+	int error;
+
+	if (!idx->eager_deltas)
+		return 0;
+
+	git_offmap_insert(idx->resolved, offset, NULL, error);
+	if (error < 0) {
+		giterr_set_oom();
+		return -1;
+	}
+
+	return 0;
+}
+
+static int store_object(
+	git_indexer *idx,
+	const git_oid *oid,
+	git_off_t entry_start,
+	git_off_t entry_end,
+	git_otype type,
+	size_t size)
 {
 	int i, error;
 	khiter_t k;
-	git_oid oid;
 	struct entry *entry;
 	git_off_t entry_size;
 	struct git_pack_entry *pentry;
-	git_off_t entry_start = idx->entry_start;
 
 	entry = git__calloc(1, sizeof(*entry));
 	GITERR_CHECK_ALLOC(entry);
@@ -276,8 +384,7 @@ static int store_object(git_indexer *idx)
 	pentry = git__calloc(1, sizeof(struct git_pack_entry));
 	GITERR_CHECK_ALLOC(pentry);
 
-	git_hash_final(&oid, &idx->hash_ctx);
-	entry_size = idx->off - entry_start;
+	entry_size = entry_end - entry_start;
 	if (entry_start > UINT31_MAX) {
 		entry->offset = UINT32_MAX;
 		entry->offset_long = entry_start;
@@ -285,7 +392,7 @@ static int store_object(git_indexer *idx)
 		entry->offset = (uint32_t)entry_start;
 	}
 
-	git_oid_cpy(&pentry->sha1, &oid);
+	git_oid_cpy(&pentry->sha1, oid);
 	pentry->offset = entry_start;
 
 	k = kh_put(oid, idx->pack->idx_cache, &pentry->sha1, &error);
@@ -304,7 +411,8 @@ static int store_object(git_indexer *idx)
 
 	kh_value(idx->pack->idx_cache, k) = pentry;
 
-	git_oid_cpy(&entry->oid, &oid);
+	git_oid_cpy(&entry->oid, oid);
+	entry->info = git_pack_objinfo__entry(type, size);
 
 	if (crc_object(&entry->crc, &idx->pack->mwf, entry_start, entry_size) < 0)
 		goto on_error;
@@ -313,11 +421,11 @@ static int store_object(git_indexer *idx)
 	if (git_vector_insert(&idx->objects, entry) < 0)
 		goto on_error;
 
-	for (i = oid.id[0]; i < 256; ++i) {
+	for (i = oid->id[0]; i < 256; ++i) {
 		idx->fanout[i]++;
 	}
 
-	return 0;
+	return mark_resolved(idx, entry_start);
 
 on_error:
 	git__free(entry);
@@ -325,6 +433,66 @@ on_error:
 	return -1;
 }
 
+/* Store the object whose data was just hashed as it was read */
+static int store_streamed_object(git_indexer *idx)
+{
+	git_oid oid;
+
+	git_hash_final(&oid, &idx->hash_ctx);
+
+	return store_object(idx, &oid, idx->entry_start, idx->off,
+		idx->entry_type, idx->entry_size);
+}
+
+/* Remember where the object whose data was just batched is in the pack */
+static int batch_object(git_indexer *idx)
+{
+	struct batched_entry *batched = git_array_alloc(idx->batched);
+	GITERR_CHECK_ALLOC(batched);
+
+	batched->start = idx->entry_start;
+	batched->end = idx->off;
+	return 0;
+}
+
+GIT_INLINE(bool) in_batch(git_indexer *idx, git_off_t offset)
+{
+	struct batched_entry *first = git_array_get(idx->batched, 0);
+
+	return (first && offset >= first->start);
+}
+
+/* Hash the batched objects and store them */
+static int flush_batch(git_indexer *idx, git_transfer_progress *stats)
+{
+	git_hash_batch_object *obj;
+	struct batched_entry *batched;
+	size_t i;
+	int error;
+
+	if (!git_hash_batch_count(&idx->batch))
+		return 0;
+
+	if ((error = git_hash_batch_run(&idx->batch)) < 0)
+		goto done;
+
+	for (i = 0; i < git_hash_batch_count(&idx->batch); i++) {
+		obj = git_array_get(idx->batch.objects, i);
+		batched = git_array_get(idx->batched, i);
+
+		if ((error = store_object(idx, &obj->id, batched->start,
+				batched->end, obj->type, obj->len)) < 0)
+			goto done;
+
+		stats->indexed_objects++;
+	}
+
+done:
+	git_hash_batch_clear(&idx->batch);
+	idx->batched.size = 0;
+	return error;
+}
+
 GIT_INLINE(bool) has_entry(git_indexer *idx, git_oid *id)
 {
 	khiter_t k;
@@ -385,6 +553,7 @@ static int hash_and_save(git_indexer *idx, git_rawobj *obj, git_off_t entry_star
 
 	git_oid_cpy(&pentry->sha1, &oid);
 	git_oid_cpy(&entry->oid, &oid);
+	entry->info = git_pack_objinfo__entry(obj->type, obj->len);
 	entry->crc = crc32(0L, Z_NULL, 0);
 
 	entry_size = (size_t)(idx->off - entry_start);
@@ -397,9 +566,36 @@ on_error:
 	git__free(pentry);
 	git__free(entry);
 	git__free(obj->data);
+	obj->data = NULL;
 	return -1;
 }
 
+/*
+ * Resolve an offset delta right away when we already know its base,
+ * which lets most of the work happen while the pack is still arriving.
+ * Returns GIT_PASSTHROUGH when the delta has to wait for the commit.
+ */
+static int resolve_delta_eagerly(git_indexer *idx)
+{
+	git_rawobj obj = {NULL};
+	git_off_t curpos = idx->entry_start;
+
+	if (!idx->eager_deltas || !idx->delta_base ||
+	    !git_offmap_exists(idx->resolved, idx->delta_base))
+		return GIT_PASSTHROUGH;
+
+	if (git_packfile_unpack(&obj, idx->pack, &curpos) < 0 ||
+	    hash_and_save(idx, &obj, idx->entry_start) < 0) {
+		/* the serial pass will report whatever is wrong with it */
+		git__free(obj.data);
+		giterr_clear();
+		return GIT_PASSTHROUGH;
+	}
+
+	git__free(obj.data);
+	return mark_resolved(idx, idx->entry_start);
+}
+
 static int do_progress_callback(git_indexer *idx, git_transfer_progress *stats)
 {
 	if (idx->progress_cb)
@@ -563,6 +759,7 @@ int git_indexer_append(git_indexer *idx, const void *data, size_t size, git_tran
 		size_t entry_size;
 		git_otype type;
 		git_mwindow *w = NULL;
+		bool indexed;
 
 		if (idx->pack->mwf.size <= idx->off + 20)
 			return 0;
@@ -592,7 +789,15 @@ int git_indexer_append(git_indexer *idx, const void *data, size_t size, git_tran
 				idx->have_delta = 1;
 			} else {
 				idx->have_delta = 0;
-				hash_header(&idx->hash_ctx, entry_size, type);
+				idx->entry_type = type;
+				idx->entry_size = entry_size;
+				idx->batching = (idx->nr_threads != 1 &&
+					entry_size <= INDEXER_BATCH_OBJECT_MAX);
+
+				if (!idx->batching)
+					hash_header(&idx->hash_ctx, entry_size, type);
+				else if ((error = git_hash_batch_new(&idx->batch, type)) < 0)
+					goto on_error;
 			}
 
 			idx->have_stream = 1;
@@ -604,6 +809,8 @@ int git_indexer_append(git_indexer *idx, const void *data, size_t size, git_tran
 
 		if (idx->have_delta) {
 			error = read_object_stream(idx, stream);
+		} else if (idx->batching) {
+			error = batch_object_stream(idx, stream);
 		} else {
 			error = hash_object_stream(idx, stream);
 		}
@@ -619,20 +826,39 @@ int git_indexer_append(git_indexer *idx, const void *data, size_t size, git_tran
 		if (error < 0)
 			goto on_error;
 
-		if (idx->have_delta) {
+		/* an eager delta can only be resolved once its base is stored */
+		if (idx->have_delta && idx->eager_deltas && in_batch(idx, idx->delta_base) &&
+		    (error = flush_batch(idx, stats)) < 0)
+			goto on_error;
+
+		indexed = !idx->have_delta && !idx->batching;
+		if (!idx->have_delta) {
+			error = idx->batching ? batch_object(idx) : store_streamed_object(idx);
+		} else if ((error = resolve_delta_eagerly(idx)) == GIT_PASSTHROUGH) {
 			error = store_delta(idx);
-		} else {
-			error = store_object(idx);
+		} else if (!error) {
+			stats->indexed_deltas++;
+			indexed = true;
 		}
 
 		if (error < 0)
 			goto on_error;
 
-		if (!idx->have_delta) {
-			stats->indexed_objects = (unsigned int)++processed;
+		if (idx->have_delta && idx->eager_deltas)
+			stats->total_deltas++;
+
+		if (indexed) {
+			stats->indexed_objects++;
 		}
 		stats->received_objects++;
 
+		if ((git_hash_batch_size(&idx->batch) >= INDEXER_BATCH_BYTES ||
+		     stats->received_objects == idx->nr_objects) &&
+		    (error = flush_batch(idx, stats)) < 0)
+			goto on_error;
+
+		processed = stats->indexed_objects;
+
 		if ((error = do_progress_callback(idx, stats)) != 0)
 			goto on_error;
 	}
@@ -666,6 +892,29 @@ static int index_path(git_buf *path, git_indexer *idx, const char *suffix)
 	return git_buf_oom(path) ? -1 : 0;
 }
 
+static int write_objinfo(git_indexer *idx, git_buf *path, const git_oid *pack_checksum)
+{
+	struct entry *entry;
+	uint64_t *entries;
+	unsigned int i;
+	int error;
+
+	if (index_path(path, idx, GIT_PACK_OBJINFO_EXTENSION) < 0)
+		return -1;
+
+	entries = git__calloc(idx->objects.length ? idx->objects.length : 1, sizeof(uint64_t));
+	GITERR_CHECK_ALLOC(entries);
+
+	git_vector_foreach(&idx->objects, i, entry)
+		entries[i] = entry->info;
+
+	error = git_pack_objinfo__write(path->ptr, entries,
+		(uint32_t)idx->objects.length, pack_checksum, idx->mode);
+
+	git__free(entries);
+	return error;
+}
+
 /**
  * Rewind the packfile by the trailer, as we might need to fix the
  * packfile by injecting objects at the tail and must overwrite it.
@@ -736,6 +985,7 @@ static int inject_object(git_indexer *idx, git_oid *id)
 
 	git_oid_cpy(&pentry->sha1, id);
 	git_oid_cpy(&entry->oid, id);
+	entry->info = git_pack_objinfo__entry(git_odb_object_type(obj), len);
 	idx->off = entry_start + hdr_len + len;
 
 	error = save_entry(idx, entry, pentry, entry_start);
@@ -813,12 +1063,549 @@ static int fix_thin_pack(git_indexer *idx, git_transfer_progress *stats)
 	return 0;
 }
 
+#ifdef GIT_THREADS
+
+/*
+ * Resolving the deltas in parallel: the deltas are arranged in a tree
+ * whose roots are the (already indexed) non-delta objects, and each
+ * worker takes a root and resolves its whole subtree depth-first, so
+ * that every base is inflated once and used for all its children.
+ */
+
+/* How much inflated data each worker may keep around as delta bases */
+#define RESOLVE_CACHE_LIMIT (16 * 1024 * 1024)
+
+struct delta_node {
+	git_off_t offset;       /* of the delta's header */
+	git_off_t data_offset;  /* of the compressed delta data */
+	size_t size;            /* of the inflated delta data */
+	git_otype type;
+	git_off_t base_offset;  /* for GIT_OBJ_OFS_DELTA */
+	git_oid base_id;        /* for GIT_OBJ_REF_DELTA */
+	size_t pos;             /* in idx->deltas */
+};
+
+struct resolve_root {
+	git_off_t offset;
+	git_oid id;
+};
+
+struct resolve_frame {
+	git_rawobj obj;           /* the data is dropped when over the budget */
+	git_oid id;
+	git_off_t offset;
+	struct delta_node *delta; /* NULL for the root */
+	size_t ofs_pos, ofs_end;  /* the children which are still to resolve */
+	size_t ref_pos, ref_end;
+};
+
+struct resolve_context {
+	git_indexer *idx;
+
+	struct delta_node *nodes;
+	size_t nr_nodes;
+	struct delta_node **by_base_offset;
+	size_t nr_ofs;
+	struct delta_node **by_base_id;
+	size_t nr_ref;
+
+	struct resolve_root *roots;
+	size_t nr_roots;
+
+	/* protected by `lock` */
+	size_t next_root;
+	size_t resolved;
+	unsigned int active;
+	bool cancelled;
+
+	git_mutex lock;
+	git_cond cond;
+};
+
+static int delta_node_offset_cmp(const void *a, const void *b, void *payload)
+{
+	const struct delta_node *na = *(const struct delta_node **)a;
+	const struct delta_node *nb = *(const struct delta_node **)b;
+	GIT_UNUSED(payload);
+
+	if (na->base_offset != nb->base_offset)
+		return na->base_offset < nb->base_offset ? -1 : 1;
+	return na->offset < nb->offset ? -1 : na->offset > nb->offset;
+}
+
+static int delta_node_id_cmp(const void *a, const void *b, void *payload)
+{
+	const struct delta_node *na = *(const struct delta_node **)a;
+	const struct delta_node *nb = *(const struct delta_node **)b;
+	int cmp;
+	GIT_UNUSED(payload);
+
+	if ((cmp = git_oid__cmp(&na->base_id, &nb->base_id)) != 0)
+		return cmp;
+	return na->offset < nb->offset ? -1 : na->offset > nb->offset;
+}
+
+static void find_ofs_children(
+	size_t *start, size_t *end, struct resolve_context *ctx, git_off_t offset)
+{
+	size_t lo = 0, hi = ctx->nr_ofs;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (ctx->by_base_offset[mid]->base_offset < offset)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	*start = *end = lo;
+	while (*end < ctx->nr_ofs && ctx->by_base_offset[*end]->base_offset == offset)
+		(*end)++;
+}
+
+static void find_ref_children(
+	size_t *start, size_t *end, struct resolve_context *ctx, const git_oid *id)
+{
+	size_t lo = 0, hi = ctx->nr_ref;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (git_oid__cmp(&ctx->by_base_id[mid]->base_id, id) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	*start = *end = lo;
+	while (*end < ctx->nr_ref && !git_oid__cmp(&ctx->by_base_id[*end]->base_id, id))
+		(*end)++;
+}
+
+static void init_frame(
+	struct resolve_frame *frame, struct resolve_context *ctx,
+	git_off_t offset, const git_oid *id, struct delta_node *delta)
+{
+	memset(frame, 0, sizeof(*frame));
+	frame->offset = offset;
+	frame->delta = delta;
+	git_oid_cpy(&frame->id, id);
+
+	find_ofs_children(&frame->ofs_pos, &frame->ofs_end, ctx, offset);
+	find_ref_children(&frame->ref_pos, &frame->ref_end, ctx, id);
+}
+
+static int parse_delta_node(struct delta_node *node, struct git_pack_file *pack)
+{
+	git_mwindow *w = NULL;
+	git_off_t curpos = node->offset;
+	unsigned char *base_info;
+	unsigned int left;
+	int error;
+
+	if ((error = git_packfile_unpack_header(&node->size, &node->type,
+			&pack->mwf, &w, &curpos)) < 0)
+		return error;
+
+	if (node->type == GIT_OBJ_OFS_DELTA) {
+		node->base_offset = get_delta_base(pack, &w, &curpos,
+			node->type, node->offset);
+		error = node->base_offset > 0 ? 0 : -1;
+	} else if (node->type == GIT_OBJ_REF_DELTA) {
+		git_mwindow_close(&w);
+		base_info = git_mwindow_open(&pack->mwf, &w, curpos, GIT_OID_RAWSZ, &left);
+		if (base_info == NULL || left < GIT_OID_RAWSZ) {
+			error = -1;
+		} else {
+			git_oid_fromraw(&node->base_id, base_info);
+			curpos += GIT_OID_RAWSZ;
+		}
+	} else {
+		error = -1;
+	}
+
+	git_mwindow_close(&w);
+	node->data_offset = curpos;
+	return error;
+}
+
+/* Inflate the delta and apply it to `base`; `end` is where its data ends */
+static int apply_delta_node(
+	git_rawobj *out, git_off_t *end, git_indexer *idx,
+	const git_rawobj *base, const struct delta_node *node)
+{
+	git_rawobj delta = {NULL};
+	git_mwindow *w = NULL;
+	git_off_t curpos = node->data_offset;
+	int error;
+
+	error = packfile_unpack_compressed(&delta, idx->pack, &w, &curpos,
+		node->size, node->type);
+	git_mwindow_close(&w);
+	if (error < 0)
+		return error;
+
+	error = git__delta_apply(out, base->data, base->len, delta.data, delta.len);
+	git__free(delta.data);
+	if (error < 0)
+		return error;
+
+	out->type = base->type;
+	if (end)
+		*end = curpos;
+	return 0;
+}
+
+static int unpack_root(git_rawobj *out, git_indexer *idx, git_off_t offset)
+{
+	git_mwindow *w = NULL;
+	git_off_t curpos = offset;
+	git_otype type;
+	size_t size;
+	int error;
+
+	if ((error = git_packfile_unpack_header(&size, &type,
+			&idx->pack->mwf, &w, &curpos)) == 0) {
+		if (type == GIT_OBJ_OFS_DELTA || type == GIT_OBJ_REF_DELTA)
+			error = -1;
+		else
+			error = packfile_unpack_compressed(out, idx->pack, &w,
+				&curpos, size, type);
+	}
+
+	git_mwindow_close(&w);
+	return error;
+}
+
+/* Inflate again the data of the frame at `pos` from the nearest base we still have */
+static int rebuild_frame(git_indexer *idx, struct resolve_frame *frames, size_t pos)
+{
+	git_rawobj base, obj;
+	bool owned = false;
+	size_t i = pos;
+	int error;
+
+	while (frames[i].obj.data == NULL)
+		i--;
+
+	base = frames[i].obj;
+	for (++i; i <= pos; i++) {
+		error = apply_delta_node(&obj, NULL, idx, &base, frames[i].delta);
+		if (owned)
+			git__free(base.data);
+		if (error < 0)
+			return error;
+
+		base = obj;
+		owned = true;
+	}
+
+	frames[pos].obj = base;
+	return 0;
+}
+
+static int resolve_node(
+	git_oid *id_out,
+	git_rawobj *out,
+	struct resolve_context *ctx,
+	const git_rawobj *base,
+	struct delta_node *node)
+{
+	git_indexer *idx = ctx->idx;
+	struct entry *entry = NULL;
+	struct git_pack_entry *pentry = NULL;
+	git_off_t end;
+	int error = -1;
+
+	if (apply_delta_node(out, &end, idx, base, node) < 0)
+		return -1;
+
+	if ((entry = git__calloc(1, sizeof(*entry))) == NULL ||
+	    (pentry = git__calloc(1, sizeof(*pentry))) == NULL)
+		goto on_error;
+
+	if (git_odb__hashobj(&entry->oid, out) < 0 ||
+	    crc_object(&entry->crc, &idx->pack->mwf, node->offset, end - node->offset) < 0)
+		goto on_error;
+
+	git_oid_cpy(&pentry->sha1, &entry->oid);
+	git_oid_cpy(id_out, &entry->oid);
+	entry->info = git_pack_objinfo__entry(out->type, out->len);
+
+	git_mutex_lock(&ctx->lock);
+	if (ctx->cancelled || has_entry(idx, &entry->oid)) {
+		/* a duplicate is for the serial pass to report */
+		error = -1;
+	} else if ((error = save_entry(idx, entry, pentry, node->offset)) < 0) {
+		/* the pack's cache may own it already */
+		pentry = NULL;
+	} else {
+		git__free(git_vector_get(&idx->deltas, node->pos));
+		git_vector_set(NULL, &idx->deltas, node->pos, NULL);
+		ctx->resolved++;
+		git_cond_signal(&ctx->cond);
+	}
+	git_mutex_unlock(&ctx->lock);
+
+	if (!error)
+		return 0;
+
+on_error:
+	git__free(entry);
+	git__free(pentry);
+	git__free(out->data);
+	return -1;
+}
+
+static void resolve_tree(struct resolve_context *ctx, const struct resolve_root *root)
+{
+	git_array_t(struct resolve_frame) stack = GIT_ARRAY_INIT;
+	struct resolve_frame *frame, *next;
+	struct delta_node *child;
+	size_t cached, depth, i;
+	git_rawobj obj;
+	git_oid id;
+
+	if ((frame = git_array_alloc(stack)) == NULL)
+		goto done;
+
+	init_frame(frame, ctx, root->offset, &root->id, NULL);
+	if (unpack_root(&frame->obj, ctx->idx, root->offset) < 0)
+		goto done;
+
+	cached = frame->obj.len;
+
+	while ((frame = git_array_last(stack)) != NULL) {
+		depth = git_array_size(stack) - 1;
+
+		if (frame->ofs_pos < frame->ofs_end) {
+			child = ctx->by_base_offset[frame->ofs_pos++];
+		} else if (frame->ref_pos < frame->ref_end) {
+			child = ctx->by_base_id[frame->ref_pos++];
+		} else {
+			if (frame->obj.data)
+				cached -= frame->obj.len;
+			git__free(frame->obj.data);
+			git_array_pop(stack);
+			continue;
+		}
+
+		if (frame->obj.data == NULL) {
+			if (rebuild_frame(ctx->idx, stack.ptr, depth) < 0)
+				break;
+			cached += frame->obj.len;
+		}
+
+		/* the subtree of a delta we cannot resolve is left to the serial pass */
+		if (resolve_node(&id, &obj, ctx, &frame->obj, child) < 0)
+			continue;
+
+		if ((next = git_array_alloc(stack)) == NULL) {
+			git__free(obj.data);
+			break;
+		}
+
+		init_frame(next, ctx, child->offset, &id, child);
+		next->obj = obj;
+		cached += obj.len;
+
+		/* keep the root and the newest object, drop the oldest bases first */
+		for (i = 1; cached > RESOLVE_CACHE_LIMIT && i + 1 < git_array_size(stack); i++) {
+			frame = git_array_get(stack, i);
+			if (frame->obj.data == NULL)
+				continue;
+
+			cached -= frame->obj.len;
+			git__free(frame->obj.data);
+			frame->obj.data = NULL;
+		}
+	}
+
+done:
+	giterr_clear();
+	while ((frame = git_array_pop(stack)) != NULL)
+		git__free(frame->obj.data);
+	git_array_clear(stack);
+}
+
+static void *resolve_deltas_thread(void *arg)
+{
+	struct resolve_context *ctx = arg;
+	struct resolve_root *root;
+
+	for (;;) {
+		git_mutex_lock(&ctx->lock);
+		if (ctx->cancelled || ctx->next_root == ctx->nr_roots)
+			root = NULL;
+		else
+			root = &ctx->roots[ctx->next_root++];
+		git_mutex_unlock(&ctx->lock);
+
+		if (!root)
+			break;
+
+		resolve_tree(ctx, root);
+	}
+
+	git_mutex_lock(&ctx->lock);
+	ctx->active--;
+	git_cond_signal(&ctx->cond);
+	git_mutex_unlock(&ctx->lock);
+
+	return NULL;
+}
+
+static int build_delta_tree(struct resolve_context *ctx, git_indexer *idx)
+{
+	size_t i, len = git_vector_length(&idx->deltas);
+	size_t ofs_start, ofs_end, ref_start, ref_end;
+	struct delta_info *delta;
+	struct delta_node *node;
+	struct entry *entry;
+	git_off_t offset;
+
+	ctx->nodes = git__calloc(len, sizeof(struct delta_node));
+	ctx->by_base_offset = git__calloc(len, sizeof(struct delta_node *));
+	ctx->by_base_id = git__calloc(len, sizeof(struct delta_node *));
+	ctx->roots = git__calloc(git_vector_length(&idx->objects), sizeof(struct resolve_root));
+	if (!ctx->nodes || !ctx->by_base_offset || !ctx->by_base_id || !ctx->roots) {
+		giterr_set_oom();
+		return -1;
+	}
+
+	git_vector_foreach(&idx->deltas, i, delta) {
+		if (!delta)
+			continue;
+
+		node = &ctx->nodes[ctx->nr_nodes];
+		node->offset = delta->delta_off;
+		node->pos = i;
+
+		/* whatever we cannot parse here is for the serial pass to report */
+		if (parse_delta_node(node, idx->pack) < 0) {
+			giterr_clear();
+			continue;
+		}
+
+		ctx->nr_nodes++;
+		if (node->type == GIT_OBJ_OFS_DELTA)
+			ctx->by_base_offset[ctx->nr_ofs++] = node;
+		else
+			ctx->by_base_id[ctx->nr_ref++] = node;
+	}
+
+	git__qsort_r(ctx->by_base_offset, ctx->nr_ofs, sizeof(struct delta_node *),
+		delta_node_offset_cmp, NULL);
+	git__qsort_r(ctx->by_base_id, ctx->nr_ref, sizeof(struct delta_node *),
+		delta_node_id_cmp, NULL);
+
+	git_vector_foreach(&idx->objects, i, entry) {
+		offset = entry->offset == UINT32_MAX ? (git_off_t)entry->offset_long : entry->offset;
+
+		find_ofs_children(&ofs_start, &ofs_end, ctx, offset);
+		find_ref_children(&ref_start, &ref_end, ctx, &entry->oid);
+		if (ofs_start == ofs_end && ref_start == ref_end)
+			continue;
+
+		ctx->roots[ctx->nr_roots].offset = offset;
+		git_oid_cpy(&ctx->roots[ctx->nr_roots].id, &entry->oid);
+		ctx->nr_roots++;
+	}
+
+	return 0;
+}
+
+/*
+ * Resolve as many deltas as we can on `idx->nr_threads` threads. The ones
+ * left over (thin packs, broken data) are for `resolve_deltas` to handle.
+ */
+static int resolve_deltas_threaded(git_indexer *idx, git_transfer_progress *stats)
+{
+	struct resolve_context ctx;
+	git_thread *threads = NULL;
+	unsigned int nr_threads, started = 0, i;
+	size_t reported = 0, n;
+	int error = 0;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.idx = idx;
+
+	if ((error = build_delta_tree(&ctx, idx)) < 0 || !ctx.nr_roots)
+		goto cleanup;
+
+	nr_threads = idx->nr_threads ? idx->nr_threads : (unsigned int)git_online_cpus();
+	if (nr_threads > ctx.nr_roots)
+		nr_threads = (unsigned int)ctx.nr_roots;
+
+	if ((threads = git__calloc(nr_threads, sizeof(git_thread))) == NULL) {
+		error = -1;
+		goto cleanup;
+	}
+
+	git_mutex_init(&ctx.lock);
+	git_cond_init(&ctx.cond);
+
+	ctx.active = nr_threads;
+	for (i = 0; i < nr_threads; i++, started++) {
+		if (git_thread_create(&threads[i], NULL, resolve_deltas_thread, &ctx) != 0) {
+			git_mutex_lock(&ctx.lock);
+			ctx.active -= nr_threads - i;
+			git_mutex_unlock(&ctx.lock);
+			break;
+		}
+	}
+
+	git_mutex_lock(&ctx.lock);
+	while (ctx.active > 0 || reported < ctx.resolved) {
+		if (reported == ctx.resolved) {
+			git_cond_wait(&ctx.cond, &ctx.lock);
+			continue;
+		}
+
+		n = ctx.resolved - reported;
+		reported = ctx.resolved;
+		git_mutex_unlock(&ctx.lock);
+
+		stats->indexed_objects += (unsigned int)n;
+		stats->indexed_deltas += (unsigned int)n;
+		if (!error && (error = do_progress_callback(idx, stats)) < 0) {
+			git_mutex_lock(&ctx.lock);
+			ctx.cancelled = true;
+			git_mutex_unlock(&ctx.lock);
+		}
+
+		git_mutex_lock(&ctx.lock);
+	}
+	git_mutex_unlock(&ctx.lock);
+
+	for (i = 0; i < started; i++)
+		git_thread_join(&threads[i], NULL);
+
+	git_cond_free(&ctx.cond);
+	git_mutex_free(&ctx.lock);
+
+cleanup:
+	git__free(threads);
+	git__free(ctx.roots);
+	git__free(ctx.by_base_id);
+	git__free(ctx.by_base_offset);
+	git__free(ctx.nodes);
+	return error;
+}
+
+#endif
+
 static int resolve_deltas(git_indexer *idx, git_transfer_progress *stats)
 {
 	unsigned int i;
 	struct delta_info *delta;
 	int progressed = 0, non_null = 0, progress_cb_result;
 
+#ifdef GIT_THREADS
+	if (idx->nr_threads != 1 && idx->deltas.length > 0 &&
+	    (progress_cb_result = resolve_deltas_threaded(idx, stats)) < 0)
+		return progress_cb_result;
+#endif
+
 	while (idx->deltas.length > 0) {
 		progressed = 0;
 		non_null = 0;
@@ -914,6 +1701,9 @@ int git_indexer_commit(git_indexer *idx, git_transfer_progress *stats)
 	git_filebuf index_file = {0};
 	void *packfile_trailer;
 
+	if ((error = flush_batch(idx, stats)) < 0)
+		return error;
+
 	if (git_hash_ctx_init(&ctx) < 0)
 		return -1;
 
@@ -939,8 +1729,8 @@ int git_indexer_commit(git_indexer *idx, git_transfer_progress *stats)
 		return -1;
 	}
 
-	/* Freeze the number of deltas */
-	stats->total_deltas = stats->total_objects - stats->indexed_objects;
+	/* Freeze the number of deltas, counting the ones resolved eagerly */
+	stats->total_deltas = stats->total_objects - stats->indexed_objects + stats->indexed_deltas;
 
 	if ((error = resolve_deltas(idx, stats)) < 0)
 		return error;
@@ -1022,6 +1812,10 @@ int git_indexer_commit(git_indexer *idx, git_transfer_progress *stats)
 	if (git_filebuf_write(&index_file, &trailer_hash, GIT_OID_RAWSZ) < 0)
 		goto on_error;
 
+	/* The `.objinfo` file goes first, so it is there as soon as the index is */
+	if (idx->write_objinfo && write_objinfo(idx, &filename, &trailer_hash) < 0)
+		goto on_error;
+
 	/* Write out the hash of the idx */
 	if (git_filebuf_hash(&trailer_hash, &index_file) < 0)
 		goto on_error;
@@ -1080,6 +1874,9 @@ void git_indexer_free(git_indexer *idx)
 
 	git_vector_free_deep(&idx->deltas);
 
+	if (idx->resolved)
+		git_offmap_free(idx->resolved);
+
 	if (!git_mutex_lock(&git__mwindow_mutex)) {
 		git_packfile_free(idx->pack);
 		git_mutex_unlock(&git__mwindow_mutex);
@@ -1087,5 +1884,7 @@ void git_indexer_free(git_indexer *idx)
 
 	git_hash_ctx_cleanup(&idx->trailer);
 	git_hash_ctx_cleanup(&idx->hash_ctx);
+	git_hash_batch_free(&idx->batch);
+	git_array_clear(idx->batched);
 	git__free(idx);
 }
@@ -40,7 +40,15 @@ typedef struct { /* memory mapped buffer	*/
 	assert((prot & GIT_PROT_WRITE) || (prot & GIT_PROT_READ)); \
 	assert((flags & GIT_MAP_FIXED) == 0); } while (0)
 
+/* p_madvise() advice values, the same as git_mwindow_advice_t */
+#define GIT_MADV_NORMAL 0
+#define GIT_MADV_RANDOM 1
+#define GIT_MADV_WILLNEED 2
+
 extern int p_mmap(git_map *out, size_t len, int prot, int flags, int fd, git_off_t offset);
 extern int p_munmap(git_map *map);
 
+/* Only a hint; platforms which cannot follow it ignore it */
+extern int p_madvise(git_map *map, int advice);
+
 #endif /* INCLUDE_map_h__ */
@@ -110,11 +110,19 @@ typedef struct {
 
 } git_merge_diff;
 
+/*
+ * Paint the history of `one` with PARENT1 and of `twos` with PARENT2 and
+ * return their merge bases. The walk stops at the commits whose generation
+ * number is below `minimum_generation`; when it is not 0 the merge bases
+ * may be incomplete and only the flags of the commits at or above that
+ * generation can be relied upon.
+ */
 int git_merge__bases_many(
 	git_commit_list **out,
 	git_revwalk *walk,
 	git_commit_list_node *one,
-	git_vector *twos);
+	git_vector *twos,
+	uint32_t minimum_generation);
 
 /*
  * Three-way tree differencing
@@ -0,0 +1,895 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "midx.h"
+
+#include "buffer.h"
+#include "filebuf.h"
+#include "hash.h"
+#include "odb.h"
+#include "oid.h"
+#include "pack.h"
+#include "path.h"
+#include "sha1_lookup.h"
+
+#define MIDX_SIGNATURE 0x4d494458 /* "MIDX" */
+#define MIDX_VERSION 1
+#define MIDX_OBJECT_ID_VERSION 1 /* SHA-1 */
+
+#define MIDX_PACKFILE_NAMES_ID 0x504e414d	   /* "PNAM" */
+#define MIDX_OID_FANOUT_ID 0x4f494446		   /* "OIDF" */
+#define MIDX_OID_LOOKUP_ID 0x4f49444c		   /* "OIDL" */
+#define MIDX_OBJECT_OFFSETS_ID 0x4f4f4646	   /* "OOFF" */
+#define MIDX_OBJECT_LARGE_OFFSETS_ID 0x4c4f4646 /* "LOFF" */
+
+#define MIDX_LARGE_OFFSET_NEEDED 0x80000000
+
+struct git_midx_header {
+	uint32_t signature;
+	uint8_t version;
+	uint8_t object_id_version;
+	uint8_t chunks;
+	uint8_t base_midx_files;
+	uint32_t packfiles;
+};
+
+struct git_midx_chunk {
+	git_off_t offset;
+	size_t length;
+};
+
+struct git_midx_writer {
+	git_buf pack_dir;
+	git_vector packs;
+};
+
+static int midx_error(const char *message)
+{
+	giterr_set(GITERR_ODB, "Invalid multi-pack-index file - %s", message);
+	return -1;
+}
+
+static uint64_t midx_get_be64(const unsigned char *data)
+{
+	return (((uint64_t)ntohl(*((uint32_t *)(data + 0)))) << 32) |
+		ntohl(*((uint32_t *)(data + 4)));
+}
+
+static int midx_parse_packfile_names(
+		git_midx_file *idx,
+		const unsigned char *data,
+		uint32_t packfiles,
+		struct git_midx_chunk *chunk)
+{
+	int error;
+	uint32_t i;
+	const char *packfile_name = (const char *)(data + chunk->offset);
+	size_t chunk_size = chunk->length, len;
+
+	if (chunk->offset == 0)
+		return midx_error("missing Packfile Names chunk");
+	if (chunk->length == 0)
+		return midx_error("empty Packfile Names chunk");
+
+	for (i = 0; i < packfiles; ++i) {
+		len = p_strnlen(packfile_name, chunk_size);
+		if (len == 0)
+			return midx_error("empty packfile name");
+		if (len + 1 > chunk_size)
+			return midx_error("unterminated packfile name");
+		if (git__suffixcmp(packfile_name, ".idx") != 0)
+			return midx_error("non-.idx packfile name");
+		if (i > 0 &&
+			strcmp(git_vector_get(&idx->packfile_names, i - 1), packfile_name) >= 0)
+			return midx_error("packfile names are not sorted");
+
+		if ((error = git_vector_insert(&idx->packfile_names, (char *)packfile_name)) < 0)
+			return error;
+
+		packfile_name += len + 1;
+		chunk_size -= len + 1;
+	}
+
+	return 0;
+}
+
+static int midx_parse_oid_fanout(
+		git_midx_file *idx,
+		const unsigned char *data,
+		struct git_midx_chunk *chunk_oid_fanout)
+{
+	uint32_t i, nr;
+
+	if (chunk_oid_fanout->offset == 0)
+		return midx_error("missing OID Fanout chunk");
+	if (chunk_oid_fanout->length != 256 * 4)
+		return midx_error("OID Fanout chunk has wrong length");
+
+	idx->oid_fanout = (const uint32_t *)(data + chunk_oid_fanout->offset);
+	nr = 0;
+	for (i = 0; i < 256; ++i) {
+		uint32_t n = ntohl(idx->oid_fanout[i]);
+		if (n < nr)
+			return midx_error("index is non-monotonic");
+		nr = n;
+	}
+	idx->num_objects = nr;
+
+	return 0;
+}
+
+static int midx_parse_oid_lookup(
+		git_midx_file *idx,
+		const unsigned char *data,
+		struct git_midx_chunk *chunk_oid_lookup)
+{
+	uint32_t i;
+	const git_oid *oid, *prev_oid;
+
+	if (chunk_oid_lookup->offset == 0)
+		return midx_error("missing OID Lookup chunk");
+	if (chunk_oid_lookup->length != idx->num_objects * GIT_OID_RAWSZ)
+		return midx_error("OID Lookup chunk has wrong length");
+
+	idx->oid_lookup = oid = (const git_oid *)(data + chunk_oid_lookup->offset);
+	prev_oid = oid++;
+	for (i = 1; i < idx->num_objects; ++i, ++oid, ++prev_oid) {
+		if (git_oid_cmp(prev_oid, oid) >= 0)
+			return midx_error("OID Lookup index is non-monotonic");
+	}
+
+	return 0;
+}
+
+static int midx_parse_object_offsets(
+		git_midx_file *idx,
+		const unsigned char *data,
+		struct git_midx_chunk *chunk_object_offsets)
+{
+	if (chunk_object_offsets->offset == 0)
+		return midx_error("missing Object Offsets chunk");
+	if (chunk_object_offsets->length != idx->num_objects * 8)
+		return midx_error("Object Offsets chunk has wrong length");
+
+	idx->object_offsets = data + chunk_object_offsets->offset;
+
+	return 0;
+}
+
+static int midx_parse_object_large_offsets(
+		git_midx_file *idx,
+		const unsigned char *data,
+		struct git_midx_chunk *chunk_object_large_offsets)
+{
+	if (chunk_object_large_offsets->length == 0)
+		return 0;
+	if (chunk_object_large_offsets->length % 8 != 0)
+		return midx_error("malformed Object Large Offsets chunk");
+
+	idx->object_large_offsets = (const uint64_t *)(data + chunk_object_large_offsets->offset);
+	idx->num_object_large_offsets = chunk_object_large_offsets->length / 8;
+
+	return 0;
+}
+
+int git_midx_parse(
+		git_midx_file *idx,
+		const unsigned char *data,
+		size_t size)
+{
+	struct git_midx_header *hdr;
+	const unsigned char *chunk_hdr;
+	struct git_midx_chunk *last_chunk;
+	uint32_t i;
+	git_off_t last_chunk_offset, chunk_offset, trailer_offset;
+	int error;
+	struct git_midx_chunk chunk_packfile_names = {0},
+					 chunk_oid_fanout = {0},
+					 chunk_oid_lookup = {0},
+					 chunk_object_offsets = {0},
+					 chunk_object_large_offsets = {0};
+
+	assert(idx);
+
+	if (size < sizeof(struct git_midx_header) + GIT_OID_RAWSZ)
+		return midx_error("multi-pack index is too short");
+
+	hdr = ((struct git_midx_header *)data);
+
+	if (hdr->signature != htonl(MIDX_SIGNATURE) ||
+		hdr->version != MIDX_VERSION ||
+		hdr->object_id_version != MIDX_OBJECT_ID_VERSION)
+		return midx_error("unsupported multi-pack index version");
+	if (hdr->chunks == 0)
+		return midx_error("no chunks in multi-pack index");
+	if (hdr->base_midx_files != 0)
+		return midx_error("incremental multi-pack indexes are not supported");
+
+	/*
+	 * The very first chunk's offset should be after the header, all the chunk
+	 * headers, and a special zero chunk.
+	 */
+	last_chunk_offset =
+			sizeof(struct git_midx_header) +
+			(1 + hdr->chunks) * 12;
+	trailer_offset = size - GIT_OID_RAWSZ;
+	if (trailer_offset < last_chunk_offset)
+		return midx_error("wrong index size");
+	git_oid_fromraw(&idx->checksum, data + trailer_offset);
+
+	chunk_hdr = data + sizeof(struct git_midx_header);
+	last_chunk = NULL;
+	for (i = 0; i < hdr->chunks; ++i, chunk_hdr += 12) {
+		chunk_offset = (git_off_t)midx_get_be64(chunk_hdr + 4);
+		if (chunk_offset < last_chunk_offset)
+			return midx_error("chunks are non-monotonic");
+		if (chunk_offset >= trailer_offset)
+			return midx_error("chunks extend beyond the trailer");
+		if (last_chunk != NULL)
+			last_chunk->length = (size_t)(chunk_offset - last_chunk_offset);
+		last_chunk_offset = chunk_offset;
+
+		switch (ntohl(*((uint32_t *)(chunk_hdr + 0)))) {
+		case MIDX_PACKFILE_NAMES_ID:
+			chunk_packfile_names.offset = last_chunk_offset;
+			last_chunk = &chunk_packfile_names;
+			break;
+
+		case MIDX_OID_FANOUT_ID:
+			chunk_oid_fanout.offset = last_chunk_offset;
+			last_chunk = &chunk_oid_fanout;
+			break;
+
+		case MIDX_OID_LOOKUP_ID:
+			chunk_oid_lookup.offset = last_chunk_offset;
+			last_chunk = &chunk_oid_lookup;
+			break;
+
+		case MIDX_OBJECT_OFFSETS_ID:
+			chunk_object_offsets.offset = last_chunk_offset;
+			last_chunk = &chunk_object_offsets;
+			break;
+
+		case MIDX_OBJECT_LARGE_OFFSETS_ID:
+			chunk_object_large_offsets.offset = last_chunk_offset;
+			last_chunk = &chunk_object_large_offsets;
+			break;
+
+		default:
+			/* unknown chunks (e.g. the reverse index) are ignored */
+			last_chunk = NULL;
+			break;
+		}
+	}
+	if (last_chunk != NULL)
+		last_chunk->length = (size_t)(trailer_offset - last_chunk_offset);
+
+	idx->num_packfiles = ntohl(hdr->packfiles);
+
+	if ((error = midx_parse_packfile_names(
+			idx, data, idx->num_packfiles, &chunk_packfile_names)) < 0)
+		return error;
+	if ((error = midx_parse_oid_fanout(idx, data, &chunk_oid_fanout)) < 0)
+		return error;
+	if ((error = midx_parse_oid_lookup(idx, data, &chunk_oid_lookup)) < 0)
+		return error;
+	if ((error = midx_parse_object_offsets(idx, data, &chunk_object_offsets)) < 0)
+		return error;
+	if ((error = midx_parse_object_large_offsets(idx, data, &chunk_object_large_offsets)) < 0)
+		return error;
+
+	return 0;
+}
+
+int git_midx_open(
+		git_midx_file **idx_out,
+		const char *path)
+{
+	git_midx_file *idx;
+	git_file fd = -1;
+	size_t idx_size;
+	struct stat st;
+	int error;
+
+	fd = git_futils_open_ro(path);
+	if (fd < 0)
+		return fd;
+
+	if (p_fstat(fd, &st) < 0) {
+		p_close(fd);
+		giterr_set(GITERR_ODB, "multi-pack-index file not found - '%s'", path);
+		return -1;
+	}
+
+	if (!S_ISREG(st.st_mode) || !git__is_sizet(st.st_size)) {
+		p_close(fd);
+		giterr_set(GITERR_ODB, "invalid pack index '%s'", path);
+		return -1;
+	}
+	idx_size = (size_t)st.st_size;
+
+	idx = git__calloc(1, sizeof(git_midx_file));
+	GITERR_CHECK_ALLOC(idx);
+
+	if ((error = git_vector_init(&idx->packfile_names, 0, NULL)) < 0 ||
+		(idx->filename = git__strdup(path)) == NULL) {
+		p_close(fd);
+		git_midx_free(idx);
+		return -1;
+	}
+
+	error = git_futils_mmap_ro(&idx->index_map, fd, 0, idx_size);
+	p_close(fd);
+	if (error < 0) {
+		git_midx_free(idx);
+		return error;
+	}
+
+	if ((error = git_midx_parse(idx, idx->index_map.data, idx_size)) < 0) {
+		git_midx_free(idx);
+		return error;
+	}
+
+	git_futils_filestamp_set_from_stat(&idx->stamp, &st);
+
+	*idx_out = idx;
+	return 0;
+}
+
+bool git_midx_needs_refresh(
+		const git_midx_file *idx,
+		const char *path)
+{
+	git_futils_filestamp stamp;
+
+	git_futils_filestamp_set(&stamp, &idx->stamp);
+
+	return git_futils_filestamp_check(&stamp, path) != 0;
+}
+
+int git_midx_entry_find(
+		git_midx_entry *e,
+		git_midx_file *idx,
+		const git_oid *short_oid,
+		size_t len)
+{
+	int pos, found = 0;
+	size_t pack_index;
+	uint32_t hi, lo;
+	const git_oid *current = NULL;
+	const unsigned char *object_offset;
+	git_off_t offset;
+
+	assert(idx);
+
+	hi = ntohl(idx->oid_fanout[(int)short_oid->id[0]]);
+	lo = ((short_oid->id[0] == 0x0) ? 0 : ntohl(idx->oid_fanout[(int)short_oid->id[0] - 1]));
+
+	pos = sha1_position(idx->oid_lookup, GIT_OID_RAWSZ, lo, hi, short_oid->id);
+
+	if (pos >= 0) {
+		/* An object matching exactly the oid was found */
+		found = 1;
+		current = idx->oid_lookup + pos;
+	} else {
+		/* No object was found */
+		/* pos refers to the object with the "closest" oid to short_oid */
+		pos = -1 - pos;
+		if (pos < (int)idx->num_objects) {
+			current = idx->oid_lookup + pos;
+
+			if (!git_oid_ncmp(short_oid, current, len))
+				found = 1;
+		}
+	}
+
+	if (found && len != GIT_OID_HEXSZ && pos + 1 < (int)idx->num_objects) {
+		/* Check for ambiguousity */
+		const git_oid *next = current + 1;
+
+		if (!git_oid_ncmp(short_oid, next, len)) {
+			found = 2;
+		}
+	}
+
+	if (!found)
+		return git_odb__error_notfound("failed to find offset for multi-pack index entry", short_oid);
+	if (found > 1)
+		return git_odb__error_ambiguous("found multiple offsets for multi-pack index entry");
+
+	object_offset = idx->object_offsets + pos * 8;
+	offset = ntohl(*((uint32_t *)(object_offset + 4)));
+	if (idx->object_large_offsets && offset & MIDX_LARGE_OFFSET_NEEDED) {
+		uint32_t object_large_offsets_pos = (uint32_t)(offset ^ MIDX_LARGE_OFFSET_NEEDED);
+		const unsigned char *object_large_offsets_index =
+			(const unsigned char *)idx->object_large_offsets;
+
+		/* Make sure we're not being sent out of bounds */
+		if (object_large_offsets_pos >= idx->num_object_large_offsets)
+			return git_odb__error_notfound("invalid index into the object large offsets table", short_oid);
+
+		object_large_offsets_index += 8 * object_large_offsets_pos;
+
+		offset = (git_off_t)midx_get_be64(object_large_offsets_index);
+	}
+	pack_index = ntohl(*((uint32_t *)(object_offset + 0)));
+	if (pack_index >= git_vector_length(&idx->packfile_names))
+		return midx_error("invalid index into the packfile names table");
+
+	e->pack_index = (uint32_t)pack_index;
+	e->offset = offset;
+	git_oid_cpy(&e->sha1, current);
+	return 0;
+}
+
+int git_midx_foreach_entry(
+		git_midx_file *idx,
+		git_odb_foreach_cb cb,
+		void *data)
+{
+	size_t i;
+	int error;
+
+	assert(idx);
+
+	for (i = 0; i < idx->num_objects; ++i) {
+		if ((error = cb(&idx->oid_lookup[i], data)) != 0)
+			return giterr_set_after_callback(error);
+	}
+
+	return 0;
+}
+
+int git_midx_close(git_midx_file *idx)
+{
+	assert(idx);
+
+	if (idx->index_map.data)
+		git_futils_mmap_free(&idx->index_map);
+
+	git_vector_free(&idx->packfile_names);
+
+	return 0;
+}
+
+void git_midx_free(git_midx_file *idx)
+{
+	if (!idx)
+		return;
+
+	git__free(idx->filename);
+	git_midx_close(idx);
+	git__free(idx);
+}
+
+/***********************************************************
+ *
+ * MULTI-PACK-INDEX VERIFICATION
+ *
+ ***********************************************************/
+
+int git_midx_verify(const char *pack_dir)
+{
+	git_midx_file *idx = NULL;
+	git_buf path = GIT_BUF_INIT;
+	git_vector packs = GIT_VECTOR_INIT;
+	struct git_pack_file *p;
+	struct git_pack_entry e;
+	git_midx_entry midx_entry;
+	git_oid checksum;
+	const char *packfile_name;
+	size_t i, pack_dir_len;
+	int error;
+
+	assert(pack_dir);
+
+	if ((error = git_buf_joinpath(&path, pack_dir, GIT_MIDX_FILE)) < 0)
+		return error;
+
+	if (!git_path_exists(path.ptr)) {
+		git_buf_free(&path);
+		return git_odb__error_notfound("no multi-pack-index file", NULL);
+	}
+
+	if ((error = git_midx_open(&idx, path.ptr)) < 0)
+		goto cleanup;
+
+	if ((error = git_hash_buf(&checksum, idx->index_map.data,
+			idx->index_map.len - GIT_OID_RAWSZ)) < 0)
+		goto cleanup;
+
+	if (!git_oid_equal(&checksum, &idx->checksum)) {
+		error = midx_error("index signature mismatch");
+		goto cleanup;
+	}
+
+	if ((error = git_buf_joinpath(&path, pack_dir, "")) < 0)
+		goto cleanup;
+	pack_dir_len = git_buf_len(&path);
+
+	git_vector_foreach(&idx->packfile_names, i, packfile_name) {
+		git_buf_truncate(&path, pack_dir_len);
+		if ((error = git_buf_puts(&path, packfile_name)) < 0 ||
+			(error = git_mwindow_get_pack(&p, path.ptr)) < 0)
+			goto cleanup;
+
+		if ((error = git_vector_insert(&packs, p)) < 0) {
+			git_mwindow_put_pack(p);
+			goto cleanup;
+		}
+	}
+
+	for (i = 0; i < idx->num_objects; ++i) {
+		if ((error = git_midx_entry_find(&midx_entry, idx,
+				&idx->oid_lookup[i], GIT_OID_HEXSZ)) < 0)
+			goto cleanup;
+
+		p = git_vector_get(&packs, midx_entry.pack_index);
+
+		if ((error = git_pack_entry_find(&e, p,
+				&midx_entry.sha1, GIT_OID_HEXSZ)) < 0)
+			goto cleanup;
+
+		if (e.offset != midx_entry.offset) {
+			error = midx_error("object offset does not match its packfile");
+			goto cleanup;
+		}
+	}
+
+cleanup:
+	git_vector_foreach(&packs, i, p)
+		git_mwindow_put_pack(p);
+	git_vector_free(&packs);
+	git_midx_free(idx);
+	git_buf_free(&path);
+
+	return error;
+}
+
+/***********************************************************
+ *
+ * MULTI-PACK-INDEX WRITER
+ *
+ ***********************************************************/
+
+typedef struct {
+	git_oid id;
+	git_off_t offset;
+	uint32_t pack_index;
+	git_time_t pack_mtime;
+} midx_write_entry;
+
+typedef struct {
+	git_vector *entries;
+	uint32_t pack_index;
+	git_time_t pack_mtime;
+} midx_collect_data;
+
+static int packfile__cmp(const void *a_, const void *b_)
+{
+	const struct git_pack_file *a = a_;
+	const struct git_pack_file *b = b_;
+
+	return strcmp(a->pack_name, b->pack_name);
+}
+
+/*
+ * Sort the entries by id and, for objects that are in multiple packfiles,
+ * prefer the one in the most recent packfile, like git does.
+ */
+static int midx_write_entry__cmp(const void *a_, const void *b_)
+{
+	const midx_write_entry *a = a_;
+	const midx_write_entry *b = b_;
+	int cmp;
+
+	if ((cmp = git_oid__cmp(&a->id, &b->id)) != 0)
+		return cmp;
+
+	if (a->pack_mtime != b->pack_mtime)
+		return a->pack_mtime > b->pack_mtime ? -1 : 1;
+
+	return (int)a->pack_index - (int)b->pack_index;
+}
+
+int git_midx_writer_new(
+		git_midx_writer **out,
+		const char *pack_dir)
+{
+	git_midx_writer *w = git__calloc(1, sizeof(git_midx_writer));
+	GITERR_CHECK_ALLOC(w);
+
+	if (git_buf_sets(&w->pack_dir, pack_dir) < 0) {
+		git__free(w);
+		return -1;
+	}
+
+	if (git_vector_init(&w->packs, 0, packfile__cmp) < 0) {
+		git_buf_free(&w->pack_dir);
+		git__free(w);
+		return -1;
+	}
+
+	*out = w;
+	return 0;
+}
+
+void git_midx_writer_free(git_midx_writer *w)
+{
+	struct git_pack_file *p;
+	size_t i;
+
+	if (!w)
+		return;
+
+	git_vector_foreach(&w->packs, i, p)
+		git_mwindow_put_pack(p);
+	git_vector_free(&w->packs);
+	git_buf_free(&w->pack_dir);
+	git__free(w);
+}
+
+int git_midx_writer_add(
+		git_midx_writer *w,
+		const char *idx_path)
+{
+	git_buf idx_path_buf = GIT_BUF_INIT;
+	int error;
+	struct git_pack_file *p;
+
+	assert(w && idx_path);
+
+	if ((error = git_path_join_unrooted(&idx_path_buf, idx_path, w->pack_dir.ptr, NULL)) < 0)
+		return error;
+
+	if (git__suffixcmp(idx_path_buf.ptr, ".idx") != 0) {
+		giterr_set(GITERR_INVALID, "'%s' is not an index file", idx_path_buf.ptr);
+		git_buf_free(&idx_path_buf);
+		return -1;
+	}
+
+	error = git_mwindow_get_pack(&p, git_buf_cstr(&idx_path_buf));
+	git_buf_free(&idx_path_buf);
+	if (error < 0)
+		return error;
+
+	if ((error = git_vector_insert(&w->packs, p)) < 0) {
+		git_mwindow_put_pack(p);
+		return error;
+	}
+
+	return 0;
+}
+
+static int midx_collect_entry(const git_oid *id, git_off_t offset, void *payload)
+{
+	midx_collect_data *data = payload;
+	midx_write_entry *entry;
+
+	entry = git__malloc(sizeof(midx_write_entry));
+	GITERR_CHECK_ALLOC(entry);
+
+	git_oid_cpy(&entry->id, id);
+	entry->offset = offset;
+	entry->pack_index = data->pack_index;
+	entry->pack_mtime = data->pack_mtime;
+
+	return git_vector_insert(data->entries, entry);
+}
+
+static int midx_write_chunk_header(git_buf *out, uint32_t id, git_off_t offset)
+{
+	uint32_t word[3];
+
+	word[0] = htonl(id);
+	word[1] = htonl((uint32_t)((uint64_t)offset >> 32));
+	word[2] = htonl((uint32_t)((uint64_t)offset & 0xffffffff));
+
+	return git_buf_put(out, (const char *)word, sizeof(word));
+}
+
+static int midx_write_be32(git_buf *out, uint32_t value)
+{
+	value = htonl(value);
+	return git_buf_put(out, (const char *)&value, sizeof(value));
+}
+
+static int midx_write_be64(git_buf *out, uint64_t value)
+{
+	int error;
+
+	if ((error = midx_write_be32(out, (uint32_t)(value >> 32))) < 0)
+		return error;
+
+	return midx_write_be32(out, (uint32_t)(value & 0xffffffff));
+}
+
+static int midx_write(git_buf *out, git_midx_writer *w)
+{
+	git_buf packfile_names = GIT_BUF_INIT,
+		oid_fanout = GIT_BUF_INIT,
+		oid_lookup = GIT_BUF_INIT,
+		object_offsets = GIT_BUF_INIT,
+		object_large_offsets = GIT_BUF_INIT;
+	git_vector entries = GIT_VECTOR_INIT;
+	midx_write_entry *entry, *prev = NULL;
+	struct git_pack_file *p;
+	struct git_midx_header hdr = {0};
+	uint32_t fanout[256] = {0}, num_objects = 0, num_large_offsets = 0;
+	git_off_t offset;
+	git_oid checksum;
+	size_t i;
+	int error = 0;
+
+	git_vector_sort(&w->packs);
+	git_vector_uniq(&w->packs, (void (*)(void *))git_mwindow_put_pack);
+
+	if ((error = git_vector_init(&entries, 0, midx_write_entry__cmp)) < 0)
+		return error;
+
+	/* Collect the objects of every packfile */
+	git_vector_foreach(&w->packs, i, p) {
+		const char *basename;
+		size_t basename_len;
+		midx_collect_data data;
+
+		data.entries = &entries;
+		data.pack_index = (uint32_t)i;
+		data.pack_mtime = p->mtime;
+
+		if ((error = git_pack_foreach_entry_offset(p, midx_collect_entry, &data)) < 0)
+			goto cleanup;
+
+		basename = strrchr(p->pack_name, '/');
+		basename = basename ? basename + 1 : p->pack_name;
+		basename_len = strlen(basename) - strlen(".pack");
+
+		git_buf_put(&packfile_names, basename, basename_len);
+		git_buf_puts(&packfile_names, ".idx");
+		git_buf_putc(&packfile_names, '\0');
+	}
+
+	/* Pad the Packfile Names chunk to a multiple of four bytes */
+	while (git_buf_len(&packfile_names) & 3)
+		git_buf_putc(&packfile_names, '\0');
+
+	if (git_buf_oom(&packfile_names)) {
+		error = -1;
+		goto cleanup;
+	}
+
+	git_vector_sort(&entries);
+
+	git_vector_foreach(&entries, i, entry) {
+		if (prev && git_oid_equal(&prev->id, &entry->id))
+			continue;
+		prev = entry;
+
+		fanout[entry->id.id[0]]++;
+		num_objects++;
+
+		git_buf_put(&oid_lookup, (const char *)entry->id.id, GIT_OID_RAWSZ);
+		midx_write_be32(&object_offsets, entry->pack_index);
+
+		if ((uint64_t)entry->offset >= MIDX_LARGE_OFFSET_NEEDED) {
+			midx_write_be32(&object_offsets, MIDX_LARGE_OFFSET_NEEDED | num_large_offsets++);
+			midx_write_be64(&object_large_offsets, (uint64_t)entry->offset);
+		} else {
+			midx_write_be32(&object_offsets, (uint32_t)entry->offset);
+		}
+	}
+
+	for (i = 0; i < 256; ++i) {
+		if (i > 0)
+			fanout[i] += fanout[i - 1];
+		midx_write_be32(&oid_fanout, fanout[i]);
+	}
+
+	if (git_buf_oom(&oid_lookup) || git_buf_oom(&object_offsets) ||
+		git_buf_oom(&object_large_offsets) || git_buf_oom(&oid_fanout)) {
+		error = -1;
+		goto cleanup;
+	}
+
+	assert(fanout[255] == num_objects);
+
+	/* Write the header */
+	hdr.signature = htonl(MIDX_SIGNATURE);
+	hdr.version = MIDX_VERSION;
+	hdr.object_id_version = MIDX_OBJECT_ID_VERSION;
+	hdr.chunks = num_large_offsets ? 5 : 4;
+	hdr.base_midx_files = 0;
+	hdr.packfiles = htonl((uint32_t)git_vector_length(&w->packs));
+
+	if ((error = git_buf_put(out, (const char *)&hdr, sizeof(hdr))) < 0)
+		goto cleanup;
+
+	/* Write the chunk lookup table */
+	offset = sizeof(hdr) + (hdr.chunks + 1) * 12;
+	if ((error = midx_write_chunk_header(out, MIDX_PACKFILE_NAMES_ID, offset)) < 0)
+		goto cleanup;
+	offset += git_buf_len(&packfile_names);
+	if ((error = midx_write_chunk_header(out, MIDX_OID_FANOUT_ID, offset)) < 0)
+		goto cleanup;
+	offset += git_buf_len(&oid_fanout);
+	if ((error = midx_write_chunk_header(out, MIDX_OID_LOOKUP_ID, offset)) < 0)
+		goto cleanup;
+	offset += git_buf_len(&oid_lookup);
+	if ((error = midx_write_chunk_header(out, MIDX_OBJECT_OFFSETS_ID, offset)) < 0)
+		goto cleanup;
+	offset += git_buf_len(&object_offsets);
+	if (num_large_offsets) {
+		if ((error = midx_write_chunk_header(out, MIDX_OBJECT_LARGE_OFFSETS_ID, offset)) < 0)
+			goto cleanup;
+		offset += git_buf_len(&object_large_offsets);
+	}
+	if ((error = midx_write_chunk_header(out, 0, offset)) < 0)
+		goto cleanup;
+
+	/* Write the chunks and the trailing checksum */
+	git_buf_put(out, git_buf_cstr(&packfile_names), git_buf_len(&packfile_names));
+	git_buf_put(out, git_buf_cstr(&oid_fanout), git_buf_len(&oid_fanout));
+	git_buf_put(out, git_buf_cstr(&oid_lookup), git_buf_len(&oid_lookup));
+	git_buf_put(out, git_buf_cstr(&object_offsets), git_buf_len(&object_offsets));
+	git_buf_put(out, git_buf_cstr(&object_large_offsets), git_buf_len(&object_large_offsets));
+
+	if (git_buf_oom(out)) {
+		error = -1;
+		goto cleanup;
+	}
+
+	if ((error = git_hash_buf(&checksum, git_buf_cstr(out), git_buf_len(out))) < 0)
+		goto cleanup;
+
+	error = git_buf_put(out, (const char *)checksum.id, GIT_OID_RAWSZ);
+
+cleanup:
+	git_vector_free_deep(&entries);
+	git_buf_free(&packfile_names);
+	git_buf_free(&oid_fanout);
+	git_buf_free(&oid_lookup);
+	git_buf_free(&object_offsets);
+	git_buf_free(&object_large_offsets);
+	return error;
+}
+
+int git_midx_writer_commit(
+		git_midx_writer *w)
+{
+	git_buf midx = GIT_BUF_INIT, path = GIT_BUF_INIT;
+	git_filebuf output = GIT_FILEBUF_INIT;
+	int error;
+
+	assert(w);
+
+	if ((error = git_buf_joinpath(&path, w->pack_dir.ptr, GIT_MIDX_FILE)) < 0 ||
+		(error = midx_write(&midx, w)) < 0)
+		goto cleanup;
+
+	if ((error = git_filebuf_open(&output, path.ptr, 0, GIT_PACK_FILE_MODE)) < 0 ||
+		(error = git_filebuf_write(&output, midx.ptr, midx.size)) < 0)
+		goto cleanup;
+
+	error = git_filebuf_commit(&output);
+
+cleanup:
+	git_filebuf_cleanup(&output);
+	git_buf_free(&midx);
+	git_buf_free(&path);
+	return error;
+}
+
+int git_midx_writer_dump(
+		git_buf *midx,
+		git_midx_writer *w)
+{
+	assert(midx && w);
+
+	git_buf_sanitize(midx);
+
+	return midx_write(midx, w);
+}
@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#ifndef INCLUDE_midx_h__
+#define INCLUDE_midx_h__
+
+#include "common.h"
+
+#include "git2/oid.h"
+#include "git2/odb.h"
+#include "git2/sys/midx.h"
+
+#include "map.h"
+#include "vector.h"
+#include "fileops.h"
+
+#define GIT_MIDX_FILE "multi-pack-index"
+
+/*
+ * A multi-pack-index file.
+ *
+ * This file contains a merged index for multiple independent .pack files.
+ * This can help speed up locating objects without requiring a garbage
+ * collection cycle to create a single .pack file.
+ *
+ * The format is documented in git.git as
+ * Documentation/technical/pack-format.txt; only version 1 using SHA-1
+ * object names is supported.
+ */
+typedef struct git_midx_file {
+	git_map index_map;
+
+	/* The number of packfiles described by this index. */
+	uint32_t num_packfiles;
+
+	/* The OID Fanout table. */
+	const uint32_t *oid_fanout;
+	/* The total number of objects in the index. */
+	uint32_t num_objects;
+
+	/* The OID Lookup table. */
+	const git_oid *oid_lookup;
+
+	/* The Object Offsets table. Each entry has two 4-byte fields with the pack index and the offset. */
+	const unsigned char *object_offsets;
+
+	/* The Object Large Offsets table. */
+	const uint64_t *object_large_offsets;
+	/* The number of entries in the Object Large Offsets table. Each entry has an 8-byte with an offset */
+	size_t num_object_large_offsets;
+
+	/* The names of the packfiles, in the order of their pack index. */
+	git_vector packfile_names;
+
+	/* The checksum of the whole file, stored in its trailer. */
+	git_oid checksum;
+
+	/* Stat information used to detect that the file was rewritten. */
+	git_futils_filestamp stamp;
+
+	/* something like ".git/objects/pack/multi-pack-index". */
+	char *filename;
+} git_midx_file;
+
+/*
+ * An entry in the multi-pack-index: the packfile (by its position in
+ * `packfile_names`) and the offset at which the object can be found.
+ */
+typedef struct git_midx_entry {
+	uint32_t pack_index;
+	git_off_t offset;
+	git_oid sha1;
+} git_midx_entry;
+
+int git_midx_open(
+		git_midx_file **idx_out,
+		const char *path);
+bool git_midx_needs_refresh(
+		const git_midx_file *idx,
+		const char *path);
+int git_midx_entry_find(
+		git_midx_entry *e,
+		git_midx_file *idx,
+		const git_oid *short_oid,
+		size_t len);
+int git_midx_foreach_entry(
+		git_midx_file *idx,
+		git_odb_foreach_cb cb,
+		void *data);
+int git_midx_close(git_midx_file *idx);
+void git_midx_free(git_midx_file *idx);
+
+/* This is exposed for use in the tests. */
+int git_midx_parse(
+		git_midx_file *idx,
+		const unsigned char *data,
+		size_t size);
+
+#endif
@@ -26,8 +26,10 @@ GIT__USE_STRMAP
 
 size_t git_mwindow__window_size = DEFAULT_WINDOW_SIZE;
 size_t git_mwindow__mapped_limit = DEFAULT_MAPPED_LIMIT;
+int git_mwindow__full_map = 0;
+int git_mwindow__advice = GIT_MADV_NORMAL;
 
-/* Whenever you want to read or modify this, grab git__mwindow_mutex */
+/* See git_mwindow_ctl for the locking */
 static git_mwindow_ctl mem_ctl;
 
 /* Global list of mwindow files, to open packs once across repos */
@@ -132,6 +134,24 @@ void git_mwindow_put_pack(struct git_pack_file *pack)
 	return;
 }
 
+int git_mwindow_file_init(git_mwindow_file *mwf)
+{
+	memset(mwf, 0, sizeof(*mwf));
+	mwf->fd = -1;
+
+	if (git_mutex_init(&mwf->lock)) {
+		giterr_set(GITERR_OS, "failed to initialize mwindow file mutex");
+		return -1;
+	}
+
+	return 0;
+}
+
+void git_mwindow_file_free(git_mwindow_file *mwf)
+{
+	git_mutex_free(&mwf->lock);
+}
+
 void git_mwindow_free_all(git_mwindow_file *mwf)
 {
 	if (git_mutex_lock(&git__mwindow_mutex)) {
@@ -144,6 +164,28 @@ void git_mwindow_free_all(git_mwindow_file *mwf)
 	git_mutex_unlock(&git__mwindow_mutex);
 }
 
+/* Called under lock, once the window is out of its file's list */
+static void free_window(git_mwindow *w)
+{
+	git_mwindow_ctl *ctl = &mem_ctl;
+	git_mwindow **last = git_array_pop(ctl->clock);
+
+	/* the last window of the clock takes its place */
+	if (*last != w) {
+		*git_array_get(ctl->clock, w->clock_pos) = *last;
+		(*last)->clock_pos = w->clock_pos;
+	}
+
+	if (git_array_size(ctl->clock) == 0)
+		git_array_clear(ctl->clock);
+
+	ctl->mapped -= w->window_map.len;
+	ctl->open_windows--;
+
+	git_futils_mmap_free(&w->window_map);
+	git__free(w);
+}
+
 /*
  * Free all the windows in a sequence, typically because we're done
  * with the file
@@ -170,18 +212,19 @@ void git_mwindow_free_all_locked(git_mwindow_file *mwf)
 
 	while (mwf->windows) {
 		git_mwindow *w = mwf->windows;
-		assert(w->inuse_cnt == 0);
-
-		ctl->mapped -= w->window_map.len;
-		ctl->open_windows--;
-
-		git_futils_mmap_free(&w->window_map);
+		assert(w->inuse_cnt.val == 0);
 
 		mwf->windows = w->next;
-		git__free(w);
+		free_window(w);
 	}
 }
 
+void git_mwindow_advise(git_map *map)
+{
+	if (git_mwindow__advice != GIT_MADV_NORMAL)
+		p_madvise(map, git_mwindow__advice);
+}
+
 /*
  * Check if a window 'win' contains the address 'offset'
  */
@@ -192,75 +235,73 @@ int git_mwindow_contains(git_mwindow *win, git_off_t offset)
 		&& offset <= (git_off_t)(win_off + win->window_map.len);
 }
 
-/*
- * Find the least-recently-used window in a file
- */
-static void git_mwindow_scan_lru(
-	git_mwindow_file *mwf,
-	git_mwindow **lru_w,
-	git_mwindow **lru_l)
+/* Called under the lock of the window's file */
+static void unlink_window(git_mwindow *w)
 {
-	git_mwindow *w, *w_l;
-
-	for (w_l = NULL, w = mwf->windows; w; w = w->next) {
-		if (!w->inuse_cnt) {
-			/*
-			 * If the current one is more recent than the last one,
-			 * store it in the output parameter. If lru_w is NULL,
-			 * it's the first loop, so store it as well.
-			 */
-			if (!*lru_w || w->last_used < (*lru_w)->last_used) {
-				*lru_w = w;
-				*lru_l = w_l;
-			}
-		}
-		w_l = w;
-	}
+	git_mwindow **list = &w->mwf->windows;
+
+	while (*list != w)
+		list = &(*list)->next;
+
+	*list = w->next;
 }
 
 /*
- * Close the least recently used window. You should check to see if
- * the file descriptors need closing from time to time. Called under
- * lock from new_window.
+ * Close a window which was not used recently. The CLOCK hand goes over
+ * every open window and gives a second chance to the ones which were
+ * used since it last passed, so this takes constant time on average.
+ * Called under lock from new_window, which also holds the lock of
+ * `mwf`.
  */
 static int git_mwindow_close_lru(git_mwindow_file *mwf)
 {
 	git_mwindow_ctl *ctl = &mem_ctl;
-	size_t i;
-	git_mwindow *lru_w = NULL, *lru_l = NULL, **list = &mwf->windows;
-
-	/* FIXME: Does this give us any advantage? */
-	if(mwf->windows)
-		git_mwindow_scan_lru(mwf, &lru_w, &lru_l);
-
-	for (i = 0; i < ctl->windowfiles.length; ++i) {
-		git_mwindow *last = lru_w;
-		git_mwindow_file *cur = git_vector_get(&ctl->windowfiles, i);
-		git_mwindow_scan_lru(cur, &lru_w, &lru_l);
-		if (lru_w != last)
-			list = &cur->windows;
-	}
+	size_t steps, max_steps = 2 * git_array_size(ctl->clock);
 
-	if (!lru_w) {
-		giterr_set(GITERR_OS, "Failed to close memory window. Couldn't find LRU");
-		return -1;
-	}
+	for (steps = 0; steps < max_steps; steps++) {
+		git_mwindow *w;
 
-	ctl->mapped -= lru_w->window_map.len;
-	git_futils_mmap_free(&lru_w->window_map);
+		if (ctl->hand >= git_array_size(ctl->clock))
+			ctl->hand = 0;
 
-	if (lru_l)
-		lru_l->next = lru_w->next;
-	else
-		*list = lru_w->next;
+		w = *git_array_get(ctl->clock, ctl->hand);
 
-	git__free(lru_w);
-	ctl->open_windows--;
+		if (w->inuse_cnt.val || w->full) {
+			ctl->hand++;
+			continue;
+		}
 
-	return 0;
+		if (w->referenced.val) {
+			git_atomic_set(&w->referenced, 0);
+			ctl->hand++;
+			continue;
+		}
+
+		/* windows are only handed out under their file's lock */
+		if (w->mwf != mwf && git_mutex_trylock(&w->mwf->lock)) {
+			ctl->hand++;
+			continue;
+		}
+
+		if (w->inuse_cnt.val) {
+			git_mutex_unlock(&w->mwf->lock);
+			ctl->hand++;
+			continue;
+		}
+
+		unlink_window(w);
+		if (w->mwf != mwf)
+			git_mutex_unlock(&w->mwf->lock);
+
+		free_window(w);
+		return 0;
+	}
+
+	giterr_set(GITERR_OS, "Failed to close memory window. Couldn't find LRU");
+	return -1;
 }
 
-/* This gets called under lock from git_mwindow_open */
+/* This gets called under the file's lock from git_mwindow_open */
 static git_mwindow *new_window(
 	git_mwindow_file *mwf,
 	git_file fd,
@@ -269,6 +310,7 @@ static git_mwindow *new_window(
 {
 	git_mwindow_ctl *ctl = &mem_ctl;
 	size_t walign = git_mwindow__window_size / 2;
+	git_mwindow **clock_slot;
 	git_off_t len;
 	git_mwindow *w;
 
@@ -278,15 +320,33 @@ static git_mwindow *new_window(
 		return NULL;
 
 	memset(w, 0x0, sizeof(*w));
-	w->offset = (offset / walign) * walign;
+	w->mwf = mwf;
+
+	/*
+	 * With the whole file in a single window, we never have to look
+	 * for another one. This needs the address space of a 64-bit host.
+	 */
+	if (git_mwindow__full_map && sizeof(void *) >= 8 && git__is_sizet(size)) {
+		w->full = 1;
+		w->offset = 0;
+		len = size;
+	} else {
+		w->offset = (offset / walign) * walign;
+
+		len = size - w->offset;
+		if (len > (git_off_t)git_mwindow__window_size)
+			len = (git_off_t)git_mwindow__window_size;
+	}
 
-	len = size - w->offset;
-	if (len > (git_off_t)git_mwindow__window_size)
-		len = (git_off_t)git_mwindow__window_size;
+	if (git_mutex_lock(&git__mwindow_mutex)) {
+		giterr_set(GITERR_THREAD, "unable to lock mwindow mutex");
+		git__free(w);
+		return NULL;
+	}
 
 	ctl->mapped += (size_t)len;
 
-	while (git_mwindow__mapped_limit < ctl->mapped &&
+	while (!w->full && git_mwindow__mapped_limit < ctl->mapped &&
 			git_mwindow_close_lru(mwf) == 0) /* nop */;
 
 	/*
@@ -295,11 +355,21 @@ static git_mwindow *new_window(
 	 * window.
 	 */
 
-	if (git_futils_mmap_ro(&w->window_map, fd, w->offset, (size_t)len) < 0) {
+	if ((clock_slot = git_array_alloc(ctl->clock)) == NULL ||
+		git_futils_mmap_ro(&w->window_map, fd, w->offset, (size_t)len) < 0) {
+		if (clock_slot)
+			git_array_pop(ctl->clock);
+		ctl->mapped -= (size_t)len;
+		git_mutex_unlock(&git__mwindow_mutex);
 		git__free(w);
 		return NULL;
 	}
 
+	w->clock_pos = git_array_size(ctl->clock) - 1;
+	*clock_slot = w;
+
+	git_mwindow_advise(&w->window_map);
+
 	ctl->mmap_calls++;
 	ctl->open_windows++;
 
@@ -309,6 +379,7 @@ static git_mwindow *new_window(
 	if (ctl->open_windows > ctl->peak_open_windows)
 		ctl->peak_open_windows = ctl->open_windows;
 
+	git_mutex_unlock(&git__mwindow_mutex);
 	return w;
 }
 
@@ -323,53 +394,63 @@ unsigned char *git_mwindow_open(
 	size_t extra,
 	unsigned int *left)
 {
-	git_mwindow_ctl *ctl = &mem_ctl;
 	git_mwindow *w = *cursor;
 
-	if (git_mutex_lock(&git__mwindow_mutex)) {
-		giterr_set(GITERR_THREAD, "unable to lock mwindow mutex");
+	/*
+	 * We hold a reference on the window in the cursor, so it cannot
+	 * go away while we read it and we need no lock at all.
+	 */
+	if (w && git_mwindow_contains(w, offset) && git_mwindow_contains(w, offset + extra))
+		goto done;
+
+	if (git_mutex_lock(&mwf->lock)) {
+		giterr_set(GITERR_THREAD, "unable to lock mwindow file mutex");
 		return NULL;
 	}
 
-	if (!w || !(git_mwindow_contains(w, offset) && git_mwindow_contains(w, offset + extra))) {
-		if (w) {
-			w->inuse_cnt--;
-		}
+	if (w) {
+		git_atomic_dec(&w->inuse_cnt);
+		*cursor = NULL;
+	}
 
-		for (w = mwf->windows; w; w = w->next) {
-			if (git_mwindow_contains(w, offset) &&
-				git_mwindow_contains(w, offset + extra))
-				break;
-		}
+	for (w = mwf->windows; w; w = w->next) {
+		if (git_mwindow_contains(w, offset) &&
+			git_mwindow_contains(w, offset + extra))
+			break;
+	}
 
-		/*
-		 * If there isn't a suitable window, we need to create a new
-		 * one.
-		 */
-		if (!w) {
-			w = new_window(mwf, mwf->fd, mwf->size, offset);
-			if (w == NULL) {
-				git_mutex_unlock(&git__mwindow_mutex);
-				return NULL;
-			}
-			w->next = mwf->windows;
-			mwf->windows = w;
+	/*
+	 * If there isn't a suitable window, we need to create a new
+	 * one.
+	 */
+	if (!w) {
+		w = new_window(mwf, mwf->fd, mwf->size, offset);
+		if (w == NULL) {
+			git_mutex_unlock(&mwf->lock);
+			return NULL;
 		}
+		w->next = mwf->windows;
+		mwf->windows = w;
 	}
 
-	/* If we changed w, store it in the cursor */
-	if (w != *cursor) {
-		w->last_used = ctl->used_ctr++;
-		w->inuse_cnt++;
-		*cursor = w;
-	}
+	git_atomic_inc(&w->inuse_cnt);
+	git_atomic_set(&w->referenced, 1);
+	*cursor = w;
+
+	git_mutex_unlock(&mwf->lock);
 
+done:
 	offset -= w->offset;
 
-	if (left)
-		*left = (unsigned int)(w->window_map.len - offset);
+	/*
+	 * A window mapping a whole pack can be longer than `left` says;
+	 * the callers come back for the rest.
+	 */
+	if (left) {
+		size_t len = w->window_map.len - (size_t)offset;
+		*left = len > UINT_MAX ? UINT_MAX : (unsigned int)len;
+	}
 
-	git_mutex_unlock(&git__mwindow_mutex);
 	return (unsigned char *) w->window_map.data + offset;
 }
 
@@ -418,13 +499,7 @@ void git_mwindow_close(git_mwindow **window)
 {
 	git_mwindow *w = *window;
 	if (w) {
-		if (git_mutex_lock(&git__mwindow_mutex)) {
-			giterr_set(GITERR_THREAD, "unable to lock mwindow mutex");
-			return;
-		}
-
-		w->inuse_cnt--;
-		git_mutex_unlock(&git__mwindow_mutex);
+		git_atomic_dec(&w->inuse_cnt);
 		*window = NULL;
 	}
 }
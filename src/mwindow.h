@@ -10,39 +10,59 @@
 
 #include "map.h"
 #include "vector.h"
+#include "array.h"
+
+struct git_mwindow_file;
 
 typedef struct git_mwindow {
 	struct git_mwindow *next;
+	struct git_mwindow_file *mwf;
 	git_map window_map;
 	git_off_t offset;
-	size_t last_used;
-	size_t inuse_cnt;
+	git_atomic inuse_cnt;
+	git_atomic referenced; /* since the clock hand last passed */
+	size_t clock_pos;
+	unsigned int full:1; /* maps the whole file, never evicted */
 } git_mwindow;
 
 typedef struct git_mwindow_file {
+	git_mutex lock; /* protects the list of windows */
 	git_mwindow *windows;
 	int fd;
 	git_off_t size;
 } git_mwindow_file;
 
+/*
+ * Whenever you want to read or modify this, grab git__mwindow_mutex.
+ * Evicting a window from another file than the one we are opening a
+ * window for also needs that file's lock, which we only try to take.
+ */
 typedef struct git_mwindow_ctl {
 	size_t mapped;
 	unsigned int open_windows;
 	unsigned int mmap_calls;
 	unsigned int peak_open_windows;
 	size_t peak_mapped;
-	size_t used_ctr;
 	git_vector windowfiles;
+
+	/* every open window, for the CLOCK hand to go over */
+	git_array_t(git_mwindow *) clock;
+	size_t hand;
 } git_mwindow_ctl;
 
 int git_mwindow_contains(git_mwindow *win, git_off_t offset);
 void git_mwindow_free_all(git_mwindow_file *mwf); /* locks */
 void git_mwindow_free_all_locked(git_mwindow_file *mwf); /* run under lock */
 unsigned char *git_mwindow_open(git_mwindow_file *mwf, git_mwindow **cursor, git_off_t offset, size_t extra, unsigned int *left);
+int git_mwindow_file_init(git_mwindow_file *mwf);
+void git_mwindow_file_free(git_mwindow_file *mwf);
 int git_mwindow_file_register(git_mwindow_file *mwf);
 void git_mwindow_file_deregister(git_mwindow_file *mwf);
 void git_mwindow_close(git_mwindow **w_cursor);
 
+/* Give the kernel the hint set with GIT_OPT_SET_MWINDOW_ADVICE */
+void git_mwindow_advise(git_map *map);
+
 int git_mwindow_files_init(void);
 void git_mwindow_files_free(void);
 
@@ -30,6 +30,8 @@
 
 #define GIT_ALTERNATES_MAX_DEPTH 5
 
+bool git_odb__negative_cache = false;
+
 typedef struct
 {
 	git_odb_backend *backend;
@@ -385,8 +387,13 @@ int git_odb_new(git_odb **out)
 	git_odb *db = git__calloc(1, sizeof(*db));
 	GITERR_CHECK_ALLOC(db);
 
+	if (git_mutex_init(&db->lock) < 0) {
+		git__free(db);
+		return -1;
+	}
 	if (git_cache_init(&db->own_cache) < 0 ||
 		git_vector_init(&db->backends, 4, backend_sort_cmp) < 0) {
+		git_mutex_free(&db->lock);
 		git__free(db);
 		return -1;
 	}
@@ -583,7 +590,8 @@ int git_odb_open(git_odb **out, const char *objects_dir)
 	if (git_odb_new(&db) < 0)
 		return -1;
 
-	if (add_default_backends(db, objects_dir, 0, 0) < 0) {
+	if (add_default_backends(db, objects_dir, 0, 0) < 0 ||
+		git_commit_graph_new(&db->cgraph, objects_dir) < 0) {
 		git_odb_free(db);
 		return -1;
 	}
@@ -607,11 +615,50 @@ static void odb_free(git_odb *db)
 
 	git_vector_free(&db->backends);
 	git_cache_free(&db->own_cache);
+	git_commit_graph_free(db->cgraph);
+	git_mutex_free(&db->lock);
 
 	git__memzero(db, sizeof(*db));
 	git__free(db);
 }
 
+int git_odb__get_commit_graph_file(git_commit_graph_file **out, git_odb *odb)
+{
+	int error;
+
+	if (!odb->cgraph)
+		return GIT_ENOTFOUND;
+
+	if (git_mutex_lock(&odb->lock) < 0) {
+		giterr_set(GITERR_OS, "Failed to lock object database");
+		return -1;
+	}
+	error = git_commit_graph_get_file(out, odb->cgraph);
+	git_mutex_unlock(&odb->lock);
+
+	return error;
+}
+
+int git_odb__find_packed(
+	struct git_pack_entry *e, git_odb *db, const git_oid *id)
+{
+	size_t i;
+	int error;
+
+	for (i = 0; i < db->backends.length; ++i) {
+		backend_internal *internal = git_vector_get(&db->backends, i);
+
+		error = git_odb_backend__find_packed(e, internal->backend, id);
+		if (error == 0)
+			return 0;
+		if (error != GIT_PASSTHROUGH && error != GIT_ENOTFOUND)
+			return error;
+	}
+
+	giterr_clear();
+	return GIT_ENOTFOUND;
+}
+
 void git_odb_free(git_odb *db)
 {
 	if (db == NULL)
@@ -822,6 +869,165 @@ int git_odb_read(git_odb_object **out, git_odb *db, const git_oid *id)
 	return 0;
 }
 
+typedef struct {
+	git_odb *db;
+	git_odb_read_many_cb cb;
+	void *payload;
+
+	/* the ids not read yet, and their position in the caller's array */
+	git_oid *pending_ids;
+	size_t *pending_pos;
+	size_t pending;
+
+	bool *done;
+} read_many_state;
+
+static int read_many_deliver(
+	read_many_state *st, const git_oid *id, git_rawobj *raw)
+{
+	git_odb_object *object;
+	int error;
+
+	if ((object = odb_object__alloc(id, raw)) == NULL) {
+		git__free(raw->data);
+		return -1;
+	}
+
+	object = git_cache_store_raw(odb_cache(st->db), object);
+	error = st->cb(object, st->payload);
+	git_odb_object_free(object);
+
+	return giterr_set_after_callback(error);
+}
+
+static int read_many_backend_cb(
+	size_t idx, void *data, size_t len, git_otype type, void *payload)
+{
+	read_many_state *st = payload;
+	size_t pos;
+	git_rawobj raw;
+
+	assert(idx < st->pending);
+	pos = st->pending_pos[idx];
+
+	raw.data = data;
+	raw.len = len;
+	raw.type = type;
+
+	/* a backend which gives us the same object twice */
+	if (st->done[pos]) {
+		git__free(data);
+		return 0;
+	}
+
+	st->done[pos] = true;
+	return read_many_deliver(st, &st->pending_ids[idx], &raw);
+}
+
+static void read_many_compact(read_many_state *st)
+{
+	size_t i, j;
+
+	for (i = 0, j = 0; i < st->pending; i++) {
+		if (st->done[st->pending_pos[i]])
+			continue;
+
+		st->pending_ids[j] = st->pending_ids[i];
+		st->pending_pos[j] = st->pending_pos[i];
+		j++;
+	}
+
+	st->pending = j;
+}
+
+int git_odb_read_many(
+	git_odb *db,
+	const git_oid *ids,
+	size_t count,
+	git_odb_read_many_cb cb,
+	void *payload)
+{
+	read_many_state st = { NULL };
+	git_odb_object *object;
+	git_rawobj raw;
+	size_t i, j;
+	int error = 0;
+
+	assert(db && (ids || !count) && cb);
+
+	st.db = db;
+	st.cb = cb;
+	st.payload = payload;
+
+	st.pending_ids = git__calloc(count ? count : 1, sizeof(git_oid));
+	st.pending_pos = git__calloc(count ? count : 1, sizeof(size_t));
+	st.done = git__calloc(count ? count : 1, sizeof(bool));
+
+	if (!st.pending_ids || !st.pending_pos || !st.done) {
+		error = -1;
+		goto done;
+	}
+
+	/* the objects we already have don't go to the backends */
+	for (i = 0; i < count; i++) {
+		if ((object = git_cache_get_raw(odb_cache(db), &ids[i])) != NULL) {
+			st.done[i] = true;
+			error = giterr_set_after_callback(cb(object, payload));
+			git_odb_object_free(object);
+		} else if (hardcoded_objects(&raw, &ids[i]) == 0) {
+			st.done[i] = true;
+			error = read_many_deliver(&st, &ids[i], &raw);
+		} else {
+			git_oid_cpy(&st.pending_ids[st.pending], &ids[i]);
+			st.pending_pos[st.pending++] = i;
+		}
+
+		if (error)
+			goto done;
+	}
+
+	for (i = 0; i < db->backends.length && st.pending > 0; ++i) {
+		backend_internal *internal = git_vector_get(&db->backends, i);
+		git_odb_backend *b = internal->backend;
+
+		if (b->read_many != NULL) {
+			error = b->read_many(b, st.pending_ids, st.pending,
+				read_many_backend_cb, &st);
+
+			if (error == GIT_PASSTHROUGH)
+				error = 0;
+		} else if (b->read != NULL) {
+			for (j = 0; j < st.pending && !error; j++) {
+				error = b->read(&raw.data, &raw.len, &raw.type, b, &st.pending_ids[j]);
+
+				if (error == GIT_ENOTFOUND || error == GIT_PASSTHROUGH) {
+					error = 0;
+					continue;
+				}
+
+				if (!error)
+					error = read_many_backend_cb(j, raw.data, raw.len, raw.type, &st);
+			}
+		}
+
+		if (error)
+			goto done;
+
+		read_many_compact(&st);
+	}
+
+	giterr_clear();
+
+	if (st.pending > 0)
+		error = git_odb__error_notfound("no match for id", &st.pending_ids[0]);
+
+done:
+	git__free(st.pending_ids);
+	git__free(st.pending_pos);
+	git__free(st.done);
+	return error;
+}
+
 int git_odb_read_prefix(
 	git_odb_object **out, git_odb *db, const git_oid *short_id, size_t len)
 {
@@ -1135,6 +1341,15 @@ int git_odb_refresh(struct git_odb *db)
 		}
 	}
 
+	if (db->cgraph) {
+		if (git_mutex_lock(&db->lock) < 0) {
+			giterr_set(GITERR_OS, "Failed to lock object database");
+			return -1;
+		}
+		git_commit_graph_refresh(db->cgraph);
+		git_mutex_unlock(&db->lock);
+	}
+
 	return 0;
 }
 
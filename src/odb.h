@@ -15,6 +15,7 @@
 #include "cache.h"
 #include "posix.h"
 #include "filter.h"
+#include "commit_graph.h"
 
 #define GIT_OBJECTS_DIR "objects/"
 #define GIT_OBJECT_DIR_MODE 0777
@@ -36,10 +37,24 @@ struct git_odb_object {
 /* EXPORT */
 struct git_odb {
 	git_refcount rc;
+	git_mutex lock;  /* protects cgraph */
 	git_vector backends;
 	git_cache own_cache;
+	git_commit_graph *cgraph;
 };
 
+/*
+ * Get the commit-graph of the object database, if there is one. Returns
+ * GIT_ENOTFOUND when the object database has no usable commit-graph.
+ */
+int git_odb__get_commit_graph_file(git_commit_graph_file **out, git_odb *odb);
+
+/*
+ * Whether the backends remember which objects are missing, so that
+ * checking for them again needs no I/O, until `git_odb_refresh`.
+ */
+extern bool git_odb__negative_cache;
+
 /*
  * Hash a git_rawobj internally.
  * The `git_rawobj` is supposed to be previously initialized
@@ -97,6 +112,24 @@ int git_odb__read_header_or_object(
 	git_odb_object **out, size_t *len_p, git_otype *type_p,
 	git_odb *db, const git_oid *id);
 
+struct git_pack_entry;
+
+/*
+ * Find the packfile and offset where the object `id` is stored, for
+ * callers that want to read the packed data directly. Returns
+ * GIT_ENOTFOUND (without setting an error) when the object is not in
+ * any packfile of the object database.
+ */
+int git_odb__find_packed(
+	struct git_pack_entry *e, git_odb *db, const git_oid *id);
+
+/*
+ * Find the object `id` in the packed backend `backend`. Returns
+ * GIT_PASSTHROUGH when `backend` is not a packed backend.
+ */
+int git_odb_backend__find_packed(
+	struct git_pack_entry *e, git_odb_backend *backend, const git_oid *id);
+
 /* fully free the object; internal method, DO NOT EXPORT */
 void git_odb_object__free(void *object);
 
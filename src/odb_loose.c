@@ -14,6 +14,9 @@
 #include "odb.h"
 #include "delta-apply.h"
 #include "filebuf.h"
+#include "oid.h"
+#include "array.h"
+#include "zstream.h"
 
 #include "git2/odb_backend.h"
 #include "git2/types.h"
@@ -28,6 +31,20 @@ typedef struct {
 	git_filebuf fbuf;
 } loose_writestream;
 
+/*
+ * The sorted ids of the loose objects in one fanout directory, so that
+ * looking up an abbreviated id is a binary search instead of a readdir.
+ * The listing is reused for as long as the directory is not modified.
+ */
+typedef struct {
+	git_futils_filestamp stamp;
+	git_array_t(git_oid) ids;
+	unsigned int loaded : 1,
+		racy : 1; /* modified in the second it was listed */
+} loose_fanout;
+
+#define LOOSE_FANOUT_DIRS 256
+
 typedef struct loose_backend {
 	git_odb_backend parent;
 
@@ -36,23 +53,24 @@ typedef struct loose_backend {
 	mode_t object_file_mode;
 	mode_t object_dir_mode;
 
+	/* ids that were not found, for the negative cache */
+	git_mutex missing_lock;
+	git_oid *missing;
+
+	/* listings of the fanout directories, for prefix lookups */
+	git_mutex fanout_lock;
+	loose_fanout *fanout;
+
 	size_t objects_dirlen;
 	char objects_dir[GIT_FLEX_ARRAY];
 } loose_backend;
 
-/* State structure for exploring directories,
- * in order to locate objects matching a short oid.
+/*
+ * The negative cache is a table of the ids that were looked up and not
+ * found, each in a slot picked by its first bytes. A new miss replaces
+ * whatever was in its slot, so the table never grows.
  */
-typedef struct {
-	size_t dir_len;
-	unsigned char short_oid[GIT_OID_HEXSZ]; /* hex formatted oid to match */
-	size_t short_oid_len;
-	int found;				/* number of matching
-						 * objects already found */
-	unsigned char res_oid[GIT_OID_HEXSZ];	/* hex formatted oid of
-						 * the object found */
-} loose_locate_object_state;
-
+#define LOOSE_MISSING_SLOTS 4096
 
 /***********************************************************
  *
@@ -229,37 +247,25 @@ static int is_zlib_compressed_data(unsigned char *data)
 	return (data[0] & 0x8F) == 0x08 && !(w % 31);
 }
 
+/* `out` has room for `outlen` bytes and a NUL */
 static int inflate_buffer(void *in, size_t inlen, void *out, size_t outlen)
 {
-	z_stream zs;
-	int status = Z_OK;
-
-	memset(&zs, 0x0, sizeof(zs));
-
-	zs.next_out = out;
-	zs.avail_out = (uInt)outlen;
-
-	zs.next_in = in;
-	zs.avail_in = (uInt)inlen;
+	git_zinflate zi;
+	size_t used;
+	int error;
 
-	if (inflateInit(&zs) < Z_OK) {
-		giterr_set(GITERR_ZLIB, "Failed to inflate buffer");
+	if (git_zinflate_init(&zi) < 0)
 		return -1;
-	}
 
-	while (status == Z_OK)
-		status = inflate(&zs, Z_FINISH);
+	error = git_zinflate_buf(&used, &zi, out, outlen, in, inlen);
+	git_zinflate_free(&zi);
 
-	inflateEnd(&zs);
-
-	if (status != Z_STREAM_END /* || zs.avail_in != 0 */ ||
-		zs.total_out != outlen)
-	{
+	if (error == GIT_EBUFS) {
 		giterr_set(GITERR_ZLIB, "Failed to inflate buffer. Stream aborted prematurely");
 		return -1;
 	}
 
-	return 0;
+	return error;
 }
 
 static void *inflate_tail(z_stream *s, void *hb, size_t used, obj_hdr *hdr)
@@ -468,6 +474,57 @@ static int read_header_loose(git_rawobj *out, git_buf *loc)
 	return error;
 }
 
+GIT_INLINE(git_oid *) missing_slot(loose_backend *backend, const git_oid *oid)
+{
+	uint32_t h;
+
+	memcpy(&h, oid->id, sizeof(h));
+	return &backend->missing[h & (LOOSE_MISSING_SLOTS - 1)];
+}
+
+static bool missing_contains(loose_backend *backend, const git_oid *oid)
+{
+	bool found;
+
+	if (!backend->missing || git_mutex_lock(&backend->missing_lock) < 0)
+		return false;
+
+	found = backend->missing && git_oid_equal(missing_slot(backend, oid), oid);
+
+	git_mutex_unlock(&backend->missing_lock);
+	return found;
+}
+
+static void missing_add(loose_backend *backend, const git_oid *oid)
+{
+	if (git_mutex_lock(&backend->missing_lock) < 0)
+		return;
+
+	if (!backend->missing)
+		backend->missing = git__calloc(LOOSE_MISSING_SLOTS, sizeof(git_oid));
+
+	if (backend->missing)
+		git_oid_cpy(missing_slot(backend, oid), oid);
+	else
+		giterr_clear();
+
+	git_mutex_unlock(&backend->missing_lock);
+}
+
+static void missing_remove(loose_backend *backend, const git_oid *oid)
+{
+	git_oid *slot;
+
+	if (!backend->missing || git_mutex_lock(&backend->missing_lock) < 0)
+		return;
+
+	if (backend->missing &&
+		git_oid_equal(slot = missing_slot(backend, oid), oid))
+		memset(slot, 0x0, sizeof(git_oid));
+
+	git_mutex_unlock(&backend->missing_lock);
+}
+
 static int locate_object(
 	git_buf *object_location,
 	loose_backend *backend,
@@ -481,118 +538,202 @@ static int locate_object(
 	return error;
 }
 
-/* Explore an entry of a directory and see if it matches a short oid */
-static int fn_locate_object_short_oid(void *state, git_buf *pathbuf) {
-	loose_locate_object_state *sstate = (loose_locate_object_state *)state;
+static int fanout_id_cmp(const void *a, const void *b, void *payload)
+{
+	GIT_UNUSED(payload);
+	return git_oid__cmp(a, b);
+}
+
+/* Order an id against the first `len` hex digits of a prefix */
+static int fanout_prefix_cmp(const git_oid *id, const git_oid *prefix, size_t len)
+{
+	int cmp;
+
+	if ((cmp = memcmp(id->id, prefix->id, len / 2)) != 0 || !(len & 1))
+		return cmp;
+
+	return (int)(id->id[len / 2] & 0xf0) - (int)(prefix->id[len / 2] & 0xf0);
+}
+
+typedef struct {
+	loose_fanout *fanout;
+	size_t dir_len;
+	char hex[GIT_OID_HEXSZ]; /* the directory name, then each entry */
+} fanout_load_state;
+
+static int fanout_load_cb(void *payload, git_buf *path)
+{
+	fanout_load_state *state = payload;
+	git_oid id, *entry;
+	size_t i;
 
-	if (git_buf_len(pathbuf) - sstate->dir_len != GIT_OID_HEXSZ - 2) {
-		/* Entry cannot be an object. Continue to next entry */
+	/* Entry cannot be an object. Continue to next entry */
+	if (git_buf_len(path) - state->dir_len != GIT_OID_HEXSZ - 2)
 		return 0;
-	}
 
-	if (git_path_isdir(pathbuf->ptr) == false) {
-		/* We are already in the directory matching the 2 first hex characters,
-		 * compare the first ncmp characters of the oids */
-		if (!memcmp(sstate->short_oid + 2,
-			(unsigned char *)pathbuf->ptr + sstate->dir_len,
-			sstate->short_oid_len - 2)) {
-
-			if (!sstate->found) {
-				sstate->res_oid[0] = sstate->short_oid[0];
-				sstate->res_oid[1] = sstate->short_oid[1];
-				memcpy(sstate->res_oid+2, pathbuf->ptr+sstate->dir_len, GIT_OID_HEXSZ-2);
-			}
-			sstate->found++;
-		}
+	memcpy(state->hex + 2, path->ptr + state->dir_len, GIT_OID_HEXSZ - 2);
+
+	for (i = 0; i < GIT_OID_HEXSZ; i += 2) {
+		int v = (git__fromhex(state->hex[i]) << 4) | git__fromhex(state->hex[i + 1]);
+
+		if (v < 0)
+			return 0;
+
+		id.id[i / 2] = (unsigned char)v;
 	}
 
-	if (sstate->found > 1)
-		return GIT_EAMBIGUOUS;
+	entry = git_array_alloc(state->fanout->ids);
+	GITERR_CHECK_ALLOC(entry);
 
+	git_oid_cpy(entry, &id);
 	return 0;
 }
 
-/* Locate an object matching a given short oid */
-static int locate_object_short_oid(
-	git_buf *object_location,
-	git_oid *res_oid,
+static int fanout_load(loose_fanout *fanout, git_buf *dir, git_time_t now)
+{
+	fanout_load_state state;
+	int error;
+
+	fanout->ids.size = 0;
+	fanout->loaded = 0;
+
+	state.fanout = fanout;
+	state.dir_len = git_buf_len(dir);
+	memcpy(state.hex, dir->ptr + state.dir_len - 3, 2);
+
+	if ((error = git_path_direach(dir, 0, fanout_load_cb, &state)) < 0)
+		return error;
+
+	git__qsort_r(fanout->ids.ptr, fanout->ids.size, sizeof(git_oid),
+		fanout_id_cmp, NULL);
+
+	/*
+	 * The mtime only has a resolution of one second: an object added
+	 * later in the second of the listing would not change it.
+	 */
+	fanout->loaded = 1;
+	fanout->racy = (fanout->stamp.mtime >= now);
+
+	return 0;
+}
+
+static void fanout_clear(loose_fanout *fanout)
+{
+	git_array_clear(fanout->ids);
+	git_futils_filestamp_set(&fanout->stamp, NULL);
+	fanout->loaded = 0;
+}
+
+/* Find the only loose object whose id starts with the given prefix */
+static int fanout_find(
+	git_oid *out,
 	loose_backend *backend,
 	const git_oid *short_oid,
 	size_t len)
 {
-	char *objects_dir = backend->objects_dir;
-	size_t dir_len = strlen(objects_dir), alloc_len;
-	loose_locate_object_state state;
+	git_buf dir = GIT_BUF_INIT;
+	git_time_t now = (git_time_t)time(NULL);
+	loose_fanout *fanout;
+	size_t lo, hi, mid;
 	int error;
 
-	/* prealloc memory for OBJ_DIR/xx/xx..38x..xx */
-	GITERR_CHECK_ALLOC_ADD(&alloc_len, dir_len, GIT_OID_HEXSZ);
-	GITERR_CHECK_ALLOC_ADD(&alloc_len, alloc_len, 3);
-	if (git_buf_grow(object_location, alloc_len) < 0)
+	if (git_buf_put(&dir, backend->objects_dir, backend->objects_dirlen) < 0 ||
+		git_buf_printf(&dir, "%02x/", short_oid->id[0]) < 0)
 		return -1;
 
-	git_buf_set(object_location, objects_dir, dir_len);
-	git_path_to_dir(object_location);
-
-	/* save adjusted position at end of dir so it can be restored later */
-	dir_len = git_buf_len(object_location);
-
-	/* Convert raw oid to hex formatted oid */
-	git_oid_fmt((char *)state.short_oid, short_oid);
-
-	/* Explore OBJ_DIR/xx/ where xx is the beginning of hex formatted short oid */
-	if (git_buf_put(object_location, (char *)state.short_oid, 3) < 0)
+	if (git_mutex_lock(&backend->fanout_lock) < 0) {
+		giterr_set(GITERR_OS, "failed to lock loose object backend");
+		git_buf_free(&dir);
 		return -1;
-	object_location->ptr[object_location->size - 1] = '/';
+	}
 
-	/* Check that directory exists */
-	if (git_path_isdir(object_location->ptr) == false)
-		return git_odb__error_notfound("no matching loose object for prefix", short_oid);
+	if (!backend->fanout &&
+		!(backend->fanout = git__calloc(LOOSE_FANOUT_DIRS, sizeof(loose_fanout)))) {
+		error = -1;
+		goto done;
+	}
 
-	state.dir_len = git_buf_len(object_location);
-	state.short_oid_len = len;
-	state.found = 0;
+	fanout = &backend->fanout[short_oid->id[0]];
 
-	/* Explore directory to find a unique object matching short_oid */
-	error = git_path_direach(
-		object_location, 0, fn_locate_object_short_oid, &state);
-	if (error < 0 && error != GIT_EAMBIGUOUS)
-		return error;
+	if ((error = git_futils_filestamp_check(&fanout->stamp, dir.ptr)) == GIT_ENOTFOUND) {
+		fanout_clear(fanout);
+		error = git_odb__error_notfound("no matching loose object for prefix", short_oid);
+		goto done;
+	}
 
-	if (!state.found)
-		return git_odb__error_notfound("no matching loose object for prefix", short_oid);
+	if ((error > 0 || !fanout->loaded || fanout->racy) &&
+		(error = fanout_load(fanout, &dir, now)) < 0)
+		goto done;
 
-	if (state.found > 1)
-		return git_odb__error_ambiguous("multiple matches in loose objects");
+	/* the first id that does not sort before the prefix */
+	lo = 0;
+	hi = fanout->ids.size;
 
-	/* Convert obtained hex formatted oid to raw */
-	error = git_oid_fromstr(res_oid, (char *)state.res_oid);
-	if (error)
-		return error;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+
+		if (fanout_prefix_cmp(&fanout->ids.ptr[mid], short_oid, len) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
 
-	/* Update the location according to the oid obtained */
-	GITERR_CHECK_ALLOC_ADD(&alloc_len, dir_len, GIT_OID_HEXSZ);
-	GITERR_CHECK_ALLOC_ADD(&alloc_len, alloc_len, 2);
+	if (lo == fanout->ids.size ||
+		fanout_prefix_cmp(&fanout->ids.ptr[lo], short_oid, len) != 0)
+		error = git_odb__error_notfound("no matching loose object for prefix", short_oid);
+	else if (lo + 1 < fanout->ids.size &&
+		fanout_prefix_cmp(&fanout->ids.ptr[lo + 1], short_oid, len) == 0)
+		error = git_odb__error_ambiguous("multiple matches in loose objects");
+	else
+		git_oid_cpy(out, &fanout->ids.ptr[lo]);
 
-	git_buf_truncate(object_location, dir_len);
-	if (git_buf_grow(object_location, alloc_len) < 0)
-		return -1;
+done:
+	git_mutex_unlock(&backend->fanout_lock);
+	git_buf_free(&dir);
+	return error;
+}
 
-	git_oid_pathfmt(object_location->ptr + dir_len, res_oid);
+/* A new object makes the listing of its directory out of date */
+static void fanout_invalidate(loose_backend *backend, const git_oid *oid)
+{
+	if (!backend->fanout || git_mutex_lock(&backend->fanout_lock) < 0)
+		return;
 
-	object_location->size += GIT_OID_HEXSZ + 1;
-	object_location->ptr[object_location->size] = '\0';
+	if (backend->fanout)
+		backend->fanout[oid->id[0]].loaded = 0;
 
-	return 0;
+	git_mutex_unlock(&backend->fanout_lock);
 }
 
+static void fanout_free(loose_backend *backend)
+{
+	size_t i;
 
+	if (!backend->fanout)
+		return;
 
+	for (i = 0; i < LOOSE_FANOUT_DIRS; i++)
+		fanout_clear(&backend->fanout[i]);
 
+	git__free(backend->fanout);
+	backend->fanout = NULL;
+}
 
+/* Locate an object matching a given short oid */
+static int locate_object_short_oid(
+	git_buf *object_location,
+	git_oid *res_oid,
+	loose_backend *backend,
+	const git_oid *short_oid,
+	size_t len)
+{
+	int error;
 
+	if ((error = fanout_find(res_oid, backend, short_oid, len)) < 0)
+		return error;
 
-
+	return object_file_name(object_location, backend, res_oid);
+}
 
 /***********************************************************
  *
@@ -646,6 +787,63 @@ static int loose_backend__read(void **buffer_p, size_t *len_p, git_otype *type_p
 	return error;
 }
 
+static int read_many_cmp(const void *a, const void *b, void *payload)
+{
+	const git_oid *ids = payload;
+
+	return git_oid__cmp(&ids[*(const size_t *)a], &ids[*(const size_t *)b]);
+}
+
+/*
+ * Read the objects by id, so that each fan-out directory is visited
+ * once, reusing the same buffers. There is no separate check for the
+ * file's existence: a missing file is just skipped.
+ */
+static int loose_backend__read_many(
+	git_odb_backend *backend,
+	const git_oid *ids,
+	size_t count,
+	git_odb_backend_read_many_cb cb,
+	void *payload)
+{
+	git_buf object_path = GIT_BUF_INIT, obj = GIT_BUF_INIT;
+	git_rawobj raw;
+	size_t i, *order;
+	int error = 0;
+
+	assert(backend && (ids || !count));
+
+	order = git__calloc(count ? count : 1, sizeof(size_t));
+	GITERR_CHECK_ALLOC(order);
+
+	for (i = 0; i < count; i++)
+		order[i] = i;
+
+	git__qsort_r(order, count, sizeof(size_t), read_many_cmp, (void *)ids);
+
+	for (i = 0; i < count && !error; i++) {
+		if ((error = object_file_name(&object_path, (loose_backend *)backend, &ids[order[i]])) < 0)
+			break;
+
+		if ((error = git_futils_readbuffer(&obj, object_path.ptr)) == GIT_ENOTFOUND) {
+			giterr_clear();
+			error = 0;
+			continue;
+		}
+
+		if (error < 0 || (error = inflate_disk_obj(&raw, &obj)) < 0)
+			break;
+
+		error = cb(order[i], raw.data, raw.len, raw.type, payload);
+	}
+
+	git_buf_free(&object_path);
+	git_buf_free(&obj);
+	git__free(order);
+
+	return error;
+}
+
 static int loose_backend__read_prefix(
 	git_oid *out_oid,
 	void **buffer_p,
@@ -692,8 +890,14 @@ static int loose_backend__exists(git_odb_backend *backend, const git_oid *oid)
 
 	assert(backend && oid);
 
+	if (git_odb__negative_cache && missing_contains((loose_backend *)backend, oid))
+		return (int)false;
+
 	error = locate_object(&object_path, (loose_backend *)backend, oid);
 
+	if (error == GIT_ENOTFOUND && git_odb__negative_cache)
+		missing_add((loose_backend *)backend, oid);
+
 	git_buf_free(&object_path);
 
 	return !error;
@@ -702,17 +906,9 @@ static int loose_backend__exists(git_odb_backend *backend, const git_oid *oid)
 static int loose_backend__exists_prefix(
 	git_oid *out, git_odb_backend *backend, const git_oid *short_id, size_t len)
 {
-	git_buf object_path = GIT_BUF_INIT;
-	int error;
-
 	assert(backend && out && short_id && len >= GIT_OID_MINPREFIXLEN);
 
-	error = locate_object_short_oid(
-		&object_path, out, (loose_backend *)backend, short_id, len);
-
-	git_buf_free(&object_path);
-
-	return error;
+	return fanout_find(out, (loose_backend *)backend, short_id, len);
 }
 
 struct foreach_state {
@@ -815,6 +1011,11 @@ static int loose_backend__stream_fwrite(git_odb_stream *_stream, const git_oid *
 		error = git_filebuf_commit_at(
 			&stream->fbuf, final_path.ptr);
 
+	if (!error) {
+		missing_remove(backend, oid);
+		fanout_invalidate(backend, oid);
+	}
+
 	git_buf_free(&final_path);
 
 	return error;
@@ -906,6 +1107,10 @@ static int loose_backend__write(git_odb_backend *_backend, const git_oid *oid, c
 		object_mkdir(&final_path, backend) < 0 ||
 		git_filebuf_commit_at(&fbuf, final_path.ptr) < 0)
 		error = -1;
+	else {
+		missing_remove(backend, oid);
+		fanout_invalidate(backend, oid);
+	}
 
 cleanup:
 	if (error < 0)
@@ -920,9 +1125,38 @@ static void loose_backend__free(git_odb_backend *_backend)
 	assert(_backend);
 	backend = (loose_backend *)_backend;
 
+	git__free(backend->missing);
+	git_mutex_free(&backend->missing_lock);
+	fanout_free(backend);
+	git_mutex_free(&backend->fanout_lock);
 	git__free(backend);
 }
 
+static int loose_backend__refresh(git_odb_backend *_backend)
+{
+	loose_backend *backend = (loose_backend *)_backend;
+
+	if (git_mutex_lock(&backend->missing_lock) < 0) {
+		giterr_set(GITERR_OS, "failed to lock loose object backend");
+		return -1;
+	}
+
+	git__free(backend->missing);
+	backend->missing = NULL;
+
+	git_mutex_unlock(&backend->missing_lock);
+
+	if (git_mutex_lock(&backend->fanout_lock) < 0) {
+		giterr_set(GITERR_OS, "failed to lock loose object backend");
+		return -1;
+	}
+
+	fanout_free(backend);
+
+	git_mutex_unlock(&backend->fanout_lock);
+	return 0;
+}
+
 int git_odb_backend_loose(
 	git_odb_backend **backend_out,
 	const char *objects_dir,
@@ -962,6 +1196,8 @@ int git_odb_backend_loose(
 	backend->fsync_object_files = do_fsync;
 	backend->object_dir_mode = dir_mode;
 	backend->object_file_mode = file_mode;
+	git_mutex_init(&backend->missing_lock);
+	git_mutex_init(&backend->fanout_lock);
 
 	backend->parent.read = &loose_backend__read;
 	backend->parent.write = &loose_backend__write;
@@ -970,7 +1206,9 @@ int git_odb_backend_loose(
 	backend->parent.writestream = &loose_backend__stream;
 	backend->parent.exists = &loose_backend__exists;
 	backend->parent.exists_prefix = &loose_backend__exists_prefix;
+	backend->parent.refresh = &loose_backend__refresh;
 	backend->parent.foreach = &loose_backend__foreach;
+	backend->parent.read_many = &loose_backend__read_many;
 	backend->parent.free = &loose_backend__free;
 
 	*backend_out = (git_odb_backend *)backend;
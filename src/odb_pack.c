@@ -17,14 +17,23 @@
 #include "sha1_lookup.h"
 #include "mwindow.h"
 #include "pack.h"
+#include "midx.h"
+#include "bloom.h"
 
 #include "git2/odb_backend.h"
 
 struct pack_backend {
 	git_odb_backend parent;
+	git_midx_file *midx;
+	git_vector midx_packs;
 	git_vector packs;
 	struct git_pack_file *last_found;
 	char *pack_folder;
+
+	/* of the ids in every pack, for the negative cache */
+	git_mutex bloom_lock;
+	git_bloom bloom;
+	size_t bloom_packs; /* how many packs there were when it was built */
 };
 
 struct pack_writepack {
@@ -77,6 +86,14 @@ struct pack_writepack {
  *
  *
  *
+ *	|-# refresh_multi_pack_index
+ *		If the pack folder contains a `multi-pack-index` file, load it
+ *		and move every packfile it describes from the `packs` list to
+ *		the `midx_packs` list, in the order of the index. Those packs
+ *		are then only searched through the multi-pack-index.
+ *
+ *
+ *
  *	Chapter 2: To be, or not to be...
  *	A standard packed `exist` query for an OID
  *	--------------------------------------------------
@@ -86,9 +103,11 @@ struct pack_writepack {
  * | that have been loaded for our ODB.
  * |
  * |-# pack_entry_find
- *	| Iterate through all the packs that have been preloaded
- *	| (starting by the pack where the latest object was found)
- *	| to try to find the OID in one of them.
+ *	| Look up the OID in the multi-pack-index, if there is one,
+ *	| with a single binary search. Otherwise iterate through all
+ *	| the packs that have been preloaded (starting by the pack
+ *	| where the latest object was found) to try to find the OID
+ *	| in one of them.
  *	|
  *	|-# pack_entry_find1
  *		| Check the index of an individual pack to see if the SHA1
@@ -190,12 +209,35 @@ static int packfile_sort__cb(const void *a_, const void *b_)
 }
 
 
+static int packfile_byname_search_cmp(const void *path_, const void *p_)
+{
+	const git_buf *path = (const git_buf *)path_;
+	const struct git_pack_file *p = (const struct git_pack_file *)p_;
+
+	return strncmp(p->pack_name, git_buf_cstr(path), git_buf_len(path));
+}
+
+static bool packfile_is_loaded(
+	const git_vector *packs, const char *path_str, size_t cmp_len)
+{
+	size_t i;
+
+	for (i = 0; i < packs->length; ++i) {
+		struct git_pack_file *p = git_vector_get(packs, i);
+
+		if (memcmp(p->pack_name, path_str, cmp_len) == 0)
+			return true;
+	}
+
+	return false;
+}
+
 static int packfile_load__cb(void *data, git_buf *path)
 {
 	struct pack_backend *backend = data;
 	struct git_pack_file *pack;
 	const char *path_str = git_buf_cstr(path);
-	size_t i, cmp_len = git_buf_len(path);
+	size_t cmp_len = git_buf_len(path);
 	int error;
 
 	if (cmp_len <= strlen(".idx") || git__suffixcmp(path_str, ".idx") != 0)
@@ -203,12 +245,9 @@ static int packfile_load__cb(void *data, git_buf *path)
 
 	cmp_len -= strlen(".idx");
 
-	for (i = 0; i < backend->packs.length; ++i) {
-		struct git_pack_file *p = git_vector_get(&backend->packs, i);
-
-		if (memcmp(p->pack_name, path_str, cmp_len) == 0)
-			return 0;
-	}
+	if (packfile_is_loaded(&backend->midx_packs, path_str, cmp_len) ||
+		packfile_is_loaded(&backend->packs, path_str, cmp_len))
+		return 0;
 
 	error = git_mwindow_get_pack(&pack, path->ptr);
 
@@ -253,14 +292,136 @@ static int pack_entry_find_inner(
 	return -1;
 }
 
+static int pack_entry_find_midx(
+	struct git_pack_entry *e,
+	struct pack_backend *backend,
+	const git_oid *short_oid,
+	size_t len)
+{
+	git_midx_entry midx_entry;
+	struct git_pack_file *p;
+	int error;
+
+	if ((error = git_midx_entry_find(&midx_entry, backend->midx, short_oid, len)) < 0)
+		return error;
+
+	p = git_vector_get(&backend->midx_packs, midx_entry.pack_index);
+	if (p == NULL)
+		return git_odb__error_notfound("no packfile for multi-pack-index entry", short_oid);
+
+	/* make sure the packfile backing the index still exists on disk */
+	if (p->mwf.fd == -1 && (error = git_packfile_open(p)) < 0)
+		return error;
+
+	e->offset = midx_entry.offset;
+	e->nr = UINT32_MAX;
+	e->p = p;
+	git_oid_cpy(&e->sha1, &midx_entry.sha1);
+
+	return 0;
+}
+
+static int bloom_add_id(const git_oid *id, git_off_t offset, void *payload)
+{
+	GIT_UNUSED(offset);
+
+	git_bloom_add(payload, id);
+	return 0;
+}
+
+static int bloom_add_midx_id(const git_oid *id, void *payload)
+{
+	git_bloom_add(payload, id);
+	return 0;
+}
+
+/*
+ * The objects of the packs the multi-pack-index covers come from the
+ * index itself, so that building the filter does not open their own
+ * `.idx` files.
+ */
+static int bloom_build(struct pack_backend *backend)
+{
+	struct git_pack_file *p;
+	size_t i, nr_ids = 0;
+	uint32_t nr;
+	int error;
+
+	if (backend->midx)
+		nr_ids += backend->midx->num_objects;
+
+	git_vector_foreach(&backend->packs, i, p) {
+		if ((error = git_packfile__num_objects(&nr, p)) < 0)
+			return error;
+		nr_ids += nr;
+	}
+
+	if ((error = git_bloom_init(&backend->bloom, nr_ids)) < 0)
+		return error;
+
+	if (backend->midx &&
+		(error = git_midx_foreach_entry(
+			backend->midx, bloom_add_midx_id, &backend->bloom)) < 0)
+		goto on_error;
+
+	git_vector_foreach(&backend->packs, i, p) {
+		if ((error = git_pack_foreach_entry_offset(
+				p, bloom_add_id, &backend->bloom)) < 0)
+			goto on_error;
+	}
+
+	return 0;
+
+on_error:
+	git_bloom_free(&backend->bloom);
+	return error;
+}
+
+/*
+ * With the negative cache, tell whether the object may be in one of
+ * the packs without searching their indexes. Refreshing the backend
+ * only ever adds packs, so the filter is rebuilt when their number
+ * changes.
+ */
+static bool pack_backend__may_have(struct pack_backend *backend, const git_oid *oid)
+{
+	size_t nr_packs = backend->packs.length + backend->midx_packs.length;
+	bool found = true;
+
+	if (!git_odb__negative_cache || git_mutex_lock(&backend->bloom_lock) < 0)
+		return true;
+
+	if (backend->bloom_packs != nr_packs) {
+		git_bloom_free(&backend->bloom);
+		backend->bloom_packs = nr_packs;
+
+		/* without a filter, every lookup searches the indexes */
+		if (bloom_build(backend) < 0)
+			giterr_clear();
+	}
+
+	if (backend->bloom.words)
+		found = git_bloom_contains(&backend->bloom, oid);
+
+	git_mutex_unlock(&backend->bloom_lock);
+	return found;
+}
+
 static int pack_entry_find(struct git_pack_entry *e, struct pack_backend *backend, const git_oid *oid)
 {
 	struct git_pack_file *last_found = backend->last_found;
 
+	if (!pack_backend__may_have(backend, oid))
+		return git_odb__error_notfound("failed to find pack entry", oid);
+
 	if (backend->last_found &&
 		git_pack_entry_find(e, backend->last_found, oid, GIT_OID_HEXSZ) == 0)
 		return 0;
 
+	if (backend->midx &&
+		pack_entry_find_midx(e, backend, oid, GIT_OID_HEXSZ) == 0)
+		return 0;
+
 	if (!pack_entry_find_inner(e, backend, oid, last_found))
 		return 0;
 
@@ -289,6 +450,18 @@ static int pack_entry_find_prefix(
 		}
 	}
 
+	if (backend->midx) {
+		error = pack_entry_find_midx(e, backend, short_oid, len);
+		if (error == GIT_EAMBIGUOUS)
+			return error;
+		if (!error) {
+			if (found && git_oid_cmp(&e->sha1, &found_full_oid))
+				return git_odb__error_ambiguous("found multiple pack entries");
+			git_oid_cpy(&found_full_oid, &e->sha1);
+			found = true;
+		}
+	}
+
 	for (i = 0; i < backend->packs.length; ++i) {
 		struct git_pack_file *p;
 
@@ -315,6 +488,110 @@ static int pack_entry_find_prefix(
 }
 
 
+/*
+ * Stop using the multi-pack-index. The packs it described are moved
+ * back into the regular pack list, so they don't need to be reopened.
+ */
+static int remove_multi_pack_index(struct pack_backend *backend)
+{
+	size_t i;
+	struct git_pack_file *p;
+	int error = 0;
+
+	git_vector_foreach(&backend->midx_packs, i, p) {
+		if (!error && (error = git_vector_insert(&backend->packs, p)) == 0)
+			continue;
+
+		if (backend->last_found == p)
+			backend->last_found = NULL;
+		git_mwindow_put_pack(p);
+	}
+
+	git_vector_clear(&backend->midx_packs);
+	git_midx_free(backend->midx);
+	backend->midx = NULL;
+
+	git_vector_sort(&backend->packs);
+
+	return error;
+}
+
+/*
+ * Load (or reload, if it has changed) the multi-pack-index in the pack
+ * folder. A multi-pack-index that cannot be used is ignored, like git
+ * does, and we fall back to searching every pack.
+ */
+static int refresh_multi_pack_index(struct pack_backend *backend)
+{
+	int error;
+	git_buf midx_path = GIT_BUF_INIT;
+	const char *packfile_name;
+	size_t i, path_len;
+
+	if ((error = git_buf_joinpath(&midx_path, backend->pack_folder, GIT_MIDX_FILE)) < 0)
+		return error;
+
+	if (backend->midx) {
+		if (!git_midx_needs_refresh(backend->midx, git_buf_cstr(&midx_path)))
+			goto done;
+
+		if ((error = remove_multi_pack_index(backend)) < 0)
+			goto done;
+	}
+
+	if (!git_path_exists(git_buf_cstr(&midx_path)))
+		goto done;
+
+	if (git_midx_open(&backend->midx, git_buf_cstr(&midx_path)) < 0) {
+		giterr_clear();
+		backend->midx = NULL;
+		goto done;
+	}
+
+	git_buf_truncate(&midx_path, git_buf_len(&midx_path) - strlen(GIT_MIDX_FILE));
+	path_len = git_buf_len(&midx_path);
+
+	git_vector_foreach(&backend->midx->packfile_names, i, packfile_name) {
+		struct git_pack_file *p;
+		size_t found_position;
+
+		git_buf_truncate(&midx_path, path_len);
+		git_buf_put(&midx_path, packfile_name, strlen(packfile_name) - strlen(".idx"));
+		if (git_buf_oom(&midx_path)) {
+			error = -1;
+			break;
+		}
+
+		if (git_vector_search2(&found_position,
+				&backend->packs, packfile_byname_search_cmp, &midx_path) == 0) {
+			p = git_vector_get(&backend->packs, found_position);
+			git_vector_remove(&backend->packs, found_position);
+		} else {
+			git_buf_puts(&midx_path, ".idx");
+
+			if ((error = git_mwindow_get_pack(&p, git_buf_cstr(&midx_path))) < 0)
+				break;
+		}
+
+		if ((error = git_vector_insert(&backend->midx_packs, p)) < 0) {
+			git_mwindow_put_pack(p);
+			break;
+		}
+	}
+
+	/* a packfile named in the index is gone; the index is stale */
+	if (error == GIT_ENOTFOUND) {
+		giterr_clear();
+		error = remove_multi_pack_index(backend);
+	} else if (error < 0) {
+		remove_multi_pack_index(backend);
+	}
+
+done:
+	git_buf_free(&midx_path);
+	return error;
+}
+
 /***********************************************************
  *
  * PACKED BACKEND PUBLIC API
@@ -335,6 +612,9 @@ static int pack_backend__refresh(git_odb_backend *backend_)
 	if (p_stat(backend->pack_folder, &st) < 0 || !S_ISDIR(st.st_mode))
 		return git_odb__error_notfound("failed to refresh packfiles", NULL);
 
+	if ((error = refresh_multi_pack_index(backend)) < 0)
+		return error;
+
 	git_buf_sets(&path, backend->pack_folder);
 
 	/* reload all packs */
@@ -358,7 +638,7 @@ static int pack_backend__read_header_internal(
 	if ((error = pack_entry_find(&e, (struct pack_backend *)backend, oid)) < 0)
 		return error;
 
-	return git_packfile_resolve_header(len_p, type_p, e.p, e.offset);
+	return git_packfile_resolve_header_nth(len_p, type_p, e.p, e.offset, e.nr);
 }
 
 static int pack_backend__read_header(
@@ -475,6 +755,103 @@ static int pack_backend__read_prefix(
 		out_oid, buffer_p, len_p, type_p, backend, short_oid, len);
 }
 
+struct pack_read_entry {
+	struct git_pack_file *p;
+	git_off_t offset;
+	size_t idx;
+};
+
+static int pack_read_entry_cmp(const void *a, const void *b, void *payload)
+{
+	const struct pack_read_entry *ea = a, *eb = b;
+
+	GIT_UNUSED(payload);
+
+	if (ea->p != eb->p)
+		return ((uintptr_t)ea->p < (uintptr_t)eb->p) ? -1 : 1;
+
+	return (ea->offset < eb->offset) ? -1 : (ea->offset > eb->offset);
+}
+
+/*
+ * Look up every object first, then unpack them grouped by packfile and
+ * in the order they are stored in it, so that the windows we map are
+ * used for many objects and the reads move forward through the file.
+ */
+static int pack_backend__read_many(
+	git_odb_backend *_backend,
+	const git_oid *ids,
+	size_t count,
+	git_odb_backend_read_many_cb cb,
+	void *payload)
+{
+	struct pack_backend *backend = (struct pack_backend *)_backend;
+	git_array_t(struct pack_read_entry) entries = GIT_ARRAY_INIT;
+	struct pack_read_entry *entry;
+	struct git_pack_entry e;
+	git_rawobj raw;
+	bool refreshed = false;
+	size_t i;
+	int error = 0;
+
+	for (i = 0; i < count; i++) {
+		error = pack_entry_find(&e, backend, &ids[i]);
+
+		if (error == GIT_ENOTFOUND && !refreshed) {
+			refreshed = true;
+
+			if ((error = pack_backend__refresh(_backend)) < 0)
+				goto done;
+
+			error = pack_entry_find(&e, backend, &ids[i]);
+		}
+
+		if (error == GIT_ENOTFOUND) {
+			error = 0;
+			continue;
+		}
+
+		if (error < 0)
+			goto done;
+
+		entry = git_array_alloc(entries);
+		if (!entry) {
+			error = -1;
+			goto done;
+		}
+
+		entry->p = e.p;
+		entry->offset = e.offset;
+		entry->idx = i;
+	}
+
+	giterr_clear();
+
+	git__qsort_r(entries.ptr, git_array_size(entries), sizeof(struct pack_read_entry),
+		pack_read_entry_cmp, NULL);
+
+	for (i = 0; i < git_array_size(entries); i++) {
+		entry = git_array_get(entries, i);
+
+		if ((error = git_packfile_unpack(&raw, entry->p, &entry->offset)) < 0 ||
+			(error = cb(entry->idx, raw.data, raw.len, raw.type, payload)) != 0)
+			break;
+	}
+
+done:
+	git_array_clear(entries);
+	return error;
+}
+
+int git_odb_backend__find_packed(
+	struct git_pack_entry *e, git_odb_backend *backend, const git_oid *oid)
+{
+	if (backend->read != &pack_backend__read)
+		return GIT_PASSTHROUGH;
+
+	return pack_entry_find(e, (struct pack_backend *)backend, oid);
+}
+
 static int pack_backend__exists(git_odb_backend *backend, const git_oid *oid)
 {
 	struct git_pack_entry e;
@@ -485,6 +862,10 @@ static int pack_backend__exists(git_odb_backend *backend, const git_oid *oid)
 	if (error != GIT_ENOTFOUND)
 		return error == 0;
 
+	/* new packs are only looked for by `git_odb_refresh` then */
+	if (git_odb__negative_cache)
+		return (int)false;
+
 	if ((error = pack_backend__refresh(backend)) < 0) {
 		giterr_clear();
 		return (int)false;
@@ -524,6 +905,10 @@ static int pack_backend__foreach(git_odb_backend *_backend, git_odb_foreach_cb c
 	if ((error = pack_backend__refresh(_backend)) < 0)
 		return error;
 
+	if (backend->midx &&
+		(error = git_midx_foreach_entry(backend->midx, cb, data)) < 0)
+		return error;
+
 	git_vector_foreach(&backend->packs, i, p) {
 		if ((error = git_pack_foreach_entry(p, cb, data)) < 0)
 			return error;
@@ -544,10 +929,18 @@ static int pack_backend__writepack_append(struct git_odb_writepack *_writepack,
 static int pack_backend__writepack_commit(struct git_odb_writepack *_writepack, git_transfer_progress *stats)
 {
 	struct pack_writepack *writepack = (struct pack_writepack *)_writepack;
+	int error;
 
 	assert(writepack);
 
-	return git_indexer_commit(writepack->indexer, stats);
+	if ((error = git_indexer_commit(writepack->indexer, stats)) < 0)
+		return error;
+
+	/* the negative cache would hide the new pack until the next refresh */
+	if (git_odb__negative_cache)
+		error = pack_backend__refresh(writepack->parent.backend);
+
+	return error;
 }
 
 static void pack_backend__writepack_free(struct git_odb_writepack *_writepack)
@@ -584,6 +977,14 @@ static int pack_backend__writepack(struct git_odb_writepack **out,
 		return -1;
 	}
 
+	/* resolve what we can while the pack is still being received */
+	if (git_indexer_set_eager_deltas(writepack->indexer, 1) < 0 ||
+		git_indexer_set_objinfo(writepack->indexer, git_pack__write_objinfo) < 0) {
+		git_indexer_free(writepack->indexer);
+		git__free(writepack);
+		return -1;
+	}
+
 	writepack->parent.backend = _backend;
 	writepack->parent.append = pack_backend__writepack_append;
 	writepack->parent.commit = pack_backend__writepack_commit;
@@ -603,12 +1004,21 @@ static void pack_backend__free(git_odb_backend *_backend)
 
 	backend = (struct pack_backend *)_backend;
 
+	for (i = 0; i < backend->midx_packs.length; ++i) {
+		struct git_pack_file *p = git_vector_get(&backend->midx_packs, i);
+		git_mwindow_put_pack(p);
+	}
+
 	for (i = 0; i < backend->packs.length; ++i) {
 		struct git_pack_file *p = git_vector_get(&backend->packs, i);
 		git_mwindow_put_pack(p);
 	}
 
+	git_midx_free(backend->midx);
+	git_vector_free(&backend->midx_packs);
 	git_vector_free(&backend->packs);
+	git_bloom_free(&backend->bloom);
+	git_mutex_free(&backend->bloom_lock);
 	git__free(backend->pack_folder);
 	git__free(backend);
 }
@@ -618,11 +1028,19 @@ static int pack_backend__alloc(struct pack_backend **out, size_t initial_size)
 	struct pack_backend *backend = git__calloc(1, sizeof(struct pack_backend));
 	GITERR_CHECK_ALLOC(backend);
 
+	if (git_vector_init(&backend->midx_packs, 0, NULL) < 0) {
+		git__free(backend);
+		return -1;
+	}
+
 	if (git_vector_init(&backend->packs, initial_size, packfile_sort__cb) < 0) {
+		git_vector_free(&backend->midx_packs);
 		git__free(backend);
 		return -1;
 	}
 
+	git_mutex_init(&backend->bloom_lock);
+
 	backend->parent.version = GIT_ODB_BACKEND_VERSION;
 
 	backend->parent.read = &pack_backend__read;
@@ -633,6 +1051,7 @@ static int pack_backend__alloc(struct pack_backend **out, size_t initial_size)
 	backend->parent.refresh = &pack_backend__refresh;
 	backend->parent.foreach = &pack_backend__foreach;
 	backend->parent.writepack = &pack_backend__writepack;
+	backend->parent.read_many = &pack_backend__read_many;
 	backend->parent.free = &pack_backend__free;
 
 	*out = backend;
@@ -9,9 +9,12 @@
 
 #include "zstream.h"
 #include "delta.h"
+#include "delta_index_cache.h"
 #include "iterator.h"
 #include "netops.h"
+#include "odb.h"
 #include "pack.h"
+#include "pack_bitmap.h"
 #include "thread-utils.h"
 #include "tree.h"
 #include "util.h"
@@ -28,9 +31,25 @@ struct unpacked {
 	git_pobject *object;
 	void *data;
 	struct git_delta_index *index;
+	git_delta_index_cache_entry *cached; /* which owns the index if set */
 	int depth;
 };
 
+/*
+ * The objects a thread is searching deltas against. Each thread has its
+ * own, along with its share of the delta cache, so that the search does
+ * not need any lock.
+ */
+struct delta_window {
+	struct unpacked *array;
+	unsigned int size;
+	uint32_t idx, count;
+	unsigned long mem_usage;
+
+	uint64_t cache_size;
+	uint64_t max_cache_size;
+};
+
 struct tree_walk_context {
 	git_packbuilder *pb;
 	git_buf buf;
@@ -57,8 +76,6 @@ GIT__USE_OIDMAP
 
 #endif /* GIT_THREADS */
 
-#define git_packbuilder__cache_lock(pb) GIT_PACKBUILDER__MUTEX_OP(pb, cache_mutex, lock)
-#define git_packbuilder__cache_unlock(pb) GIT_PACKBUILDER__MUTEX_OP(pb, cache_mutex, unlock)
 #define git_packbuilder__progress_lock(pb) GIT_PACKBUILDER__MUTEX_OP(pb, progress_mutex, lock)
 #define git_packbuilder__progress_unlock(pb) GIT_PACKBUILDER__MUTEX_OP(pb, progress_mutex, unlock)
 
@@ -68,24 +85,9 @@ GIT__USE_OIDMAP
 /* Size of the buffer to feed to zlib */
 #define COMPRESS_BUFLEN (1024 * 1024)
 
-static unsigned name_hash(const char *name)
+static int add_island_cb(const git_config_entry *entry, void *payload)
 {
-	unsigned c, hash = 0;
-
-	if (!name)
-		return 0;
-
-	/*
-	 * This effectively just creates a sortable number from the
-	 * last sixteen non-whitespace characters. Last characters
-	 * count "most", so things that end in ".c" sort together.
-	 */
-	while ((c = *name++) != 0) {
-		if (git__isspace(c))
-			continue;
-		hash = (hash >> 2) + (c << 24);
-	}
-	return hash;
+	return git_packbuilder_add_island(payload, entry->value);
 }
 
 static int packbuilder_config(git_packbuilder *pb)
@@ -110,12 +112,21 @@ static int packbuilder_config(git_packbuilder *pb)
 	config_get("pack.deltaCacheSize", pb->big_file_threshold,
 		   GIT_PACK_BIG_FILE_THRESHOLD);
 	config_get("pack.windowMemory", pb->window_memory_limit, 0);
+	config_get("pack.nameHashVersion", pb->name_hash,
+		   GIT_PACKBUILDER_NAME_HASH_FILENAME);
 
 #undef config_get
 
+	if ((ret = git_packbuilder_set_name_hash(pb, pb->name_hash)) == 0 &&
+		(ret = git_config_get_multivar_foreach(config,
+			"pack.island", NULL, add_island_cb, pb)) == GIT_ENOTFOUND) {
+		giterr_clear();
+		ret = 0;
+	}
+
 	git_config_free(config);
 
-	return 0;
+	return ret;
 }
 
 int git_packbuilder_new(git_packbuilder **out, git_repository *repo)
@@ -140,6 +151,8 @@ int git_packbuilder_new(git_packbuilder **out, git_repository *repo)
 
 	pb->repo = repo;
 	pb->nr_threads = 1; /* do not spawn any thread by default */
+	pb->reuse = true;
+	pb->ofs_delta = true;
 
 	if (git_hash_ctx_init(&pb->ctx) < 0 ||
 		git_zstream_init(&pb->zstream) < 0 ||
@@ -149,9 +162,7 @@ int git_packbuilder_new(git_packbuilder **out, git_repository *repo)
 
 #ifdef GIT_THREADS
 
-	if (git_mutex_init(&pb->cache_mutex) ||
-		git_mutex_init(&pb->progress_mutex) ||
-		git_cond_init(&pb->progress_cond))
+	if (git_mutex_init(&pb->progress_mutex))
 	{
 		giterr_set(GITERR_OS, "Failed to initialize packbuilder mutex");
 		goto on_error;
@@ -181,6 +192,46 @@ unsigned int git_packbuilder_set_threads(git_packbuilder *pb, unsigned int n)
 	return pb->nr_threads;
 }
 
+void git_packbuilder_set_reuse(git_packbuilder *pb, int enabled)
+{
+	assert(pb);
+
+	pb->reuse = !!enabled;
+}
+
+void git_packbuilder_set_ofs_delta(git_packbuilder *pb, int enabled)
+{
+	assert(pb);
+
+	pb->ofs_delta = !!enabled;
+}
+
+int git_packbuilder_set_name_hash(
+	git_packbuilder *pb, git_packbuilder_name_hash_t name_hash)
+{
+	assert(pb);
+
+	if (name_hash != GIT_PACKBUILDER_NAME_HASH_FILENAME &&
+		name_hash != GIT_PACKBUILDER_NAME_HASH_PATH) {
+		giterr_set(GITERR_INVALID, "unknown name hash version %d", (int)name_hash);
+		return -1;
+	}
+
+	pb->name_hash = name_hash;
+	return 0;
+}
+
+int git_packbuilder_add_island(git_packbuilder *pb, const char *pattern)
+{
+	assert(pb && pattern);
+
+	if (!pb->islands && git_delta_islands_new(&pb->islands) < 0)
+		return -1;
+
+	pb->done = false;
+	return git_delta_islands_add(pb->islands, pattern);
+}
+
 static void rehash(git_packbuilder *pb)
 {
 	git_pobject *po;
@@ -195,22 +246,18 @@ static void rehash(git_packbuilder *pb)
 	}
 }
 
-int git_packbuilder_insert(git_packbuilder *pb, const git_oid *oid,
-			   const char *name)
+static int insert_object(
+	git_packbuilder *pb,
+	const git_oid *oid,
+	git_otype type,
+	size_t size,
+	unsigned int hash)
 {
 	git_pobject *po;
 	khiter_t pos;
 	size_t newsize;
 	int ret;
 
-	assert(pb && oid);
-
-	/* If the object already exists in the hash table, then we don't
-	 * have any work to do */
-	pos = kh_get(oid, pb->object_ix, oid);
-	if (pos != kh_end(pb->object_ix))
-		return 0;
-
 	if (pb->nr_objects >= pb->nr_alloc) {
 		GITERR_CHECK_ALLOC_ADD(&newsize, pb->nr_alloc, 1024);
 		GITERR_CHECK_ALLOC_MULTIPLY(&newsize, newsize, 3 / 2);
@@ -231,12 +278,11 @@ int git_packbuilder_insert(git_packbuilder *pb, const git_oid *oid,
 	po = pb->object_list + pb->nr_objects;
 	memset(po, 0x0, sizeof(*po));
 
-	if ((ret = git_odb_read_header(&po->size, &po->type, pb->odb, oid)) < 0)
-		return ret;
-
 	pb->nr_objects++;
 	git_oid_cpy(&po->id, oid);
-	po->hash = name_hash(name);
+	po->type = type;
+	po->size = size;
+	po->hash = hash;
 
 	pos = kh_put(oid, pb->object_ix, &po->id, &ret);
 	if (ret < 0) {
@@ -267,6 +313,30 @@ int git_packbuilder_insert(git_packbuilder *pb, const git_oid *oid,
 	return 0;
 }
 
+int git_packbuilder_insert(git_packbuilder *pb, const git_oid *oid,
+			   const char *name)
+{
+	git_otype type;
+	size_t size;
+	khiter_t pos;
+	int ret;
+
+	assert(pb && oid);
+
+	/* If the object already exists in the hash table, then we don't
+	 * have any work to do */
+	pos = kh_get(oid, pb->object_ix, oid);
+	if (pos != kh_end(pb->object_ix))
+		return 0;
+
+	if ((ret = git_odb_read_header(&size, &type, pb->odb, oid)) < 0)
+		return ret;
+
+	return insert_object(pb, oid, type, size,
+		pb->name_hash == GIT_PACKBUILDER_NAME_HASH_PATH ?
+		git_packfile__name_hash_path(name) : git_packfile__name_hash(name));
+}
+
 static int get_delta(void **out, git_odb *odb, git_pobject *po)
 {
 	git_odb_object *src = NULL, *trg = NULL;
@@ -301,6 +371,149 @@ on_error:
 	return -1;
 }
 
+/* Write to the pack and to its checksum, keeping track of the offset */
+static int write_pack_data(
+	git_packbuilder *pb,
+	void *buf,
+	size_t len,
+	int (*write_cb)(void *buf, size_t size, void *cb_data),
+	void *cb_data)
+{
+	int error;
+
+	if ((error = write_cb(buf, len, cb_data)) < 0 ||
+		(error = git_hash_update(&pb->ctx, buf, len)) < 0)
+		return error;
+
+	pb->write_offset += len;
+	return 0;
+}
+
+/*
+ * Write the header of an object, followed for a delta by its base: the
+ * distance back to it when it is in the pack already and offset deltas
+ * are enabled, its id otherwise.
+ */
+static int write_object_header(
+	git_packbuilder *pb,
+	git_pobject *po,
+	git_otype type,
+	size_t size,
+	int (*write_cb)(void *buf, size_t size, void *cb_data),
+	void *cb_data)
+{
+	unsigned char hdr[10], ofs_hdr[10];
+	size_t hdr_len, pos = sizeof(ofs_hdr) - 1;
+	git_off_t ofs;
+	int error;
+
+	if (po->delta)
+		type = (pb->ofs_delta && po->delta->written) ?
+			GIT_OBJ_OFS_DELTA : GIT_OBJ_REF_DELTA;
+
+	hdr_len = git_packfile__object_header(hdr, size, type);
+
+	if ((error = write_pack_data(pb, hdr, hdr_len, write_cb, cb_data)) < 0)
+		return error;
+
+	if (type == GIT_OBJ_REF_DELTA)
+		return write_pack_data(pb, po->delta->id.id, GIT_OID_RAWSZ,
+			write_cb, cb_data);
+
+	if (type != GIT_OBJ_OFS_DELTA)
+		return 0;
+
+	/*
+	 * The distance is written most significant group first, with one
+	 * taken off every group but the last, as `get_delta_base()` reads
+	 * it.
+	 */
+	ofs = po->offset - po->delta->offset;
+	ofs_hdr[pos] = ofs & 127;
+	while (ofs >>= 7)
+		ofs_hdr[--pos] = 128 | (--ofs & 127);
+
+	return write_pack_data(pb, ofs_hdr + pos, sizeof(ofs_hdr) - pos,
+		write_cb, cb_data);
+}
+
+struct reuse_write_context {
+	git_packbuilder *pb;
+	int (*write_cb)(void *buf, size_t size, void *cb_data);
+	void *cb_data;
+};
+
+static int reuse_crc_cb(void *buf, size_t len, void *payload)
+{
+	uint32_t *crc = payload;
+
+	*crc = crc32(*crc, buf, (uInt)len);
+	return 0;
+}
+
+static int reuse_write_cb(void *buf, size_t len, void *payload)
+{
+	struct reuse_write_context *ctx = payload;
+
+	return write_pack_data(ctx->pb, buf, len, ctx->write_cb, ctx->cb_data);
+}
+
+/*
+ * Copy the compressed data of an object from the packfile where it is
+ * already stored. Returns GIT_PASSTHROUGH when it cannot be reused and
+ * the object must be written from its inflated data instead.
+ */
+static int write_reused_object(
+	git_packbuilder *pb,
+	git_pobject *po,
+	int (*write_cb)(void *buf, size_t size, void *cb_data),
+	void *cb_data)
+{
+	struct reuse_write_context ctx;
+	git_pack_raw_entry raw;
+	uint32_t crc;
+	int error;
+
+	if ((error = git_packfile__raw_entry(&raw, po->in_pack, po->in_pack_offset)) < 0)
+		return error;
+
+	/* a stored delta is only usable against the same base */
+	if (raw.type == GIT_OBJ_OFS_DELTA || raw.type == GIT_OBJ_REF_DELTA) {
+		if (!po->delta || !po->reused_delta ||
+			!git_oid_equal(&po->delta->id, &raw.base_id))
+			return GIT_PASSTHROUGH;
+	} else if (po->delta) {
+		return GIT_PASSTHROUGH;
+	}
+
+	/* do not spread a corruption of the source packfile */
+	crc = crc32(0L, Z_NULL, 0);
+	if ((error = git_packfile__foreach_raw(po->in_pack,
+			po->in_pack_offset, raw.end_offset, reuse_crc_cb, &crc)) < 0)
+		return error;
+
+	if (crc != raw.crc)
+		return GIT_PASSTHROUGH;
+
+	/* the base of a delta is written the way we write our own deltas */
+	po->offset = pb->write_offset;
+
+	if ((error = write_object_header(pb, po, raw.type, raw.size,
+			write_cb, cb_data)) < 0)
+		return error;
+
+	ctx.pb = pb;
+	ctx.write_cb = write_cb;
+	ctx.cb_data = cb_data;
+
+	if ((error = git_packfile__foreach_raw(po->in_pack,
+			raw.data_offset, raw.end_offset, reuse_write_cb, &ctx)) < 0)
+		return error;
+
+	pb->nr_written++;
+	return 0;
+}
+
 static int write_object(
 	git_packbuilder *pb,
 	git_pobject *po,
@@ -309,11 +522,21 @@ static int write_object(
 {
 	git_odb_object *obj = NULL;
 	git_otype type;
-	unsigned char hdr[10], *zbuf = NULL;
+	unsigned char *zbuf = NULL;
 	void *data = NULL;
-	size_t hdr_len, zbuf_len = COMPRESS_BUFLEN, data_len;
+	size_t zbuf_len = COMPRESS_BUFLEN, data_len;
 	int error;
 
+	if (po->in_pack &&
+		(error = write_reused_object(pb, po, write_cb, cb_data)) != GIT_PASSTHROUGH)
+		return error;
+
+	/* a reused delta cannot be recomputed with the same size */
+	if (po->reused_delta) {
+		po->delta = NULL;
+		po->reused_delta = 0;
+	}
+
 	/*
 	 * If we have a delta base, let's use the delta to save space.
 	 * Otherwise load the whole object. 'data' ends up pointing to
@@ -337,24 +560,16 @@ static int write_object(
 	}
 
 	/* Write header */
-	hdr_len = git_packfile__object_header(hdr, data_len, type);
+	po->offset = pb->write_offset;
 
-	if ((error = write_cb(hdr, hdr_len, cb_data)) < 0 ||
-		(error = git_hash_update(&pb->ctx, hdr, hdr_len)) < 0)
+	if ((error = write_object_header(pb, po, type, data_len, write_cb, cb_data)) < 0)
 		goto done;
 
-	if (type == GIT_OBJ_REF_DELTA) {
-		if ((error = write_cb(po->delta->id.id, GIT_OID_RAWSZ, cb_data)) < 0 ||
-			(error = git_hash_update(&pb->ctx, po->delta->id.id, GIT_OID_RAWSZ)) < 0)
-			goto done;
-	}
-
 	/* Write data */
 	if (po->z_delta_size) {
 		data_len = po->z_delta_size;
 
-		if ((error = write_cb(data, data_len, cb_data)) < 0 ||
-			(error = git_hash_update(&pb->ctx, data, data_len)) < 0)
+		if ((error = write_pack_data(pb, data, data_len, write_cb, cb_data)) < 0)
 			goto done;
 	} else {
 		zbuf = git__malloc(zbuf_len);
@@ -365,8 +580,7 @@ static int write_object(
 
 		while (!git_zstream_done(&pb->zstream)) {
 			if ((error = git_zstream_get_output(zbuf, &zbuf_len, &pb->zstream)) < 0 ||
-				(error = write_cb(zbuf, zbuf_len, cb_data)) < 0 ||
-				(error = git_hash_update(&pb->ctx, zbuf, zbuf_len)) < 0)
+				(error = write_pack_data(pb, zbuf, zbuf_len, write_cb, cb_data)) < 0)
 				goto done;
 
 			zbuf_len = COMPRESS_BUFLEN; /* reuse buffer */
@@ -636,8 +850,9 @@ static int write_pack(git_packbuilder *pb,
 	ph.hdr_version = htonl(PACK_VERSION);
 	ph.hdr_entries = htonl(pb->nr_objects);
 
-	if ((error = write_cb(&ph, sizeof(ph), cb_data)) < 0 ||
-		(error = git_hash_update(&pb->ctx, &ph, sizeof(ph))) < 0)
+	pb->write_offset = 0;
+
+	if ((error = write_pack_data(pb, &ph, sizeof(ph), write_cb, cb_data)) < 0)
 		goto done;
 
 	pb->nr_remaining = pb->nr_objects;
@@ -706,11 +921,12 @@ static int type_size_sort(const void *_a, const void *_b)
 	return a < b ? -1 : (a > b); /* newest first */
 }
 
-static int delta_cacheable(git_packbuilder *pb, unsigned long src_size,
-			   unsigned long trg_size, unsigned long delta_size)
+static int delta_cacheable(git_packbuilder *pb, struct delta_window *w,
+			   unsigned long src_size, unsigned long trg_size,
+			   unsigned long delta_size)
 {
-	if (pb->max_delta_cache_size &&
-		pb->delta_cache_size + delta_size > pb->max_delta_cache_size)
+	if (w->max_cache_size &&
+		w->cache_size + delta_size > w->max_cache_size)
 		return 0;
 
 	if (delta_size < pb->cache_max_small_delta_size)
@@ -723,9 +939,9 @@ static int delta_cacheable(git_packbuilder *pb, unsigned long src_size,
 	return 0;
 }
 
-static int try_delta(git_packbuilder *pb, struct unpacked *trg,
-		     struct unpacked *src, int max_depth,
-		     unsigned long *mem_usage, int *ret)
+static int try_delta(git_packbuilder *pb, struct delta_window *w,
+		     struct unpacked *trg, struct unpacked *src,
+		     int max_depth, int *ret)
 {
 	git_pobject *trg_object = trg->object;
 	git_pobject *src_object = src->object;
@@ -749,6 +965,11 @@ static int try_delta(git_packbuilder *pb, struct unpacked *trg,
 	if (src->depth >= max_depth)
 		return 0;
 
+	/* Nor send a delta to someone who may not have its base. */
+	if (pb->islands && !git_delta_islands_allow(pb->islands,
+			trg_object->islands, src_object->islands))
+		return 0;
+
 	/* Now some size filtering heuristics. */
 	trg_size = (unsigned long)trg_object->size;
 	if (!trg_object->delta) {
@@ -789,9 +1010,14 @@ static int try_delta(git_packbuilder *pb, struct unpacked *trg,
 			return -1;
 		}
 
-		*mem_usage += sz;
+		w->mem_usage += sz;
 	}
-	if (!src->data) {
+	/* An earlier packbuilder may have indexed it already */
+	if (!src->index &&
+		(src->cached = git_delta_index_cache_get(&src_object->id)) != NULL)
+		src->index = src->cached->index;
+
+	if (!src->data && !src->index) {
 		size_t obj_sz;
 
 		if (git_odb_read(&obj, pb->odb, &src_object->id) < 0 ||
@@ -811,14 +1037,24 @@ static int try_delta(git_packbuilder *pb, struct unpacked *trg,
 			return -1;
 		}
 
-		*mem_usage += sz;
+		w->mem_usage += sz;
 	}
 	if (!src->index) {
 		src->index = git_delta_create_index(src->data, src_size);
 		if (!src->index)
 			return 0; /* suboptimal pack - out of memory */
 
-		*mem_usage += git_delta_sizeof_index(src->index);
+		w->mem_usage += git_delta_sizeof_index(src->index);
+
+		/*
+		 * Keep it for the packbuilders that come after us. The
+		 * data is then the cache's, and out of our window.
+		 */
+		if ((src->cached = git_delta_index_cache_add(&src_object->id,
+				src->data, src_size, src->index)) != NULL) {
+			w->mem_usage -= src_size + git_delta_sizeof_index(src->index);
+			src->data = NULL;
+		}
 	}
 
 	delta_buf = git_delta_create(src->index, trg->data, trg_size,
@@ -835,24 +1071,17 @@ static int try_delta(git_packbuilder *pb, struct unpacked *trg,
 		}
 	}
 
-	git_packbuilder__cache_lock(pb);
 	if (trg_object->delta_data) {
 		git__free(trg_object->delta_data);
-		pb->delta_cache_size -= trg_object->delta_size;
+		w->cache_size -= trg_object->delta_size;
 		trg_object->delta_data = NULL;
 	}
-	if (delta_cacheable(pb, src_size, trg_size, delta_size)) {
-		bool overflow = git__add_uint64_overflow(
-			&pb->delta_cache_size, pb->delta_cache_size, delta_size);
-
-		git_packbuilder__cache_unlock(pb);
-
-		if (overflow ||
+	if (delta_cacheable(pb, w, src_size, trg_size, delta_size)) {
+		if (git__add_uint64_overflow(&w->cache_size, w->cache_size, delta_size) ||
 			!(trg_object->delta_data = git__realloc(delta_buf, delta_size)))
 			return -1;
 	} else {
 		/* create delta when writing the pack */
-		git_packbuilder__cache_unlock(pb);
 		git__free(delta_buf);
 	}
 
@@ -880,8 +1109,16 @@ static unsigned int check_delta_limit(git_pobject *me, unsigned int n)
 
 static unsigned long free_unpacked(struct unpacked *n)
 {
-	unsigned long freed_mem = git_delta_sizeof_index(n->index);
-	git_delta_free_index(n->index);
+	unsigned long freed_mem = 0;
+
+	if (n->cached) {
+		git_delta_index_cache_release(n->cached);
+		n->cached = NULL;
+	} else {
+		freed_mem += git_delta_sizeof_index(n->index);
+		git_delta_free_index(n->index);
+	}
+
 	n->index = NULL;
 	if (n->data) {
 		freed_mem += (unsigned long)n->object->size;
@@ -916,47 +1153,89 @@ static int report_delta_progress(git_packbuilder *pb, uint32_t count, bool force
 	return 0;
 }
 
-static int find_deltas(git_packbuilder *pb, git_pobject **list,
-		       unsigned int *list_size, unsigned int window,
+static int delta_window_init(
+	struct delta_window *w, unsigned int size, uint64_t max_cache_size)
+{
+	memset(w, 0, sizeof(*w));
+
+	w->array = git__calloc(size, sizeof(struct unpacked));
+	GITERR_CHECK_ALLOC(w->array);
+
+	w->size = size;
+	w->max_cache_size = max_cache_size;
+	return 0;
+}
+
+static void delta_window_clear(struct delta_window *w)
+{
+	unsigned int i;
+
+	for (i = 0; i < w->size; ++i)
+		free_unpacked(&w->array[i]);
+
+	w->idx = w->count = 0;
+	w->mem_usage = 0;
+}
+
+static void delta_window_free(struct delta_window *w)
+{
+	if (!w->array)
+		return;
+
+	delta_window_clear(w);
+	git__free(w->array);
+	w->array = NULL;
+}
+
+static void add_delta_progress(git_packbuilder *pb, uint32_t count)
+{
+	if (!count)
+		return;
+
+	git_packbuilder__progress_lock(pb);
+	pb->nr_deltified += count;
+	report_delta_progress(pb, pb->nr_deltified, false);
+	git_packbuilder__progress_unlock(pb);
+}
+
+/* How many objects we search deltas for between two progress updates */
+#define DELTA_PROGRESS_BATCH 32
+
+/*
+ * Search deltas for the objects of `list`, against the ones before them
+ * in the window `w`, which carries over from one call to the next.
+ */
+static int find_deltas(git_packbuilder *pb, struct delta_window *w,
+		       git_pobject **list, unsigned int list_size,
 		       int depth)
 {
 	git_pobject *po;
 	git_buf zbuf = GIT_BUF_INIT;
-	struct unpacked *array;
-	uint32_t idx = 0, count = 0;
-	unsigned long mem_usage = 0;
-	unsigned int i;
+	struct unpacked *array = w->array;
+	unsigned int window = w->size, i;
+	uint32_t progress = 0;
 	int error = -1;
 
-	array = git__calloc(window, sizeof(struct unpacked));
-	GITERR_CHECK_ALLOC(array);
-
-	for (;;) {
-		struct unpacked *n = array + idx;
+	for (i = 0; i < list_size; i++) {
+		struct unpacked *n = array + w->idx;
 		int max_depth, j, best_base = -1;
 
-		git_packbuilder__progress_lock(pb);
-		if (!*list_size) {
-			git_packbuilder__progress_unlock(pb);
-			break;
+		if (++progress == DELTA_PROGRESS_BATCH) {
+			add_delta_progress(pb, progress);
+			progress = 0;
 		}
 
-		pb->nr_deltified += 1;
-		report_delta_progress(pb, pb->nr_deltified, false);
-
-		po = *list++;
-		(*list_size)--;
-		git_packbuilder__progress_unlock(pb);
+		po = list[i];
 
-		mem_usage -= free_unpacked(n);
+		w->mem_usage -= free_unpacked(n);
 		n->object = po;
 
 		while (pb->window_memory_limit &&
-		       mem_usage > pb->window_memory_limit &&
-		       count > 1) {
-			uint32_t tail = (idx + window - count) % window;
-			mem_usage -= free_unpacked(array + tail);
-			count--;
+		       w->mem_usage > pb->window_memory_limit &&
+		       w->count > 1) {
+			uint32_t tail = (w->idx + window - w->count) % window;
+			w->mem_usage -= free_unpacked(array + tail);
+			w->count--;
 		}
 
 		/*
@@ -974,7 +1253,7 @@ static int find_deltas(git_packbuilder *pb, git_pobject **list,
 		j = window;
 		while (--j > 0) {
 			int ret;
-			uint32_t other_idx = idx + j;
+			uint32_t other_idx = w->idx + j;
 			struct unpacked *m;
 
 			if (other_idx >= window)
@@ -984,7 +1263,7 @@ static int find_deltas(git_packbuilder *pb, git_pobject **list,
 			if (!m->object)
 				break;
 
-			if (try_delta(pb, n, m, max_depth, &mem_usage, &ret) < 0)
+			if (try_delta(pb, w, n, m, max_depth, &ret) < 0)
 				goto on_error;
 			if (ret < 0)
 				break;
@@ -1018,10 +1297,8 @@ static int find_deltas(git_packbuilder *pb, git_pobject **list,
 			po->z_delta_size = (unsigned long)zbuf.size;
 			git_buf_clear(&zbuf);
 
-			git_packbuilder__cache_lock(pb);
-			pb->delta_cache_size -= po->delta_size;
-			pb->delta_cache_size += po->z_delta_size;
-			git_packbuilder__cache_unlock(pb);
+			w->cache_size -= po->delta_size;
+			w->cache_size += po->z_delta_size;
 		}
 
 		/*
@@ -1039,7 +1316,7 @@ static int find_deltas(git_packbuilder *pb, git_pobject **list,
 		 */
 		if (po->delta) {
 			struct unpacked swap = array[best_base];
-			int dist = (window + idx - best_base) % window;
+			int dist = (window + w->idx - best_base) % window;
 			int dst = best_base;
 			while (dist--) {
 				int src = (dst + 1) % window;
@@ -1050,80 +1327,139 @@ static int find_deltas(git_packbuilder *pb, git_pobject **list,
 		}
 
 		next:
-		idx++;
-		if (count + 1 < window)
-			count++;
-		if (idx >= window)
-			idx = 0;
+		w->idx++;
+		if (w->count + 1 < window)
+			w->count++;
+		if (w->idx >= window)
+			w->idx = 0;
 	}
 	error = 0;
 
 on_error:
-	for (i = 0; i < window; ++i) {
-		git__free(array[i].index);
-		git__free(array[i].data);
-	}
-	git__free(array);
+	add_delta_progress(pb, progress);
 	git_buf_free(&zbuf);
 
 	return error;
 }
 
+static int single_find_deltas(git_packbuilder *pb, git_pobject **list,
+			      unsigned int list_size, unsigned int window,
+			      int depth)
+{
+	struct delta_window w;
+
+	if (delta_window_init(&w, window, pb->max_delta_cache_size) < 0)
+		return -1;
+
+	/* a failed search only means fewer deltas */
+	if (find_deltas(pb, &w, list, list_size, depth) < 0)
+		giterr_clear();
+
+	pb->delta_cache_size = w.cache_size;
+	delta_window_free(&w);
+	return 0;
+}
+
 #ifdef GIT_THREADS
 
+/*
+ * The threaded delta search splits the list into small tasks, which end
+ * on path boundaries where possible. Each thread starts with an even,
+ * contiguous share of them as its deque. It takes tasks from the front,
+ * so that its window carries over from one to the next, and once it runs
+ * dry it steals the back half of the deque of another thread.
+ */
+
+/* The number of tasks per thread, so that no thread is left idle for long */
+#define DELTA_TASKS_PER_THREAD 32
+
+struct delta_task {
+	git_pobject **list;
+	unsigned int size;
+};
+
 struct thread_params {
 	git_thread thread;
 	git_packbuilder *pb;
 
-	git_pobject **list;
+	struct delta_task *tasks;
+	struct thread_params *all;
+	unsigned int nr_threads;
+	unsigned int id;
 
-	git_cond cond;
+	/* the deque of this thread, tasks [head, tail) */
 	git_mutex mutex;
+	size_t head;
+	size_t tail;
 
-	unsigned int list_size;
-	unsigned int remaining;
-
-	int window;
+	struct delta_window window;
 	int depth;
-	int working;
-	int data_ready;
 };
 
-static void *threaded_find_deltas(void *arg)
+static bool pop_task(struct delta_task *out, struct thread_params *me)
 {
-	struct thread_params *me = arg;
+	bool found = false;
 
-	while (me->remaining) {
-		if (find_deltas(me->pb, me->list, &me->remaining,
-				me->window, me->depth) < 0) {
-			; /* TODO */
-		}
+	git_mutex_lock(&me->mutex);
+	if (me->head < me->tail) {
+		*out = me->tasks[me->head++];
+		found = true;
+	}
+	git_mutex_unlock(&me->mutex);
 
-		git_packbuilder__progress_lock(me->pb);
-		me->working = 0;
-		git_cond_signal(&me->pb->progress_cond);
-		git_packbuilder__progress_unlock(me->pb);
+	return found;
+}
 
-		if (git_mutex_lock(&me->mutex)) {
-			giterr_set(GITERR_THREAD, "unable to lock packfile condition mutex");
-			return NULL;
+static bool steal_tasks(struct thread_params *me)
+{
+	struct thread_params *victim;
+	size_t start = 0, n;
+	unsigned int i;
+
+	for (i = 1; i < me->nr_threads; i++) {
+		victim = &me->all[(me->id + i) % me->nr_threads];
+
+		git_mutex_lock(&victim->mutex);
+		if ((n = victim->tail - victim->head) > 0) {
+			n = (n + 1) / 2;
+			victim->tail -= n;
+			start = victim->tail;
 		}
+		git_mutex_unlock(&victim->mutex);
 
-		while (!me->data_ready)
-			git_cond_wait(&me->cond, &me->mutex);
+		if (!n)
+			continue;
 
-		/*
-		 * We must not set ->data_ready before we wait on the
-		 * condition because the main thread may have set it to 1
-		 * before we get here. In order to be sure that new
-		 * work is available if we see 1 in ->data_ready, it
-		 * was initialized to 0 before this thread was spawned
-		 * and we reset it to 0 right away.
-		 */
-		me->data_ready = 0;
+		git_mutex_lock(&me->mutex);
+		me->head = start;
+		me->tail = start + n;
 		git_mutex_unlock(&me->mutex);
+		return true;
+	}
+
+	return false;
+}
+
+static void *threaded_find_deltas(void *arg)
+{
+	struct thread_params *me = arg;
+	git_pobject **next = NULL;
+	struct delta_task task;
+
+	while (pop_task(&task, me) || (steal_tasks(me) && pop_task(&task, me))) {
+		/* a stolen task does not follow the objects in the window */
+		if (task.list != next)
+			delta_window_clear(&me->window);
+
+		/* a failed search only means fewer deltas */
+		if (find_deltas(me->pb, &me->window, task.list, task.size, me->depth) < 0) {
+			giterr_clear();
+			delta_window_clear(&me->window);
+		}
+
+		next = task.list + task.size;
 	}
-	/* leave ->working 1 so that this doesn't get more work assigned */
+
 	return NULL;
 }
 
@@ -1131,153 +1467,176 @@ static int ll_find_deltas(git_packbuilder *pb, git_pobject **list,
 			  unsigned int list_size, unsigned int window,
 			  int depth)
 {
-	struct thread_params *p;
-	int i, ret, active_threads = 0;
+	struct thread_params *p = NULL;
+	struct delta_task *tasks = NULL;
+	size_t nr_tasks = 0;
+	unsigned int i, nr_threads, task_size, start, size, initialized = 0;
+	int error = -1;
 
 	if (!pb->nr_threads)
 		pb->nr_threads = git_online_cpus();
 
-	if (pb->nr_threads <= 1) {
-		find_deltas(pb, list, &list_size, window, depth);
-		return 0;
-	}
-
-	p = git__mallocarray(pb->nr_threads, sizeof(*p));
-	GITERR_CHECK_ALLOC(p);
+	if (pb->nr_threads <= 1)
+		return single_find_deltas(pb, list, list_size, window, depth);
 
-	/* Partition the work among the threads */
-	for (i = 0; i < pb->nr_threads; ++i) {
-		unsigned sub_size = list_size / (pb->nr_threads - i);
+	/* small enough to balance the load, but worth filling a window for */
+	task_size = list_size / (pb->nr_threads * DELTA_TASKS_PER_THREAD);
+	if (task_size < 2 * window)
+		task_size = 2 * window;
 
-		/* don't use too small segments or no deltas will be found */
-		if (sub_size < 2*window && i+1 < pb->nr_threads)
-			sub_size = 0;
+	tasks = git__mallocarray(list_size / task_size + 1, sizeof(*tasks));
+	GITERR_CHECK_ALLOC(tasks);
 
-		p[i].pb = pb;
-		p[i].window = window;
-		p[i].depth = depth;
-		p[i].working = 1;
-		p[i].data_ready = 0;
+	for (start = 0; start < list_size; start += size) {
+		size = min(task_size, list_size - start);
 
 		/* try to split chunks on "path" boundaries */
-		while (sub_size && sub_size < list_size &&
-		       list[sub_size]->hash &&
-		       list[sub_size]->hash == list[sub_size-1]->hash)
-			sub_size++;
+		while (start + size < list_size &&
+		       list[start + size]->hash &&
+		       list[start + size]->hash == list[start + size - 1]->hash)
+			size++;
+
+		tasks[nr_tasks].list = list + start;
+		tasks[nr_tasks].size = size;
+		nr_tasks++;
+	}
 
-		p[i].list = list;
-		p[i].list_size = sub_size;
-		p[i].remaining = sub_size;
+	nr_threads = pb->nr_threads;
+	if (nr_threads > nr_tasks)
+		nr_threads = (unsigned int)nr_tasks;
 
-		list += sub_size;
-		list_size -= sub_size;
+	if ((p = git__calloc(nr_threads, sizeof(*p))) == NULL) {
+		giterr_set_oom();
+		goto cleanup;
 	}
 
-	/* Start work threads */
-	for (i = 0; i < pb->nr_threads; ++i) {
-		if (!p[i].list_size)
-			continue;
+	for (i = 0; i < nr_threads; ++i, ++initialized) {
+		p[i].pb = pb;
+		p[i].tasks = tasks;
+		p[i].all = p;
+		p[i].nr_threads = nr_threads;
+		p[i].id = i;
+		p[i].head = nr_tasks * i / nr_threads;
+		p[i].tail = nr_tasks * (i + 1) / nr_threads;
+		p[i].depth = depth;
 
-		git_mutex_init(&p[i].mutex);
-		git_cond_init(&p[i].cond);
+		if (delta_window_init(&p[i].window, window,
+				pb->max_delta_cache_size / nr_threads) < 0)
+			goto cleanup;
 
-		ret = git_thread_create(&p[i].thread, NULL,
-					threaded_find_deltas, &p[i]);
-		if (ret) {
-			giterr_set(GITERR_THREAD, "unable to create thread");
-			return -1;
+		if (git_mutex_init(&p[i].mutex)) {
+			giterr_set(GITERR_THREAD, "unable to initialize packbuilder mutex");
+			delta_window_free(&p[i].window);
+			goto cleanup;
 		}
-		active_threads++;
 	}
 
 	/*
-	 * Now let's wait for work completion.  Each time a thread is done
-	 * with its work, we steal half of the remaining work from the
-	 * thread with the largest number of unprocessed objects and give
-	 * it to that newly idle thread.  This ensure good load balancing
-	 * until the remaining object list segments are simply too short
-	 * to be worth splitting anymore.
+	 * This thread takes the first share. If a thread cannot be
+	 * created, the others steal its share.
 	 */
-	while (active_threads) {
-		struct thread_params *target = NULL;
-		struct thread_params *victim = NULL;
-		unsigned sub_size = 0;
-
-		/* Start by locating a thread that has transitioned its
-		 * 'working' flag from 1 -> 0. This indicates that it is
-		 * ready to receive more work using our work-stealing
-		 * algorithm. */
-		git_packbuilder__progress_lock(pb);
-		for (;;) {
-			for (i = 0; !target && i < pb->nr_threads; i++)
-				if (!p[i].working)
-					target = &p[i];
-			if (target)
-				break;
-			git_cond_wait(&pb->progress_cond, &pb->progress_mutex);
-		}
+	for (i = 1; i < nr_threads; ++i) {
+		if (git_thread_create(&p[i].thread, NULL, threaded_find_deltas, &p[i]))
+			break;
+	}
 
-		/* At this point we hold the progress lock and have located
-		 * a thread to receive more work. We still need to locate a
-		 * thread from which to steal work (the victim). */
-		for (i = 0; i < pb->nr_threads; i++)
-			if (p[i].remaining > 2*window &&
-			    (!victim || victim->remaining < p[i].remaining))
-				victim = &p[i];
-
-		if (victim) {
-			sub_size = victim->remaining / 2;
-			list = victim->list + victim->list_size - sub_size;
-			while (sub_size && list[0]->hash &&
-			       list[0]->hash == list[-1]->hash) {
-				list++;
-				sub_size--;
-			}
-			if (!sub_size) {
-				/*
-				 * It is possible for some "paths" to have
-				 * so many objects that no hash boundary
-				 * might be found.  Let's just steal the
-				 * exact half in that case.
-				 */
-				sub_size = victim->remaining / 2;
-				list -= sub_size;
-			}
-			target->list = list;
-			victim->list_size -= sub_size;
-			victim->remaining -= sub_size;
-		}
-		target->list_size = sub_size;
-		target->remaining = sub_size;
-		target->working = 1;
-		git_packbuilder__progress_unlock(pb);
-
-		if (git_mutex_lock(&target->mutex)) {
-			giterr_set(GITERR_THREAD, "unable to lock packfile condition mutex");
-			git__free(p);
-			return -1;
-		}
+	nr_threads = i;
+	threaded_find_deltas(&p[0]);
 
-		target->data_ready = 1;
-		git_cond_signal(&target->cond);
-		git_mutex_unlock(&target->mutex);
+	for (i = 1; i < nr_threads; ++i)
+		git_thread_join(&p[i].thread, NULL);
 
-		if (!sub_size) {
-			git_thread_join(&target->thread, NULL);
-			git_cond_free(&target->cond);
-			git_mutex_free(&target->mutex);
-			active_threads--;
-		}
+	pb->delta_cache_size = 0;
+	for (i = 0; i < initialized; ++i)
+		pb->delta_cache_size += p[i].window.cache_size;
+
+	error = 0;
+
+cleanup:
+	for (i = 0; i < initialized; ++i) {
+		delta_window_free(&p[i].window);
+		git_mutex_free(&p[i].mutex);
 	}
 
 	git__free(p);
-	return 0;
+	git__free(tasks);
+	return error;
 }
 
 #else
-#define ll_find_deltas(pb, l, ls, w, d) find_deltas(pb, l, &ls, w, d)
+#define ll_find_deltas(pb, l, ls, w, d) single_find_deltas(pb, l, ls, w, d)
 #endif
 
+/*
+ * Find where the objects are already stored in packfiles, so that
+ * their compressed data can be copied as it is, and keep the deltas
+ * against objects that are also in the pack being built.
+ */
+static int find_reusable_objects(git_packbuilder *pb)
+{
+	struct git_pack_entry e;
+	git_pack_raw_entry raw;
+	git_pobject *base;
+	khiter_t pos;
+	unsigned int i;
+	int error;
+
+	for (i = 0; i < pb->nr_objects; ++i) {
+		git_pobject *po = pb->object_list + i;
+
+		/* already looked up by an earlier call, or deltified */
+		if (po->in_pack || po->delta)
+			continue;
+
+		if ((error = git_odb__find_packed(&e, pb->odb, &po->id)) == GIT_ENOTFOUND)
+			continue;
+		else if (error < 0)
+			return error;
+
+		if ((error = git_packfile__raw_entry(&raw, e.p, e.offset)) == GIT_PASSTHROUGH)
+			continue;
+		else if (error < 0)
+			return error;
+
+		po->in_pack = e.p;
+		po->in_pack_offset = e.offset;
+
+		if (raw.type != GIT_OBJ_OFS_DELTA && raw.type != GIT_OBJ_REF_DELTA)
+			continue;
+
+		pos = kh_get(oid, pb->object_ix, &raw.base_id);
+		if (pos == kh_end(pb->object_ix))
+			continue;
+
+		base = kh_value(pb->object_ix, pos);
+
+		if (pb->islands && !git_delta_islands_allow(pb->islands,
+				po->islands, base->islands))
+			continue;
+
+		po->delta = base;
+		po->delta_size = (unsigned long)raw.size;
+		po->reused_delta = 1;
+	}
+
+	return 0;
+}
+
+static int load_islands(git_packbuilder *pb)
+{
+	unsigned int i;
+
+	if (git_delta_islands_load(pb->islands, pb->repo, pb->object_ix) < 0)
+		return -1;
+
+	for (i = 0; i < pb->nr_objects; ++i) {
+		git_pobject *po = pb->object_list + i;
+		po->islands = git_delta_islands_get(pb->islands, &po->id);
+	}
+
+	return 0;
+}
+
 static int prepare_pack(git_packbuilder *pb)
 {
 	git_pobject **delta_list;
@@ -1286,6 +1645,12 @@ static int prepare_pack(git_packbuilder *pb)
 	if (pb->nr_objects == 0 || pb->done)
 		return 0; /* nothing to do */
 
+	if (pb->islands && load_islands(pb) < 0)
+		return -1;
+
+	if (pb->reuse && find_reusable_objects(pb) < 0)
+		return -1;
+
 	/*
 	 * Although we do not report progress during deltafication, we
 	 * at least report that we are in the deltafication stage
@@ -1303,6 +1668,10 @@ static int prepare_pack(git_packbuilder *pb)
 		if (po->size < 50 || po->size > pb->big_file_threshold)
 			continue;
 
+		/* There is no need to search a delta we already have */
+		if (po->reused_delta)
+			continue;
+
 		delta_list[n++] = po;
 	}
 
@@ -1596,9 +1965,13 @@ static int mark_edges_uninteresting(git_packbuilder *pb, git_commit_list *commit
 	return 0;
 }
 
-int insert_tree(git_packbuilder *pb, git_tree *tree)
+/*
+ * `path` is the one of the tree, with a trailing slash, which is only
+ * needed by the name hash of the blobs if it hashes whole paths.
+ */
+int insert_tree(git_packbuilder *pb, git_tree *tree, git_buf *path)
 {
-	size_t i;
+	size_t i, path_len = path->size;
 	int error;
 	git_tree *subtree;
 	git_walk_object *obj;
@@ -1623,7 +1996,11 @@ int insert_tree(git_packbuilder *pb, git_tree *tree)
 			if ((error = git_tree_lookup(&subtree, pb->repo, entry_id)) < 0)
 				return error;
 
-			error = insert_tree(pb, subtree);
+			if (!(error = git_buf_puts(path, git_tree_entry_name(entry))) &&
+				!(error = git_buf_putc(path, '/')))
+				error = insert_tree(pb, subtree, path);
+
+			git_buf_truncate(path, path_len);
 			git_tree_free(subtree);
 
 			if (error < 0)
@@ -1632,7 +2009,17 @@ int insert_tree(git_packbuilder *pb, git_tree *tree)
 			break;
 		case GIT_OBJ_BLOB:
 			name = git_tree_entry_name(entry);
-			if ((error = git_packbuilder_insert(pb, entry_id, name)) < 0)
+
+			if (pb->name_hash == GIT_PACKBUILDER_NAME_HASH_PATH) {
+				if ((error = git_buf_puts(path, name)) < 0)
+					return error;
+				name = path->ptr;
+			}
+
+			error = git_packbuilder_insert(pb, entry_id, name);
+			git_buf_truncate(path, path_len);
+
+			if (error < 0)
 				return error;
 			break;
 		default:
@@ -1650,6 +2037,7 @@ int insert_commit(git_packbuilder *pb, git_walk_object *obj)
 	int error;
 	git_commit *commit = NULL;
 	git_tree *tree = NULL;
+	git_buf path = GIT_BUF_INIT;
 
 	obj->seen = 1;
 
@@ -1662,12 +2050,94 @@ int insert_commit(git_packbuilder *pb, git_walk_object *obj)
 	if ((error = git_tree_lookup(&tree, pb->repo, git_commit_tree_id(commit))) < 0)
 		goto cleanup;
 
-	if ((error = insert_tree(pb, tree)) < 0)
+	if ((error = insert_tree(pb, tree, &path)) < 0)
 		goto cleanup;
 
 cleanup:
 	git_commit_free(commit);
 	git_tree_free(tree);
+	git_buf_free(&path);
+	return error;
+}
+
+static int load_bitmap(git_pack_bitmap_index **out, git_packbuilder *pb)
+{
+	git_buf pack_dir = GIT_BUF_INIT;
+	int error;
+
+	if (!pb->bitmap_checked) {
+		pb->bitmap_checked = true;
+
+		if ((error = git_buf_joinpath(&pack_dir,
+				git_repository_path(pb->repo), "objects/pack")) < 0)
+			return error;
+
+		error = git_pack_bitmap_index_find(&pb->bitmap, git_buf_cstr(&pack_dir));
+		git_buf_free(&pack_dir);
+
+		if (error < 0 && error != GIT_ENOTFOUND)
+			return error;
+	}
+
+	*out = pb->bitmap;
+	return *out ? 0 : GIT_ENOTFOUND;
+}
+
+/*
+ * Find the objects to send with the reachability bitmaps, when every
+ * commit pushed to (or hidden from) the walk has one. The objects are
+ * then those reachable from the wanted commits but not from the others,
+ * and no tree needs to be read. Returns GIT_PASSTHROUGH when the
+ * bitmaps cannot be used.
+ */
+static int insert_walk_bitmap(git_packbuilder *pb, git_revwalk *walk)
+{
+	git_pack_bitmap_index *index;
+	git_bitmap wants = GIT_BITMAP_INIT, haves = GIT_BITMAP_INIT;
+	git_commit_list *list;
+	size_t pos = 0;
+	int error;
+
+	if ((error = load_bitmap(&index, pb)) < 0)
+		return error == GIT_ENOTFOUND ? GIT_PASSTHROUGH : error;
+
+	for (list = walk->user_input; list; list = list->next) {
+		const git_bitmap *bitmap;
+
+		if ((error = git_pack_bitmap_index_get(&bitmap, index, &list->item->oid)) < 0) {
+			if (error == GIT_ENOTFOUND)
+				error = GIT_PASSTHROUGH;
+			goto cleanup;
+		}
+
+		if ((error = git_bitmap_or(
+				list->item->uninteresting ? &haves : &wants, bitmap)) < 0)
+			goto cleanup;
+	}
+
+	git_bitmap_and_not(&wants, &haves);
+
+	while (git_bitmap_next(&pos, &wants, pos)) {
+		uint32_t idx_pos = index->objects.pack_order[pos];
+		const git_oid *id = &index->objects.ids[idx_pos];
+		git_otype type;
+		size_t size;
+
+		if (!git_oidmap_valid_index(pb->object_ix,
+				git_oidmap_lookup_index(pb->object_ix, id))) {
+			if ((error = git_packfile_resolve_header_nth(&size, &type,
+					index->objects.pack, index->objects.offsets[idx_pos], idx_pos)) < 0 ||
+				(error = insert_object(pb, id, type, size,
+					git_pack_bitmap_index_name_hash(index, pos))) < 0)
+				goto cleanup;
+		}
+
+		pos++;
+	}
+
+cleanup:
+	git_bitmap_free(&wants);
+	git_bitmap_free(&haves);
 	return error;
 }
 
@@ -1679,6 +2149,11 @@ int git_packbuilder_insert_walk(git_packbuilder *pb, git_revwalk *walk)
 
 	assert(pb && walk);
 
+	if ((error = insert_walk_bitmap(pb, walk)) != GIT_PASSTHROUGH)
+		return error;
+
+	giterr_clear();
+
 	if ((error = mark_edges_uninteresting(pb, walk->user_input)) < 0)
 		return error;
 
@@ -1725,9 +2200,7 @@ void git_packbuilder_free(git_packbuilder *pb)
 
 #ifdef GIT_THREADS
 
-	git_mutex_free(&pb->cache_mutex);
 	git_mutex_free(&pb->progress_mutex);
-	git_cond_free(&pb->progress_cond);
 
 #endif
 
@@ -1743,6 +2216,10 @@ void git_packbuilder_free(git_packbuilder *pb)
 	git_oidmap_free(pb->walk_objects);
 	git_pool_clear(&pb->object_pool);
 
+	git_delta_islands_free(pb->islands);
+
+	git_pack_bitmap_index_free(pb->bitmap);
+
 	git_hash_ctx_cleanup(&pb->ctx);
 	git_zstream_free(&pb->zstream);
 
@@ -11,6 +11,7 @@
 #include "common.h"
 
 #include "buffer.h"
+#include "delta_islands.h"
 #include "hash.h"
 #include "oidmap.h"
 #include "netops.h"
@@ -29,12 +30,18 @@
 typedef struct git_pobject {
 	git_oid id;
 	git_otype type;
-	git_off_t offset;
+	git_off_t offset; /* where it was written in the pack */
 
 	size_t size;
 
 	unsigned int hash; /* name hint hash */
 
+	/* the packfile where the object is already stored, if any */
+	struct git_pack_file *in_pack;
+	git_off_t in_pack_offset;
+
+	const uint32_t *islands; /* the delta islands it is in, if any */
+
 	struct git_pobject *delta; /* delta base object */
 	struct git_pobject *delta_child; /* deltified objects who bases me */
 	struct git_pobject *delta_sibling; /* other deltified objects
@@ -48,7 +55,8 @@ typedef struct git_pobject {
 	int written:1,
 	    recursing:1,
 	    tagged:1,
-	    filled:1;
+	    filled:1,
+	    reused_delta:1; /* the delta is the one of in_pack */
 } git_pobject;
 
 typedef struct {
@@ -79,10 +87,12 @@ struct git_packbuilder {
 
 	git_oid pack_oid; /* hash of written pack */
 
+	/* reachability bitmaps of the repository, loaded on first use */
+	struct git_pack_bitmap_index *bitmap;
+	bool bitmap_checked;
+
 	/* synchronization objects */
-	git_mutex cache_mutex;
 	git_mutex progress_mutex;
-	git_cond progress_cond;
 
 	/* configs */
 	uint64_t delta_cache_size;
@@ -93,6 +103,14 @@ struct git_packbuilder {
 
 	int nr_threads; /* nr of threads to use */
 
+	bool reuse; /* copy the data of existing packfiles */
+	bool ofs_delta; /* name the base of a delta by its offset */
+	git_packbuilder_name_hash_t name_hash; /* how to hash the name hints */
+
+	git_delta_islands *islands; /* NULL unless there are island patterns */
+
+	git_off_t write_offset; /* the size of the pack written so far */
+
 	git_packbuilder_progress progress_cb;
 	void *progress_cb_payload;
 	double last_progress_report_time; /* the time progress was last reported */
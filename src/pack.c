@@ -9,17 +9,20 @@
 #include "odb.h"
 #include "pack.h"
 #include "delta-apply.h"
+#include "buffer.h"
 #include "sha1_lookup.h"
 #include "mwindow.h"
 #include "fileops.h"
 #include "oid.h"
+#include "global.h"
+#include "path.h"
+#include "zstream.h"
 
 #include <zlib.h>
 
 GIT__USE_OFFMAP
 GIT__USE_OIDMAP
 
-static int packfile_open(struct git_pack_file *p);
 static git_off_t nth_packed_object_offset(const struct git_pack_file *p, uint32_t n);
 int packfile_unpack_compressed(
 		git_rawobj *obj,
@@ -28,6 +31,21 @@ int packfile_unpack_compressed(
 		git_off_t *curpos,
 		size_t size,
 		git_otype type);
+static int unpack_inflate(
+		git_zinflate *zinflate,
+		unsigned char *buffer,
+		struct git_pack_file *p,
+		git_mwindow **w_curs,
+		git_off_t *curpos,
+		size_t size);
+static int packfile_resolve_header(
+		size_t *size_p,
+		git_otype *type_p,
+		struct git_pack_file *p,
+		git_off_t offset);
+static int pack_revindex_load(struct git_pack_file *p);
+static const struct git_pack_revindex_entry *pack_revindex_find(
+		struct git_pack_file *p, git_off_t offset);
 
 /* Can find the offset of an object given
  * a prefix of an identifier.
@@ -38,6 +56,7 @@ int packfile_unpack_compressed(
  */
 static int pack_entry_find_offset(
 		git_off_t *offset_out,
+		uint32_t *nr_out,
 		git_oid *found_oid,
 		struct git_pack_file *p,
 		const git_oid *short_oid,
@@ -53,6 +72,21 @@ static int packfile_error(const char *message)
  * Delta base cache
  ********************/
 
+/*
+ * The bases of every pack are kept in a single LRU list, so that the
+ * packs which are read the most get the memory, and evicting a base
+ * only takes it from the tail. All of it is under git__pack_cache_mutex.
+ */
+static struct {
+	git_pack_cache_entry *head, *tail;
+	size_t memory_used;
+	size_t hits, misses, evictions;
+} pack_cache_lru;
+
+static size_t pack_cache_max_storage = GIT_PACK_CACHE_MEMORY_LIMIT;
+
+bool git_pack__cache_intermediates = true;
+
 static git_pack_cache_entry *new_cache_object(git_rawobj *source)
 {
 	git_pack_cache_entry *e = git__calloc(1, sizeof(git_pack_cache_entry));
@@ -76,16 +110,56 @@ static void free_cache_object(void *o)
 	}
 }
 
+/* These run with the cache lock held */
+static void lru_unlink(git_pack_cache_entry *e)
+{
+	if (e->prev)
+		e->prev->next = e->next;
+	else
+		pack_cache_lru.head = e->next;
+
+	if (e->next)
+		e->next->prev = e->prev;
+	else
+		pack_cache_lru.tail = e->prev;
+
+	e->prev = e->next = NULL;
+}
+
+static void lru_push_head(git_pack_cache_entry *e)
+{
+	e->prev = NULL;
+	e->next = pack_cache_lru.head;
+
+	if (pack_cache_lru.head)
+		pack_cache_lru.head->prev = e;
+	else
+		pack_cache_lru.tail = e;
+
+	pack_cache_lru.head = e;
+}
+
 static void cache_free(git_pack_cache *cache)
 {
+	git_pack_cache_entry *entry;
 	khiter_t k;
 
 	if (cache->entries) {
+		if (git_mutex_lock(&git__pack_cache_mutex) < 0)
+			return;
+
 		for (k = kh_begin(cache->entries); k != kh_end(cache->entries); k++) {
-			if (kh_exist(cache->entries, k))
-				free_cache_object(kh_value(cache->entries, k));
+			if (!kh_exist(cache->entries, k))
+				continue;
+
+			entry = kh_value(cache->entries, k);
+			lru_unlink(entry);
+			pack_cache_lru.memory_used -= entry->raw.len;
+			free_cache_object(entry);
 		}
 
+		git_mutex_unlock(&git__pack_cache_mutex);
+
 		git_offmap_free(cache->entries);
 		cache->entries = NULL;
 	}
@@ -96,17 +170,6 @@ static int cache_init(git_pack_cache *cache)
 	cache->entries = git_offmap_alloc();
 	GITERR_CHECK_ALLOC(cache->entries);
 
-	cache->memory_limit = GIT_PACK_CACHE_MEMORY_LIMIT;
-
-	if (git_mutex_init(&cache->lock)) {
-		giterr_set(GITERR_OS, "Failed to initialize pack cache mutex");
-
-		git__free(cache->entries);
-		cache->entries = NULL;
-
-		return -1;
-	}
-
 	return 0;
 }
 
@@ -115,38 +178,57 @@ static git_pack_cache_entry *cache_get(git_pack_cache *cache, git_off_t offset)
 	khiter_t k;
 	git_pack_cache_entry *entry = NULL;
 
-	if (git_mutex_lock(&cache->lock) < 0)
+	if (git_mutex_lock(&git__pack_cache_mutex) < 0)
 		return NULL;
 
 	k = kh_get(off, cache->entries, offset);
 	if (k != kh_end(cache->entries)) { /* found it */
 		entry = kh_value(cache->entries, k);
 		git_atomic_inc(&entry->refcount);
-		entry->last_usage = cache->use_ctr++;
+
+		lru_unlink(entry);
+		lru_push_head(entry);
+		pack_cache_lru.hits++;
+	} else {
+		pack_cache_lru.misses++;
 	}
-	git_mutex_unlock(&cache->lock);
+	git_mutex_unlock(&git__pack_cache_mutex);
 
 	return entry;
 }
 
-/* Run with the cache lock held */
-static void free_lowest_entry(git_pack_cache *cache)
+/*
+ * Evict the least recently used bases until `len` more bytes fit in
+ * the budget. Bases which are being applied are skipped; if only those
+ * are left, this fails. Run with the cache lock held.
+ */
+static int cache_make_room(size_t len)
 {
-	git_pack_cache_entry *entry;
+	git_pack_cache_entry *entry = pack_cache_lru.tail, *prev;
 	khiter_t k;
 
-	for (k = kh_begin(cache->entries); k != kh_end(cache->entries); k++) {
-		if (!kh_exist(cache->entries, k))
-			continue;
+	while (pack_cache_lru.memory_used + len > pack_cache_max_storage) {
+		while (entry && entry->refcount.val)
+			entry = entry->prev;
 
-		entry = kh_value(cache->entries, k);
+		if (!entry)
+			return -1;
 
-		if (entry && entry->refcount.val == 0) {
-			cache->memory_used -= entry->raw.len;
-			kh_del(off, cache->entries, k);
-			free_cache_object(entry);
-		}
+		prev = entry->prev;
+
+		k = kh_get(off, entry->cache->entries, entry->offset);
+		assert(k != kh_end(entry->cache->entries));
+		kh_del(off, entry->cache->entries, k);
+
+		lru_unlink(entry);
+		pack_cache_lru.memory_used -= entry->raw.len;
+		pack_cache_lru.evictions++;
+		free_cache_object(entry);
+
+		entry = prev;
 	}
+
+	return 0;
 }
 
 static int cache_add(
@@ -164,26 +246,28 @@ static int cache_add(
 
 	entry = new_cache_object(base);
 	if (entry) {
-		if (git_mutex_lock(&cache->lock) < 0) {
+		if (git_mutex_lock(&git__pack_cache_mutex) < 0) {
 			giterr_set(GITERR_OS, "failed to lock cache");
 			git__free(entry);
 			return -1;
 		}
-		/* Add it to the cache if nobody else has */
-		exists = kh_get(off, cache->entries, offset) != kh_end(cache->entries);
+		/* Add it to the cache if nobody else has, and if it fits */
+		exists = kh_get(off, cache->entries, offset) != kh_end(cache->entries) ||
+			cache_make_room(base->len) < 0;
 		if (!exists) {
-			while (cache->memory_used + base->len > cache->memory_limit)
-				free_lowest_entry(cache);
-
 			k = kh_put(off, cache->entries, offset, &error);
 			assert(error != 0);
 			kh_value(cache->entries, k) = entry;
-			cache->memory_used += entry->raw.len;
+
+			entry->cache = cache;
+			entry->offset = offset;
+			lru_push_head(entry);
+			pack_cache_lru.memory_used += entry->raw.len;
 
 			*cached_out = entry;
 		}
-		git_mutex_unlock(&cache->lock);
-		/* Somebody beat us to adding it into the cache */
+		git_mutex_unlock(&git__pack_cache_mutex);
+		/* Somebody beat us to adding it into the cache, or it's full */
 		if (exists) {
 			git__free(entry);
 			return -1;
@@ -193,6 +277,44 @@ static int cache_add(
 	return 0;
 }
 
+void git_pack__cache_set_max_storage(size_t max_storage)
+{
+	if (git_mutex_lock(&git__pack_cache_mutex) < 0)
+		return;
+
+	pack_cache_max_storage = max_storage;
+	cache_make_room(0);
+
+	git_mutex_unlock(&git__pack_cache_mutex);
+}
+
+void git_pack__cache_memory(size_t *current, size_t *allowed)
+{
+	if (git_mutex_lock(&git__pack_cache_mutex) < 0) {
+		*current = *allowed = 0;
+		return;
+	}
+
+	*current = pack_cache_lru.memory_used;
+	*allowed = pack_cache_max_storage;
+
+	git_mutex_unlock(&git__pack_cache_mutex);
+}
+
+void git_pack__cache_stats(size_t *hits, size_t *misses, size_t *evictions)
+{
+	if (git_mutex_lock(&git__pack_cache_mutex) < 0) {
+		*hits = *misses = *evictions = 0;
+		return;
+	}
+
+	*hits = pack_cache_lru.hits;
+	*misses = pack_cache_lru.misses;
+	*evictions = pack_cache_lru.evictions;
+
+	git_mutex_unlock(&git__pack_cache_mutex);
+}
+
 /***********************************************************
  *
  * PACK INDEX METHODS
@@ -205,10 +327,38 @@ static void pack_index_free(struct git_pack_file *p)
 		git__free(p->oids);
 		p->oids = NULL;
 	}
+	if (p->revindex) {
+		git__free(p->revindex);
+		p->revindex = NULL;
+	}
 	if (p->index_map.data) {
 		git_futils_mmap_free(&p->index_map);
 		p->index_map.data = NULL;
 	}
+
+	git_pack_objinfo__close(&p->objinfo);
+}
+
+/* An `.objinfo` file is optional, so one that can't be used is ignored */
+static void pack_objinfo_open(struct git_pack_file *p)
+{
+	git_buf path = GIT_BUF_INIT;
+	const unsigned char *pack_checksum;
+	size_t name_len = strlen(p->pack_name);
+
+	git_buf_put(&path, p->pack_name, name_len - strlen(".pack"));
+	git_buf_puts(&path, GIT_PACK_OBJINFO_EXTENSION);
+
+	if (!git_buf_oom(&path) && git_path_isfile(path.ptr)) {
+		pack_checksum = (const unsigned char *)p->index_map.data +
+			p->index_map.len - 2 * GIT_OID_RAWSZ;
+
+		if (git_pack_objinfo__open(&p->objinfo, path.ptr,
+				p->num_objects, pack_checksum) < 0)
+			giterr_clear();
+	}
+
+	git_buf_free(&path);
 }
 
 static int pack_index_check(const char *path, struct git_pack_file *p)
@@ -246,6 +396,8 @@ static int pack_index_check(const char *path, struct git_pack_file *p)
 	if (error < 0)
 		return error;
 
+	git_mwindow_advise(&p->index_map);
+
 	hdr = idx_map = p->index_map.data;
 
 	if (hdr->idx_signature == htonl(PACK_IDX_SIGNATURE)) {
@@ -314,6 +466,8 @@ static int pack_index_check(const char *path, struct git_pack_file *p)
 
 	p->num_objects = nr;
 	p->index_version = version;
+
+	pack_objinfo_open(p);
 	return 0;
 }
 
@@ -358,7 +512,7 @@ static unsigned char *pack_window_open(
 		git_off_t offset,
 		unsigned int *left)
 {
-	if (p->mwf.fd == -1 && packfile_open(p) < 0)
+	if (p->mwf.fd == -1 && git_packfile_open(p) < 0)
 		return NULL;
 
 	/* Since packfiles end in a hash of their content and it's
@@ -475,11 +629,76 @@ int git_packfile_unpack_header(
 	return 0;
 }
 
+/*
+ * Look the object at `offset` up in the `.objinfo` table. `nr` is its
+ * position in the index when the caller knows it; it is checked against
+ * the offset, and the reverse index finds the position otherwise.
+ * Returns GIT_PASSTHROUGH when the header has to be read from the pack.
+ */
+static int pack_objinfo_find(
+		size_t *size_p,
+		git_otype *type_p,
+		struct git_pack_file *p,
+		git_off_t offset,
+		uint32_t nr)
+{
+	const struct git_pack_revindex_entry *entry;
+	int error;
+
+	if (!p->objinfo.entries)
+		return GIT_PASSTHROUGH;
+
+	if (nr >= p->num_objects || nth_packed_object_offset(p, nr) != offset) {
+		if (!p->revindex && (error = pack_revindex_load(p)) < 0)
+			return error;
+
+		if ((entry = pack_revindex_find(p, offset)) == NULL)
+			return GIT_PASSTHROUGH;
+
+		nr = entry->nr;
+	}
+
+	return git_pack_objinfo__get(size_p, type_p, &p->objinfo, nr);
+}
+
+int git_packfile_resolve_header_nth(
+		size_t *size_p,
+		git_otype *type_p,
+		struct git_pack_file *p,
+		git_off_t offset,
+		uint32_t nr)
+{
+	int error;
+
+	error = pack_objinfo_find(size_p, type_p, p, offset, nr);
+
+	if (error != GIT_PASSTHROUGH)
+		return error;
+
+	return packfile_resolve_header(size_p, type_p, p, offset);
+}
+
 int git_packfile_resolve_header(
 		size_t *size_p,
 		git_otype *type_p,
 		struct git_pack_file *p,
 		git_off_t offset)
+{
+	int error;
+
+	error = pack_objinfo_find(size_p, type_p, p, offset, UINT32_MAX);
+
+	if (error != GIT_PASSTHROUGH)
+		return error;
+
+	return packfile_resolve_header(size_p, type_p, p, offset);
+}
+
+static int packfile_resolve_header(
+		size_t *size_p,
+		git_otype *type_p,
+		struct git_pack_file *p,
+		git_off_t offset)
 {
 	git_mwindow *w_curs = NULL;
 	git_off_t curpos = offset;
@@ -637,6 +856,9 @@ int git_packfile_unpack(
 	struct pack_chain_elem small_stack[SMALL_STACK_SIZE];
 	size_t stack_size = 0, elem_pos, alloclen;
 	git_otype base_type;
+	git_buf results[2] = { GIT_BUF_INIT, GIT_BUF_INIT }, delta = GIT_BUF_INIT;
+	git_rawobj base;
+	git_zinflate zinflate;
 
 	/*
 	 * TODO: optionally check the CRC on the packfile
@@ -704,40 +926,56 @@ int git_packfile_unpack(
 		goto cleanup;
 	}
 
-	/* we now apply each consecutive delta until we run out */
-	while (elem_pos > 0 && !error) {
-		git_rawobj base, delta;
+	/* a base which is not a delta is the object itself */
+	if (elem_pos == 0)
+		goto cleanup;
 
-		/*
-		 * We can now try to add the base to the cache, as
-		 * long as it's not already the cached one.
-		 */
-		if (!cached)
-			free_base = !!cache_add(&cached, &p->bases, obj, elem->base_key);
+	/*
+	 * We now apply each consecutive delta until we run out. The
+	 * deltas are inflated into a single buffer, and the results go
+	 * to two buffers in turn, one holding the base of the delta
+	 * being applied and the other its result, so that a step needs
+	 * no allocation once they are large enough. The base we start
+	 * from is either in the cache or, if it couldn't be added to it,
+	 * still owned by `obj`.
+	 */
+	if ((error = git_zinflate_init(&zinflate)) < 0) {
+		/* the base is still in `obj`; don't free it if the cache has it */
+		if (cached) {
+			git_atomic_dec(&cached->refcount);
+			obj->data = NULL;
+		}
+		goto cleanup;
+	}
+
+	if (!cached)
+		free_base = !!cache_add(&cached, &p->bases, obj, elem->base_key);
+
+	base = *obj;
+	obj->data = NULL;
+	obj->len = 0;
+	obj->type = GIT_OBJ_BAD;
+
+	while (elem_pos > 0) {
+		git_buf *result = &results[elem_pos % 2];
 
 		elem = &stack[elem_pos - 1];
 		curpos = elem->offset;
-		error = packfile_unpack_compressed(&delta, p, &w_curs, &curpos, elem->size, elem->type);
+
+		if ((error = git_buf_grow(&delta, elem->size + 1)) < 0)
+			break;
+
+		error = unpack_inflate(&zinflate, (unsigned char *)delta.ptr,
+			p, &w_curs, &curpos, elem->size);
 		git_mwindow_close(&w_curs);
 
 		if (error < 0)
 			break;
 
-		/* the current object becomes the new base, on which we apply the delta */
-		base = *obj;
-		obj->data = NULL;
-		obj->len = 0;
-		obj->type = GIT_OBJ_BAD;
+		error = git__delta_apply_buf(result, base.data, base.len,
+			(unsigned char *)delta.ptr, elem->size);
 
-		error = git__delta_apply(obj, base.data, base.len, delta.data, delta.len);
-		obj->type = base_type;
-		/*
-		 * We usually don't want to free the base at this
-		 * point, as we put it into the cache in the previous
-		 * iteration. free_base lets us know that we got the
-		 * base object directly from the packfile, so we can free it.
-		 */
-		git__free(delta.data);
+		/* we are done with the base, unless it is in the other buffer */
 		if (free_base) {
 			free_base = 0;
 			git__free(base.data);
@@ -751,9 +989,36 @@ int git_packfile_unpack(
 		if (error < 0)
 			break;
 
-		elem_pos--;
+		base.data = result->ptr;
+		base.len = result->size;
+
+		/*
+		 * Cache the intermediate results too, if asked to, so that
+		 * other objects whose chain goes through this one start from
+		 * here. The buffer goes to the cache, which costs us an
+		 * allocation for the next result.
+		 */
+		if (--elem_pos > 0 && git_pack__cache_intermediates) {
+			base.data = git_buf_detach(result);
+
+			free_base = !!cache_add(&cached, &p->bases, &base, elem->base_key);
+		}
 	}
 
+	git_zinflate_free(&zinflate);
+
+	if (!error) {
+		obj->data = git_buf_detach(&results[(elem_pos + 1) % 2]);
+		obj->len = base.len;
+		obj->type = base_type;
+	}
+
+	if (free_base)
+		git__free(base.data);
+
+	if (cached)
+		git_atomic_dec(&cached->refcount);
+
 cleanup:
 	if (error < 0)
 		git__free(obj->data);
@@ -761,22 +1026,13 @@ cleanup:
 	if (elem)
 		*obj_offset = curpos;
 
+	git_buf_free(&results[0]);
+	git_buf_free(&results[1]);
+	git_buf_free(&delta);
 	git_array_clear(chain);
 	return error;
 }
 
-static void *use_git_alloc(void *opaq, unsigned int count, unsigned int size)
-{
-	GIT_UNUSED(opaq);
-	return git__calloc(count, size);
-}
-
-static void use_git_free(void *opaq, void *ptr)
-{
-	GIT_UNUSED(opaq);
-	git__free(ptr);
-}
-
 int git_packfile_stream_open(git_packfile_stream *obj, struct git_pack_file *p, git_off_t curpos)
 {
 	int st;
@@ -784,8 +1040,8 @@ int git_packfile_stream_open(git_packfile_stream *obj, struct git_pack_file *p,
 	memset(obj, 0, sizeof(git_packfile_stream));
 	obj->curpos = curpos;
 	obj->p = p;
-	obj->zstream.zalloc = use_git_alloc;
-	obj->zstream.zfree = use_git_free;
+	obj->zstream.zalloc = git_zstream__alloc;
+	obj->zstream.zfree = git_zstream__free;
 	obj->zstream.next_in = Z_NULL;
 	obj->zstream.next_out = Z_NULL;
 	st = inflateInit(&obj->zstream);
@@ -843,63 +1099,103 @@ void git_packfile_stream_free(git_packfile_stream *obj)
 	inflateEnd(&obj->zstream);
 }
 
-int packfile_unpack_compressed(
-	git_rawobj *obj,
+/*
+ * Inflate the `size` bytes of data at `curpos` into `buffer`, which has
+ * room for them and a NUL. The inflater is reset first, so a single one
+ * can be used for several objects.
+ */
+static int unpack_inflate(
+	git_zinflate *zinflate,
+	unsigned char *buffer,
 	struct git_pack_file *p,
 	git_mwindow **w_curs,
 	git_off_t *curpos,
-	size_t size,
-	git_otype type)
+	size_t size)
 {
-	size_t buf_size;
+	z_stream *stream = &zinflate->z;
+	unsigned int left;
+	size_t used;
 	int st;
-	z_stream stream;
-	unsigned char *buffer, *in;
-
-	GITERR_CHECK_ALLOC_ADD(&buf_size, size, 1);
-	buffer = git__calloc(1, buf_size);
-	GITERR_CHECK_ALLOC(buffer);
+	unsigned char *in;
 
-	memset(&stream, 0, sizeof(stream));
-	stream.next_out = buffer;
-	stream.avail_out = (uInt)buf_size;
-	stream.zalloc = use_git_alloc;
-	stream.zfree = use_git_free;
+	/*
+	 * The windows are large, so the stream is nearly always all in
+	 * the first one and can be inflated in one go. If it runs on into
+	 * the next window, start over and stream it instead.
+	 */
+	if ((in = pack_window_open(p, w_curs, *curpos, &left)) != NULL) {
+		st = git_zinflate_buf(&used, zinflate, buffer, size, in, left);
+		git_mwindow_close(w_curs);
 
-	st = inflateInit(&stream);
-	if (st != Z_OK) {
-		git__free(buffer);
-		giterr_set(GITERR_ZLIB, "failed to init zlib stream on unpack");
+		if (st != GIT_EBUFS) {
+			if (!st)
+				*curpos += used;
+			return st;
+		}
+	}
 
+	if (inflateReset(stream) != Z_OK) {
+		giterr_set(GITERR_ZLIB, "failed to reset zlib stream on unpack");
 		return -1;
 	}
 
+	stream->next_out = buffer;
+	stream->avail_out = (uInt)(size + 1);
+
 	do {
-		in = pack_window_open(p, w_curs, *curpos, &stream.avail_in);
-		stream.next_in = in;
-		st = inflate(&stream, Z_FINISH);
+		in = pack_window_open(p, w_curs, *curpos, &stream->avail_in);
+		stream->next_in = in;
+		st = inflate(stream, Z_FINISH);
 		git_mwindow_close(w_curs);
 
-		if (!stream.avail_out)
+		if (!stream->avail_out)
 			break; /* the payload is larger than it should be */
 
-		if (st == Z_BUF_ERROR && in == NULL) {
-			inflateEnd(&stream);
-			git__free(buffer);
+		if (st == Z_BUF_ERROR && in == NULL)
 			return GIT_EBUFS;
-		}
 
-		*curpos += stream.next_in - in;
+		*curpos += stream->next_in - in;
 	} while (st == Z_OK || st == Z_BUF_ERROR);
 
-	inflateEnd(&stream);
-
-	if ((st != Z_STREAM_END) || stream.total_out != size) {
-		git__free(buffer);
+	if ((st != Z_STREAM_END) || stream->total_out != size) {
 		giterr_set(GITERR_ZLIB, "error inflating zlib stream");
 		return -1;
 	}
 
+	buffer[size] = '\0';
+	return 0;
+}
+
+int packfile_unpack_compressed(
+	git_rawobj *obj,
+	struct git_pack_file *p,
+	git_mwindow **w_curs,
+	git_off_t *curpos,
+	size_t size,
+	git_otype type)
+{
+	size_t buf_size;
+	int error;
+	git_zinflate zinflate;
+	unsigned char *buffer;
+
+	GITERR_CHECK_ALLOC_ADD(&buf_size, size, 1);
+	buffer = git__malloc(buf_size);
+	GITERR_CHECK_ALLOC(buffer);
+
+	if ((error = git_zinflate_init(&zinflate)) < 0) {
+		git__free(buffer);
+		return error;
+	}
+
+	error = unpack_inflate(&zinflate, buffer, p, w_curs, curpos, size);
+	git_zinflate_free(&zinflate);
+
+	if (error < 0) {
+		git__free(buffer);
+		return error;
+	}
+
 	obj->type = type;
 	obj->len = size;
 	obj->data = buffer;
@@ -920,6 +1216,7 @@ git_off_t get_delta_base(
 	unsigned int left = 0;
 	unsigned char *base_info;
 	git_off_t base_offset;
+	uint32_t base_nr;
 	git_oid unused;
 
 	base_info = pack_window_open(p, w_curs, *curpos, &left);
@@ -970,7 +1267,7 @@ git_off_t get_delta_base(
 		}
 
 		/* The base entry _must_ be in the same pack */
-		if (pack_entry_find_offset(&base_offset, &unused, p, (git_oid *)base_info, GIT_OID_HEXSZ) < 0)
+		if (pack_entry_find_offset(&base_offset, &base_nr, &unused, p, (git_oid *)base_info, GIT_OID_HEXSZ) < 0)
 			return packfile_error("base entry delta is not in the same pack");
 		*curpos += 20;
 	} else
@@ -1002,11 +1299,11 @@ void git_packfile_free(struct git_pack_file *p)
 	git__free(p->bad_object_sha1);
 
 	git_mutex_free(&p->lock);
-	git_mutex_free(&p->bases.lock);
+	git_mwindow_file_free(&p->mwf);
 	git__free(p);
 }
 
-static int packfile_open(struct git_pack_file *p)
+int git_packfile_open(struct git_pack_file *p)
 {
 	struct stat st;
 	struct git_pack_header hdr;
@@ -1145,7 +1442,11 @@ int git_packfile_alloc(struct git_pack_file **pack_out, const char *path)
 	/* ok, it looks sane as far as we can check without
 	 * actually mapping the pack file.
 	 */
-	p->mwf.fd = -1;
+	if (git_mwindow_file_init(&p->mwf) < 0) {
+		git__free(p);
+		return -1;
+	}
+
 	p->mwf.size = st.st_size;
 	p->pack_local = 1;
 	p->mtime = (git_time_t)st.st_mtime;
@@ -1153,11 +1454,13 @@ int git_packfile_alloc(struct git_pack_file **pack_out, const char *path)
 
 	if (git_mutex_init(&p->lock)) {
 		giterr_set(GITERR_OS, "Failed to initialize packfile mutex");
+		git_mwindow_file_free(&p->mwf);
 		git__free(p);
 		return -1;
 	}
 
 	if (cache_init(&p->bases) < 0) {
+		git_mwindow_file_free(&p->mwf);
 		git__free(p);
 		return -1;
 	}
@@ -1191,6 +1494,261 @@ static git_off_t nth_packed_object_offset(const struct git_pack_file *p, uint32_
 	}
 }
 
+static int revindex_cmp(const void *a_, const void *b_, void *payload)
+{
+	const struct git_pack_revindex_entry *a = a_, *b = b_;
+
+	GIT_UNUSED(payload);
+
+	return (a->offset > b->offset) - (a->offset < b->offset);
+}
+
+static int pack_revindex_load(struct git_pack_file *p)
+{
+	struct git_pack_revindex_entry *revindex;
+	uint32_t i;
+
+	if (git_mutex_lock(&p->lock) < 0)
+		return packfile_error("failed to get lock for the reverse index");
+
+	if (p->revindex) {
+		git_mutex_unlock(&p->lock);
+		return 0;
+	}
+
+	revindex = git__calloc(p->num_objects + 1, sizeof(*revindex));
+	if (!revindex) {
+		git_mutex_unlock(&p->lock);
+		return -1;
+	}
+
+	for (i = 0; i < p->num_objects; i++) {
+		revindex[i].offset = nth_packed_object_offset(p, i);
+		revindex[i].nr = i;
+	}
+
+	git__qsort_r(revindex, p->num_objects, sizeof(*revindex), revindex_cmp, NULL);
+
+	p->revindex = revindex;
+	git_mutex_unlock(&p->lock);
+	return 0;
+}
+
+static const struct git_pack_revindex_entry *pack_revindex_find(
+	struct git_pack_file *p, git_off_t offset)
+{
+	uint32_t lo = 0, hi = p->num_objects;
+
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+
+		if (p->revindex[mid].offset == offset)
+			return &p->revindex[mid];
+		else if (p->revindex[mid].offset < offset)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return NULL;
+}
+
+int git_packfile__raw_entry(
+	git_pack_raw_entry *out,
+	struct git_pack_file *p,
+	git_off_t offset)
+{
+	const struct git_pack_revindex_entry *entry, *base;
+	const unsigned char *index;
+	git_mwindow *w_curs = NULL;
+	git_off_t curpos = offset, base_offset;
+	unsigned char *base_info;
+	unsigned int left;
+	int error;
+
+	if (p->mwf.fd == -1 && (error = git_packfile_open(p)) < 0)
+		return error;
+
+	/* only version 2 indexes have the CRC of the entries */
+	if (p->index_version < 2)
+		return GIT_PASSTHROUGH;
+
+	if (!p->revindex && (error = pack_revindex_load(p)) < 0)
+		return error;
+
+	if ((entry = pack_revindex_find(p, offset)) == NULL)
+		return packfile_error("no object at the given offset");
+
+	if ((error = git_packfile_unpack_header(&out->size, &out->type,
+			&p->mwf, &w_curs, &curpos)) < 0)
+		return error;
+
+	if (out->type == GIT_OBJ_OFS_DELTA) {
+		base_offset = get_delta_base(p, &w_curs, &curpos, out->type, offset);
+		git_mwindow_close(&w_curs);
+
+		if (base_offset <= 0 ||
+			(base = pack_revindex_find(p, base_offset)) == NULL)
+			return packfile_error("invalid delta base offset");
+
+		index = (const unsigned char *)p->index_map.data + 8 + 256 * 4;
+		git_oid_fromraw(&out->base_id, index + GIT_OID_RAWSZ * base->nr);
+	} else if (out->type == GIT_OBJ_REF_DELTA) {
+		if ((base_info = pack_window_open(p, &w_curs, curpos, &left)) == NULL)
+			return packfile_error("truncated delta base");
+
+		git_oid_fromraw(&out->base_id, base_info);
+		git_mwindow_close(&w_curs);
+		curpos += GIT_OID_RAWSZ;
+	} else {
+		memset(&out->base_id, 0, sizeof(out->base_id));
+	}
+
+	out->data_offset = curpos;
+
+	/* the last entry ends where the trailer starts */
+	if (entry + 1 < p->revindex + p->num_objects)
+		out->end_offset = (entry + 1)->offset;
+	else
+		out->end_offset = p->mwf.size - GIT_OID_RAWSZ;
+
+	index = (const unsigned char *)p->index_map.data + 8 + 256 * 4 +
+		p->num_objects * GIT_OID_RAWSZ;
+	out->crc = ntohl(*((const uint32_t *)(index + 4 * entry->nr)));
+
+	return 0;
+}
+
+int git_packfile__foreach_raw(
+	struct git_pack_file *p,
+	git_off_t start,
+	git_off_t end,
+	int (*cb)(void *buf, size_t len, void *payload),
+	void *payload)
+{
+	git_mwindow *w_curs = NULL;
+	unsigned char *ptr;
+	unsigned int left;
+	size_t len;
+	int error = 0;
+
+	while (start < end) {
+		ptr = git_mwindow_open(&p->mwf, &w_curs, start, 0, &left);
+		if (ptr == NULL)
+			return packfile_error("failed to map the packfile");
+
+		len = (size_t)min((git_off_t)left, end - start);
+		error = cb(ptr, len, payload);
+		git_mwindow_close(&w_curs);
+
+		if (error < 0)
+			return error;
+
+		start += len;
+	}
+
+	return 0;
+}
+
+unsigned int git_packfile__name_hash(const char *name)
+{
+	unsigned c, hash = 0;
+
+	if (!name)
+		return 0;
+
+	/*
+	 * This effectively just creates a sortable number from the
+	 * last sixteen non-whitespace characters. Last characters
+	 * count "most", so things that end in ".c" sort together.
+	 */
+	while ((c = *name++) != 0) {
+		if (git__isspace(c))
+			continue;
+		hash = (hash >> 2) + (c << 24);
+	}
+	return hash;
+}
+
+unsigned int git_packfile__name_hash_path(const char *path)
+{
+	unsigned c, hash = 0, base = 0;
+
+	if (!path)
+		return 0;
+
+	/*
+	 * Hash each component of the path like the name above, with the
+	 * bits of each character reversed so that the low ones, which
+	 * tell apart most characters of a name, count most. The hashes
+	 * of the directories only go into the low bits: files with the
+	 * same name still sort close to each other, but the ones at the
+	 * same path sort right next to each other.
+	 */
+	while ((c = (unsigned char)*path++) != 0) {
+		if (git__isspace(c))
+			continue;
+
+		if (c == '/') {
+			base = (base >> 6) ^ hash;
+			hash = 0;
+			continue;
+		}
+
+		c = (c & 0xf0) >> 4 | (c & 0x0f) << 4;
+		c = (c & 0xcc) >> 2 | (c & 0x33) << 2;
+		c = (c & 0xaa) >> 1 | (c & 0x55) << 1;
+		hash = (hash >> 2) + (c << 24);
+	}
+
+	return (base >> 6) ^ hash;
+}
+
+int git_packfile__num_objects(uint32_t *out, struct git_pack_file *p)
+{
+	int error;
+
+	if (p->index_version == -1 && (error = pack_index_open(p)) < 0)
+		return error;
+
+	*out = p->num_objects;
+	return 0;
+}
+
+int git_pack_foreach_entry_offset(
+	struct git_pack_file *p,
+	git_pack_foreach_entry_offset_cb cb,
+	void *data)
+{
+	const unsigned char *index;
+	const git_oid *current;
+	uint32_t i;
+	int error = 0;
+
+	if (p->index_version == -1 && (error = pack_index_open(p)) < 0)
+		return error;
+
+	assert(p->index_map.data);
+	index = p->index_map.data;
+
+	if (p->index_version > 1)
+		index += 8;
+
+	index += 4 * 256;
+
+	for (i = 0; i < p->num_objects; i++) {
+		if (p->index_version > 1)
+			current = (const git_oid *)(index + 20 * i);
+		else
+			current = (const git_oid *)(index + 24 * i + 4);
+
+		if ((error = cb(current, nth_packed_object_offset(p, i), data)) != 0)
+			return giterr_set_after_callback(error);
+	}
+
+	return error;
+}
+
 static int git__memcmp4(const void *a, const void *b) {
 	return memcmp(a, b, 4);
 }
@@ -1256,6 +1814,7 @@ int git_pack_foreach_entry(
 
 static int pack_entry_find_offset(
 	git_off_t *offset_out,
+	uint32_t *nr_out,
 	git_oid *found_oid,
 	struct git_pack_file *p,
 	const git_oid *short_oid,
@@ -1338,6 +1897,7 @@ static int pack_entry_find_offset(
 		return git_odb__error_ambiguous("found multiple offsets for pack entry");
 
 	*offset_out = nth_packed_object_offset(p, pos);
+	*nr_out = (uint32_t)pos;
 	git_oid_fromraw(found_oid, current);
 
 #ifdef INDEX_DEBUG_LOOKUP
@@ -1359,6 +1919,7 @@ int git_pack_entry_find(
 		size_t len)
 {
 	git_off_t offset;
+	uint32_t nr;
 	git_oid found_oid;
 	int error;
 
@@ -1371,17 +1932,18 @@ int git_pack_entry_find(
 				return packfile_error("bad object found in packfile");
 	}
 
-	error = pack_entry_find_offset(&offset, &found_oid, p, short_oid, len);
+	error = pack_entry_find_offset(&offset, &nr, &found_oid, p, short_oid, len);
 	if (error < 0)
 		return error;
 
 	/* we found a unique entry in the index;
 	 * make sure the packfile backing the index
 	 * still exists on disk */
-	if (p->mwf.fd == -1 && (error = packfile_open(p)) < 0)
+	if (p->mwf.fd == -1 && (error = git_packfile_open(p)) < 0)
 		return error;
 
 	e->offset = offset;
+	e->nr = nr;
 	e->p = p;
 
 	git_oid_cpy(&e->sha1, &found_oid);
@@ -18,6 +18,7 @@
 #include "odb.h"
 #include "oidmap.h"
 #include "array.h"
+#include "pack_objinfo.h"
 
 #define GIT_PACK_FILE_MODE 0444
 
@@ -56,7 +57,10 @@ struct git_pack_idx_header {
 };
 
 typedef struct git_pack_cache_entry {
-	size_t last_usage; /* enough? */
+	/* in the LRU list shared by every pack, most recently used first */
+	struct git_pack_cache_entry *prev, *next;
+	struct git_pack_cache *cache; /* the cache of the pack it came from */
+	git_off_t offset;
 	git_atomic refcount;
 	git_rawobj raw;
 } git_pack_cache_entry;
@@ -73,17 +77,35 @@ typedef git_array_t(struct pack_chain_elem) git_dependency_chain;
 #include "offmap.h"
 #include "oidmap.h"
 
-#define GIT_PACK_CACHE_MEMORY_LIMIT 16 * 1024 * 1024
+#define GIT_PACK_CACHE_MEMORY_LIMIT 96 * 1024 * 1024 /* for every pack together */
 #define GIT_PACK_CACHE_SIZE_LIMIT 1024 * 1024 /* don't bother caching anything over 1MB */
 
-typedef struct {
-	size_t memory_used;
-	size_t memory_limit;
-	size_t use_ctr;
-	git_mutex lock;
+/*
+ * The delta bases of a pack. The entries of every pack share a single
+ * memory budget and LRU list, all under git__pack_cache_mutex.
+ */
+typedef struct git_pack_cache {
 	git_offmap *entries;
 } git_pack_cache;
 
+/* Whether the intermediate results of a delta chain are cached too */
+extern bool git_pack__cache_intermediates;
+
+/* Change the budget of the delta base caches, evicting bases to meet it */
+extern void git_pack__cache_set_max_storage(size_t max_storage);
+
+/* Get the memory used by the delta bases of every pack */
+extern void git_pack__cache_memory(size_t *current, size_t *allowed);
+
+/* Get the hits, misses and evictions of the delta base caches */
+extern void git_pack__cache_stats(size_t *hits, size_t *misses, size_t *evictions);
+
+/* An entry of the reverse index, which sorts the objects by offset */
+struct git_pack_revindex_entry {
+	git_off_t offset;
+	uint32_t nr; /* position in the index */
+};
+
 struct git_pack_file {
 	git_mwindow_file mwf;
 	git_map index_map;
@@ -99,6 +121,8 @@ struct git_pack_file {
 	unsigned pack_local:1, pack_keep:1, has_cache:1;
 	git_oidmap *idx_cache;
 	git_oid **oids;
+	struct git_pack_revindex_entry *revindex; /* built on first use */
+	git_pack_objinfo objinfo; /* from the `.objinfo` file, if any */
 
 	git_pack_cache bases; /* delta base cache */
 
@@ -110,6 +134,7 @@ struct git_pack_entry {
 	git_off_t offset;
 	git_oid sha1;
 	struct git_pack_file *p;
+	uint32_t nr; /* position in the index, UINT32_MAX when unknown */
 };
 
 typedef struct git_packfile_stream {
@@ -137,6 +162,18 @@ int git_packfile_resolve_header(
 		struct git_pack_file *p,
 		git_off_t offset);
 
+/*
+ * Like `git_packfile_resolve_header`, for the object at position `nr`
+ * of the index, which saves a lookup in the reverse index when there
+ * is an `.objinfo` file.
+ */
+int git_packfile_resolve_header_nth(
+		size_t *size_p,
+		git_otype *type_p,
+		struct git_pack_file *p,
+		git_off_t offset,
+		uint32_t nr);
+
 int git_packfile_unpack(git_rawobj *obj, struct git_pack_file *p, git_off_t *obj_offset);
 int packfile_unpack_compressed(
 	git_rawobj *obj,
@@ -156,15 +193,79 @@ git_off_t get_delta_base(struct git_pack_file *p, git_mwindow **w_curs,
 
 void git_packfile_free(struct git_pack_file *p);
 int git_packfile_alloc(struct git_pack_file **pack_out, const char *path);
+int git_packfile_open(struct git_pack_file *p);
 
 int git_pack_entry_find(
 		struct git_pack_entry *e,
 		struct git_pack_file *p,
 		const git_oid *short_oid,
 		size_t len);
+/* Get the number of objects in the pack, opening its index if needed */
+int git_packfile__num_objects(uint32_t *out, struct git_pack_file *p);
+
 int git_pack_foreach_entry(
 		struct git_pack_file *p,
 		git_odb_foreach_cb cb,
 		void *data);
 
+/*
+ * Calls `cb` with the id and the offset of every object in the pack,
+ * in the order of the index (that is, sorted by id).
+ */
+typedef int (*git_pack_foreach_entry_offset_cb)(
+		const git_oid *id,
+		git_off_t offset,
+		void *payload);
+
+int git_pack_foreach_entry_offset(
+		struct git_pack_file *p,
+		git_pack_foreach_entry_offset_cb cb,
+		void *data);
+
+/*
+ * What is needed to copy the entry at an offset of a packfile verbatim
+ * into another packfile.
+ */
+typedef struct {
+	git_otype type; /* the type of the entry, possibly a delta */
+	size_t size; /* the inflated size of the entry's data */
+	git_off_t data_offset; /* where the compressed data starts */
+	git_off_t end_offset; /* where the next entry starts */
+	git_oid base_id; /* the delta base, for deltas */
+	uint32_t crc; /* the CRC32 of the whole entry, from the index */
+} git_pack_raw_entry;
+
+/*
+ * Describe the raw entry at `offset`. Returns GIT_PASSTHROUGH when the
+ * entry cannot be reused safely because the index (version 1) has no
+ * CRC for it.
+ */
+int git_packfile__raw_entry(
+		git_pack_raw_entry *out,
+		struct git_pack_file *p,
+		git_off_t offset);
+
+/*
+ * Calls `cb` with the raw bytes of the packfile between `start` and
+ * `end`, a window at a time.
+ */
+int git_packfile__foreach_raw(
+		struct git_pack_file *p,
+		git_off_t start,
+		git_off_t end,
+		int (*cb)(void *buf, size_t len, void *payload),
+		void *payload);
+
+/*
+ * The hash of a path name that is used to sort objects for delta
+ * compression, so that files with the same name end up close together.
+ */
+unsigned int git_packfile__name_hash(const char *name);
+
+/*
+ * The same for the whole path of a file, which keeps the files at the
+ * same path closer together than the ones with the same name.
+ */
+unsigned int git_packfile__name_hash_path(const char *path);
+
 #endif
@@ -0,0 +1,949 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "pack_bitmap.h"
+
+#include "array.h"
+#include "buffer.h"
+#include "commit.h"
+#include "filebuf.h"
+#include "hash.h"
+#include "mwindow.h"
+#include "oid.h"
+#include "path.h"
+#include "sha1_lookup.h"
+#include "tree.h"
+
+#include "git2/revwalk.h"
+
+GIT__USE_OIDMAP
+
+#define BITMAP_SIGNATURE "BITM"
+#define BITMAP_VERSION 1
+
+#define BITMAP_OPT_FULL_DAG 0x1
+#define BITMAP_OPT_HASH_CACHE 0x4
+
+/* signature, version, options, entry count and pack checksum */
+#define BITMAP_HEADER_SIZE (4 + 2 + 2 + 4 + GIT_OID_RAWSZ)
+
+/* git refuses longer chains of XOR'ed bitmaps */
+#define BITMAP_MAX_XOR_DEPTH 160
+
+/* select a commit every so many commits when writing bitmaps */
+#define BITMAP_SELECTION_INTERVAL 100
+
+static int bitmap_error(const char *message)
+{
+	giterr_set(GITERR_ODB, "Invalid pack bitmap file - %s", message);
+	return -1;
+}
+
+static uint32_t bitmap_get_be32(const unsigned char *data)
+{
+	return ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) |
+		((uint32_t)data[2] << 8) | (uint32_t)data[3];
+}
+
+/***********************************************************
+ *
+ * PACKFILE OBJECT ORDER
+ *
+ ***********************************************************/
+
+typedef struct {
+	git_pack_bitmap_objects *objects;
+	uint32_t i;
+} objects_collect_data;
+
+static int objects_collect(const git_oid *id, git_off_t offset, void *payload)
+{
+	objects_collect_data *data = payload;
+
+	git_oid_cpy(&data->objects->ids[data->i], id);
+	data->objects->offsets[data->i] = offset;
+	data->i++;
+
+	return 0;
+}
+
+static int objects_offset_cmp(const void *a, const void *b, void *payload)
+{
+	const git_off_t *offsets = payload;
+	git_off_t offset_a = offsets[*(const uint32_t *)a];
+	git_off_t offset_b = offsets[*(const uint32_t *)b];
+
+	return (offset_a > offset_b) - (offset_a < offset_b);
+}
+
+int git_pack_bitmap_objects_init(
+	git_pack_bitmap_objects *objects, struct git_pack_file *pack)
+{
+	objects_collect_data data;
+	uint32_t i;
+	int error;
+
+	memset(objects, 0, sizeof(*objects));
+
+	/* this loads the index and therefore the number of objects */
+	if (pack->mwf.fd == -1 && (error = git_packfile_open(pack)) < 0)
+		return error;
+
+	objects->pack = pack;
+	objects->num_objects = pack->num_objects;
+
+	objects->ids = git__calloc(pack->num_objects + 1, sizeof(git_oid));
+	objects->offsets = git__calloc(pack->num_objects + 1, sizeof(git_off_t));
+	objects->pack_order = git__calloc(pack->num_objects + 1, sizeof(uint32_t));
+	objects->pack_positions = git__calloc(pack->num_objects + 1, sizeof(uint32_t));
+
+	if (!objects->ids || !objects->offsets ||
+		!objects->pack_order || !objects->pack_positions) {
+		git_pack_bitmap_objects_free(objects);
+		giterr_set_oom();
+		return -1;
+	}
+
+	data.objects = objects;
+	data.i = 0;
+
+	if ((error = git_pack_foreach_entry_offset(pack, objects_collect, &data)) < 0) {
+		git_pack_bitmap_objects_free(objects);
+		return error;
+	}
+
+	for (i = 0; i < objects->num_objects; i++)
+		objects->pack_order[i] = i;
+
+	git__qsort_r(objects->pack_order, objects->num_objects, sizeof(uint32_t),
+		objects_offset_cmp, objects->offsets);
+
+	for (i = 0; i < objects->num_objects; i++)
+		objects->pack_positions[objects->pack_order[i]] = i;
+
+	return 0;
+}
+
+void git_pack_bitmap_objects_free(git_pack_bitmap_objects *objects)
+{
+	git__free(objects->ids);
+	git__free(objects->offsets);
+	git__free(objects->pack_order);
+	git__free(objects->pack_positions);
+	memset(objects, 0, sizeof(*objects));
+}
+
+int git_pack_bitmap_objects_position(
+	uint32_t *out, const git_pack_bitmap_objects *objects, const git_oid *id)
+{
+	int pos = sha1_position(objects->ids, GIT_OID_RAWSZ,
+		0, objects->num_objects, id->id);
+
+	if (pos < 0)
+		return GIT_ENOTFOUND;
+
+	*out = objects->pack_positions[pos];
+	return 0;
+}
+
+/***********************************************************
+ *
+ * BITMAP INDEX READING
+ *
+ ***********************************************************/
+
+static int bitmap_parse_ewah(
+	git_bitmap *out, const unsigned char **data, size_t *remaining)
+{
+	size_t len;
+	int error;
+
+	if ((error = git_ewah_read(out, *data, *remaining, &len)) < 0)
+		return error;
+
+	*data += len;
+	*remaining -= len;
+	return 0;
+}
+
+int git_pack_bitmap_index_parse(
+	git_pack_bitmap_index *index, const unsigned char *data, size_t size)
+{
+	const unsigned char *pack_checksum;
+	size_t remaining, i;
+	uint16_t version, options;
+	uint32_t entry_count;
+	int error;
+
+	assert(index && index->objects.pack);
+
+	if (size < BITMAP_HEADER_SIZE + GIT_OID_RAWSZ)
+		return bitmap_error("file is too short");
+
+	if (memcmp(data, BITMAP_SIGNATURE, 4) != 0)
+		return bitmap_error("wrong signature");
+
+	version = (uint16_t)((data[4] << 8) | data[5]);
+	options = (uint16_t)((data[6] << 8) | data[7]);
+	entry_count = bitmap_get_be32(data + 8);
+
+	if (version != BITMAP_VERSION)
+		return bitmap_error("unsupported version");
+	if (!(options & BITMAP_OPT_FULL_DAG))
+		return bitmap_error("only full bitmaps are supported");
+
+	/* the checksum of the packfile is stored right before the one of the index */
+	pack_checksum = (const unsigned char *)index->objects.pack->index_map.data +
+		index->objects.pack->index_map.len - 2 * GIT_OID_RAWSZ;
+	if (memcmp(data + 12, pack_checksum, GIT_OID_RAWSZ) != 0)
+		return bitmap_error("the bitmap does not match its packfile");
+
+	git_oid_fromraw(&index->checksum, data + size - GIT_OID_RAWSZ);
+
+	data += BITMAP_HEADER_SIZE;
+	remaining = size - BITMAP_HEADER_SIZE - GIT_OID_RAWSZ;
+
+	if ((error = bitmap_parse_ewah(&index->commits, &data, &remaining)) < 0 ||
+		(error = bitmap_parse_ewah(&index->trees, &data, &remaining)) < 0 ||
+		(error = bitmap_parse_ewah(&index->blobs, &data, &remaining)) < 0 ||
+		(error = bitmap_parse_ewah(&index->tags, &data, &remaining)) < 0)
+		return error;
+
+	index->entries = git__calloc(entry_count + 1, sizeof(git_pack_bitmap_entry));
+	GITERR_CHECK_ALLOC(index->entries);
+
+	for (i = 0; i < entry_count; i++) {
+		git_pack_bitmap_entry *entry = &index->entries[i];
+		uint32_t idx_pos;
+		size_t len;
+
+		/* object position, XOR offset, flags and the EWAH header */
+		if (remaining < 4 + 1 + 1 + 8)
+			return bitmap_error("truncated bitmap entry");
+
+		idx_pos = bitmap_get_be32(data);
+		if (idx_pos >= index->objects.num_objects)
+			return bitmap_error("bitmap entry for an unknown object");
+
+		git_oid_cpy(&entry->commit_id, &index->objects.ids[idx_pos]);
+		entry->xor_offset = data[4];
+
+		if (entry->xor_offset > i || entry->xor_offset > BITMAP_MAX_XOR_DEPTH)
+			return bitmap_error("invalid XOR offset");
+
+		data += 6;
+		remaining -= 6;
+
+		/* the EWAH header, the words and the RLW position */
+		len = 8 + (size_t)bitmap_get_be32(data + 4) * 8 + 4;
+		if (len > remaining)
+			return bitmap_error("truncated bitmap entry");
+
+		entry->data = data;
+		entry->len = len;
+
+		git_oidmap_insert(index->entry_map, &entry->commit_id, entry, error);
+		if (error < 0)
+			return -1;
+
+		index->num_entries++;
+		data += len;
+		remaining -= len;
+	}
+
+	if (options & BITMAP_OPT_HASH_CACHE) {
+		if (remaining < (size_t)index->objects.num_objects * 4)
+			return bitmap_error("truncated name-hash cache");
+
+		index->hash_cache = data;
+	}
+
+	/* other extensions (like the lookup table) are not used */
+	return 0;
+}
+
+static void bitmap_index_clear(git_pack_bitmap_index *index)
+{
+	size_t i;
+
+	for (i = 0; i < index->num_entries; i++)
+		git_bitmap_free(&index->entries[i].bitmap);
+
+	git__free(index->entries);
+	index->entries = NULL;
+	index->num_entries = 0;
+
+	git_bitmap_free(&index->commits);
+	git_bitmap_free(&index->trees);
+	git_bitmap_free(&index->blobs);
+	git_bitmap_free(&index->tags);
+}
+
+int git_pack_bitmap_index_open(
+	git_pack_bitmap_index **out, const char *idx_path)
+{
+	git_pack_bitmap_index *index;
+	struct git_pack_file *pack;
+	git_buf path = GIT_BUF_INIT;
+	git_file fd = -1;
+	struct stat st;
+	int error;
+
+	if (git__suffixcmp(idx_path, ".idx") != 0) {
+		giterr_set(GITERR_INVALID, "'%s' is not an index file", idx_path);
+		return -1;
+	}
+
+	if ((error = git_buf_set(&path, idx_path, strlen(idx_path) - strlen(".idx"))) < 0 ||
+		(error = git_buf_puts(&path, GIT_PACK_BITMAP_EXTENSION)) < 0)
+		return error;
+
+	if ((fd = git_futils_open_ro(path.ptr)) < 0) {
+		git_buf_free(&path);
+		return fd;
+	}
+
+	if (p_fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || !git__is_sizet(st.st_size)) {
+		p_close(fd);
+		giterr_set(GITERR_ODB, "invalid pack bitmap '%s'", path.ptr);
+		git_buf_free(&path);
+		return -1;
+	}
+
+	if ((error = git_mwindow_get_pack(&pack, idx_path)) < 0) {
+		p_close(fd);
+		git_buf_free(&path);
+		return error;
+	}
+
+	index = git__calloc(1, sizeof(git_pack_bitmap_index));
+	GITERR_CHECK_ALLOC(index);
+
+	index->filename = git_buf_detach(&path);
+	index->entry_map = git_oidmap_alloc();
+
+	if (!index->entry_map ||
+		(error = git_pack_bitmap_objects_init(&index->objects, pack)) < 0) {
+		p_close(fd);
+		git_mwindow_put_pack(pack);
+		git_pack_bitmap_index_free(index);
+		return error ? error : -1;
+	}
+
+	error = git_futils_mmap_ro(&index->bitmap_map, fd, 0, (size_t)st.st_size);
+	p_close(fd);
+
+	if (error < 0 ||
+		(error = git_pack_bitmap_index_parse(index,
+			index->bitmap_map.data, (size_t)st.st_size)) < 0) {
+		git_pack_bitmap_index_free(index);
+		return error;
+	}
+
+	*out = index;
+	return 0;
+}
+
+typedef struct {
+	git_pack_bitmap_index **out;
+} bitmap_find_data;
+
+static int bitmap_find_cb(void *payload, git_buf *path)
+{
+	bitmap_find_data *data = payload;
+	git_buf idx_path = GIT_BUF_INIT;
+	int error;
+
+	if (git__suffixcmp(path->ptr, GIT_PACK_BITMAP_EXTENSION) != 0)
+		return 0;
+
+	if (git_buf_set(&idx_path, path->ptr,
+			path->size - strlen(GIT_PACK_BITMAP_EXTENSION)) < 0 ||
+		git_buf_puts(&idx_path, ".idx") < 0)
+		return -1;
+
+	error = git_pack_bitmap_index_open(data->out, idx_path.ptr);
+	git_buf_free(&idx_path);
+
+	/* an unusable bitmap is just ignored */
+	if (error < 0) {
+		giterr_clear();
+		return 0;
+	}
+
+	return 1;
+}
+
+int git_pack_bitmap_index_find(
+	git_pack_bitmap_index **out, const char *pack_dir)
+{
+	git_buf path = GIT_BUF_INIT;
+	bitmap_find_data data;
+	int error;
+
+	*out = NULL;
+	data.out = out;
+
+	if ((error = git_buf_sets(&path, pack_dir)) < 0)
+		return error;
+
+	error = git_path_direach(&path, 0, bitmap_find_cb, &data);
+	git_buf_free(&path);
+
+	if (error < 0) {
+		giterr_clear();
+		return GIT_ENOTFOUND;
+	}
+
+	return *out ? 0 : GIT_ENOTFOUND;
+}
+
+static int bitmap_entry_load(
+	git_pack_bitmap_index *index, git_pack_bitmap_entry *entry)
+{
+	git_pack_bitmap_entry *base;
+	int error;
+
+	if (entry->loaded)
+		return 0;
+
+	if ((error = git_ewah_read(&entry->bitmap, entry->data, entry->len, NULL)) < 0)
+		return error;
+
+	/* the bitmap is stored XOR'ed with the bitmap of a previous entry */
+	if (entry->xor_offset) {
+		base = entry - entry->xor_offset;
+
+		if ((error = bitmap_entry_load(index, base)) < 0 ||
+			(error = git_bitmap_xor(&entry->bitmap, &base->bitmap)) < 0) {
+			git_bitmap_free(&entry->bitmap);
+			return error;
+		}
+	}
+
+	entry->loaded = 1;
+	return 0;
+}
+
+int git_pack_bitmap_index_get(
+	const git_bitmap **out, git_pack_bitmap_index *index, const git_oid *commit_id)
+{
+	git_pack_bitmap_entry *entry;
+	khiter_t pos;
+	int error;
+
+	pos = git_oidmap_lookup_index(index->entry_map, commit_id);
+	if (!git_oidmap_valid_index(index->entry_map, pos))
+		return GIT_ENOTFOUND;
+
+	entry = git_oidmap_value_at(index->entry_map, pos);
+	if ((error = bitmap_entry_load(index, entry)) < 0)
+		return error;
+
+	*out = &entry->bitmap;
+	return 0;
+}
+
+git_otype git_pack_bitmap_index_type(
+	const git_pack_bitmap_index *index, size_t pos)
+{
+	if (git_bitmap_get(&index->commits, pos))
+		return GIT_OBJ_COMMIT;
+	if (git_bitmap_get(&index->trees, pos))
+		return GIT_OBJ_TREE;
+	if (git_bitmap_get(&index->blobs, pos))
+		return GIT_OBJ_BLOB;
+	if (git_bitmap_get(&index->tags, pos))
+		return GIT_OBJ_TAG;
+
+	return GIT_OBJ_BAD;
+}
+
+uint32_t git_pack_bitmap_index_name_hash(
+	const git_pack_bitmap_index *index, size_t pos)
+{
+	if (!index->hash_cache || pos >= index->objects.num_objects)
+		return 0;
+
+	/* the cache is in index order */
+	return bitmap_get_be32(index->hash_cache + index->objects.pack_order[pos] * 4);
+}
+
+void git_pack_bitmap_index_free(git_pack_bitmap_index *index)
+{
+	if (!index)
+		return;
+
+	bitmap_index_clear(index);
+
+	if (index->entry_map)
+		git_oidmap_free(index->entry_map);
+
+	if (index->objects.pack)
+		git_mwindow_put_pack(index->objects.pack);
+	git_pack_bitmap_objects_free(&index->objects);
+
+	if (index->bitmap_map.data)
+		git_futils_mmap_free(&index->bitmap_map);
+
+	git__free(index->filename);
+	git__free(index);
+}
+
+/***********************************************************
+ *
+ * BITMAP INDEX WRITING
+ *
+ ***********************************************************/
+
+typedef struct {
+	git_oid commit_id;
+	uint32_t pos;
+	git_bitmap bitmap;
+} bitmap_writer_entry;
+
+struct git_pack_bitmap_writer {
+	git_repository *repo;
+	git_buf idx_path;
+	git_array_t(git_oid) tips;
+};
+
+typedef struct {
+	git_pack_bitmap_writer *w;
+	git_pack_bitmap_objects objects;
+	git_bitmap commits, trees, blobs, tags;
+	uint32_t *name_hashes;
+
+	git_array_t(bitmap_writer_entry) entries;
+	git_oidmap *entry_map;
+} bitmap_write_state;
+
+int git_pack_bitmap_writer_new(
+	git_pack_bitmap_writer **out,
+	git_repository *repo,
+	const char *idx_path)
+{
+	git_pack_bitmap_writer *w;
+
+	assert(out && repo && idx_path);
+
+	if (git__suffixcmp(idx_path, ".idx") != 0) {
+		giterr_set(GITERR_INVALID, "'%s' is not an index file", idx_path);
+		return -1;
+	}
+
+	w = git__calloc(1, sizeof(git_pack_bitmap_writer));
+	GITERR_CHECK_ALLOC(w);
+
+	w->repo = repo;
+
+	if (git_buf_sets(&w->idx_path, idx_path) < 0) {
+		git__free(w);
+		return -1;
+	}
+
+	*out = w;
+	return 0;
+}
+
+void git_pack_bitmap_writer_free(git_pack_bitmap_writer *w)
+{
+	if (!w)
+		return;
+
+	git_array_clear(w->tips);
+	git_buf_free(&w->idx_path);
+	git__free(w);
+}
+
+int git_pack_bitmap_writer_push(
+	git_pack_bitmap_writer *w,
+	const git_oid *commit_id)
+{
+	git_oid *tip;
+
+	assert(w && commit_id);
+
+	tip = git_array_alloc(w->tips);
+	GITERR_CHECK_ALLOC(tip);
+
+	git_oid_cpy(tip, commit_id);
+	return 0;
+}
+
+static int bitmap_write_position(
+	uint32_t *out, bitmap_write_state *state, const git_oid *id)
+{
+	if (git_pack_bitmap_objects_position(out, &state->objects, id) < 0) {
+		char hex[GIT_OID_HEXSZ + 1];
+
+		giterr_set(GITERR_ODB,
+			"Cannot write a bitmap, object %s is not in the packfile",
+			git_oid_tostr(hex, sizeof(hex), id));
+		return -1;
+	}
+
+	return 0;
+}
+
+static int bitmap_write_types(bitmap_write_state *state)
+{
+	struct git_pack_file *pack = state->objects.pack;
+	uint32_t i;
+	int error = 0;
+
+	for (i = 0; i < state->objects.num_objects && !error; i++) {
+		uint32_t idx_pos = state->objects.pack_order[i];
+		git_otype type;
+		size_t size;
+
+		if ((error = git_packfile_resolve_header_nth(
+				&size, &type, pack, state->objects.offsets[idx_pos], idx_pos)) < 0)
+			break;
+
+		switch (type) {
+		case GIT_OBJ_COMMIT:
+			error = git_bitmap_set(&state->commits, i);
+			break;
+		case GIT_OBJ_TREE:
+			error = git_bitmap_set(&state->trees, i);
+			break;
+		case GIT_OBJ_BLOB:
+			error = git_bitmap_set(&state->blobs, i);
+			break;
+		case GIT_OBJ_TAG:
+			error = git_bitmap_set(&state->tags, i);
+			break;
+		default:
+			error = bitmap_error("unknown object type in packfile");
+		}
+	}
+
+	return error;
+}
+
+static int bitmap_write_add_tree(
+	git_bitmap *bitmap, bitmap_write_state *state, const git_oid *tree_id)
+{
+	git_tree *tree;
+	uint32_t pos;
+	size_t i;
+	int error;
+
+	if ((error = bitmap_write_position(&pos, state, tree_id)) < 0)
+		return error;
+
+	if (git_bitmap_get(bitmap, pos))
+		return 0;
+
+	if ((error = git_bitmap_set(bitmap, pos)) < 0 ||
+		(error = git_tree_lookup(&tree, state->w->repo, tree_id)) < 0)
+		return error;
+
+	for (i = 0; i < git_tree_entrycount(tree); i++) {
+		const git_tree_entry *entry = git_tree_entry_byindex(tree, i);
+		const git_oid *entry_id = git_tree_entry_id(entry);
+		git_otype type = git_tree_entry_type(entry);
+
+		/* submodules are not in the packfile */
+		if (type != GIT_OBJ_TREE && type != GIT_OBJ_BLOB)
+			continue;
+
+		if ((error = bitmap_write_position(&pos, state, entry_id)) < 0)
+			break;
+
+		if (!state->name_hashes[pos])
+			state->name_hashes[pos] = git_packfile__name_hash(git_tree_entry_name(entry));
+
+		if (type == GIT_OBJ_TREE)
+			error = bitmap_write_add_tree(bitmap, state, entry_id);
+		else
+			error = git_bitmap_set(bitmap, pos);
+
+		if (error < 0)
+			break;
+	}
+
+	git_tree_free(tree);
+	return error;
+}
+
+/*
+ * Compute the set of objects reachable from a commit. The commits are
+ * processed parents first, so the walk can stop at any commit that
+ * already has a bitmap and just merge it.
+ */
+static int bitmap_write_reachable(
+	git_bitmap *bitmap, bitmap_write_state *state, const git_oid *commit_id)
+{
+	git_array_t(git_oid) pending = GIT_ARRAY_INIT;
+	git_oid *pending_id, id;
+	git_commit *commit;
+	unsigned int i;
+	uint32_t pos;
+	int error = 0;
+
+	if ((pending_id = git_array_alloc(pending)) == NULL)
+		return -1;
+	git_oid_cpy(pending_id, commit_id);
+
+	while ((pending_id = git_array_pop(pending)) != NULL) {
+		khiter_t entry_pos;
+
+		git_oid_cpy(&id, pending_id);
+
+		if ((error = bitmap_write_position(&pos, state, &id)) < 0)
+			break;
+
+		if (git_bitmap_get(bitmap, pos))
+			continue;
+
+		entry_pos = git_oidmap_lookup_index(state->entry_map, &id);
+		if (git_oidmap_valid_index(state->entry_map, entry_pos)) {
+			size_t n = (size_t)git_oidmap_value_at(state->entry_map, entry_pos);
+			bitmap_writer_entry *entry = git_array_get(state->entries, n);
+
+			if ((error = git_bitmap_or(bitmap, &entry->bitmap)) < 0)
+				break;
+			continue;
+		}
+
+		if ((error = git_bitmap_set(bitmap, pos)) < 0 ||
+			(error = git_commit_lookup(&commit, state->w->repo, &id)) < 0)
+			break;
+
+		error = bitmap_write_add_tree(bitmap, state, git_commit_tree_id(commit));
+
+		for (i = 0; !error && i < git_commit_parentcount(commit); i++) {
+			if ((pending_id = git_array_alloc(pending)) == NULL)
+				error = -1;
+			else
+				git_oid_cpy(pending_id, git_commit_parent_id(commit, i));
+		}
+
+		git_commit_free(commit);
+
+		if (error < 0)
+			break;
+	}
+
+	git_array_clear(pending);
+	return error;
+}
+
+static int bitmap_write_select(bitmap_write_state *state)
+{
+	git_pack_bitmap_writer *w = state->w;
+	git_revwalk *walk;
+	git_oidmap *tips;
+	git_oid id;
+	size_t i, n = 0;
+	int error;
+
+	if ((error = git_revwalk_new(&walk, w->repo)) < 0)
+		return error;
+
+	if ((tips = git_oidmap_alloc()) == NULL) {
+		git_revwalk_free(walk);
+		return -1;
+	}
+
+	git_revwalk_sorting(walk, GIT_SORT_TOPOLOGICAL | GIT_SORT_REVERSE);
+
+	for (i = 0; i < git_array_size(w->tips); i++) {
+		git_oid *tip = git_array_get(w->tips, i);
+
+		if ((error = git_revwalk_push(walk, tip)) < 0)
+			goto done;
+
+		git_oidmap_insert(tips, tip, tip, error);
+		if (error < 0)
+			goto done;
+	}
+
+	/* parents come first, so their bitmaps can be reused */
+	while ((error = git_revwalk_next(&id, walk)) == 0) {
+		bitmap_writer_entry *entry;
+		bool is_tip = git_oidmap_valid_index(tips, git_oidmap_lookup_index(tips, &id));
+
+		if (!is_tip && (++n % BITMAP_SELECTION_INTERVAL) != 0)
+			continue;
+
+		if ((entry = git_array_alloc(state->entries)) == NULL) {
+			error = -1;
+			goto done;
+		}
+
+		memset(entry, 0, sizeof(*entry));
+		git_oid_cpy(&entry->commit_id, &id);
+
+		if ((error = bitmap_write_position(&entry->pos, state, &id)) < 0 ||
+			(error = bitmap_write_reachable(&entry->bitmap, state, &id)) < 0)
+			goto done;
+
+		/* the entries may move as the array grows, the ids do not */
+		git_oidmap_insert(state->entry_map,
+			&state->objects.ids[state->objects.pack_order[entry->pos]],
+			(void *)(git_array_size(state->entries) - 1), error);
+		if (error < 0)
+			goto done;
+	}
+
+	if (error == GIT_ITEROVER)
+		error = 0;
+
+done:
+	git_oidmap_free(tips);
+	git_revwalk_free(walk);
+	return error;
+}
+
+static int bitmap_write_be32(git_buf *out, uint32_t value)
+{
+	value = htonl(value);
+	return git_buf_put(out, (const char *)&value, sizeof(value));
+}
+
+static int bitmap_write(git_buf *out, git_pack_bitmap_writer *w)
+{
+	bitmap_write_state state;
+	struct git_pack_file *pack = NULL;
+	const unsigned char *pack_checksum;
+	unsigned char header[BITMAP_HEADER_SIZE];
+	git_oid checksum;
+	size_t i;
+	int error;
+
+	memset(&state, 0, sizeof(state));
+	state.w = w;
+
+	if ((error = git_mwindow_get_pack(&pack, w->idx_path.ptr)) < 0)
+		return error;
+
+	if ((error = git_pack_bitmap_objects_init(&state.objects, pack)) < 0)
+		goto cleanup;
+
+	state.name_hashes = git__calloc(state.objects.num_objects + 1, sizeof(uint32_t));
+	state.entry_map = git_oidmap_alloc();
+	if (!state.name_hashes || !state.entry_map) {
+		giterr_set_oom();
+		error = -1;
+		goto cleanup;
+	}
+
+	if ((error = bitmap_write_types(&state)) < 0 ||
+		(error = bitmap_write_select(&state)) < 0)
+		goto cleanup;
+
+	if (!git__is_uint32(git_array_size(state.entries))) {
+		error = bitmap_error("too many bitmaps");
+		goto cleanup;
+	}
+
+	/* Write the header */
+	memcpy(header, BITMAP_SIGNATURE, 4);
+	header[4] = 0;
+	header[5] = BITMAP_VERSION;
+	header[6] = 0;
+	header[7] = BITMAP_OPT_FULL_DAG | BITMAP_OPT_HASH_CACHE;
+	header[8] = (unsigned char)(git_array_size(state.entries) >> 24);
+	header[9] = (unsigned char)(git_array_size(state.entries) >> 16);
+	header[10] = (unsigned char)(git_array_size(state.entries) >> 8);
+	header[11] = (unsigned char)git_array_size(state.entries);
+
+	pack_checksum = (const unsigned char *)pack->index_map.data +
+		pack->index_map.len - 2 * GIT_OID_RAWSZ;
+	memcpy(header + 12, pack_checksum, GIT_OID_RAWSZ);
+
+	if ((error = git_buf_put(out, (const char *)header, sizeof(header))) < 0)
+		goto cleanup;
+
+	/* Write the type bitmaps */
+	if ((error = git_ewah_write(out, &state.commits)) < 0 ||
+		(error = git_ewah_write(out, &state.trees)) < 0 ||
+		(error = git_ewah_write(out, &state.blobs)) < 0 ||
+		(error = git_ewah_write(out, &state.tags)) < 0)
+		goto cleanup;
+
+	/* Write the bitmaps of the selected commits, without XOR compression */
+	for (i = 0; i < git_array_size(state.entries); i++) {
+		bitmap_writer_entry *entry = git_array_get(state.entries, i);
+		uint32_t idx_pos = state.objects.pack_order[entry->pos];
+
+		if ((error = bitmap_write_be32(out, idx_pos)) < 0 ||
+			(error = git_buf_putc(out, 0)) < 0 ||
+			(error = git_buf_putc(out, 0)) < 0 ||
+			(error = git_ewah_write(out, &entry->bitmap)) < 0)
+			goto cleanup;
+	}
+
+	/* Write the name-hash cache, in index order */
+	for (i = 0; i < state.objects.num_objects; i++) {
+		uint32_t pos = state.objects.pack_positions[i];
+
+		if ((error = bitmap_write_be32(out, state.name_hashes[pos])) < 0)
+			goto cleanup;
+	}
+
+	if ((error = git_hash_buf(&checksum, git_buf_cstr(out), git_buf_len(out))) < 0)
+		goto cleanup;
+
+	error = git_buf_put(out, (const char *)checksum.id, GIT_OID_RAWSZ);
+
+cleanup:
+	for (i = 0; i < git_array_size(state.entries); i++)
+		git_bitmap_free(&git_array_get(state.entries, i)->bitmap);
+	git_array_clear(state.entries);
+	if (state.entry_map)
+		git_oidmap_free(state.entry_map);
+	git__free(state.name_hashes);
+	git_bitmap_free(&state.commits);
+	git_bitmap_free(&state.trees);
+	git_bitmap_free(&state.blobs);
+	git_bitmap_free(&state.tags);
+	git_pack_bitmap_objects_free(&state.objects);
+	git_mwindow_put_pack(pack);
+	return error;
+}
+
+int git_pack_bitmap_writer_commit(
+	git_pack_bitmap_writer *w)
+{
+	git_buf bitmap = GIT_BUF_INIT, path = GIT_BUF_INIT;
+	git_filebuf output = GIT_FILEBUF_INIT;
+	int error;
+
+	assert(w);
+
+	if ((error = git_buf_set(&path, w->idx_path.ptr, w->idx_path.size - strlen(".idx"))) < 0 ||
+		(error = git_buf_puts(&path, GIT_PACK_BITMAP_EXTENSION)) < 0 ||
+		(error = bitmap_write(&bitmap, w)) < 0)
+		goto cleanup;
+
+	if ((error = git_filebuf_open(&output, path.ptr, 0, GIT_PACK_FILE_MODE)) < 0 ||
+		(error = git_filebuf_write(&output, bitmap.ptr, bitmap.size)) < 0)
+		goto cleanup;
+
+	error = git_filebuf_commit(&output);
+
+cleanup:
+	git_filebuf_cleanup(&output);
+	git_buf_free(&bitmap);
+	git_buf_free(&path);
+	return error;
+}
+
+int git_pack_bitmap_writer_dump(
+	git_buf *bitmap,
+	git_pack_bitmap_writer *w)
+{
+	assert(bitmap && w);
+
+	git_buf_sanitize(bitmap);
+
+	return bitmap_write(bitmap, w);
+}
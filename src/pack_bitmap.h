@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#ifndef INCLUDE_pack_bitmap_h__
+#define INCLUDE_pack_bitmap_h__
+
+#include "common.h"
+
+#include "git2/oid.h"
+#include "git2/types.h"
+#include "git2/sys/pack_bitmap.h"
+
+#include "ewah.h"
+#include "map.h"
+#include "oidmap.h"
+#include "pack.h"
+
+#define GIT_PACK_BITMAP_EXTENSION ".bitmap"
+
+/*
+ * The objects of a packfile, both in the order of the index (sorted by
+ * id) and in the order in which they are stored in the packfile. The bit
+ * positions of reachability bitmaps are positions in the pack order.
+ */
+typedef struct {
+	struct git_pack_file *pack;
+	uint32_t num_objects;
+
+	/* the id and offset of each object, in index order */
+	git_oid *ids;
+	git_off_t *offsets;
+
+	/* the index position of each object, in pack order */
+	uint32_t *pack_order;
+	/* the pack position of each object, in index order */
+	uint32_t *pack_positions;
+} git_pack_bitmap_objects;
+
+typedef struct {
+	git_oid commit_id;
+	const unsigned char *data;
+	size_t len;
+	uint8_t xor_offset;
+
+	/* the expanded bitmap, once it was needed */
+	unsigned int loaded:1;
+	git_bitmap bitmap;
+} git_pack_bitmap_entry;
+
+/*
+ * A `.bitmap` file, which stores for a selection of commits the set of
+ * objects of the packfile that are reachable from them, and the type of
+ * every object in the packfile.
+ *
+ * The format is documented in git.git as
+ * Documentation/technical/bitmap-format.txt; only version 1 is supported.
+ */
+typedef struct git_pack_bitmap_index {
+	git_map bitmap_map;
+
+	git_pack_bitmap_objects objects;
+
+	/* the objects of each type */
+	git_bitmap commits;
+	git_bitmap trees;
+	git_bitmap blobs;
+	git_bitmap tags;
+
+	git_pack_bitmap_entry *entries;
+	size_t num_entries;
+
+	/* maps a commit id to its entry */
+	git_oidmap *entry_map;
+
+	/* the name hash of each object, in index order, if the file has them */
+	const unsigned char *hash_cache;
+
+	git_oid checksum;
+
+	/* something like ".git/objects/pack/pack-xxxxx.bitmap" */
+	char *filename;
+} git_pack_bitmap_index;
+
+extern int git_pack_bitmap_objects_init(
+	git_pack_bitmap_objects *objects, struct git_pack_file *pack);
+extern void git_pack_bitmap_objects_free(git_pack_bitmap_objects *objects);
+
+/*
+ * Find the pack position of the object `id`. Returns GIT_ENOTFOUND when
+ * the object is not in the packfile.
+ */
+extern int git_pack_bitmap_objects_position(
+	uint32_t *out, const git_pack_bitmap_objects *objects, const git_oid *id);
+
+/* Open the bitmap of the packfile whose index is at `idx_path`. */
+extern int git_pack_bitmap_index_open(
+	git_pack_bitmap_index **out, const char *idx_path);
+
+/*
+ * Open the first usable bitmap in the pack directory `pack_dir`. Returns
+ * GIT_ENOTFOUND (without setting an error) when there is none.
+ */
+extern int git_pack_bitmap_index_find(
+	git_pack_bitmap_index **out, const char *pack_dir);
+
+/*
+ * Get the reachability bitmap of `commit_id`. Returns GIT_ENOTFOUND when
+ * no bitmap was stored for that commit.
+ */
+extern int git_pack_bitmap_index_get(
+	const git_bitmap **out, git_pack_bitmap_index *index, const git_oid *commit_id);
+
+/* Get the type of the object at `pos` in pack order. */
+extern git_otype git_pack_bitmap_index_type(
+	const git_pack_bitmap_index *index, size_t pos);
+
+/* Get the name hash of the object at `pos` in pack order, or 0. */
+extern uint32_t git_pack_bitmap_index_name_hash(
+	const git_pack_bitmap_index *index, size_t pos);
+
+extern void git_pack_bitmap_index_free(git_pack_bitmap_index *index);
+
+/* This is exposed for use in the tests. */
+extern int git_pack_bitmap_index_parse(
+	git_pack_bitmap_index *index, const unsigned char *data, size_t size);
+
+#endif
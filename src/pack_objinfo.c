@@ -0,0 +1,220 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "pack_objinfo.h"
+
+#include "buffer.h"
+#include "filebuf.h"
+#include "fileops.h"
+#include "mwindow.h"
+#include "pack.h"
+
+bool git_pack__write_objinfo = false;
+
+static uint64_t objinfo_get_be64(const unsigned char *data)
+{
+	return (((uint64_t)ntohl(*((uint32_t *)(data + 0)))) << 32) |
+		ntohl(*((uint32_t *)(data + 4)));
+}
+
+int git_pack_objinfo__open(
+		git_pack_objinfo *info,
+		const char *path,
+		uint32_t num_objects,
+		const unsigned char *pack_checksum)
+{
+	const struct git_pack_objinfo_header *hdr;
+	const unsigned char *data;
+	git_file fd;
+	struct stat st;
+	size_t size;
+	int error;
+
+	memset(info, 0, sizeof(*info));
+
+	if ((fd = git_futils_open_ro(path)) < 0)
+		return fd;
+
+	if (p_fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) ||
+		!git__is_sizet(st.st_size)) {
+		p_close(fd);
+		giterr_set(GITERR_ODB, "invalid pack objinfo '%s'", path);
+		return -1;
+	}
+
+	size = (size_t)st.st_size;
+	if (size != sizeof(*hdr) + (size_t)num_objects * 8 + 2 * GIT_OID_RAWSZ) {
+		p_close(fd);
+		giterr_set(GITERR_ODB, "wrong size for pack objinfo '%s'", path);
+		return -1;
+	}
+
+	error = git_futils_mmap_ro(&info->map, fd, 0, size);
+	p_close(fd);
+
+	if (error < 0)
+		return error;
+
+	data = info->map.data;
+	hdr = (const struct git_pack_objinfo_header *)data;
+
+	if (hdr->signature != htonl(PACK_OBJINFO_SIGNATURE) ||
+		hdr->version != htonl(PACK_OBJINFO_VERSION) ||
+		ntohl(hdr->num_objects) != num_objects) {
+		git_pack_objinfo__close(info);
+		giterr_set(GITERR_ODB, "unsupported pack objinfo '%s'", path);
+		return -1;
+	}
+
+	/* a leftover from a packfile that was rewritten with the same name */
+	if (memcmp(data + size - 2 * GIT_OID_RAWSZ, pack_checksum, GIT_OID_RAWSZ)) {
+		git_pack_objinfo__close(info);
+		giterr_set(GITERR_ODB, "pack objinfo '%s' is for another packfile", path);
+		return -1;
+	}
+
+	info->entries = data + sizeof(*hdr);
+	return 0;
+}
+
+void git_pack_objinfo__close(git_pack_objinfo *info)
+{
+	if (info->map.data)
+		git_futils_mmap_free(&info->map);
+
+	memset(info, 0, sizeof(*info));
+}
+
+int git_pack_objinfo__get(
+		size_t *size_p,
+		git_otype *type_p,
+		const git_pack_objinfo *info,
+		uint32_t n)
+{
+	uint64_t entry = objinfo_get_be64(info->entries + 8 * (size_t)n);
+	uint64_t size = entry & PACK_OBJINFO_SIZE_MASK;
+	git_otype type = (git_otype)(entry >> PACK_OBJINFO_TYPE_SHIFT);
+
+	if (type < GIT_OBJ_COMMIT || type > GIT_OBJ_TAG || size > SIZE_MAX)
+		return GIT_PASSTHROUGH;
+
+	*size_p = (size_t)size;
+	*type_p = type;
+	return 0;
+}
+
+int git_pack_objinfo__write(
+		const char *path,
+		const uint64_t *entries,
+		uint32_t num_objects,
+		const git_oid *pack_checksum,
+		unsigned int mode)
+{
+	git_filebuf output = GIT_FILEBUF_INIT;
+	struct git_pack_objinfo_header hdr;
+	git_oid checksum;
+	uint32_t i, split[2];
+	int error;
+
+	if ((error = git_filebuf_open(&output, path,
+			GIT_FILEBUF_HASH_CONTENTS, mode)) < 0)
+		return error;
+
+	hdr.signature = htonl(PACK_OBJINFO_SIGNATURE);
+	hdr.version = htonl(PACK_OBJINFO_VERSION);
+	hdr.num_objects = htonl(num_objects);
+	git_filebuf_write(&output, &hdr, sizeof(hdr));
+
+	for (i = 0; i < num_objects; i++) {
+		split[0] = htonl((uint32_t)(entries[i] >> 32));
+		split[1] = htonl((uint32_t)(entries[i] & 0xffffffff));
+		git_filebuf_write(&output, split, sizeof(split));
+	}
+
+	if ((error = git_filebuf_write(&output, pack_checksum->id, GIT_OID_RAWSZ)) < 0 ||
+		(error = git_filebuf_hash(&checksum, &output)) < 0 ||
+		(error = git_filebuf_write(&output, checksum.id, GIT_OID_RAWSZ)) < 0)
+		goto cleanup;
+
+	error = git_filebuf_commit(&output);
+
+cleanup:
+	git_filebuf_cleanup(&output);
+	return error;
+}
+
+typedef struct {
+	struct git_pack_file *pack;
+	uint64_t *entries;
+	uint32_t n;
+} objinfo_collect_data;
+
+static int objinfo_collect(const git_oid *id, git_off_t offset, void *payload)
+{
+	objinfo_collect_data *data = payload;
+	size_t size;
+	git_otype type;
+	int error;
+
+	GIT_UNUSED(id);
+
+	if ((error = git_packfile_resolve_header_nth(&size, &type,
+			data->pack, offset, data->n)) < 0)
+		return error;
+
+	data->entries[data->n++] = git_pack_objinfo__entry(type, size);
+	return 0;
+}
+
+int git_pack_objinfo_write(const char *idx_path)
+{
+	objinfo_collect_data data = { NULL };
+	git_buf path = GIT_BUF_INIT;
+	git_oid pack_checksum;
+	int error;
+
+	assert(idx_path);
+
+	if (git__suffixcmp(idx_path, ".idx") != 0) {
+		giterr_set(GITERR_INVALID, "'%s' is not an index file", idx_path);
+		return -1;
+	}
+
+	if ((error = git_buf_set(&path, idx_path, strlen(idx_path) - strlen(".idx"))) < 0 ||
+		(error = git_buf_puts(&path, GIT_PACK_OBJINFO_EXTENSION)) < 0)
+		return error;
+
+	if ((error = git_mwindow_get_pack(&data.pack, idx_path)) < 0)
+		goto cleanup;
+
+	if (data.pack->mwf.fd == -1 && (error = git_packfile_open(data.pack)) < 0)
+		goto cleanup;
+
+	data.entries = git__calloc(data.pack->num_objects ? data.pack->num_objects : 1,
+		sizeof(uint64_t));
+	if (!data.entries) {
+		error = -1;
+		goto cleanup;
+	}
+
+	if ((error = git_pack_foreach_entry_offset(data.pack, objinfo_collect, &data)) < 0)
+		goto cleanup;
+
+	/* the `.idx` trailer has the checksum of the packfile first */
+	git_oid_fromraw(&pack_checksum, (const unsigned char *)data.pack->index_map.data +
+		data.pack->index_map.len - 2 * GIT_OID_RAWSZ);
+
+	error = git_pack_objinfo__write(path.ptr, data.entries, data.n,
+		&pack_checksum, GIT_PACK_FILE_MODE);
+
+cleanup:
+	if (data.pack)
+		git_mwindow_put_pack(data.pack);
+	git__free(data.entries);
+	git_buf_free(&path);
+	return error;
+}
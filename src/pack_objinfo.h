@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#ifndef INCLUDE_pack_objinfo_h__
+#define INCLUDE_pack_objinfo_h__
+
+#include "common.h"
+
+#include "git2/oid.h"
+#include "git2/types.h"
+#include "git2/sys/pack_objinfo.h"
+
+#include "map.h"
+
+#define GIT_PACK_OBJINFO_EXTENSION ".objinfo"
+
+/*
+ * An `.objinfo` file stores the type and the inflated size of every
+ * object of a packfile, so that reading the header of an object does
+ * not need to go through its delta chain.
+ *
+ *   - 4-byte signature "PKOI"
+ *   - 4-byte version number (1)
+ *   - 4-byte number of objects
+ *   - one 8-byte entry per object, in the order of the `.idx`, with
+ *     the type in the 3 high bits and the size in the others
+ *   - 20-byte checksum of the packfile, as in the `.idx` trailer
+ *   - 20-byte checksum of all of the above
+ *
+ * Every number is in network byte order.
+ */
+#define PACK_OBJINFO_SIGNATURE 0x504b4f49	/* "PKOI" */
+#define PACK_OBJINFO_VERSION 1
+
+#define PACK_OBJINFO_TYPE_SHIFT 61
+#define PACK_OBJINFO_SIZE_MASK (((uint64_t)1 << PACK_OBJINFO_TYPE_SHIFT) - 1)
+
+struct git_pack_objinfo_header {
+	uint32_t signature;
+	uint32_t version;
+	uint32_t num_objects;
+};
+
+/* Whether the packed backend writes an `.objinfo` file for new packs */
+extern bool git_pack__write_objinfo;
+
+typedef struct {
+	git_map map;
+	const unsigned char *entries; /* NULL when there is no usable file */
+} git_pack_objinfo;
+
+GIT_INLINE(uint64_t) git_pack_objinfo__entry(git_otype type, size_t size)
+{
+	return ((uint64_t)type << PACK_OBJINFO_TYPE_SHIFT) |
+		((uint64_t)size & PACK_OBJINFO_SIZE_MASK);
+}
+
+/*
+ * Map the `.objinfo` file at `path` if it describes the `num_objects`
+ * objects of the packfile with the given checksum.
+ */
+int git_pack_objinfo__open(
+		git_pack_objinfo *info,
+		const char *path,
+		uint32_t num_objects,
+		const unsigned char *pack_checksum);
+
+void git_pack_objinfo__close(git_pack_objinfo *info);
+
+/*
+ * Get the type and size of the `n`th object of the index. Returns
+ * GIT_PASSTHROUGH when the entry cannot be used.
+ */
+int git_pack_objinfo__get(
+		size_t *size_p,
+		git_otype *type_p,
+		const git_pack_objinfo *info,
+		uint32_t n);
+
+/*
+ * Write an `.objinfo` file for a packfile with `num_objects` entries
+ * (as built by `git_pack_objinfo__entry`), replacing any existing one
+ * atomically.
+ */
+int git_pack_objinfo__write(
+		const char *path,
+		const uint64_t *entries,
+		uint32_t num_objects,
+		const git_oid *pack_checksum,
+		unsigned int mode);
+
+#endif
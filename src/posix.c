@@ -256,4 +256,11 @@ int p_munmap(git_map *map)
 	return 0;
 }
 
+int p_madvise(git_map *map, int advice)
+{
+	GIT_UNUSED(map);
+	GIT_UNUSED(advice);
+	return 0;
+}
+
 #endif
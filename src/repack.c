@@ -0,0 +1,412 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "common.h"
+#include "array.h"
+#include "fileops.h"
+#include "mwindow.h"
+#include "odb.h"
+#include "pack.h"
+#include "path.h"
+#include "repository.h"
+#include "vector.h"
+
+#include "git2/pack.h"
+#include "git2/sys/midx.h"
+#include "git2/sys/repack.h"
+
+typedef struct {
+	char *name; /* the path of the pack, without the extension */
+	uint32_t nr_objects;
+} repack_pack;
+
+typedef struct {
+	git_oid id;
+	git_off_t offset;
+} repack_entry;
+
+typedef git_array_t(repack_entry) repack_entries;
+
+/* the files of a pack, the `.idx` last */
+static const char *pack_extensions[] = {
+	".pack", ".bitmap", ".objinfo", ".idx"
+};
+
+int git_repack_init_options(git_repack_options *opts, unsigned int version)
+{
+	GIT_INIT_STRUCTURE_FROM_TEMPLATE(
+		opts, version, git_repack_options, GIT_REPACK_OPTIONS_INIT);
+	return 0;
+}
+
+static int repack_pack_cmp(const void *a, const void *b)
+{
+	const repack_pack *pa = a, *pb = b;
+
+	if (pa->nr_objects != pb->nr_objects)
+		return pa->nr_objects < pb->nr_objects ? -1 : 1;
+
+	return strcmp(pa->name, pb->name);
+}
+
+static void repack_packs_free(git_vector *packs)
+{
+	repack_pack *pack;
+	size_t i;
+
+	git_vector_foreach(packs, i, pack) {
+		git__free(pack->name);
+		git__free(pack);
+	}
+
+	git_vector_free(packs);
+}
+
+static int load_pack(git_vector *packs, const char *idx_path)
+{
+	struct git_pack_file *p;
+	repack_pack *pack;
+	git_buf path = GIT_BUF_INIT;
+	size_t name_len = strlen(idx_path) - strlen(".idx");
+	uint32_t nr_objects;
+	int error;
+
+	if ((error = git_buf_put(&path, idx_path, name_len)) < 0 ||
+		(error = git_buf_puts(&path, ".keep")) < 0)
+		goto done;
+
+	if (git_path_exists(path.ptr))
+		goto done;
+
+	if ((error = git_mwindow_get_pack(&p, idx_path)) < 0) {
+		/* a pack without its `.pack` is none of our business */
+		if (error == GIT_ENOTFOUND) {
+			giterr_clear();
+			error = 0;
+		}
+		goto done;
+	}
+
+	error = git_packfile__num_objects(&nr_objects, p);
+	git_mwindow_put_pack(p);
+
+	if (error < 0)
+		goto done;
+
+	pack = git__calloc(1, sizeof(repack_pack));
+	GITERR_CHECK_ALLOC(pack);
+
+	pack->nr_objects = nr_objects;
+	pack->name = git__strndup(idx_path, name_len);
+
+	if (!pack->name || (error = git_vector_insert(packs, pack)) < 0) {
+		git__free(pack->name);
+		git__free(pack);
+		error = -1;
+	}
+
+done:
+	git_buf_free(&path);
+	return error;
+}
+
+static int load_packs(git_vector *packs, const char *pack_dir)
+{
+	git_vector files = GIT_VECTOR_INIT;
+	char *file;
+	size_t i;
+	int error;
+
+	if ((error = git_path_dirload(&files, pack_dir, 0, 0)) < 0)
+		return error;
+
+	git_vector_foreach(&files, i, file) {
+		if (git__suffixcmp(file, ".idx") != 0)
+			continue;
+
+		if ((error = load_pack(packs, file)) < 0)
+			break;
+	}
+
+	git_vector_free_deep(&files);
+	git_vector_sort(packs);
+	return error;
+}
+
+/*
+ * Find how many of the packs, sorted by their number of objects, have
+ * to be rolled up into one for each pack that is left to have at least
+ * `factor` times as many objects as the one before it.
+ */
+static size_t geometric_split(git_vector *packs, unsigned int factor)
+{
+	repack_pack *pack, *prev;
+	uint64_t rolled = 0;
+	size_t i, split;
+
+	if (packs->length < 2)
+		return 0;
+
+	/* the packs above the largest one out of progression are fine */
+	for (i = packs->length - 1; i > 0; i--) {
+		pack = git_vector_get(packs, i);
+		prev = git_vector_get(packs, i - 1);
+
+		if (pack->nr_objects < (uint64_t)factor * prev->nr_objects)
+			break;
+	}
+
+	split = i ? i + 1 : 0;
+
+	for (i = 0; i < split; i++) {
+		pack = git_vector_get(packs, i);
+		rolled += pack->nr_objects;
+	}
+
+	/* unless the pack we roll up is too large for them */
+	for (; split && split < packs->length; split++) {
+		pack = git_vector_get(packs, split);
+
+		if (pack->nr_objects >= (uint64_t)factor * rolled)
+			break;
+
+		rolled += pack->nr_objects;
+	}
+
+	return split > 1 ? split : 0;
+}
+
+static int collect_entry(const git_oid *id, git_off_t offset, void *payload)
+{
+	repack_entries *entries = payload;
+	repack_entry *entry = git_array_alloc(*entries);
+
+	GITERR_CHECK_ALLOC(entry);
+
+	git_oid_cpy(&entry->id, id);
+	entry->offset = offset;
+	return 0;
+}
+
+static int repack_entry_offset_cmp(const void *a, const void *b, void *payload)
+{
+	const repack_entry *ea = a, *eb = b;
+
+	GIT_UNUSED(payload);
+
+	if (ea->offset != eb->offset)
+		return ea->offset < eb->offset ? -1 : 1;
+
+	return 0;
+}
+
+/*
+ * Insert the objects of a pack in the order they are stored in, which
+ * is the order the pack was written in, with bases before deltas.
+ */
+static int insert_pack_objects(git_packbuilder *pb, repack_pack *pack)
+{
+	struct git_pack_file *p;
+	repack_entries entries = GIT_ARRAY_INIT;
+	git_buf idx_path = GIT_BUF_INIT;
+	size_t i;
+	int error;
+
+	if ((error = git_buf_printf(&idx_path, "%s.idx", pack->name)) < 0 ||
+		(error = git_mwindow_get_pack(&p, idx_path.ptr)) < 0)
+		goto done;
+
+	error = git_pack_foreach_entry_offset(p, collect_entry, &entries);
+	git_mwindow_put_pack(p);
+
+	if (error < 0)
+		goto done;
+
+	git__qsort_r(entries.ptr, entries.size, sizeof(repack_entry),
+		repack_entry_offset_cmp, NULL);
+
+	for (i = 0; i < entries.size; i++) {
+		if ((error = git_packbuilder_insert(pb, &entries.ptr[i].id, NULL)) < 0)
+			break;
+	}
+
+done:
+	git_array_clear(entries);
+	git_buf_free(&idx_path);
+	return error;
+}
+
+static bool is_rolled_up(git_vector *packs, size_t split, const char *idx_path)
+{
+	repack_pack *pack;
+	size_t i, name_len = strlen(idx_path) - strlen(".idx");
+
+	for (i = 0; i < split; i++) {
+		pack = git_vector_get(packs, i);
+
+		if (strlen(pack->name) == name_len &&
+			!strncmp(pack->name, idx_path, name_len))
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * List every pack but the ones we rolled up in the multi-pack-index, so
+ * that it never points to a pack that is gone.
+ */
+static int rewrite_midx(
+	const char *pack_dir, git_vector *packs, size_t split)
+{
+	git_midx_writer *w = NULL;
+	git_vector files = GIT_VECTOR_INIT;
+	git_buf path = GIT_BUF_INIT;
+	char *file;
+	size_t i;
+	int error;
+
+	if ((error = git_buf_joinpath(&path, pack_dir, "multi-pack-index")) < 0)
+		return error;
+
+	if (!git_path_exists(path.ptr))
+		goto done;
+
+	if ((error = git_path_dirload(&files, pack_dir, 0, 0)) < 0 ||
+		(error = git_midx_writer_new(&w, pack_dir)) < 0)
+		goto done;
+
+	git_vector_foreach(&files, i, file) {
+		if (git__suffixcmp(file, ".idx") != 0 ||
+			is_rolled_up(packs, split, file))
+			continue;
+
+		if ((error = git_midx_writer_add(w, file)) < 0)
+			goto done;
+	}
+
+	error = git_midx_writer_commit(w);
+
+done:
+	git_midx_writer_free(w);
+	git_vector_free_deep(&files);
+	git_buf_free(&path);
+	return error;
+}
+
+/*
+ * Remove the files of a pack, the `.pack` first: while the `.idx` is
+ * there, readers know the objects are in the pack and look for them in
+ * the other ones when it cannot be opened. If it cannot be removed,
+ * because it is open on Windows, leave the pack be.
+ */
+static int retire_pack(repack_pack *pack)
+{
+	git_buf path = GIT_BUF_INIT;
+	size_t i;
+	int error = 0;
+
+	for (i = 0; i < ARRAY_SIZE(pack_extensions); i++) {
+		git_buf_clear(&path);
+
+		if ((error = git_buf_printf(&path, "%s%s",
+				pack->name, pack_extensions[i])) < 0)
+			break;
+
+		if (p_unlink(path.ptr) < 0 && errno != ENOENT && i == 0)
+			break;
+	}
+
+	git_buf_free(&path);
+	return error;
+}
+
+int git_repository_repack(
+	git_repository *repo, const git_repack_options *given_opts)
+{
+	git_repack_options opts = GIT_REPACK_OPTIONS_INIT;
+	git_vector packs = GIT_VECTOR_INIT;
+	git_packbuilder *pb = NULL;
+	git_buf pack_dir = GIT_BUF_INIT, new_name = GIT_BUF_INIT;
+	repack_pack *pack;
+	git_odb *odb;
+	char hex[GIT_OID_HEXSZ + 1];
+	size_t split, i;
+	int error;
+
+	assert(repo);
+
+	GITERR_CHECK_VERSION(given_opts, GIT_REPACK_OPTIONS_VERSION, "git_repack_options");
+
+	if (given_opts)
+		memcpy(&opts, given_opts, sizeof(opts));
+
+	if (opts.factor < 2) {
+		giterr_set(GITERR_INVALID, "the repack factor must be at least 2");
+		return -1;
+	}
+
+	packs._cmp = repack_pack_cmp;
+
+	if ((error = git_buf_joinpath(&pack_dir,
+			git_repository_path(repo), GIT_OBJECTS_DIR "pack")) < 0 ||
+		(error = load_packs(&packs, pack_dir.ptr)) < 0)
+		goto done;
+
+	if ((split = geometric_split(&packs, opts.factor)) == 0)
+		goto done;
+
+	if ((error = git_packbuilder_new(&pb, repo)) < 0)
+		goto done;
+
+	git_packbuilder_set_threads(pb, opts.threads);
+
+	/* the largest packs first, as they have the oldest objects */
+	for (i = split; i > 0; i--) {
+		if ((error = insert_pack_objects(pb, git_vector_get(&packs, i - 1))) < 0)
+			goto done;
+	}
+
+	if ((error = git_packbuilder_write(pb, pack_dir.ptr, 0, NULL, NULL)) < 0)
+		goto done;
+
+	git_oid_tostr(hex, sizeof(hex), git_packbuilder_hash(pb));
+
+	if ((error = git_buf_printf(&new_name, "%s/pack-%s", pack_dir.ptr, hex)) < 0)
+		goto done;
+
+	/* the new pack has the name of an old one if it has the same objects */
+	git_vector_foreach(&packs, i, pack) {
+		if (i < split && !strcmp(pack->name, new_name.ptr)) {
+			git_vector_remove(&packs, i);
+			git__free(pack->name);
+			git__free(pack);
+			split--;
+			break;
+		}
+	}
+
+	if ((error = rewrite_midx(pack_dir.ptr, &packs, split)) < 0)
+		goto done;
+
+	for (i = 0; i < split; i++) {
+		if ((error = retire_pack(git_vector_get(&packs, i))) < 0)
+			goto done;
+	}
+
+	if ((error = git_repository_odb__weakptr(&odb, repo)) < 0)
+		goto done;
+
+	error = git_odb_refresh(odb);
+
+done:
+	git_packbuilder_free(pb);
+	repack_packs_free(&packs);
+	git_buf_free(&pack_dir);
+	git_buf_free(&new_name);
+	return error;
+}
@@ -13,7 +13,9 @@
 #include "common.h"
 #include "sysdir.h"
 #include "cache.h"
+#include "delta_index_cache.h"
 #include "global.h"
+#include "pack.h"
 
 void git_libgit2_version(int *major, int *minor, int *rev)
 {
@@ -40,6 +42,8 @@ int git_libgit2_features()
 /* Declarations for tuneable settings */
 extern size_t git_mwindow__window_size;
 extern size_t git_mwindow__mapped_limit;
+extern int git_mwindow__full_map;
+extern int git_mwindow__advice;
 
 static int config_level_to_sysdir(int config_level)
 {
@@ -120,6 +124,88 @@ int git_libgit2_opts(int key, ...)
 		*(va_arg(ap, ssize_t *)) = git_cache__max_storage;
 		break;
 
+	case GIT_OPT_GET_CACHE_STATS:
+		{
+			size_t *hits = va_arg(ap, size_t *);
+			size_t *misses = va_arg(ap, size_t *);
+			size_t *evictions = va_arg(ap, size_t *);
+			git_cache__stats(hits, misses, evictions);
+			break;
+		}
+
+	case GIT_OPT_SET_PACK_CACHE_MAX_SIZE:
+		git_pack__cache_set_max_storage(va_arg(ap, size_t));
+		break;
+
+	case GIT_OPT_GET_PACK_CACHED_MEMORY:
+		{
+			size_t *current = va_arg(ap, size_t *);
+			size_t *allowed = va_arg(ap, size_t *);
+			git_pack__cache_memory(current, allowed);
+			break;
+		}
+
+	case GIT_OPT_GET_PACK_CACHE_STATS:
+		{
+			size_t *hits = va_arg(ap, size_t *);
+			size_t *misses = va_arg(ap, size_t *);
+			size_t *evictions = va_arg(ap, size_t *);
+			git_pack__cache_stats(hits, misses, evictions);
+			break;
+		}
+
+	case GIT_OPT_ENABLE_PACK_CACHE_INTERMEDIATES:
+		git_pack__cache_intermediates = (va_arg(ap, int) != 0);
+		break;
+
+	case GIT_OPT_ENABLE_PACK_OBJINFO:
+		git_pack__write_objinfo = (va_arg(ap, int) != 0);
+		break;
+
+	case GIT_OPT_ENABLE_ODB_NEGATIVE_CACHE:
+		git_odb__negative_cache = (va_arg(ap, int) != 0);
+		break;
+
+	case GIT_OPT_SET_DELTA_INDEX_CACHE_MAX_SIZE:
+		git_delta_index_cache__set_max_storage(va_arg(ap, size_t));
+		break;
+
+	case GIT_OPT_GET_DELTA_INDEX_CACHED_MEMORY:
+		{
+			size_t *current = va_arg(ap, size_t *);
+			size_t *allowed = va_arg(ap, size_t *);
+			git_delta_index_cache__memory(current, allowed);
+			break;
+		}
+
+	case GIT_OPT_GET_DELTA_INDEX_CACHE_STATS:
+		{
+			size_t *hits = va_arg(ap, size_t *);
+			size_t *misses = va_arg(ap, size_t *);
+			size_t *evictions = va_arg(ap, size_t *);
+			git_delta_index_cache__stats(hits, misses, evictions);
+			break;
+		}
+
+	case GIT_OPT_ENABLE_MWINDOW_FULL_MAP:
+		git_mwindow__full_map = (va_arg(ap, int) != 0);
+		break;
+
+	case GIT_OPT_SET_MWINDOW_ADVICE:
+		{
+			int advice = va_arg(ap, int);
+
+			if (advice < GIT_MWINDOW_ADVICE_NORMAL ||
+				advice > GIT_MWINDOW_ADVICE_WILLNEED) {
+				giterr_set(GITERR_INVALID, "Invalid mwindow advice %d", advice);
+				error = -1;
+				break;
+			}
+
+			git_mwindow__advice = advice;
+			break;
+		}
+
 	case GIT_OPT_GET_TEMPLATE_PATH:
 		{
 			git_buf *out = va_arg(ap, git_buf *);
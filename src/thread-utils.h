@@ -58,6 +58,7 @@ typedef struct {
 #define git_mutex_init(a)	pthread_mutex_init(a, NULL)
 #define git_mutex_lock(a)	pthread_mutex_lock(a)
 #define git_mutex_unlock(a) pthread_mutex_unlock(a)
+#define git_mutex_trylock(a)	pthread_mutex_trylock(a)
 #define git_mutex_free(a)	pthread_mutex_destroy(a)
 
 /* Pthreads condition vars */
@@ -187,6 +188,8 @@ GIT_INLINE(int) git_mutex_init(git_mutex *mutex) \
 	{ GIT_UNUSED(mutex); return 0; }
 GIT_INLINE(int) git_mutex_lock(git_mutex *mutex) \
 	{ GIT_UNUSED(mutex); return 0; }
+GIT_INLINE(int) git_mutex_trylock(git_mutex *mutex) \
+	{ GIT_UNUSED(mutex); return 0; }
 #define git_mutex_unlock(a) (void)0
 #define git_mutex_free(a) (void)0
 
@@ -993,6 +993,9 @@ int git_smart__push(git_transport *transport, git_push *push, const git_remote_c
 		}
 	}
 
+	/* the remote has to understand the deltas we send it */
+	git_packbuilder_set_ofs_delta(push->pb, t->caps.ofs_delta);
+
 	if ((error = git_smart__get_push_stream(t, &packbuilder_payload.stream)) < 0 ||
 		(error = gen_pktline(&pktline, push)) < 0 ||
 		(error = packbuilder_payload.stream->write(packbuilder_payload.stream, git_buf_cstr(&pktline), git_buf_len(&pktline))) < 0)
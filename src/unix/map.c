@@ -64,5 +64,20 @@ int p_munmap(git_map *map)
 	return 0;
 }
 
+int p_madvise(git_map *map, int advice)
+{
+	int madv;
+
+	assert(map != NULL);
+
+	switch (advice) {
+	case GIT_MADV_RANDOM: madv = MADV_RANDOM; break;
+	case GIT_MADV_WILLNEED: madv = MADV_WILLNEED; break;
+	default: madv = MADV_NORMAL; break;
+	}
+
+	return madvise(map->data, map->len, madv);
+}
+
 #endif
 
@@ -119,4 +119,11 @@ int p_munmap(git_map *map)
 	return error;
 }
 
+int p_madvise(git_map *map, int advice)
+{
+	GIT_UNUSED(map);
+	GIT_UNUSED(advice);
+	return 0;
+}
+
 #endif
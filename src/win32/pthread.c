@@ -97,6 +97,11 @@ int pthread_mutex_unlock(pthread_mutex_t *mutex)
 	return 0;
 }
 
+int pthread_mutex_trylock(pthread_mutex_t *mutex)
+{
+	return TryEnterCriticalSection(mutex) ? 0 : EBUSY;
+}
+
 int pthread_cond_init(pthread_cond_t *cond, const pthread_condattr_t *attr)
 {
 	/* We don't support non-default attributes. */
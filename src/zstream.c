@@ -7,6 +7,10 @@
 
 #include <zlib.h>
 
+#ifdef GIT_LIBDEFLATE
+# include <libdeflate.h>
+#endif
+
 #include "zstream.h"
 #include "buffer.h"
 
@@ -154,3 +158,123 @@ done:
 	git_zstream_free(&zs);
 	return error;
 }
+
+void *git_zstream__alloc(void *opaq, unsigned int count, unsigned int size)
+{
+	GIT_UNUSED(opaq);
+	return git__calloc(count, size);
+}
+
+void git_zstream__free(void *opaq, void *ptr)
+{
+	GIT_UNUSED(opaq);
+	git__free(ptr);
+}
+
+int git_zinflate_init(git_zinflate *zinflate)
+{
+	memset(zinflate, 0, sizeof(*zinflate));
+	zinflate->z.zalloc = git_zstream__alloc;
+	zinflate->z.zfree = git_zstream__free;
+
+	if (inflateInit(&zinflate->z) != Z_OK) {
+		giterr_set(GITERR_ZLIB, "failed to init zlib stream");
+		return -1;
+	}
+
+#ifdef GIT_LIBDEFLATE
+	if ((zinflate->decompressor = libdeflate_alloc_decompressor()) == NULL) {
+		inflateEnd(&zinflate->z);
+		giterr_set_oom();
+		return -1;
+	}
+#endif
+
+	return 0;
+}
+
+void git_zinflate_free(git_zinflate *zinflate)
+{
+	inflateEnd(&zinflate->z);
+
+#ifdef GIT_LIBDEFLATE
+	libdeflate_free_decompressor(zinflate->decompressor);
+	zinflate->decompressor = NULL;
+#endif
+}
+
+#ifdef GIT_LIBDEFLATE
+
+int git_zinflate_buf(
+	size_t *in_used,
+	git_zinflate *zinflate,
+	void *out,
+	size_t out_len,
+	const void *in,
+	size_t in_len)
+{
+	enum libdeflate_result result;
+	size_t out_used;
+
+	result = libdeflate_zlib_decompress_ex(zinflate->decompressor,
+		in, in_len, out, out_len + 1, in_used, &out_used);
+
+	/*
+	 * libdeflate cannot tell a stream that goes on past the end of
+	 * `in` from a corrupt one, so both are left to zlib.
+	 */
+	if (result == LIBDEFLATE_BAD_DATA)
+		return GIT_EBUFS;
+
+	if (result != LIBDEFLATE_SUCCESS || out_used != out_len) {
+		giterr_set(GITERR_ZLIB, "error inflating zlib stream");
+		return -1;
+	}
+
+	((unsigned char *)out)[out_len] = '\0';
+	return 0;
+}
+
+#else
+
+int git_zinflate_buf(
+	size_t *in_used,
+	git_zinflate *zinflate,
+	void *out,
+	size_t out_len,
+	const void *in,
+	size_t in_len)
+{
+	z_stream *z = &zinflate->z;
+	int st;
+
+	if (out_len >= UINT_MAX)
+		return GIT_EBUFS;
+
+	if (inflateReset(z) != Z_OK) {
+		giterr_set(GITERR_ZLIB, "failed to reset zlib stream");
+		return -1;
+	}
+
+	z->next_in = (Bytef *)in;
+	z->avail_in = (uInt)min(in_len, UINT_MAX);
+	z->next_out = out;
+	z->avail_out = (uInt)(out_len + 1);
+
+	st = inflate(z, Z_FINISH);
+
+	if (st == Z_STREAM_END && z->total_out == out_len) {
+		*in_used = z->total_in;
+		((unsigned char *)out)[out_len] = '\0';
+		return 0;
+	}
+
+	/* we ran out of input before the stream, or the output, ended */
+	if ((st == Z_OK || st == Z_BUF_ERROR) && !z->avail_in && z->avail_out)
+		return GIT_EBUFS;
+
+	giterr_set(GITERR_ZLIB, "error inflating zlib stream");
+	return -1;
+}
+
+#endif
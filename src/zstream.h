@@ -36,4 +36,39 @@ void git_zstream_reset(git_zstream *zstream);
 
 int git_zstream_deflatebuf(git_buf *out, const void *in, size_t in_len);
 
+/* zlib allocation functions that go through the libgit2 allocator */
+void *git_zstream__alloc(void *opaq, unsigned int count, unsigned int size);
+void git_zstream__free(void *opaq, void *ptr);
+
+/*
+ * An inflater for whole zlib streams whose inflated size is known up
+ * front, as it is for objects. It uses libdeflate when libgit2 is built
+ * with it, and zlib otherwise. The zlib stream is there for callers to
+ * fall back to when the compressed data is not all in one buffer.
+ */
+typedef struct {
+	z_stream z;
+#ifdef GIT_LIBDEFLATE
+	struct libdeflate_decompressor *decompressor;
+#endif
+} git_zinflate;
+
+int git_zinflate_init(git_zinflate *zinflate);
+void git_zinflate_free(git_zinflate *zinflate);
+
+/*
+ * Inflate the stream at the start of `in` into `out`, which has room
+ * for `out_len` bytes and a NUL; it is an error for the stream not to
+ * inflate to exactly `out_len` bytes. Returns GIT_EBUFS without setting
+ * an error when the stream cannot be inflated from `in` alone, in which
+ * case the caller should stream it through `zinflate->z` instead.
+ */
+int git_zinflate_buf(
+	size_t *in_used,
+	git_zinflate *zinflate,
+	void *out,
+	size_t out_len,
+	const void *in,
+	size_t in_len);
+
 #endif /* INCLUDE_zstream_h__ */
@@ -0,0 +1,131 @@
+#include "clar_libgit2.h"
+#include "delta.h"
+#include "delta-apply.h"
+
+#define BASE_SIZE (200 * 1024)
+
+static unsigned char *g_base;
+
+void test_core_delta__initialize(void)
+{
+	unsigned int seed = 1;
+	size_t i;
+
+	g_base = git__malloc(BASE_SIZE);
+	cl_assert(g_base);
+
+	for (i = 0; i < BASE_SIZE; i++) {
+		seed = seed * 1103515245 + 12345;
+		g_base[i] = (unsigned char)(seed >> 16);
+	}
+}
+
+void test_core_delta__cleanup(void)
+{
+	git__free(g_base);
+	g_base = NULL;
+
+	git_delta__kernel(GIT_DELTA_KERNEL_AVX2);
+}
+
+static void *create_delta(
+	unsigned long *delta_len,
+	const unsigned char *base, size_t base_len,
+	const unsigned char *target, size_t target_len)
+{
+	void *delta = git_delta(
+		base, (unsigned long)base_len,
+		target, (unsigned long)target_len, delta_len, 0);
+
+	cl_assert(delta);
+	return delta;
+}
+
+static void assert_applies(
+	const unsigned char *base, size_t base_len,
+	const void *delta, unsigned long delta_len,
+	const unsigned char *target, size_t target_len)
+{
+	git_rawobj obj;
+
+	cl_git_pass(git__delta_apply(&obj, base, base_len, delta, delta_len));
+	cl_assert_equal_sz(target_len, obj.len);
+	cl_assert(memcmp(target, obj.data, target_len) == 0);
+	git__free(obj.data);
+}
+
+void test_core_delta__kernels_create_the_same_deltas(void)
+{
+	unsigned char *target;
+	void *portable, *delta;
+	unsigned long portable_len, delta_len;
+	size_t change;
+	int kernel;
+
+	target = git__malloc(BASE_SIZE);
+	cl_assert(target);
+
+	/* a change at each position of a vector shortens the match there */
+	for (change = 4096; change < 4096 + 100; change++) {
+		memcpy(target, g_base, BASE_SIZE);
+		target[change] ^= 0xff;
+		target[BASE_SIZE - change] ^= 0xff;
+
+		cl_assert_equal_i(GIT_DELTA_KERNEL_PORTABLE,
+			git_delta__kernel(GIT_DELTA_KERNEL_PORTABLE));
+		portable = create_delta(&portable_len, g_base, BASE_SIZE, target, BASE_SIZE);
+		assert_applies(g_base, BASE_SIZE, portable, portable_len, target, BASE_SIZE);
+
+		for (kernel = GIT_DELTA_KERNEL_SSE2; kernel <= GIT_DELTA_KERNEL_AVX2; kernel++) {
+			if (git_delta__kernel(kernel) != (git_delta_kernel)kernel)
+				continue;
+
+			delta = create_delta(&delta_len, g_base, BASE_SIZE, target, BASE_SIZE);
+			cl_assert_equal_i(portable_len, delta_len);
+			cl_assert(memcmp(portable, delta, delta_len) == 0);
+			git__free(delta);
+		}
+
+		git__free(portable);
+	}
+
+	git__free(target);
+}
+
+void test_core_delta__apply_copies_longer_than_64kb(void)
+{
+	git_buf buf = GIT_BUF_INIT;
+	void *delta;
+	unsigned long delta_len;
+
+	/* the base copied whole takes four copy instructions */
+	delta = create_delta(&delta_len, g_base, BASE_SIZE, g_base, BASE_SIZE);
+	cl_assert(delta_len < 64);
+	assert_applies(g_base, BASE_SIZE, delta, delta_len, g_base, BASE_SIZE);
+
+	cl_git_pass(git__delta_apply_buf(&buf, g_base, BASE_SIZE, delta, delta_len));
+	cl_assert_equal_sz(BASE_SIZE, buf.size);
+	cl_assert(memcmp(g_base, buf.ptr, BASE_SIZE) == 0);
+
+	/* the last one is cut short */
+	cl_git_fail(git__delta_apply_buf(&buf, g_base, BASE_SIZE, delta, delta_len - 1));
+
+	git_buf_free(&buf);
+	git__free(delta);
+}
+
+void test_core_delta__apply_rejects_bad_copies(void)
+{
+	/* base size 4, result size 4, copy 4 bytes from an offset */
+	static const unsigned char delta[] = { 0x04, 0x04, 0x91, 0x00, 0x04 };
+	static const unsigned char past_base[] = { 0x04, 0x04, 0x91, 0x01, 0x04 };
+	git_rawobj obj;
+
+	cl_git_pass(git__delta_apply(&obj, g_base, 4, delta, sizeof(delta)));
+	cl_assert(memcmp(g_base, obj.data, 4) == 0);
+	git__free(obj.data);
+
+	cl_git_fail(git__delta_apply(&obj, g_base, 4, delta, sizeof(delta) - 1));
+	cl_git_fail(git__delta_apply(&obj, g_base, 4, delta, sizeof(delta) - 2));
+	cl_git_fail(git__delta_apply(&obj, g_base, 4, past_base, sizeof(past_base)));
+}
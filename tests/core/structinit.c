@@ -2,6 +2,7 @@
 #include <git2/sys/config.h>
 #include <git2/sys/odb_backend.h>
 #include <git2/sys/refdb_backend.h>
+#include <git2/sys/repack.h>
 #include <git2/sys/transport.h>
 
 #define STRINGIFY(s) #s
@@ -165,4 +166,9 @@ void test_core_structinit__compare(void)
 	CHECK_MACRO_FUNC_INIT_EQUAL( \
 		git_submodule_update_options, GIT_SUBMODULE_UPDATE_OPTIONS_VERSION, \
 		GIT_SUBMODULE_UPDATE_OPTIONS_INIT, git_submodule_update_init_options);
+
+	/* repack */
+	CHECK_MACRO_FUNC_INIT_EQUAL( \
+		git_repack_options, GIT_REPACK_OPTIONS_VERSION, \
+		GIT_REPACK_OPTIONS_INIT, git_repack_init_options);
 }
@@ -141,3 +141,45 @@ void test_core_zstream__big_data(void)
 
 	git_buf_free(&in);
 }
+
+void test_core_zstream__inflate_whole_buffer(void)
+{
+	git_buf in = GIT_BUF_INIT, out = GIT_BUF_INIT;
+	git_zinflate zi;
+	char *inflated;
+	size_t used;
+
+	while (in.size < 1024 * 1024)
+		cl_git_pass(git_buf_put(&in, BIG_STRING_PART, strlen(BIG_STRING_PART)));
+
+	cl_git_pass(git_zstream_deflatebuf(&out, in.ptr, in.size));
+	/* trailing data after the stream is not inflated */
+	cl_git_pass(git_buf_puts(&out, "trailer"));
+
+	inflated = git__malloc(in.size + 1);
+	cl_assert(inflated);
+
+	cl_git_pass(git_zinflate_init(&zi));
+
+	cl_git_pass(git_zinflate_buf(&used, &zi, inflated, in.size, out.ptr, out.size));
+	cl_assert_equal_sz(out.size - strlen("trailer"), used);
+	cl_assert(!memcmp(in.ptr, inflated, in.size));
+	cl_assert_equal_i('\0', inflated[in.size]);
+
+	/* the size has to be exact */
+	cl_git_fail(git_zinflate_buf(&used, &zi, inflated, in.size - 1, out.ptr, out.size));
+	cl_git_fail(git_zinflate_buf(&used, &zi, inflated, 42, out.ptr, out.size));
+
+	/* a stream which goes on past the buffer is for the caller to stream */
+	cl_assert_equal_i(GIT_EBUFS,
+		git_zinflate_buf(&used, &zi, inflated, in.size, out.ptr, used / 2));
+
+	/* the inflater can be reused */
+	cl_git_pass(git_zinflate_buf(&used, &zi, inflated, in.size, out.ptr, out.size));
+	cl_assert(!memcmp(in.ptr, inflated, in.size));
+
+	git_zinflate_free(&zi);
+	git__free(inflated);
+	git_buf_free(&out);
+	git_buf_free(&in);
+}
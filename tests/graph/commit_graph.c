@@ -0,0 +1,241 @@
+#include "clar_libgit2.h"
+
+#include <git2.h>
+#include <git2/sys/commit_graph.h>
+
+#include "array.h"
+#include "commit_graph.h"
+#include "fileops.h"
+#include "odb.h"
+
+static git_repository *_repo;
+
+typedef git_array_t(git_oid) oid_array;
+
+void test_graph_commit_graph__cleanup(void)
+{
+	cl_git_sandbox_cleanup();
+}
+
+static git_repository *sandbox_with_commit_graph(const char *name, const char *fixture)
+{
+	git_repository *repo = cl_git_sandbox_init(name);
+	git_buf path = GIT_BUF_INIT;
+
+	cl_git_pass(git_buf_joinpath(&path, git_repository_path(repo), "objects/info/commit-graph"));
+	cl_git_pass(git_futils_mkpath2file(git_buf_cstr(&path), GIT_OBJECT_DIR_MODE));
+	cl_git_pass(git_futils_cp(cl_fixture(fixture), git_buf_cstr(&path), 0644));
+	git_buf_free(&path);
+
+	return repo;
+}
+
+void test_graph_commit_graph__parse(void)
+{
+	git_repository *repo;
+	git_commit_graph_file *file;
+	git_commit_graph_entry e, parent;
+	git_oid id;
+	git_buf commit_graph_path = GIT_BUF_INIT;
+
+	repo = sandbox_with_commit_graph("testrepo.git", "testrepo.commit-graph");
+	cl_git_pass(git_buf_joinpath(&commit_graph_path, git_repository_path(repo), "objects/info/commit-graph"));
+	cl_git_pass(git_commit_graph_file_open(&file, git_buf_cstr(&commit_graph_path)));
+	cl_assert_equal_i(git_commit_graph_file_needs_refresh(file, git_buf_cstr(&commit_graph_path)), 0);
+	cl_assert_equal_i(file->num_commits, 15);
+
+	cl_git_pass(git_oid_fromstr(&id, "a65fedf39aefe402d3bb6e24df4d4f5fe4547750"));
+	cl_git_pass(git_commit_graph_entry_find(&e, file, &id, GIT_OID_HEXSZ));
+	cl_assert_equal_oid(&e.sha1, &id);
+	cl_assert_equal_i(e.commit_time, 1312943626);
+	cl_assert_equal_i(e.generation, 6);
+	cl_assert_equal_i(e.parent_count, 1);
+
+	cl_git_pass(git_oid_fromstr(&id, "be3563ae3f795b2b4353bcce3a527ad0a4f7f644"));
+	cl_git_pass(git_commit_graph_entry_parent(&parent, file, &e, 0));
+	cl_assert_equal_oid(&parent.sha1, &id);
+	cl_assert_equal_i(parent.generation, 5);
+	cl_assert_equal_i(parent.parent_count, 2);
+	cl_git_fail_with(GIT_ENOTFOUND, git_commit_graph_entry_parent(&parent, file, &e, 1));
+
+	cl_git_pass(git_oid_fromstr(&id, "9fd738e8f7967c078dceed8190330fc8648ee56a"));
+	cl_git_pass(git_commit_graph_entry_parent(&e, file, &parent, 0));
+	cl_assert_equal_oid(&e.sha1, &id);
+	cl_git_pass(git_oid_fromstr(&id, "c47800c7266a2be04c571c04d5a6614691ea99bd"));
+	cl_git_pass(git_commit_graph_entry_parent(&e, file, &parent, 1));
+	cl_assert_equal_oid(&e.sha1, &id);
+
+	cl_git_pass(git_oid_fromstrn(&id, "5001298e", 8));
+	cl_git_pass(git_commit_graph_entry_find(&e, file, &id, 8));
+	cl_assert_equal_i(e.generation, 1);
+	cl_assert_equal_i(e.parent_count, 0);
+
+	cl_git_pass(git_oid_fromstr(&id, "0000000000000000000000000000000000000001"));
+	cl_assert_equal_i(GIT_ENOTFOUND, git_commit_graph_entry_find(&e, file, &id, GIT_OID_HEXSZ));
+
+	git_commit_graph_file_free(file);
+	git_buf_free(&commit_graph_path);
+}
+
+static void walk_all(oid_array *out, git_repository *repo)
+{
+	git_revwalk *walk;
+	git_oid id, *entry;
+
+	cl_git_pass(git_revwalk_new(&walk, repo));
+	git_revwalk_sorting(walk, GIT_SORT_TOPOLOGICAL | GIT_SORT_TIME);
+	cl_git_pass(git_revwalk_push_glob(walk, "refs/*"));
+
+	while (git_revwalk_next(&id, walk) == 0) {
+		cl_assert((entry = git_array_alloc(*out)) != NULL);
+		git_oid_cpy(entry, &id);
+	}
+
+	git_revwalk_free(walk);
+}
+
+static void add_all_refs(git_commit_graph_writer *w, git_repository *repo)
+{
+	git_revwalk *walk;
+
+	cl_git_pass(git_revwalk_new(&walk, repo));
+	cl_git_pass(git_revwalk_push_glob(walk, "refs/*"));
+	cl_git_pass(git_commit_graph_writer_add_revwalk(w, walk));
+	git_revwalk_free(walk);
+}
+
+void test_graph_commit_graph__writer(void)
+{
+	git_commit_graph_writer *w = NULL;
+	git_buf cgraph = GIT_BUF_INIT, expected_cgraph = GIT_BUF_INIT, path = GIT_BUF_INIT;
+
+	_repo = cl_git_sandbox_init("push_src");
+
+	cl_git_pass(git_buf_joinpath(&path, git_repository_path(_repo), "objects/info"));
+	cl_git_pass(git_commit_graph_writer_new(&w, git_buf_cstr(&path)));
+	add_all_refs(w, _repo);
+
+	cl_git_pass(git_commit_graph_writer_dump(&cgraph, w));
+
+	/* the result must be byte-for-byte what git wrote for the fixture */
+	cl_git_pass(git_futils_readbuffer(&expected_cgraph, cl_fixture("push_src.commit-graph")));
+
+	cl_assert_equal_i(git_buf_len(&cgraph), git_buf_len(&expected_cgraph));
+	cl_assert(memcmp(git_buf_cstr(&cgraph), git_buf_cstr(&expected_cgraph), git_buf_len(&cgraph)) == 0);
+
+	git_buf_free(&cgraph);
+	git_buf_free(&expected_cgraph);
+	git_buf_free(&path);
+	git_commit_graph_writer_free(w);
+}
+
+void test_graph_commit_graph__write_and_use(void)
+{
+	git_commit_graph_writer *w = NULL;
+	git_commit_graph_file *file;
+	git_commit_graph_entry e, parent;
+	oid_array before = GIT_ARRAY_INIT, after = GIT_ARRAY_INIT;
+	git_odb *odb;
+	git_buf path = GIT_BUF_INIT;
+	git_oid id;
+	size_t i;
+
+	_repo = cl_git_sandbox_init("push_src");
+
+	walk_all(&before, _repo);
+
+	cl_git_pass(git_buf_joinpath(&path, git_repository_path(_repo), "objects/info"));
+	cl_git_pass(git_commit_graph_writer_new(&w, git_buf_cstr(&path)));
+	add_all_refs(w, _repo);
+	cl_git_pass(git_commit_graph_writer_commit(w));
+	git_commit_graph_writer_free(w);
+
+	/* the octopus merge needs the Extra Edge List */
+	cl_git_pass(git_buf_joinpath(&path, git_buf_cstr(&path), "commit-graph"));
+	cl_git_pass(git_commit_graph_file_open(&file, git_buf_cstr(&path)));
+	cl_git_pass(git_oid_fromstr(&id, "951bbbb90e2259a4c8950db78946784fb53fcbce"));
+	cl_git_pass(git_commit_graph_entry_find(&e, file, &id, GIT_OID_HEXSZ));
+	cl_assert_equal_i(e.parent_count, 3);
+	cl_git_pass(git_oid_fromstr(&id, "fa38b91f199934685819bea316186d8b008c52a2"));
+	cl_git_pass(git_commit_graph_entry_parent(&parent, file, &e, 2));
+	cl_assert_equal_oid(&parent.sha1, &id);
+	git_commit_graph_file_free(file);
+
+	/* walking through the graph must give the same history */
+	cl_git_pass(git_repository_odb(&odb, _repo));
+	cl_git_pass(git_odb_refresh(odb));
+	git_odb_free(odb);
+
+	walk_all(&after, _repo);
+
+	cl_assert_equal_i(git_array_size(before), git_array_size(after));
+	for (i = 0; i < git_array_size(before); ++i)
+		cl_assert_equal_oid(git_array_get(before, i), git_array_get(after, i));
+
+	git_array_clear(before);
+	git_array_clear(after);
+	git_buf_free(&path);
+}
+
+void test_graph_commit_graph__descendant_of_outside_graph(void)
+{
+	git_commit *parent;
+	git_signature *sig;
+	git_tree *tree;
+	git_oid id, root_id, new_id;
+
+	_repo = sandbox_with_commit_graph("testrepo.git", "testrepo.commit-graph");
+
+	/* a new commit on top of a65fedf, which is in the commit-graph */
+	cl_git_pass(git_oid_fromstr(&id, "a65fedf39aefe402d3bb6e24df4d4f5fe4547750"));
+	cl_git_pass(git_commit_lookup(&parent, _repo, &id));
+	cl_git_pass(git_commit_tree(&tree, parent));
+	cl_git_pass(git_signature_new(&sig, "nulltoken", "emeric.fermas@gmail.com", 1323847743, 60));
+	cl_git_pass(git_commit_create(&new_id, _repo, NULL, sig, sig,
+		NULL, "not in the graph\n", tree, 1, (const git_commit **)&parent));
+
+	cl_git_pass(git_oid_fromstr(&root_id, "8496071c1b46c854b31185ea97743be6a8774479"));
+	cl_assert_equal_i(1, git_graph_descendant_of(_repo, &new_id, &id));
+	cl_assert_equal_i(1, git_graph_descendant_of(_repo, &new_id, &root_id));
+	cl_assert_equal_i(0, git_graph_descendant_of(_repo, &id, &new_id));
+	cl_assert_equal_i(0, git_graph_descendant_of(_repo, &root_id, &new_id));
+	cl_assert_equal_i(1, git_graph_descendant_of(_repo, &id, &root_id));
+	cl_assert_equal_i(0, git_graph_descendant_of(_repo, &root_id, &id));
+
+	git_signature_free(sig);
+	git_tree_free(tree);
+	git_commit_free(parent);
+}
+
+void test_graph_commit_graph__file_outlives_refresh(void)
+{
+	git_commit_graph_writer *w = NULL;
+	git_commit_graph_file *file, *new_file;
+	git_commit_graph_entry e;
+	git_odb *odb;
+	git_buf path = GIT_BUF_INIT;
+	git_oid id;
+
+	_repo = sandbox_with_commit_graph("push_src", "push_src.commit-graph");
+
+	cl_git_pass(git_repository_odb(&odb, _repo));
+	cl_git_pass(git_odb__get_commit_graph_file(&file, odb));
+
+	/* another thread could be walking the file while it is rewritten */
+	cl_git_pass(git_buf_joinpath(&path, git_repository_path(_repo), "objects/info"));
+	cl_git_pass(git_commit_graph_writer_new(&w, git_buf_cstr(&path)));
+	add_all_refs(w, _repo);
+	cl_git_pass(git_commit_graph_writer_commit(w));
+	git_commit_graph_writer_free(w);
+
+	cl_git_pass(git_odb_refresh(odb));
+	cl_git_pass(git_odb__get_commit_graph_file(&new_file, odb));
+	cl_assert(new_file != file);
+
+	cl_git_pass(git_oid_fromstr(&id, "951bbbb90e2259a4c8950db78946784fb53fcbce"));
+	cl_git_pass(git_commit_graph_entry_find(&e, file, &id, GIT_OID_HEXSZ));
+	cl_assert_equal_i(e.parent_count, 3);
+
+	git_odb_free(odb);
+	git_buf_free(&path);
+}
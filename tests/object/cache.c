@@ -14,6 +14,7 @@ void test_object_cache__cleanup(void)
 	g_repo = NULL;
 
 	git_libgit2_opts(GIT_OPT_SET_CACHE_OBJECT_LIMIT, (int)GIT_OBJ_BLOB, (size_t)0);
+	git_libgit2_opts(GIT_OPT_SET_CACHE_MAX_SIZE, (ssize_t)(256 * 1024 * 1024));
 }
 
 static struct {
@@ -285,3 +286,43 @@ void test_object_cache__fast_thread_rush(void)
 		g_repo = NULL;
 	}
 }
+
+void test_object_cache__stats(void)
+{
+	size_t hits, misses, evictions, new_hits, new_misses, new_evictions;
+	git_object *obj;
+	git_oid oid;
+	int i;
+
+	cl_git_pass(git_repository_open(&g_repo, cl_fixture("testrepo.git")));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_CACHE_STATS, &hits, &misses, &evictions));
+
+	cl_git_pass(git_oid_fromstr(&oid, "f1425cef211cc08caa31e7b545ffb232acb098c3"));
+	cl_git_pass(git_object_lookup(&obj, g_repo, &oid, GIT_OBJ_ANY));
+	git_object_free(obj);
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_CACHE_STATS, &new_hits, &new_misses, &new_evictions));
+	cl_assert(new_misses > misses);
+
+	cl_git_pass(git_object_lookup(&obj, g_repo, &oid, GIT_OBJ_ANY));
+	git_object_free(obj);
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_CACHE_STATS, &hits, &misses, &evictions));
+	cl_assert_equal_sz(new_hits + 1, hits);
+	cl_assert_equal_sz(new_misses, misses);
+
+	/* with no room left, storing an object evicts the others */
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_CACHE_MAX_SIZE, (ssize_t)1));
+
+	for (i = 0; g_data[i].sha != NULL; ++i) {
+		if (g_data[i].type == GIT_OBJ_BLOB)
+			continue;
+
+		cl_git_pass(git_oid_fromstr(&oid, g_data[i].sha));
+		cl_git_pass(git_object_lookup(&obj, g_repo, &oid, GIT_OBJ_ANY));
+		git_object_free(obj);
+	}
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_CACHE_STATS, &new_hits, &new_misses, &new_evictions));
+	cl_assert(new_evictions > evictions);
+}
@@ -3,6 +3,7 @@
 
 #include "odb.h"
 #include "hash.h"
+#include "hash_batch.h"
 
 #include "data.h"
 
@@ -164,3 +165,137 @@ void test_object_raw_hash__hash_multi_byte_object(void)
 	hash_object_pass(&id2, &some_obj);
 	cl_assert(git_oid_cmp(&id1, &id2) == 0);
 }
+
+void test_object_raw_hash__hash_in_uneven_chunks(void)
+{
+	git_hash_ctx ctx;
+	git_oid id1, id2;
+	char *data;
+	size_t i, len, chunk = 1;
+
+	/* the FIPS 180 test vector of one million "a" */
+	data = git__malloc(1000000);
+	cl_assert(data);
+	memset(data, 'a', 1000000);
+
+	cl_git_pass(git_hash_ctx_init(&ctx));
+	for (i = 0; i < 1000000; i += len) {
+		len = min(chunk, 1000000 - i);
+		cl_git_pass(git_hash_update(&ctx, data + i, len));
+		chunk = chunk * 7 % 1013;
+	}
+	cl_git_pass(git_hash_final(&id2, &ctx));
+	git_hash_ctx_cleanup(&ctx);
+
+	cl_git_pass(git_oid_fromstr(&id1, "34aa973cd4c4daa4f61eeb2bdbad27316534016f"));
+	cl_assert_equal_oid(&id1, &id2);
+
+	git__free(data);
+}
+
+void test_object_raw_hash__sha_instructions_match_portable_code(void)
+{
+#ifdef GIT_SHA1_SHANI
+	unsigned char data[1024];
+	git_oid portable, shani;
+	size_t i, len;
+
+	if (!git_hash__shani(true))
+		cl_skip();
+
+	for (i = 0; i < sizeof(data); i++)
+		data[i] = (unsigned char)(i * 31 + 7);
+
+	for (len = 0; len <= sizeof(data); len++) {
+		cl_assert(!git_hash__shani(false));
+		cl_git_pass(git_hash_buf(&portable, data, len));
+		cl_assert(git_hash__shani(true));
+		cl_git_pass(git_hash_buf(&shani, data, len));
+
+		cl_assert_equal_oid(&portable, &shani);
+	}
+#else
+	cl_skip();
+#endif
+}
+
+void test_object_raw_hash__batch_matches_single_objects(void)
+{
+	static const git_otype types[] = {
+		GIT_OBJ_BLOB, GIT_OBJ_TREE, GIT_OBJ_COMMIT, GIT_OBJ_TAG
+	};
+	git_hash_batch batch;
+	git_hash_batch_object *obj;
+	unsigned char *data;
+	git_oid id;
+	size_t i, len = 0, data_len = 1024 * 1024;
+
+	data = git__malloc(data_len);
+	cl_assert(data);
+	for (i = 0; i < data_len; i++)
+		data[i] = (unsigned char)(i * 131 + (i >> 9));
+
+	/* enough data for the objects to be hashed on several threads */
+	git_hash_batch_init(&batch, 4);
+	for (i = 0; len + i % 4096 <= data_len; len += i % 4096, i++) {
+		if (i % 3) {
+			cl_git_pass(git_hash_batch_add(&batch, data + len, i % 4096, types[i % 4]));
+		} else {
+			cl_git_pass(git_hash_batch_new(&batch, types[i % 4]));
+			cl_git_pass(git_hash_batch_put(&batch, data + len, i % 7));
+			cl_git_pass(git_hash_batch_put(&batch, data + len + i % 7, i % 4096 - i % 7));
+		}
+	}
+	cl_assert_equal_sz(len, git_hash_batch_size(&batch));
+
+	cl_git_pass(git_hash_batch_run(&batch));
+
+	for (i = 0, len = 0; i < git_hash_batch_count(&batch); len += i % 4096, i++) {
+		obj = git_array_get(batch.objects, i);
+		cl_git_pass(git_odb_hash(&id, data + len, i % 4096, types[i % 4]));
+		cl_assert_equal_oid(&id, &obj->id);
+	}
+
+	git_hash_batch_clear(&batch);
+	cl_assert_equal_sz(0, git_hash_batch_count(&batch));
+
+	git_hash_batch_free(&batch);
+	git__free(data);
+}
+
+void test_object_raw_hash__batch_runs_again_on_its_threads(void)
+{
+	/* each run needs another number of threads than the one before */
+	static const size_t sizes[] = { 600 * 1024, 1024 * 1024, 300 * 1024, 0 };
+	git_hash_batch batch;
+	git_hash_batch_object *obj;
+	unsigned char *data;
+	git_oid id;
+	size_t round, i, len, data_len = 1024 * 1024;
+
+	data = git__malloc(data_len);
+	cl_assert(data);
+	for (i = 0; i < data_len; i++)
+		data[i] = (unsigned char)(i * 131 + (i >> 9));
+
+	git_hash_batch_init(&batch, 4);
+
+	for (round = 0; round < ARRAY_SIZE(sizes); round++) {
+		for (len = 0; len < sizes[round]; len += 1000)
+			cl_git_pass(git_hash_batch_add(&batch, data + len,
+				min(1000, sizes[round] - len), GIT_OBJ_BLOB));
+
+		cl_git_pass(git_hash_batch_run(&batch));
+
+		for (i = 0, len = 0; i < git_hash_batch_count(&batch); i++, len += 1000) {
+			obj = git_array_get(batch.objects, i);
+			cl_git_pass(git_odb_hash(&id, data + len, obj->len, GIT_OBJ_BLOB));
+			cl_assert_equal_oid(&id, &obj->id);
+		}
+
+		git_hash_batch_clear(&batch);
+	}
+
+	git_hash_batch_free(&batch);
+	git__free(data);
+}
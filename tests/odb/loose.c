@@ -89,6 +89,43 @@ void test_odb_loose__exists(void)
 	git_odb_free(odb);
 }
 
+void test_odb_loose__exists_prefix_sees_new_objects(void)
+{
+	git_oid id, found;
+	git_odb *odb;
+
+	write_object_files(&one);
+	cl_git_pass(git_odb_open(&odb, "test-objects"));
+
+	cl_git_pass(git_oid_fromstrp(&id, "8b137891"));
+	cl_git_pass(git_odb_exists_prefix(&found, odb, &id, 8));
+	cl_git_pass(git_oid_fromstrp(&id, "8b13789a"));
+	cl_assert_equal_i(GIT_ENOTFOUND, git_odb_exists_prefix(&found, odb, &id, 8));
+	cl_git_pass(git_oid_fromstrp(&id, "7898192261"));
+	cl_assert_equal_i(GIT_ENOTFOUND, git_odb_exists_prefix(&found, odb, &id, 10));
+
+	/* objects added by someone else, after the lookups above */
+	write_object_files(&two);
+	cl_git_pass(git_odb_exists_prefix(&found, odb, &id, 10));
+	cl_assert_equal_i(0, git_oid_streq(&found, two.id));
+
+	cl_git_mkfile("test-objects/8b/13789a00000000000000000000000000000000", "");
+	cl_git_pass(git_oid_fromstrp(&id, "8b13789a"));
+	cl_git_pass(git_odb_exists_prefix(&found, odb, &id, 8));
+	cl_assert_equal_i(0, git_oid_streq(&found, "8b13789a00000000000000000000000000000000"));
+
+	cl_git_mkfile("test-objects/8b/137891791fe96927ad78e64b0aad7bded08be0", "");
+	cl_git_pass(git_oid_fromstrp(&id, "8b137891"));
+	cl_assert_equal_i(GIT_EAMBIGUOUS, git_odb_exists_prefix(&found, odb, &id, 8));
+
+	/* a longer prefix is still unique */
+	cl_git_pass(git_oid_fromstr(&id, one.id));
+	cl_git_pass(git_odb_exists_prefix(&found, odb, &id, 39));
+	cl_assert_equal_i(0, git_oid_streq(&found, one.id));
+
+	git_odb_free(odb);
+}
+
 void test_odb_loose__simple_reads(void)
 {
 	test_read_object(&commit);
@@ -0,0 +1,154 @@
+#include "clar_libgit2.h"
+#include "fileops.h"
+
+#define HIDDEN_PACK "testrepo.git/objects/pack/pack-d85f5d483273108c9d8dd0e4728ccf0b2982423a"
+
+/* only in the pack above */
+static const char *packed_id = "e90810b8df3e80c413d903f631643c716887138d";
+
+static git_repository *g_repo;
+
+void test_odb_negativecache__initialize(void)
+{
+	g_repo = cl_git_sandbox_init("testrepo.git");
+	cl_git_pass(git_libgit2_opts(GIT_OPT_ENABLE_ODB_NEGATIVE_CACHE, 1));
+}
+
+void test_odb_negativecache__cleanup(void)
+{
+	cl_git_pass(git_libgit2_opts(GIT_OPT_ENABLE_ODB_NEGATIVE_CACHE, 0));
+	cl_git_sandbox_cleanup();
+}
+
+static void open_odb(git_repository **repo, git_odb **odb)
+{
+	cl_git_pass(git_repository_open(repo, "testrepo.git"));
+	cl_git_pass(git_repository_odb(odb, *repo));
+}
+
+void test_odb_negativecache__finds_what_it_writes(void)
+{
+	git_odb *odb;
+	git_oid id;
+
+	cl_git_pass(git_repository_odb(&odb, g_repo));
+	cl_git_pass(git_odb_hash(&id, "negative", 8, GIT_OBJ_BLOB));
+
+	cl_assert(!git_odb_exists(odb, &id));
+	cl_assert(!git_odb_exists(odb, &id));
+
+	cl_git_pass(git_odb_write(&id, odb, "negative", 8, GIT_OBJ_BLOB));
+	cl_assert(git_odb_exists(odb, &id));
+
+	git_odb_free(odb);
+}
+
+void test_odb_negativecache__loose_objects_from_elsewhere(void)
+{
+	git_repository *other_repo;
+	git_odb *odb, *other;
+	git_oid id;
+
+	cl_git_pass(git_repository_odb(&odb, g_repo));
+	open_odb(&other_repo, &other);
+	cl_git_pass(git_odb_hash(&id, "elsewhere", 9, GIT_OBJ_BLOB));
+
+	cl_assert(!git_odb_exists(odb, &id));
+	cl_git_pass(git_odb_write(&id, other, "elsewhere", 9, GIT_OBJ_BLOB));
+
+	/* the miss is remembered until the object database is refreshed */
+	cl_assert(!git_odb_exists(odb, &id));
+	cl_git_pass(git_odb_refresh(odb));
+	cl_assert(git_odb_exists(odb, &id));
+
+	git_odb_free(other);
+	git_repository_free(other_repo);
+	git_odb_free(odb);
+}
+
+void test_odb_negativecache__packs_from_elsewhere(void)
+{
+	git_repository *repo;
+	git_odb *odb;
+	git_oid id;
+
+	cl_git_pass(git_oid_fromstr(&id, packed_id));
+
+	cl_must_pass(p_rename(HIDDEN_PACK ".pack", "hidden.pack"));
+	cl_must_pass(p_rename(HIDDEN_PACK ".idx", "hidden.idx"));
+
+	open_odb(&repo, &odb);
+	cl_assert(!git_odb_exists(odb, &id));
+
+	cl_must_pass(p_rename("hidden.pack", HIDDEN_PACK ".pack"));
+	cl_must_pass(p_rename("hidden.idx", HIDDEN_PACK ".idx"));
+
+	cl_assert(!git_odb_exists(odb, &id));
+	cl_git_pass(git_odb_refresh(odb));
+	cl_assert(git_odb_exists(odb, &id));
+
+	git_odb_free(odb);
+	git_repository_free(repo);
+}
+
+void test_odb_negativecache__disabled(void)
+{
+	git_repository *repo;
+	git_odb *odb;
+	git_oid id;
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_ENABLE_ODB_NEGATIVE_CACHE, 0));
+	cl_git_pass(git_oid_fromstr(&id, packed_id));
+
+	cl_must_pass(p_rename(HIDDEN_PACK ".pack", "hidden.pack"));
+	cl_must_pass(p_rename(HIDDEN_PACK ".idx", "hidden.idx"));
+
+	open_odb(&repo, &odb);
+	cl_assert(!git_odb_exists(odb, &id));
+
+	cl_must_pass(p_rename("hidden.pack", HIDDEN_PACK ".pack"));
+	cl_must_pass(p_rename("hidden.idx", HIDDEN_PACK ".idx"));
+
+	/* a miss looks for new packs right away */
+	cl_assert(git_odb_exists(odb, &id));
+
+	git_odb_free(odb);
+	git_repository_free(repo);
+}
+
+static int check_exists(const git_oid *id, void *payload)
+{
+	cl_assert(git_odb_exists(payload, id));
+	return 0;
+}
+
+void test_odb_negativecache__finds_every_object(void)
+{
+	git_repository *repo;
+	git_odb *odb;
+
+	open_odb(&repo, &odb);
+	cl_git_pass(git_odb_foreach(odb, check_exists, odb));
+
+	git_odb_free(odb);
+	git_repository_free(repo);
+}
+
+void test_odb_negativecache__finds_every_object_with_a_midx(void)
+{
+	git_repository *repo;
+	git_odb *odb;
+	git_oid id;
+
+	cl_git_pass(git_futils_cp(cl_fixture("testrepo.midx"),
+		"testrepo.git/objects/pack/multi-pack-index", 0644));
+
+	open_odb(&repo, &odb);
+	cl_git_pass(git_odb_foreach(odb, check_exists, odb));
+
+	cl_git_pass(git_odb_hash(&id, "negative", 8, GIT_OBJ_BLOB));
+	cl_assert(!git_odb_exists(odb, &id));
+
+	git_odb_free(odb);
+	git_repository_free(repo);
+}
@@ -0,0 +1,97 @@
+#include "clar_libgit2.h"
+#include "odb.h"
+#include "array.h"
+
+static git_odb *_odb;
+static git_array_t(git_oid) _ids;
+
+static int collect_id(const git_oid *id, void *payload)
+{
+	git_oid *out = git_array_alloc(_ids);
+	GITERR_CHECK_ALLOC(out);
+
+	GIT_UNUSED(payload);
+	git_oid_cpy(out, id);
+	return 0;
+}
+
+void test_odb_readmany__initialize(void)
+{
+	/* testrepo has both loose and packed objects */
+	cl_git_pass(git_odb_open(&_odb, cl_fixture("testrepo.git/objects")));
+	cl_git_pass(git_odb_foreach(_odb, collect_id, NULL));
+	cl_assert(git_array_size(_ids) > 0);
+}
+
+void test_odb_readmany__cleanup(void)
+{
+	git_array_clear(_ids);
+	git_odb_free(_odb);
+	_odb = NULL;
+}
+
+struct read_counts {
+	size_t objects;
+	size_t stop_after;
+};
+
+static int check_object(git_odb_object *obj, void *payload)
+{
+	struct read_counts *counts = payload;
+	git_oid actual;
+
+	cl_git_pass(git_odb_hash(&actual, git_odb_object_data(obj),
+		git_odb_object_size(obj), git_odb_object_type(obj)));
+	cl_assert_equal_oid(git_odb_object_id(obj), &actual);
+
+	if (++counts->objects == counts->stop_after)
+		return 42;
+
+	return 0;
+}
+
+void test_odb_readmany__reads_every_object(void)
+{
+	struct read_counts counts = { 0 };
+
+	cl_git_pass(git_odb_read_many(_odb, _ids.ptr, git_array_size(_ids),
+		check_object, &counts));
+	cl_assert_equal_sz(git_array_size(_ids), counts.objects);
+
+	/* once more, with some of them in the cache */
+	counts.objects = 0;
+	cl_git_pass(git_odb_read_many(_odb, _ids.ptr, git_array_size(_ids),
+		check_object, &counts));
+	cl_assert_equal_sz(git_array_size(_ids), counts.objects);
+}
+
+void test_odb_readmany__reads_what_it_finds(void)
+{
+	struct read_counts counts = { 0 };
+	git_oid *missing;
+
+	missing = git_array_alloc(_ids);
+	cl_assert(missing);
+	cl_git_pass(git_oid_fromstr(missing, "deadbeefdeadbeefdeadbeefdeadbeefdeadbeef"));
+
+	cl_assert_equal_i(GIT_ENOTFOUND, git_odb_read_many(_odb, _ids.ptr,
+		git_array_size(_ids), check_object, &counts));
+	cl_assert_equal_sz(git_array_size(_ids) - 1, counts.objects);
+}
+
+void test_odb_readmany__callback_stops_the_read(void)
+{
+	struct read_counts counts = { 0, 2 };
+
+	cl_assert_equal_i(42, git_odb_read_many(_odb, _ids.ptr,
+		git_array_size(_ids), check_object, &counts));
+	cl_assert_equal_sz(2, counts.objects);
+}
+
+void test_odb_readmany__empty(void)
+{
+	struct read_counts counts = { 0 };
+
+	cl_git_pass(git_odb_read_many(_odb, NULL, 0, check_object, &counts));
+	cl_assert_equal_sz(0, counts.objects);
+}
@@ -0,0 +1,164 @@
+#include "clar_libgit2.h"
+
+#include <git2.h>
+#include <git2/sys/pack_bitmap.h>
+
+#include "pack_bitmap.h"
+#include "fileops.h"
+
+#define BITMAP_PACK "objects/pack/pack-810e3550d0233b4b47db110d556cd2c430426fde"
+
+static git_repository *_repo;
+
+void test_pack_bitmap__cleanup(void)
+{
+	cl_git_sandbox_cleanup();
+}
+
+static void assert_reachable_count(
+	git_pack_bitmap_index *index, const char *commit, size_t expected)
+{
+	const git_bitmap *bitmap;
+	git_oid id;
+
+	cl_git_pass(git_oid_fromstr(&id, commit));
+	cl_git_pass(git_pack_bitmap_index_get(&bitmap, index, &id));
+	cl_assert_equal_sz(git_bitmap_popcount(bitmap), expected);
+}
+
+void test_pack_bitmap__parse(void)
+{
+	git_pack_bitmap_index *index;
+	git_buf path = GIT_BUF_INIT;
+	const git_bitmap *bitmap;
+	uint32_t pos;
+	git_oid id;
+
+	cl_git_pass(git_buf_joinpath(&path, cl_fixture("bitmap.git"), BITMAP_PACK ".idx"));
+	cl_git_pass(git_pack_bitmap_index_open(&index, git_buf_cstr(&path)));
+	cl_assert_equal_i(index->objects.num_objects, 55);
+	cl_assert_equal_i(git_bitmap_popcount(&index->commits), 15);
+
+	/* `git rev-list --objects master | wc -l` */
+	assert_reachable_count(index, "a65fedf39aefe402d3bb6e24df4d4f5fe4547750", 20);
+
+	cl_git_pass(git_oid_fromstr(&id, "3697d64be941a53d4ae8f6a271e4e3fa56b022cc"));
+	cl_git_pass(git_pack_bitmap_objects_position(&pos, &index->objects, &id));
+	cl_assert_equal_i(git_pack_bitmap_index_type(index, pos), GIT_OBJ_BLOB);
+	cl_assert(git_pack_bitmap_index_name_hash(index, pos) != 0);
+
+	/* only commits have bitmaps */
+	cl_assert_equal_i(GIT_ENOTFOUND, git_pack_bitmap_index_get(&bitmap, index, &id));
+
+	cl_git_pass(git_oid_fromstr(&id, "0000000000000000000000000000000000000001"));
+	cl_assert_equal_i(GIT_ENOTFOUND, git_pack_bitmap_objects_position(&pos, &index->objects, &id));
+
+	git_pack_bitmap_index_free(index);
+	git_buf_free(&path);
+}
+
+void test_pack_bitmap__writer(void)
+{
+	git_pack_bitmap_writer *w = NULL;
+	git_pack_bitmap_index *index;
+	git_buf idx_path = GIT_BUF_INIT, bitmap_path = GIT_BUF_INIT;
+	git_strarray refs;
+	uint32_t pos, name_hash;
+	git_oid id;
+	size_t i;
+
+	_repo = cl_git_sandbox_init("bitmap.git");
+
+	cl_git_pass(git_buf_joinpath(&idx_path, git_repository_path(_repo), BITMAP_PACK ".idx"));
+	cl_git_pass(git_pack_bitmap_index_open(&index, git_buf_cstr(&idx_path)));
+	cl_git_pass(git_oid_fromstr(&id, "3697d64be941a53d4ae8f6a271e4e3fa56b022cc"));
+	cl_git_pass(git_pack_bitmap_objects_position(&pos, &index->objects, &id));
+	name_hash = git_pack_bitmap_index_name_hash(index, pos);
+	git_pack_bitmap_index_free(index);
+
+	cl_git_pass(git_buf_joinpath(&bitmap_path, git_repository_path(_repo), BITMAP_PACK ".bitmap"));
+	cl_git_pass(p_unlink(git_buf_cstr(&bitmap_path)));
+
+	cl_git_pass(git_pack_bitmap_writer_new(&w, _repo, git_buf_cstr(&idx_path)));
+
+	cl_git_pass(git_reference_list(&refs, _repo));
+	for (i = 0; i < refs.count; i++) {
+		git_object *obj;
+
+		cl_git_pass(git_revparse_single(&obj, _repo, refs.strings[i]));
+		if (git_object_type(obj) == GIT_OBJ_COMMIT)
+			cl_git_pass(git_pack_bitmap_writer_push(w, git_object_id(obj)));
+		git_object_free(obj);
+	}
+	git_strarray_free(&refs);
+
+	cl_git_pass(git_pack_bitmap_writer_commit(w));
+	git_pack_bitmap_writer_free(w);
+
+	cl_git_pass(git_pack_bitmap_index_open(&index, git_buf_cstr(&idx_path)));
+	cl_assert_equal_i(git_bitmap_popcount(&index->commits), 15);
+	cl_assert_equal_i(git_bitmap_popcount(&index->trees) +
+		git_bitmap_popcount(&index->blobs) +
+		git_bitmap_popcount(&index->tags) + 15, 55);
+
+	assert_reachable_count(index, "a65fedf39aefe402d3bb6e24df4d4f5fe4547750", 20);
+	assert_reachable_count(index, "be3563ae3f795b2b4353bcce3a527ad0a4f7f644", 17);
+
+	/* the name hashes must be the ones git computed */
+	cl_git_pass(git_oid_fromstr(&id, "3697d64be941a53d4ae8f6a271e4e3fa56b022cc"));
+	cl_git_pass(git_pack_bitmap_objects_position(&pos, &index->objects, &id));
+	cl_assert_equal_i(git_pack_bitmap_index_name_hash(index, pos), name_hash);
+
+	git_pack_bitmap_index_free(index);
+	git_buf_free(&idx_path);
+	git_buf_free(&bitmap_path);
+}
+
+static size_t packbuilder_count(const char *want, const char *hide)
+{
+	git_packbuilder *pb;
+	git_revwalk *walk;
+	git_oid id;
+	size_t count;
+
+	cl_git_pass(git_packbuilder_new(&pb, _repo));
+	cl_git_pass(git_revwalk_new(&walk, _repo));
+
+	cl_git_pass(git_oid_fromstr(&id, want));
+	cl_git_pass(git_revwalk_push(walk, &id));
+	if (hide) {
+		cl_git_pass(git_oid_fromstr(&id, hide));
+		cl_git_pass(git_revwalk_hide(walk, &id));
+	}
+
+	cl_git_pass(git_packbuilder_insert_walk(pb, walk));
+	count = git_packbuilder_object_count(pb);
+
+	git_revwalk_free(walk);
+	git_packbuilder_free(pb);
+	return count;
+}
+
+void test_pack_bitmap__packbuilder(void)
+{
+	git_buf path = GIT_BUF_INIT;
+
+	_repo = cl_git_sandbox_init("bitmap.git");
+
+	/* with the bitmaps */
+	cl_assert_equal_sz(20, packbuilder_count("a65fedf39aefe402d3bb6e24df4d4f5fe4547750", NULL));
+	cl_assert_equal_sz(3, packbuilder_count(
+		"a65fedf39aefe402d3bb6e24df4d4f5fe4547750",
+		"be3563ae3f795b2b4353bcce3a527ad0a4f7f644"));
+
+	/* by walking the trees, which sends again the blobs the hidden commit has */
+	cl_git_pass(git_buf_joinpath(&path, git_repository_path(_repo), BITMAP_PACK ".bitmap"));
+	cl_git_pass(p_unlink(git_buf_cstr(&path)));
+
+	cl_assert_equal_sz(20, packbuilder_count("a65fedf39aefe402d3bb6e24df4d4f5fe4547750", NULL));
+	cl_assert_equal_sz(5, packbuilder_count(
+		"a65fedf39aefe402d3bb6e24df4d4f5fe4547750",
+		"be3563ae3f795b2b4353bcce3a527ad0a4f7f644"));
+
+	git_buf_free(&path);
+}
@@ -0,0 +1,117 @@
+#include "clar_libgit2.h"
+#include "pack.h"
+
+static git_repository *g_repo;
+static git_odb *g_odb;
+
+void test_pack_cache__initialize(void)
+{
+	cl_git_pass(git_repository_open(&g_repo, cl_fixture("testrepo.git")));
+	cl_git_pass(git_repository_odb(&g_odb, g_repo));
+
+	/* every read has to go to the packs */
+	cl_git_pass(git_libgit2_opts(GIT_OPT_ENABLE_CACHING, 0));
+}
+
+void test_pack_cache__cleanup(void)
+{
+	git_odb_free(g_odb);
+	g_odb = NULL;
+	git_repository_free(g_repo);
+	g_repo = NULL;
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_ENABLE_CACHING, 1));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_PACK_CACHE_MAX_SIZE,
+		(size_t)GIT_PACK_CACHE_MEMORY_LIMIT));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_ENABLE_PACK_CACHE_INTERMEDIATES, 1));
+}
+
+static int read_object(const git_oid *id, void *payload)
+{
+	git_odb_object *obj;
+
+	GIT_UNUSED(payload);
+
+	cl_git_pass(git_odb_read(&obj, g_odb, id));
+	git_odb_object_free(obj);
+	return 0;
+}
+
+static int check_object(const git_oid *id, void *payload)
+{
+	git_odb_object *obj;
+	git_oid actual;
+
+	GIT_UNUSED(payload);
+
+	cl_git_pass(git_odb_read(&obj, g_odb, id));
+	cl_git_pass(git_odb_hash(&actual, git_odb_object_data(obj),
+		git_odb_object_size(obj), git_odb_object_type(obj)));
+	cl_assert_equal_oid(id, &actual);
+
+	git_odb_object_free(obj);
+	return 0;
+}
+
+void test_pack_cache__shares_bases(void)
+{
+	size_t hits, misses, evictions, new_hits, new_misses, new_evictions;
+	size_t current, allowed;
+
+	cl_git_pass(git_odb_foreach(g_odb, read_object, NULL));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_PACK_CACHE_STATS, &hits, &misses, &evictions));
+
+	/* the bases are all cached now */
+	cl_git_pass(git_odb_foreach(g_odb, read_object, NULL));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_PACK_CACHE_STATS, &new_hits, &new_misses, &new_evictions));
+	cl_assert(new_hits > hits);
+	cl_assert_equal_sz(evictions, new_evictions);
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_PACK_CACHED_MEMORY, &current, &allowed));
+	cl_assert(current > 0);
+	cl_assert_equal_sz(GIT_PACK_CACHE_MEMORY_LIMIT, allowed);
+}
+
+void test_pack_cache__evicts_to_the_budget(void)
+{
+	size_t hits, misses, evictions, new_evictions, current, allowed;
+
+	cl_git_pass(git_odb_foreach(g_odb, read_object, NULL));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_PACK_CACHED_MEMORY, &current, &allowed));
+	cl_assert(current > 0);
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_PACK_CACHE_STATS, &hits, &misses, &evictions));
+
+	/* lowering the budget evicts the bases right away */
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_PACK_CACHE_MAX_SIZE, (size_t)1));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_PACK_CACHED_MEMORY, &current, &allowed));
+	cl_assert_equal_sz(0, current);
+	cl_assert_equal_sz(1, allowed);
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_PACK_CACHE_STATS, &hits, &misses, &new_evictions));
+	cl_assert(new_evictions > evictions);
+
+	/* and nothing fits any more */
+	cl_git_pass(git_odb_foreach(g_odb, read_object, NULL));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_PACK_CACHED_MEMORY, &current, &allowed));
+	cl_assert_equal_sz(0, current);
+}
+
+void test_pack_cache__applies_chains(void)
+{
+	/* from the bases and the intermediate results in the cache */
+	cl_git_pass(git_odb_foreach(g_odb, check_object, NULL));
+	cl_git_pass(git_odb_foreach(g_odb, check_object, NULL));
+
+	/* from the bases only */
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_PACK_CACHE_MAX_SIZE, (size_t)0));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_PACK_CACHE_MAX_SIZE,
+		(size_t)GIT_PACK_CACHE_MEMORY_LIMIT));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_ENABLE_PACK_CACHE_INTERMEDIATES, 0));
+	cl_git_pass(git_odb_foreach(g_odb, check_object, NULL));
+	cl_git_pass(git_odb_foreach(g_odb, check_object, NULL));
+
+	/* from the packfile every time */
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_PACK_CACHE_MAX_SIZE, (size_t)0));
+	cl_git_pass(git_odb_foreach(g_odb, check_object, NULL));
+}
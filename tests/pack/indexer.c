@@ -125,3 +125,176 @@ void test_pack_indexer__fix_thin(void)
 		git_indexer_free(idx);
 	}
 }
+
+static int count_progress_cb(const git_transfer_progress *stats, void *payload)
+{
+	*(unsigned int *)payload = stats->indexed_objects;
+	return 0;
+}
+
+static void index_with_threads(
+	git_oid *out, git_transfer_progress *stats, const git_buf *pack, unsigned int threads)
+{
+	git_indexer *idx;
+	unsigned int reported = 0;
+
+	memset(stats, 0, sizeof(*stats));
+
+	cl_git_pass(git_indexer_new(&idx, ".", 0, NULL, count_progress_cb, &reported));
+	git_indexer_set_threads(idx, threads);
+	cl_git_pass(git_indexer_append(idx, pack->ptr, pack->size, stats));
+	cl_git_pass(git_indexer_commit(idx, stats));
+
+	cl_assert_equal_i(stats->indexed_objects, reported);
+	git_oid_cpy(out, git_indexer_hash(idx));
+
+	git_indexer_free(idx);
+}
+
+void test_pack_indexer__threaded(void)
+{
+	git_buf path = GIT_BUF_INIT, pack = GIT_BUF_INIT;
+	git_transfer_progress serial, threaded;
+	git_oid serial_id, threaded_id;
+
+	cl_git_pass(git_buf_joinpath(&path, cl_fixture("bitmap.git"),
+		"objects/pack/pack-810e3550d0233b4b47db110d556cd2c430426fde.pack"));
+	cl_git_pass(git_futils_readbuffer(&pack, git_buf_cstr(&path)));
+
+	index_with_threads(&serial_id, &serial, &pack, 1);
+#ifdef GIT_THREADS
+	index_with_threads(&threaded_id, &threaded, &pack, 4);
+#else
+	index_with_threads(&threaded_id, &threaded, &pack, 1);
+#endif
+
+	cl_assert(serial.indexed_deltas > 0);
+	cl_assert_equal_i(55, threaded.indexed_objects);
+	cl_assert_equal_i(serial.total_deltas, threaded.total_deltas);
+	cl_assert_equal_i(serial.indexed_deltas, threaded.indexed_deltas);
+	cl_assert_equal_oid(&serial_id, &threaded_id);
+
+	git_buf_free(&path);
+	git_buf_free(&pack);
+}
+
+void test_pack_indexer__threaded_out_of_order(void)
+{
+	git_indexer *idx = 0;
+	git_transfer_progress stats = { 0 };
+
+	cl_git_pass(git_indexer_new(&idx, ".", 0, NULL, NULL, NULL));
+#ifdef GIT_THREADS
+	git_indexer_set_threads(idx, 0);
+#endif
+	cl_git_pass(git_indexer_append(
+		idx, out_of_order_pack, out_of_order_pack_len, &stats));
+	cl_git_pass(git_indexer_commit(idx, &stats));
+
+	cl_assert_equal_i(stats.indexed_objects, 3);
+	cl_assert_equal_i(stats.indexed_deltas, 2);
+
+	git_indexer_free(idx);
+}
+
+void test_pack_indexer__eager_deltas(void)
+{
+	git_buf path = GIT_BUF_INIT, pack = GIT_BUF_INIT;
+	git_transfer_progress serial, stats = { 0 };
+	git_oid serial_id;
+	git_indexer *idx;
+	size_t off, chunk;
+
+	cl_git_pass(git_buf_joinpath(&path, cl_fixture("bitmap.git"),
+		"objects/pack/pack-810e3550d0233b4b47db110d556cd2c430426fde.pack"));
+	cl_git_pass(git_futils_readbuffer(&pack, git_buf_cstr(&path)));
+
+	index_with_threads(&serial_id, &serial, &pack, 1);
+
+	cl_git_pass(git_indexer_new(&idx, ".", 0, NULL, NULL, NULL));
+	cl_git_pass(git_indexer_set_eager_deltas(idx, 1));
+
+	/* small chunks, so objects span several calls */
+	for (off = 0; off < pack.size; off += chunk) {
+		chunk = min(pack.size - off, 97);
+		cl_git_pass(git_indexer_append(idx, pack.ptr + off, chunk, &stats));
+	}
+
+	/* the deltas against objects we had already seen are resolved */
+	cl_assert(stats.indexed_deltas > 0);
+	cl_assert_equal_i(serial.total_deltas, stats.total_deltas);
+	cl_assert(stats.indexed_objects > serial.total_objects - serial.total_deltas);
+
+	cl_git_pass(git_indexer_commit(idx, &stats));
+
+	cl_assert_equal_i(55, stats.indexed_objects);
+	cl_assert_equal_i(serial.total_deltas, stats.total_deltas);
+	cl_assert_equal_i(serial.indexed_deltas, stats.indexed_deltas);
+	cl_assert_equal_oid(&serial_id, git_indexer_hash(idx));
+
+	git_indexer_free(idx);
+	git_buf_free(&path);
+	git_buf_free(&pack);
+}
+
+void test_pack_indexer__eager_deltas_threaded(void)
+{
+	git_buf path = GIT_BUF_INIT, pack = GIT_BUF_INIT;
+	git_transfer_progress serial, stats = { 0 };
+	git_oid serial_id;
+	git_indexer *idx;
+	size_t off, chunk;
+
+	cl_git_pass(git_buf_joinpath(&path, cl_fixture("bitmap.git"),
+		"objects/pack/pack-810e3550d0233b4b47db110d556cd2c430426fde.pack"));
+	cl_git_pass(git_futils_readbuffer(&pack, git_buf_cstr(&path)));
+
+	index_with_threads(&serial_id, &serial, &pack, 1);
+
+	/* the whole objects are hashed in batches, which the deltas wait for */
+	cl_git_pass(git_indexer_new(&idx, ".", 0, NULL, NULL, NULL));
+#ifdef GIT_THREADS
+	git_indexer_set_threads(idx, 4);
+#endif
+	cl_git_pass(git_indexer_set_eager_deltas(idx, 1));
+
+	for (off = 0; off < pack.size; off += chunk) {
+		chunk = min(pack.size - off, 97);
+		cl_git_pass(git_indexer_append(idx, pack.ptr + off, chunk, &stats));
+	}
+
+	cl_assert(stats.indexed_deltas > 0);
+	cl_assert_equal_i(stats.total_objects, stats.received_objects);
+
+	cl_git_pass(git_indexer_commit(idx, &stats));
+
+	cl_assert_equal_i(55, stats.indexed_objects);
+	cl_assert_equal_i(serial.indexed_deltas, stats.indexed_deltas);
+	cl_assert_equal_oid(&serial_id, git_indexer_hash(idx));
+
+	git_indexer_free(idx);
+	git_buf_free(&path);
+	git_buf_free(&pack);
+}
+
+void test_pack_indexer__eager_deltas_out_of_order(void)
+{
+	git_indexer *idx = 0;
+	git_transfer_progress stats = { 0 };
+
+	cl_git_pass(git_indexer_new(&idx, ".", 0, NULL, NULL, NULL));
+	cl_git_pass(git_indexer_set_eager_deltas(idx, 1));
+	cl_git_pass(git_indexer_append(
+		idx, out_of_order_pack, out_of_order_pack_len, &stats));
+
+	/* these are reference deltas, which wait for the commit */
+	cl_assert_equal_i(stats.indexed_objects, 1);
+
+	cl_git_pass(git_indexer_commit(idx, &stats));
+
+	cl_assert_equal_i(stats.indexed_objects, 3);
+	cl_assert_equal_i(stats.total_deltas, 2);
+	cl_assert_equal_i(stats.indexed_deltas, 2);
+
+	git_indexer_free(idx);
+}
@@ -0,0 +1,156 @@
+#include "clar_libgit2.h"
+
+#include <git2.h>
+#include <git2/sys/midx.h>
+
+#include "midx.h"
+#include "fileops.h"
+
+static git_repository *_repo;
+
+void test_pack_midx__cleanup(void)
+{
+	cl_git_sandbox_cleanup();
+}
+
+/* testrepo.git with the multi-pack-index git wrote for its packs */
+static git_repository *sandbox_with_midx(void)
+{
+	git_repository *repo = cl_git_sandbox_init("testrepo.git");
+
+	cl_git_pass(git_futils_cp(cl_fixture("testrepo.midx"),
+		"testrepo.git/objects/pack/multi-pack-index", 0644));
+
+	return repo;
+}
+
+void test_pack_midx__parse(void)
+{
+	git_repository *repo = sandbox_with_midx();
+	git_midx_file *idx;
+	git_midx_entry e;
+	git_oid id;
+	git_buf midx_path = GIT_BUF_INIT;
+
+	cl_git_pass(git_buf_joinpath(&midx_path, git_repository_path(repo), "objects/pack/multi-pack-index"));
+	cl_git_pass(git_midx_open(&idx, git_buf_cstr(&midx_path)));
+	cl_assert_equal_i(git_midx_needs_refresh(idx, git_buf_cstr(&midx_path)), 0);
+	cl_assert_equal_i(idx->num_packfiles, 3);
+	cl_assert_equal_i(idx->num_objects, 1640);
+
+	cl_git_pass(git_oid_fromstr(&id, "5001298e0c09ad9c34e4249bc5801c75e9754fa5"));
+	cl_git_pass(git_midx_entry_find(&e, idx, &id, GIT_OID_HEXSZ));
+	cl_assert_equal_oid(&e.sha1, &id);
+	cl_assert_equal_s(
+			(const char *)git_vector_get(&idx->packfile_names, e.pack_index),
+			"pack-d7c6adf9f61318f041845b01440d09aa7a91e1b5.idx");
+	cl_assert_equal_i(e.offset, 169);
+
+	cl_git_pass(git_oid_fromstrn(&id, "5001298e", 8));
+	cl_git_pass(git_midx_entry_find(&e, idx, &id, 8));
+	cl_assert_equal_i(e.offset, 169);
+
+	cl_git_pass(git_oid_fromstr(&id, "0000000000000000000000000000000000000001"));
+	cl_assert_equal_i(GIT_ENOTFOUND, git_midx_entry_find(&e, idx, &id, GIT_OID_HEXSZ));
+
+	git_midx_free(idx);
+	git_buf_free(&midx_path);
+}
+
+void test_pack_midx__lookup(void)
+{
+	git_repository *repo = sandbox_with_midx();
+	git_commit *commit;
+	git_oid id;
+
+	cl_git_pass(git_oid_fromstr(&id, "5001298e0c09ad9c34e4249bc5801c75e9754fa5"));
+	cl_git_pass(git_commit_lookup_prefix(&commit, repo, &id, GIT_OID_HEXSZ));
+	cl_assert_equal_s(git_commit_message(commit), "packed commit one\n");
+
+	git_commit_free(commit);
+}
+
+void test_pack_midx__verify(void)
+{
+	sandbox_with_midx();
+
+	cl_git_pass(git_midx_verify("testrepo.git/objects/pack"));
+	cl_git_fail_with(GIT_ENOTFOUND,
+		git_midx_verify(cl_fixture("duplicate.git/objects/pack")));
+}
+
+void test_pack_midx__writer(void)
+{
+	git_midx_writer *w = NULL;
+	git_buf midx = GIT_BUF_INIT, expected_midx = GIT_BUF_INIT, path = GIT_BUF_INIT;
+
+	_repo = cl_git_sandbox_init("testrepo.git");
+
+	cl_git_pass(git_buf_joinpath(&path, git_repository_path(_repo), "objects/pack"));
+	cl_git_pass(git_midx_writer_new(&w, git_buf_cstr(&path)));
+
+	cl_git_pass(git_midx_writer_add(w, "pack-d7c6adf9f61318f041845b01440d09aa7a91e1b5.idx"));
+	cl_git_pass(git_midx_writer_add(w, "pack-d85f5d483273108c9d8dd0e4728ccf0b2982423a.idx"));
+	cl_git_pass(git_midx_writer_add(w, "pack-a81e489679b7d3418f9ab594bda8ceb37dd4c695.idx"));
+
+	cl_git_pass(git_midx_writer_dump(&midx, w));
+
+	/* the result must be byte-for-byte what git wrote for the fixture */
+	cl_git_pass(git_futils_readbuffer(&expected_midx, cl_fixture("testrepo.midx")));
+
+	cl_assert_equal_i(git_buf_len(&midx), git_buf_len(&expected_midx));
+	cl_assert(memcmp(git_buf_cstr(&midx), git_buf_cstr(&expected_midx), git_buf_len(&midx)) == 0);
+
+	git_buf_free(&midx);
+	git_buf_free(&expected_midx);
+	git_buf_free(&path);
+	git_midx_writer_free(w);
+}
+
+static int read_object_cb(const git_oid *id, void *payload)
+{
+	git_odb *odb = payload;
+	git_odb_object *obj;
+
+	cl_git_pass(git_odb_read(&obj, odb, id));
+	cl_assert_equal_oid(git_odb_object_id(obj), id);
+	git_odb_object_free(obj);
+
+	return 0;
+}
+
+void test_pack_midx__write_and_use(void)
+{
+	git_midx_writer *w = NULL;
+	git_odb *odb;
+	git_buf path = GIT_BUF_INIT;
+	git_oid id;
+	size_t len;
+	git_otype type;
+
+	_repo = cl_git_sandbox_init("duplicate.git");
+
+	cl_git_pass(git_buf_joinpath(&path, git_repository_path(_repo), "objects/pack"));
+	cl_git_pass(git_midx_writer_new(&w, git_buf_cstr(&path)));
+
+	cl_git_pass(git_midx_writer_add(w, "pack-29a4896f0a0b9c9947b0927c57a5c03dcae052e3.idx"));
+	cl_git_pass(git_midx_writer_add(w, "pack-b18eeacbd65cbd30a365d7564b45a468e8bd43d6.idx"));
+	cl_git_pass(git_midx_writer_add(w, "pack-e87994ad581c9af946de0eb890175c08cd005f38.idx"));
+	cl_git_pass(git_midx_writer_add(w, "pack-f4ef1aa326265de7d05018ee51acc0a8717fe1ea.idx"));
+	cl_git_pass(git_midx_writer_commit(w));
+	git_midx_writer_free(w);
+
+	cl_git_pass(git_midx_verify(git_buf_cstr(&path)));
+
+	/* pick up the new index and read every object through it */
+	cl_git_pass(git_repository_odb(&odb, _repo));
+	cl_git_pass(git_odb_refresh(odb));
+	cl_git_pass(git_odb_foreach(odb, read_object_cb, odb));
+
+	cl_git_pass(git_oid_fromstr(&id, "0ddeaded9502971eefe1e41e34d0e536853ae20f"));
+	cl_assert(git_odb_exists(odb, &id));
+	cl_git_pass(git_odb_read_header(&len, &type, odb, &id));
+
+	git_odb_free(odb);
+	git_buf_free(&path);
+}
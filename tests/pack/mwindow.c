@@ -0,0 +1,35 @@
+#include "clar_libgit2.h"
+
+#include "mwindow.h"
+
+void test_pack_mwindow__left_of_a_window_over_4gb(void)
+{
+	git_mwindow_file mwf;
+	git_mwindow w, *cursor = &w;
+	unsigned char *data;
+	unsigned int left;
+
+	if (sizeof(size_t) < 8)
+		cl_skip();
+
+	/* a full map of a large pack; the cursor holds it, so it is never read */
+	memset(&mwf, 0, sizeof(mwf));
+	memset(&w, 0, sizeof(w));
+	w.mwf = &mwf;
+	w.window_map.data = (void *)0x1000;
+	w.window_map.len = (size_t)UINT_MAX + 4096;
+	w.full = 1;
+
+	data = git_mwindow_open(&mwf, &cursor, 0, 20, &left);
+	cl_assert(data == (unsigned char *)0x1000);
+	cl_assert(cursor == &w);
+	cl_assert_equal_i(UINT_MAX, left);
+
+	/* from here on, what is left fits */
+	data = git_mwindow_open(&mwf, &cursor, 4096, 20, &left);
+	cl_assert(data == (unsigned char *)0x1000 + 4096);
+	cl_assert_equal_i(UINT_MAX, left);
+
+	data = git_mwindow_open(&mwf, &cursor, (git_off_t)UINT_MAX, 20, &left);
+	cl_assert_equal_i(4096, left);
+}
@@ -0,0 +1,216 @@
+#include "clar_libgit2.h"
+#include "fileops.h"
+#include "pack.h"
+
+#include "git2/sys/pack_objinfo.h"
+
+#define TESTREPO_PACK "testrepo.git/objects/pack/pack-d7c6adf9f61318f041845b01440d09aa7a91e1b5"
+#define BITMAP_PACK "pack-810e3550d0233b4b47db110d556cd2c430426fde"
+
+static git_repository *g_repo;
+
+void test_pack_objinfo__initialize(void)
+{
+	g_repo = cl_git_sandbox_init("testrepo.git");
+}
+
+void test_pack_objinfo__cleanup(void)
+{
+	cl_git_sandbox_cleanup();
+	cl_git_pass(git_libgit2_opts(GIT_OPT_ENABLE_PACK_OBJINFO, 0));
+}
+
+static int check_header(const git_oid *id, void *payload)
+{
+	git_odb *odb = payload;
+	git_odb_object *obj;
+	git_otype type;
+	size_t len;
+
+	cl_git_pass(git_odb_read_header(&len, &type, odb, id));
+	cl_git_pass(git_odb_read(&obj, odb, id));
+	cl_assert_equal_i(git_odb_object_type(obj), type);
+	cl_assert_equal_sz(git_odb_object_size(obj), len);
+
+	git_odb_object_free(obj);
+	return 0;
+}
+
+static void check_every_header(void)
+{
+	git_repository *repo;
+	git_odb *odb;
+
+	cl_git_pass(git_repository_open(&repo, "testrepo.git"));
+	cl_git_pass(git_repository_odb(&odb, repo));
+	cl_git_pass(git_odb_foreach(odb, check_header, odb));
+
+	git_odb_free(odb);
+	git_repository_free(repo);
+}
+
+void test_pack_objinfo__write_on_demand(void)
+{
+	git_vector packs = GIT_VECTOR_INIT;
+	git_buf path = GIT_BUF_INIT;
+	char *idx_path;
+	size_t i;
+
+	cl_git_pass(git_buf_sets(&path, "testrepo.git/objects/pack"));
+	cl_git_pass(git_path_dirload(&packs, path.ptr, 0, 0));
+
+	git_vector_foreach(&packs, i, idx_path) {
+		if (git__suffixcmp(idx_path, ".idx") != 0)
+			continue;
+
+		cl_git_pass(git_pack_objinfo_write(idx_path));
+
+		cl_git_pass(git_buf_set(&path, idx_path, strlen(idx_path) - strlen(".idx")));
+		cl_git_pass(git_buf_puts(&path, ".objinfo"));
+		cl_assert(git_path_isfile(path.ptr));
+	}
+
+	check_every_header();
+
+	git_vector_free_deep(&packs);
+	git_buf_free(&path);
+}
+
+static void write_fake_objinfo(const char *pack, bool same_pack)
+{
+	git_buf idx = GIT_BUF_INIT, path = GIT_BUF_INIT;
+	git_oid pack_checksum;
+	uint64_t *entries;
+	uint32_t i, nr;
+
+	cl_git_pass(git_buf_printf(&path, "%s.idx", pack));
+	cl_git_pass(git_futils_readbuffer(&idx, path.ptr));
+
+	/* a version 2 index has the fanout table after the 8-byte header */
+	nr = ntohl(*(uint32_t *)(idx.ptr + 8 + 255 * 4));
+	git_oid_fromraw(&pack_checksum,
+		(const unsigned char *)idx.ptr + idx.size - 2 * GIT_OID_RAWSZ);
+	if (!same_pack)
+		pack_checksum.id[0] ^= 0xff;
+
+	entries = git__calloc(nr, sizeof(uint64_t));
+	cl_assert(entries);
+	for (i = 0; i < nr; i++)
+		entries[i] = git_pack_objinfo__entry(GIT_OBJ_BLOB, 42);
+
+	git_buf_clear(&path);
+	cl_git_pass(git_buf_printf(&path, "%s.objinfo", pack));
+	cl_git_pass(git_pack_objinfo__write(path.ptr, entries, nr,
+		&pack_checksum, GIT_PACK_FILE_MODE));
+
+	git__free(entries);
+	git_buf_free(&path);
+	git_buf_free(&idx);
+}
+
+static void read_header(size_t *len, git_otype *type, const char *sha)
+{
+	git_repository *repo;
+	git_odb *odb;
+	git_oid id;
+
+	cl_git_pass(git_oid_fromstr(&id, sha));
+	cl_git_pass(git_repository_open(&repo, "testrepo.git"));
+	cl_git_pass(git_repository_odb(&odb, repo));
+	cl_git_pass(git_odb_read_header(len, type, odb, &id));
+
+	git_odb_free(odb);
+	git_repository_free(repo);
+}
+
+void test_pack_objinfo__headers_come_from_the_table(void)
+{
+	git_otype type;
+	size_t len;
+
+	/* a commit in the pack, which the table says is a blob */
+	write_fake_objinfo(TESTREPO_PACK, true);
+	read_header(&len, &type, "41bc8c69075bbdb46c5c6f0566cc8cc5b46e8bd9");
+	cl_assert_equal_i(GIT_OBJ_BLOB, type);
+	cl_assert_equal_sz(42, len);
+}
+
+void test_pack_objinfo__ignores_the_table_of_another_pack(void)
+{
+	git_otype type;
+	size_t len;
+
+	write_fake_objinfo(TESTREPO_PACK, false);
+	read_header(&len, &type, "41bc8c69075bbdb46c5c6f0566cc8cc5b46e8bd9");
+	cl_assert_equal_i(GIT_OBJ_COMMIT, type);
+}
+
+void test_pack_objinfo__written_by_the_indexer(void)
+{
+	git_buf path = GIT_BUF_INIT, pack = GIT_BUF_INIT,
+		indexed = GIT_BUF_INIT, on_demand = GIT_BUF_INIT;
+	git_transfer_progress stats = { 0 };
+	git_indexer *idx;
+	char hash[GIT_OID_HEXSZ + 1];
+
+	cl_fixture_sandbox("bitmap.git");
+	cl_git_pass(git_buf_joinpath(&path, "bitmap.git/objects/pack", BITMAP_PACK ".pack"));
+	cl_git_pass(git_futils_readbuffer(&pack, path.ptr));
+
+	cl_git_pass(git_indexer_new(&idx, ".", 0, NULL, NULL, NULL));
+	cl_git_pass(git_indexer_set_objinfo(idx, 1));
+	cl_git_pass(git_indexer_append(idx, pack.ptr, pack.size, &stats));
+	cl_git_pass(git_indexer_commit(idx, &stats));
+	git_oid_tostr(hash, sizeof(hash), git_indexer_hash(idx));
+	git_indexer_free(idx);
+
+	git_buf_clear(&path);
+	cl_git_pass(git_buf_printf(&path, "pack-%s.objinfo", hash));
+	cl_git_pass(git_futils_readbuffer(&indexed, path.ptr));
+
+	/* the indexer and the on-demand writer agree */
+	cl_git_pass(git_buf_joinpath(&path, "bitmap.git/objects/pack", BITMAP_PACK ".idx"));
+	cl_git_pass(git_pack_objinfo_write(path.ptr));
+	cl_git_pass(git_buf_joinpath(&path, "bitmap.git/objects/pack", BITMAP_PACK ".objinfo"));
+	cl_git_pass(git_futils_readbuffer(&on_demand, path.ptr));
+
+	cl_assert_equal_sz(on_demand.size, indexed.size);
+	cl_assert(memcmp(on_demand.ptr, indexed.ptr, indexed.size) == 0);
+
+	cl_fixture_cleanup("bitmap.git");
+	git_buf_free(&path);
+	git_buf_free(&pack);
+	git_buf_free(&indexed);
+	git_buf_free(&on_demand);
+}
+
+void test_pack_objinfo__written_for_received_packs(void)
+{
+	git_buf path = GIT_BUF_INIT, pack = GIT_BUF_INIT;
+	git_transfer_progress stats = { 0 };
+	git_odb_writepack *writepack;
+	git_odb *odb;
+
+	cl_git_pass(git_buf_joinpath(&path, cl_fixture("bitmap.git"),
+		"objects/pack/" BITMAP_PACK ".pack"));
+	cl_git_pass(git_futils_readbuffer(&pack, path.ptr));
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_ENABLE_PACK_OBJINFO, 1));
+	cl_git_pass(git_repository_odb(&odb, g_repo));
+	cl_git_pass(git_odb_write_pack(&writepack, odb, NULL, NULL));
+	cl_git_pass(writepack->append(writepack, pack.ptr, pack.size, &stats));
+	cl_git_pass(writepack->commit(writepack, &stats));
+	writepack->free(writepack);
+
+	/* the objects of the new pack are read from the table */
+	cl_git_pass(git_odb_refresh(odb));
+	cl_git_pass(git_odb_foreach(odb, check_header, odb));
+
+	/* the indexer names the pack after the ids of its objects */
+	cl_assert(git_path_isfile("testrepo.git/objects/pack/"
+		"pack-90277fc817b0a1b4e94e1b4861975b4d02ffa0ab.objinfo"));
+
+	git_odb_free(odb);
+	git_buf_free(&path);
+	git_buf_free(&pack);
+}
@@ -96,6 +96,7 @@ void test_pack_packbuilder__create_pack(void)
 	char hex[GIT_OID_HEXSZ+1]; hex[GIT_OID_HEXSZ] = '\0';
 
 	seed_packbuilder();
+	git_packbuilder_set_ofs_delta(_packbuilder, 0);
 
 	cl_git_pass(git_indexer_new(&_indexer, ".", 0, NULL, NULL, NULL));
 	cl_git_pass(git_packbuilder_foreach(_packbuilder, feed_indexer, &stats));
@@ -108,7 +109,8 @@ void test_pack_packbuilder__create_pack(void)
 	 * By default, packfiles are created with only one thread.
 	 * Therefore we can predict the object ordering and make sure
 	 * we create exactly the same pack as git.git does when *not*
-	 * reusing existing deltas (as libgit2).
+	 * reusing existing deltas and writing reference deltas (as
+	 * libgit2 with offset deltas disabled).
 	 *
 	 * $ cd tests/resources/testrepo.git
 	 * $ git rev-list --objects HEAD | \
@@ -223,3 +225,250 @@ void test_pack_packbuilder__foreach_with_cancel(void)
 		git_packbuilder_foreach(_packbuilder, foreach_cancel_cb, idx), -1111);
 	git_indexer_free(idx);
 }
+
+static void build_blob_pack(
+	git_transfer_progress *stats,
+	size_t *pack_size,
+	unsigned int threads,
+	int ofs_delta)
+{
+	git_packbuilder *pb;
+	git_indexer *idx;
+	git_buf content = GIT_BUF_INIT, pack = GIT_BUF_INIT;
+	git_oid id;
+	int i, j;
+
+	cl_git_pass(git_packbuilder_new(&pb, _repo));
+	git_packbuilder_set_threads(pb, threads);
+	git_packbuilder_set_ofs_delta(pb, ofs_delta);
+
+	/* many similar blobs, so there are deltas to find in every task */
+	for (i = 0; i < 500; i++) {
+		git_buf_clear(&content);
+		for (j = 0; j < 40; j++)
+			git_buf_printf(&content, "line %d of a blob %d\n", j, (j == i % 40) ? i : 0);
+
+		cl_git_pass(git_blob_create_frombuffer(&id, _repo, content.ptr, content.size));
+		cl_git_pass(git_packbuilder_insert(pb, &id, NULL));
+	}
+
+	cl_git_pass(git_packbuilder_write_buf(&pack, pb));
+	if (pack_size)
+		*pack_size = pack.size;
+
+	memset(stats, 0, sizeof(*stats));
+	cl_git_pass(git_indexer_new(&idx, ".", 0, NULL, NULL, NULL));
+	cl_git_pass(git_indexer_append(idx, pack.ptr, pack.size, stats));
+	cl_git_pass(git_indexer_commit(idx, stats));
+
+	git_indexer_free(idx);
+	git_packbuilder_free(pb);
+	git_buf_free(&content);
+	git_buf_free(&pack);
+}
+
+void test_pack_packbuilder__threaded_delta_search(void)
+{
+	git_transfer_progress single, threaded;
+
+	build_blob_pack(&single, NULL, 1, 1);
+	build_blob_pack(&threaded, NULL, 4, 1);
+
+	cl_assert_equal_i(500, single.indexed_objects);
+	cl_assert_equal_i(500, threaded.indexed_objects);
+
+	/* the tasks split the window, which may cost a few deltas */
+	cl_assert(single.indexed_deltas > 400);
+	cl_assert(threaded.indexed_deltas > 400);
+}
+
+void test_pack_packbuilder__ofs_deltas(void)
+{
+	git_transfer_progress ofs, ref;
+	size_t ofs_size, ref_size;
+
+	build_blob_pack(&ofs, &ofs_size, 1, 1);
+	build_blob_pack(&ref, &ref_size, 1, 0);
+
+	cl_assert_equal_i(500, ofs.indexed_objects);
+	cl_assert_equal_i(ref.indexed_deltas, ofs.indexed_deltas);
+	cl_assert(ofs.indexed_deltas > 400);
+
+	/* in a pack this small, an offset takes three bytes at most */
+	cl_assert(ref_size - ofs_size >= ofs.indexed_deltas * (GIT_OID_RAWSZ - 3));
+}
+
+void test_pack_packbuilder__delta_index_cache(void)
+{
+	git_transfer_progress first, second;
+	size_t first_size, second_size, current, allowed;
+	size_t hits[2], misses[2], evictions[2];
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_DELTA_INDEX_CACHE_MAX_SIZE, (size_t)(16 * 1024 * 1024)));
+
+	build_blob_pack(&first, &first_size, 1, 1);
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_DELTA_INDEX_CACHE_STATS, &hits[0], &misses[0], &evictions[0]));
+
+	/* the second packbuilder finds the indexes of the first one */
+	build_blob_pack(&second, &second_size, 1, 1);
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_DELTA_INDEX_CACHE_STATS, &hits[1], &misses[1], &evictions[1]));
+	cl_assert(hits[1] - hits[0] > 400);
+	cl_assert_equal_sz(misses[0], misses[1]);
+
+	cl_assert_equal_i(first.indexed_deltas, second.indexed_deltas);
+	cl_assert_equal_sz(first_size, second_size);
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_DELTA_INDEX_CACHED_MEMORY, &current, &allowed));
+	cl_assert(current > 0 && current <= allowed);
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_DELTA_INDEX_CACHE_MAX_SIZE, (size_t)0));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_DELTA_INDEX_CACHED_MEMORY, &current, &allowed));
+	cl_assert_equal_sz(0, current);
+}
+
+static void commit_blob(
+	git_oid *blob_id,
+	const char *refname,
+	const char *content,
+	const git_oid *parent_id)
+{
+	git_treebuilder *builder;
+	git_signature *sig;
+	git_commit *parent = NULL;
+	git_tree *tree;
+	git_oid tree_id, commit_id;
+
+	cl_git_pass(git_blob_create_frombuffer(blob_id, _repo, content, strlen(content)));
+
+	cl_git_pass(git_treebuilder_new(&builder, _repo, NULL));
+	cl_git_pass(git_treebuilder_insert(NULL, builder, "file", blob_id, GIT_FILEMODE_BLOB));
+	cl_git_pass(git_treebuilder_write(&tree_id, builder));
+	cl_git_pass(git_tree_lookup(&tree, _repo, &tree_id));
+
+	if (parent_id)
+		cl_git_pass(git_commit_lookup(&parent, _repo, parent_id));
+
+	cl_git_pass(git_signature_new(&sig, "me", "me@example.com", 1234567890, 0));
+	cl_git_pass(git_commit_create_v(&commit_id, _repo, refname, sig, sig,
+		NULL, "island\n", tree, parent ? 1 : 0, parent));
+
+	git_signature_free(sig);
+	git_commit_free(parent);
+	git_tree_free(tree);
+	git_treebuilder_free(builder);
+}
+
+static unsigned int count_blob_deltas(const char *island, const git_oid *ids)
+{
+	git_packbuilder *pb;
+	git_buf pack = GIT_BUF_INIT;
+	git_transfer_progress stats = {0};
+
+	cl_git_pass(git_packbuilder_new(&pb, _repo));
+
+	if (island)
+		cl_git_pass(git_packbuilder_add_island(pb, island));
+
+	cl_git_pass(git_packbuilder_insert(pb, &ids[0], NULL));
+	cl_git_pass(git_packbuilder_insert(pb, &ids[1], NULL));
+	cl_git_pass(git_packbuilder_write_buf(&pack, pb));
+
+	cl_git_pass(git_indexer_new(&_indexer, ".", 0, NULL, NULL, NULL));
+	cl_git_pass(git_indexer_append(_indexer, pack.ptr, pack.size, &stats));
+	cl_git_pass(git_indexer_commit(_indexer, &stats));
+	cl_assert_equal_i(2, stats.indexed_objects);
+
+	git_indexer_free(_indexer);
+	_indexer = NULL;
+	git_packbuilder_free(pb);
+	git_buf_free(&pack);
+
+	return stats.indexed_deltas;
+}
+
+static void blob_contents(git_buf *large, git_buf *small)
+{
+	int i;
+
+	for (i = 0; i < 60; i++) {
+		git_buf_printf(large, "line %d of the file\n", i);
+		if (i < 50)
+			git_buf_printf(small, "line %d of the file\n", i);
+	}
+}
+
+void test_pack_packbuilder__islands_forbid_crossing_deltas(void)
+{
+	git_buf large = GIT_BUF_INIT, small = GIT_BUF_INIT;
+	git_oid ids[2];
+
+	blob_contents(&large, &small);
+
+	/* two unrelated forks */
+	commit_blob(&ids[0], "refs/virtual/1/heads/master", large.ptr, NULL);
+	commit_blob(&ids[1], "refs/virtual/2/heads/master", small.ptr, NULL);
+
+	cl_assert_equal_i(1, count_blob_deltas(NULL, ids));
+	cl_assert_equal_i(0, count_blob_deltas("^refs/virtual/([0-9]+)/", ids));
+
+	/* without a capture group, they are all in the same island */
+	cl_assert_equal_i(1, count_blob_deltas("^refs/virtual/", ids));
+
+	git_buf_free(&large);
+	git_buf_free(&small);
+}
+
+void test_pack_packbuilder__islands_allow_deltas_against_shared_bases(void)
+{
+	git_buf large = GIT_BUF_INIT, small = GIT_BUF_INIT;
+	git_oid ids[2], parent_id;
+	git_config *cfg;
+
+	blob_contents(&large, &small);
+
+	/* the second fork has the history of the first one */
+	commit_blob(&ids[0], "refs/virtual/1/heads/master", large.ptr, NULL);
+	cl_git_pass(git_reference_name_to_id(&parent_id, _repo, "refs/virtual/1/heads/master"));
+	commit_blob(&ids[1], "refs/virtual/2/heads/master", small.ptr, &parent_id);
+
+	cl_git_pass(git_repository_config(&cfg, _repo));
+	cl_git_pass(git_config_set_string(cfg, "pack.island", "^refs/virtual/([0-9]+)/"));
+	git_config_free(cfg);
+
+	/* the base is in both islands, the delta in the second one only */
+	cl_assert_equal_i(1, count_blob_deltas(NULL, ids));
+
+	git_buf_free(&large);
+	git_buf_free(&small);
+}
+
+void test_pack_packbuilder__invalid_island(void)
+{
+	cl_git_fail(git_packbuilder_add_island(_packbuilder, "refs/(heads"));
+}
+
+void test_pack_packbuilder__name_hash_path(void)
+{
+	unsigned int one = git_packfile__name_hash_path("src/one/Makefile");
+	unsigned int two = git_packfile__name_hash_path("src/two/Makefile");
+
+	/* the files at different paths are apart, but not far */
+	cl_assert(one != two);
+	cl_assert_equal_i(one >> 26, two >> 26);
+	cl_assert_equal_i(git_packfile__name_hash_path("Makefile"),
+		git_packfile__name_hash_path("Make file"));
+
+	cl_git_fail(git_packbuilder_set_name_hash(_packbuilder, 3));
+	cl_git_pass(git_packbuilder_set_name_hash(_packbuilder,
+		GIT_PACKBUILDER_NAME_HASH_PATH));
+
+	/* the walk builds the paths of the blobs itself */
+	cl_git_pass(git_revwalk_push_ref(_revwalker, "HEAD"));
+	cl_git_pass(git_packbuilder_insert_walk(_packbuilder, _revwalker));
+
+	cl_git_pass(git_indexer_new(&_indexer, ".", 0, NULL, NULL, NULL));
+	cl_git_pass(git_packbuilder_foreach(_packbuilder, feed_indexer, &_stats));
+	cl_git_pass(git_indexer_commit(_indexer, &_stats));
+
+	cl_assert_equal_i(git_packbuilder_object_count(_packbuilder), _stats.indexed_objects);
+}
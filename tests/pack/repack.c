@@ -0,0 +1,204 @@
+#include "clar_libgit2.h"
+#include "array.h"
+#include "fileops.h"
+#include "vector.h"
+
+#include "git2/sys/midx.h"
+#include "git2/sys/repack.h"
+
+#define PACK_DIR "testrepo.git/objects/pack"
+#define SMALL_PACK PACK_DIR "/pack-d85f5d483273108c9d8dd0e4728ccf0b2982423a"
+
+/* in the small pack above */
+static const char *small_pack_ids[] = {
+	"e90810b8df3e80c413d903f631643c716887138d",
+	"6336846bd5c88d32f93ae57d846683e61ab5c530"
+};
+
+static git_repository *g_repo;
+
+void test_pack_repack__initialize(void)
+{
+	g_repo = cl_git_sandbox_init("testrepo.git");
+}
+
+void test_pack_repack__cleanup(void)
+{
+	cl_git_sandbox_cleanup();
+}
+
+static size_t count_packs(void)
+{
+	git_vector files = GIT_VECTOR_INIT;
+	char *file;
+	size_t i, count = 0;
+
+	cl_git_pass(git_path_dirload(&files, PACK_DIR, 0, 0));
+
+	git_vector_foreach(&files, i, file) {
+		if (!git__suffixcmp(file, ".idx"))
+			count++;
+	}
+
+	git_vector_free_deep(&files);
+	return count;
+}
+
+static int check_read(const git_oid *id, void *payload)
+{
+	git_odb_object *obj;
+
+	cl_git_pass(git_odb_read(&obj, payload, id));
+	git_odb_object_free(obj);
+	return 0;
+}
+
+static void check_every_object(git_oid *ids, size_t count)
+{
+	git_repository *repo;
+	git_odb *odb;
+	size_t i;
+
+	cl_git_pass(git_repository_open(&repo, "testrepo.git"));
+	cl_git_pass(git_repository_odb(&odb, repo));
+
+	for (i = 0; i < count; i++)
+		check_read(&ids[i], odb);
+
+	git_odb_free(odb);
+	git_repository_free(repo);
+}
+
+static void remove_loose(const git_oid *id)
+{
+	char path[] = "testrepo.git/objects/xx/" \
+		"xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx";
+	char hex[GIT_OID_HEXSZ + 1];
+
+	git_oid_tostr(hex, sizeof(hex), id);
+	memcpy(path + strlen("testrepo.git/objects/"), hex, 2);
+	memcpy(path + strlen("testrepo.git/objects/xx/"), hex + 2, GIT_OID_HEXSZ - 2);
+	cl_must_pass(p_unlink(path));
+}
+
+static int collect_id(const git_oid *id, void *payload)
+{
+	git_array_t(git_oid) *ids = payload;
+	git_oid *out = git_array_alloc(*ids);
+
+	cl_assert(out);
+	git_oid_cpy(out, id);
+	return 0;
+}
+
+/* the fixture has packs of 1628, 6 and 6 objects */
+void test_pack_repack__rolls_up_small_packs(void)
+{
+	git_array_t(git_oid) ids = GIT_ARRAY_INIT;
+	git_odb *odb;
+
+	/* with a multi-pack-index, which the repack has to rewrite */
+	cl_git_pass(git_futils_cp(cl_fixture("testrepo.midx"),
+		PACK_DIR "/multi-pack-index", 0644));
+
+	cl_git_pass(git_repository_odb(&odb, g_repo));
+	cl_git_pass(git_odb_foreach(odb, collect_id, &ids));
+
+	cl_assert_equal_sz(3, count_packs());
+	cl_git_pass(git_repository_repack(g_repo, NULL));
+	cl_assert_equal_sz(2, count_packs());
+	cl_assert(!git_path_exists(SMALL_PACK ".pack"));
+	cl_assert(!git_path_exists(SMALL_PACK ".idx"));
+
+	/* the multi-pack-index lists the new pack */
+	cl_git_pass(git_midx_verify(PACK_DIR));
+
+	check_every_object(ids.ptr, ids.size);
+
+	/* the packs are in progression now */
+	cl_git_pass(git_repository_repack(g_repo, NULL));
+	cl_assert_equal_sz(2, count_packs());
+
+	git_array_clear(ids);
+	git_odb_free(odb);
+}
+
+void test_pack_repack__rolls_up_fetched_packs(void)
+{
+	git_packbuilder *pb;
+	git_buf content = GIT_BUF_INIT;
+	git_repack_options opts = GIT_REPACK_OPTIONS_INIT;
+	git_oid ids[8];
+	int i;
+
+	/* one pack per fetch */
+	for (i = 0; i < 8; i++) {
+		cl_git_pass(git_buf_printf(&content, "fetched %d\n", i));
+		cl_git_pass(git_blob_create_frombuffer(&ids[i], g_repo, content.ptr, content.size));
+
+		cl_git_pass(git_packbuilder_new(&pb, g_repo));
+		cl_git_pass(git_packbuilder_insert(pb, &ids[i], NULL));
+		cl_git_pass(git_packbuilder_write(pb, PACK_DIR, 0, NULL, NULL));
+		git_packbuilder_free(pb);
+	}
+
+	cl_assert_equal_sz(11, count_packs());
+
+	/* the pack of the fixture is large enough to be left alone */
+	opts.factor = 16;
+	cl_git_pass(git_repository_repack(g_repo, &opts));
+	cl_assert_equal_sz(2, count_packs());
+
+	opts.factor = 2000;
+	cl_git_pass(git_repository_repack(g_repo, &opts));
+	cl_assert_equal_sz(1, count_packs());
+
+	for (i = 0; i < 8; i++)
+		remove_loose(&ids[i]);
+	check_every_object(ids, 8);
+
+	git_buf_free(&content);
+}
+
+void test_pack_repack__leaves_kept_packs(void)
+{
+	cl_git_mkfile(SMALL_PACK ".keep", "");
+
+	cl_git_pass(git_repository_repack(g_repo, NULL));
+	cl_assert_equal_sz(3, count_packs());
+	cl_assert(git_path_exists(SMALL_PACK ".pack"));
+}
+
+void test_pack_repack__open_packs_stay_readable(void)
+{
+	git_repository *repo;
+	git_odb *odb;
+	git_odb_object *obj;
+	git_oid id;
+
+	/* this one has the small pack open already */
+	cl_git_pass(git_repository_open(&repo, "testrepo.git"));
+	cl_git_pass(git_repository_odb(&odb, repo));
+	cl_git_pass(git_oid_fromstr(&id, small_pack_ids[0]));
+	cl_git_pass(git_odb_read(&obj, odb, &id));
+	git_odb_object_free(obj);
+
+	cl_git_pass(git_repository_repack(g_repo, NULL));
+	cl_assert(!git_path_exists(SMALL_PACK ".pack"));
+
+	/* an object it has not read yet, which is not in its cache */
+	cl_git_pass(git_oid_fromstr(&id, small_pack_ids[1]));
+	cl_git_pass(git_odb_read(&obj, odb, &id));
+	git_odb_object_free(obj);
+
+	git_odb_free(odb);
+	git_repository_free(repo);
+}
+
+void test_pack_repack__invalid_factor(void)
+{
+	git_repack_options opts = GIT_REPACK_OPTIONS_INIT;
+
+	opts.factor = 1;
+	cl_git_fail(git_repository_repack(g_repo, &opts));
+}
@@ -0,0 +1,152 @@
+#include "clar_libgit2.h"
+
+#include <git2.h>
+
+#include "mwindow.h"
+#include "pack.h"
+#include "pack-objects.h"
+#include "fileops.h"
+
+static git_repository *_repo;
+
+void test_pack_reuse__initialize(void)
+{
+	_repo = cl_git_sandbox_init("bitmap.git");
+}
+
+void test_pack_reuse__cleanup(void)
+{
+	cl_git_sandbox_cleanup();
+}
+
+static void build_pack(git_buf *out, int reuse)
+{
+	git_packbuilder *pb;
+	git_revwalk *walk;
+
+	cl_git_pass(git_packbuilder_new(&pb, _repo));
+	git_packbuilder_set_reuse(pb, reuse);
+
+	cl_git_pass(git_revwalk_new(&walk, _repo));
+	cl_git_pass(git_revwalk_push_glob(walk, "refs/heads/*"));
+	cl_git_pass(git_packbuilder_insert_walk(pb, walk));
+
+	cl_git_pass(git_packbuilder_write_buf(out, pb));
+
+	git_revwalk_free(walk);
+	git_packbuilder_free(pb);
+}
+
+static void index_pack(git_buf *idx_path, git_buf *pack)
+{
+	git_indexer *idx;
+	git_transfer_progress stats;
+	char hex[GIT_OID_HEXSZ + 1];
+
+	cl_git_pass(git_indexer_new(&idx, ".", 0, NULL, NULL, NULL));
+	cl_git_pass(git_indexer_append(idx, pack->ptr, pack->size, &stats));
+	cl_git_pass(git_indexer_commit(idx, &stats));
+
+	git_oid_tostr(hex, sizeof(hex), git_indexer_hash(idx));
+	cl_git_pass(git_buf_printf(idx_path, "pack-%s.idx", hex));
+
+	git_indexer_free(idx);
+}
+
+static int append_cb(void *buf, size_t len, void *payload)
+{
+	return git_buf_put((git_buf *)payload, buf, len);
+}
+
+static void read_raw_entry_data(
+	git_pack_raw_entry *raw, git_buf *data, const char *idx_path, const char *id_str)
+{
+	struct git_pack_file *p;
+	struct git_pack_entry e;
+	git_oid id;
+
+	cl_git_pass(git_oid_fromstr(&id, id_str));
+	cl_git_pass(git_mwindow_get_pack(&p, idx_path));
+	cl_git_pass(git_pack_entry_find(&e, p, &id, GIT_OID_HEXSZ));
+	cl_git_pass(git_packfile__raw_entry(raw, p, e.offset));
+	if (data)
+		cl_git_pass(git_packfile__foreach_raw(p,
+			raw->data_offset, raw->end_offset, append_cb, data));
+	git_mwindow_put_pack(p);
+}
+
+static void read_raw_entry(
+	git_pack_raw_entry *raw, const char *idx_path, const char *id_str)
+{
+	read_raw_entry_data(raw, NULL, idx_path, id_str);
+}
+
+void test_pack_reuse__existing_deltas(void)
+{
+	git_buf pack = GIT_BUF_INIT, idx_path = GIT_BUF_INIT;
+	git_pack_raw_entry raw;
+	git_oid base;
+
+	build_pack(&pack, 1);
+	index_pack(&idx_path, &pack);
+
+	/* in the fixture, be3563a is stored as a delta against a4a7dce */
+	read_raw_entry(&raw, git_buf_cstr(&idx_path), "be3563ae3f795b2b4353bcce3a527ad0a4f7f644");
+	cl_assert_equal_i(GIT_OBJ_OFS_DELTA, raw.type);
+	cl_git_pass(git_oid_fromstr(&base, "a4a7dce85cf63874e984719f4fdd239f5145052f"));
+	cl_assert_equal_oid(&base, &raw.base_id);
+
+	git_buf_free(&pack);
+	git_buf_free(&idx_path);
+}
+
+void test_pack_reuse__verbatim_data(void)
+{
+	git_buf pack = GIT_BUF_INIT, idx_path = GIT_BUF_INIT, source_idx_path = GIT_BUF_INIT;
+	git_buf data = GIT_BUF_INIT, source_data = GIT_BUF_INIT;
+	git_pack_raw_entry raw, source_raw;
+
+	build_pack(&pack, 1);
+	index_pack(&idx_path, &pack);
+
+	cl_git_pass(git_buf_joinpath(&source_idx_path, git_repository_path(_repo),
+		"objects/pack/pack-810e3550d0233b4b47db110d556cd2c430426fde.idx"));
+
+	/* the compressed data is copied as it is */
+	read_raw_entry_data(&source_raw, &source_data,
+		git_buf_cstr(&source_idx_path), "3697d64be941a53d4ae8f6a271e4e3fa56b022cc");
+	read_raw_entry_data(&raw, &data,
+		git_buf_cstr(&idx_path), "3697d64be941a53d4ae8f6a271e4e3fa56b022cc");
+
+	cl_assert_equal_i(GIT_OBJ_BLOB, raw.type);
+	cl_assert_equal_sz(source_raw.size, raw.size);
+	cl_assert_equal_sz(git_buf_len(&source_data), git_buf_len(&data));
+	cl_assert(memcmp(source_data.ptr, data.ptr, data.size) == 0);
+
+	git_buf_free(&pack);
+	git_buf_free(&idx_path);
+	git_buf_free(&source_idx_path);
+	git_buf_free(&data);
+	git_buf_free(&source_data);
+}
+
+void test_pack_reuse__same_objects(void)
+{
+	git_buf reused = GIT_BUF_INIT, recompressed = GIT_BUF_INIT;
+	git_buf reused_idx = GIT_BUF_INIT, recompressed_idx = GIT_BUF_INIT;
+
+	build_pack(&reused, 1);
+	build_pack(&recompressed, 0);
+
+	/* both packs have the same header and thus number of objects */
+	cl_assert(memcmp(reused.ptr, recompressed.ptr, 12) == 0);
+
+	/* and both are complete packs */
+	index_pack(&reused_idx, &reused);
+	index_pack(&recompressed_idx, &recompressed);
+
+	git_buf_free(&reused);
+	git_buf_free(&recompressed);
+	git_buf_free(&reused_idx);
+	git_buf_free(&recompressed_idx);
+}
@@ -0,0 +1,205 @@
+#include "clar_libgit2.h"
+#include "helper__perf__timer.h"
+#include "delta.h"
+#include "delta-apply.h"
+
+/* This test needs a repository with some history, whose path is given
+ * in GITTEST_PERF_REPO. It takes the blobs the commits reachable from
+ * HEAD changed, with what they were before, and reports how fast
+ * deltas between them are created, with each kernel the CPU runs, and
+ * applied.
+ */
+
+#define MAX_PAIRS 4000
+#define MAX_SIZE (64 * 1024 * 1024)
+#define ROUNDS 10
+
+typedef struct {
+	git_blob *base;
+	git_blob *target;
+	struct git_delta_index *index;
+	void *delta;
+	unsigned long delta_len;
+} blob_pair;
+
+static git_repository *g_repo;
+static blob_pair *g_pairs;
+static size_t g_count, g_base_size, g_target_size;
+
+static void add_pairs(git_commit *commit)
+{
+	git_commit *parent;
+	git_tree *old_tree, *new_tree;
+	git_diff *diff;
+	const git_diff_delta *d;
+	blob_pair *pair;
+	size_t i;
+
+	if (git_commit_parentcount(commit) == 0)
+		return;
+
+	cl_git_pass(git_commit_parent(&parent, commit, 0));
+	cl_git_pass(git_commit_tree(&old_tree, parent));
+	cl_git_pass(git_commit_tree(&new_tree, commit));
+	cl_git_pass(git_diff_tree_to_tree(&diff, g_repo, old_tree, new_tree, NULL));
+
+	for (i = 0; i < git_diff_num_deltas(diff) && g_count < MAX_PAIRS; i++) {
+		d = git_diff_get_delta(diff, i);
+		if (d->status != GIT_DELTA_MODIFIED ||
+			d->old_file.mode == GIT_FILEMODE_COMMIT)
+			continue;
+
+		pair = &g_pairs[g_count++];
+		cl_git_pass(git_blob_lookup(&pair->base, g_repo, &d->old_file.id));
+		cl_git_pass(git_blob_lookup(&pair->target, g_repo, &d->new_file.id));
+
+		g_base_size += (size_t)git_blob_rawsize(pair->base);
+		g_target_size += (size_t)git_blob_rawsize(pair->target);
+	}
+
+	git_diff_free(diff);
+	git_tree_free(new_tree);
+	git_tree_free(old_tree);
+	git_commit_free(parent);
+}
+
+void test_perf_delta__initialize(void)
+{
+	char *path = cl_getenv("GITTEST_PERF_REPO");
+	git_revwalk *walk;
+	git_commit *commit;
+	git_oid id;
+	blob_pair *pair;
+	size_t i;
+
+	if (!path)
+		cl_skip();
+
+	cl_git_pass(git_repository_open(&g_repo, path));
+	git__free(path);
+
+	g_pairs = git__calloc(MAX_PAIRS, sizeof(blob_pair));
+	cl_assert(g_pairs);
+
+	cl_git_pass(git_revwalk_new(&walk, g_repo));
+	cl_git_pass(git_revwalk_push_head(walk));
+
+	while (g_count < MAX_PAIRS && g_target_size < MAX_SIZE &&
+		git_revwalk_next(&id, walk) == 0) {
+		cl_git_pass(git_commit_lookup(&commit, g_repo, &id));
+		add_pairs(commit);
+		git_commit_free(commit);
+	}
+
+	git_revwalk_free(walk);
+
+	for (i = 0; i < g_count; i++) {
+		pair = &g_pairs[i];
+		pair->index = git_delta_create_index(
+			git_blob_rawcontent(pair->base),
+			(unsigned long)git_blob_rawsize(pair->base));
+	}
+}
+
+void test_perf_delta__cleanup(void)
+{
+	size_t i;
+
+	for (i = 0; i < g_count; i++) {
+		git_blob_free(g_pairs[i].base);
+		git_blob_free(g_pairs[i].target);
+		git_delta_free_index(g_pairs[i].index);
+		git__free(g_pairs[i].delta);
+	}
+
+	git__free(g_pairs);
+	g_pairs = NULL;
+	g_count = g_base_size = g_target_size = 0;
+
+	git_repository_free(g_repo);
+	g_repo = NULL;
+
+	git_delta__kernel(GIT_DELTA_KERNEL_AVX2);
+}
+
+static void create_deltas(const char *name)
+{
+	perf_timer t = PERF_TIMER_INIT;
+	blob_pair *pair;
+	size_t i, delta_size;
+	int round;
+
+	for (round = 0; round < ROUNDS; round++) {
+		delta_size = 0;
+
+		for (i = 0; i < g_count; i++) {
+			git__free(g_pairs[i].delta);
+			g_pairs[i].delta = NULL;
+		}
+
+		perf__timer__start(&t);
+		for (i = 0; i < g_count; i++) {
+			pair = &g_pairs[i];
+
+			if (!pair->index)
+				continue;
+
+			pair->delta = git_delta_create(pair->index,
+				git_blob_rawcontent(pair->target),
+				(unsigned long)git_blob_rawsize(pair->target),
+				&pair->delta_len, 0);
+			if (pair->delta)
+				delta_size += pair->delta_len;
+		}
+		perf__timer__stop(&t);
+	}
+
+	perf__timer__report(&t, "create, %s: %u pairs, %.1f MB/s, %u bytes of deltas",
+		name, (unsigned int)g_count,
+		(double)g_target_size * ROUNDS / (1024 * 1024) / perf__timer__seconds(&t),
+		(unsigned int)delta_size);
+}
+
+static void apply_deltas(void)
+{
+	perf_timer t = PERF_TIMER_INIT;
+	git_buf buf = GIT_BUF_INIT;
+	blob_pair *pair;
+	size_t i, result_size = 0;
+	int round;
+
+	perf__timer__start(&t);
+	for (round = 0; round < ROUNDS; round++) {
+		for (i = 0; i < g_count; i++) {
+			pair = &g_pairs[i];
+
+			if (!pair->delta)
+				continue;
+
+			cl_git_pass(git__delta_apply_buf(&buf,
+				git_blob_rawcontent(pair->base),
+				(size_t)git_blob_rawsize(pair->base),
+				pair->delta, pair->delta_len));
+			result_size += buf.size;
+		}
+	}
+	perf__timer__stop(&t);
+
+	perf__timer__report(&t, "apply: %.1f MB/s",
+		(double)result_size / (1024 * 1024) / perf__timer__seconds(&t));
+
+	git_buf_free(&buf);
+}
+
+void test_perf_delta__blob_pairs(void)
+{
+	static const char *names[] = { "portable", "SSE2", "AVX2" };
+	int kernel;
+
+	for (kernel = GIT_DELTA_KERNEL_PORTABLE; kernel <= GIT_DELTA_KERNEL_AVX2; kernel++) {
+		if (git_delta__kernel(kernel) == (git_delta_kernel)kernel)
+			create_deltas(names[kernel]);
+	}
+
+	apply_deltas();
+}
@@ -0,0 +1,143 @@
+#include "clar_libgit2.h"
+#include "helper__perf__timer.h"
+#include "hash.h"
+#include "hash_batch.h"
+#include "odb.h"
+
+#ifdef GIT_OPENSSL
+# include <openssl/sha.h>
+#endif
+
+/* This test is run when GITTEST_PERF_HASH is set. It hashes many small
+ * blobs, the way the indexer does, with each SHA-1 implementation that
+ * is built in and in batches, and reports the throughput of each.
+ */
+
+#define OBJECTS 500000
+#define DATA_SIZE (1024 * 1024)
+
+static unsigned char *g_data;
+
+void test_perf_hash__initialize(void)
+{
+	char *run = cl_getenv("GITTEST_PERF_HASH");
+	unsigned int seed = 1;
+	size_t i;
+
+	if (!run)
+		cl_skip();
+	git__free(run);
+
+	g_data = git__malloc(DATA_SIZE);
+	cl_assert(g_data);
+
+	for (i = 0; i < DATA_SIZE; i++) {
+		seed = seed * 1103515245 + 12345;
+		g_data[i] = (unsigned char)(seed >> 16);
+	}
+}
+
+void test_perf_hash__cleanup(void)
+{
+	git__free(g_data);
+	g_data = NULL;
+
+#ifdef GIT_SHA1_SHANI
+	git_hash__shani(true);
+#endif
+}
+
+static void hash_libgit2(git_oid *out, git_buf_vec *vec)
+{
+	cl_git_pass(git_hash_vec(out, vec, 2));
+}
+
+#ifdef GIT_OPENSSL
+static void hash_openssl(git_oid *out, git_buf_vec *vec)
+{
+	SHA_CTX ctx;
+
+	SHA1_Init(&ctx);
+	SHA1_Update(&ctx, vec[0].data, vec[0].len);
+	SHA1_Update(&ctx, vec[1].data, vec[1].len);
+	SHA1_Final(out->id, &ctx);
+}
+#endif
+
+static void hash_objects(
+	const char *name, void (*hash)(git_oid *, git_buf_vec *))
+{
+	perf_timer t = PERF_TIMER_INIT;
+	unsigned int seed = 1;
+	char hdr[64];
+	git_buf_vec vec[2];
+	git_oid id;
+	size_t i, len, total = 0;
+
+	perf__timer__start(&t);
+	for (i = 0; i < OBJECTS; i++) {
+		/* most objects in a repository are a few hundred bytes */
+		seed = seed * 1103515245 + 12345;
+		len = 64 + (seed >> 16) % 2048;
+
+		vec[0].data = hdr;
+		vec[0].len = git_odb__format_object_header(hdr, sizeof(hdr), len, GIT_OBJ_BLOB);
+		vec[1].data = g_data + (seed % (DATA_SIZE - len));
+		vec[1].len = len;
+
+		hash(&id, vec);
+		total += vec[0].len + len;
+	}
+	perf__timer__stop(&t);
+
+	perf__timer__report(&t, "%s: %u objects, %.1f MB/s", name, OBJECTS,
+		(double)total / (1024 * 1024) / perf__timer__seconds(&t));
+}
+
+static void hash_batched(unsigned int threads)
+{
+	perf_timer t = PERF_TIMER_INIT;
+	git_hash_batch batch;
+	unsigned int seed = 1;
+	size_t i, len;
+
+	git_hash_batch_init(&batch, threads);
+
+	for (i = 0; i < OBJECTS; i++) {
+		seed = seed * 1103515245 + 12345;
+		len = 64 + (seed >> 16) % 2048;
+
+		cl_git_pass(git_hash_batch_add(&batch,
+			g_data + (seed % (DATA_SIZE - len)), len, GIT_OBJ_BLOB));
+	}
+
+	perf__timer__start(&t);
+	cl_git_pass(git_hash_batch_run(&batch));
+	perf__timer__stop(&t);
+
+	perf__timer__report(&t, "batch, %u threads: %u objects, %.1f MB/s",
+		threads ? threads : (unsigned int)git_online_cpus(), OBJECTS,
+		(double)git_hash_batch_size(&batch) / (1024 * 1024) / perf__timer__seconds(&t));
+
+	git_hash_batch_free(&batch);
+}
+
+void test_perf_hash__small_objects(void)
+{
+#ifdef GIT_SHA1_SHANI
+	git_hash__shani(false);
+	hash_objects("builtin, portable", hash_libgit2);
+
+	if (git_hash__shani(true))
+		hash_objects("builtin, SHA instructions", hash_libgit2);
+#else
+	hash_objects("libgit2", hash_libgit2);
+#endif
+
+#ifdef GIT_OPENSSL
+	hash_objects("OpenSSL", hash_openssl);
+#endif
+
+	hash_batched(1);
+	hash_batched(0);
+}
@@ -16,17 +16,20 @@ void perf__timer__stop(perf_timer *t)
 	t->sum.QuadPart += (time_now.QuadPart - t->time_started.QuadPart);
 }
 
-void perf__timer__report(perf_timer *t, const char *fmt, ...)
+double perf__timer__seconds(perf_timer *t)
 {
-	va_list arglist;
 	LARGE_INTEGER freq;
-	double fraction;
 
 	QueryPerformanceFrequency(&freq);
 
-	fraction = ((double)t->sum.QuadPart) / ((double)freq.QuadPart);
+	return ((double)t->sum.QuadPart) / ((double)freq.QuadPart);
+}
+
+void perf__timer__report(perf_timer *t, const char *fmt, ...)
+{
+	va_list arglist;
 
-	printf("%10.3f: ", fraction);
+	printf("%10.3f: ", perf__timer__seconds(t));
 
 	va_start(arglist, fmt);
 	vprintf(fmt, arglist);
@@ -57,11 +60,16 @@ void perf__timer__stop(perf_timer *t)
 	t->sum += (now - t->time_started);
 }
 
+double perf__timer__seconds(perf_timer *t)
+{
+	return ((double)t->sum) / 1000;
+}
+
 void perf__timer__report(perf_timer *t, const char *fmt, ...)
 {
 	va_list arglist;
 
-	printf("%10.3f: ", ((double)t->sum) / 1000);
+	printf("%10.3f: ", perf__timer__seconds(t));
 
 	va_start(arglist, fmt);
 	vprintf(fmt, arglist);
@@ -24,4 +24,5 @@ typedef struct perf__timer perf_timer;
 
 void perf__timer__start(perf_timer *t);
 void perf__timer__stop(perf_timer *t);
+double perf__timer__seconds(perf_timer *t);
 void perf__timer__report(perf_timer *t, const char *fmt, ...);
@@ -0,0 +1,93 @@
+#include "clar_libgit2.h"
+#include "helper__perf__timer.h"
+#include "array.h"
+
+/* This test needs a large packed repository, whose path is given in
+ * GITTEST_PERF_REPO. It reads its objects in a random order, with the
+ * packfiles mapped in windows and then in full.
+ */
+
+#define READS 100000
+
+static git_repository *g_repo;
+static git_array_t(git_oid) g_ids;
+
+static int collect_id(const git_oid *id, void *payload)
+{
+	git_oid *out = git_array_alloc(g_ids);
+	GITERR_CHECK_ALLOC(out);
+
+	GIT_UNUSED(payload);
+	git_oid_cpy(out, id);
+	return 0;
+}
+
+void test_perf_mwindow__initialize(void)
+{
+	char *path = cl_getenv("GITTEST_PERF_REPO");
+	git_odb *odb;
+
+	if (!path)
+		cl_skip();
+
+	cl_git_pass(git_repository_open(&g_repo, path));
+	git__free(path);
+
+	cl_git_pass(git_repository_odb(&odb, g_repo));
+	cl_git_pass(git_odb_foreach(odb, collect_id, NULL));
+	git_odb_free(odb);
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_ENABLE_CACHING, 0));
+}
+
+void test_perf_mwindow__cleanup(void)
+{
+	git_array_clear(g_ids);
+	git_repository_free(g_repo);
+	g_repo = NULL;
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_ENABLE_CACHING, 1));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_ENABLE_MWINDOW_FULL_MAP, 0));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_MWINDOW_ADVICE, GIT_MWINDOW_ADVICE_NORMAL));
+}
+
+static void random_reads(const char *mode)
+{
+	git_repository *repo;
+	git_odb *odb;
+	git_odb_object *obj;
+	perf_timer t = PERF_TIMER_INIT;
+	unsigned int seed = 1;
+	size_t i;
+
+	/* a fresh repository, so that the packs are mapped again */
+	cl_git_pass(git_repository_open(&repo, git_repository_path(g_repo)));
+	cl_git_pass(git_repository_odb(&odb, repo));
+
+	perf__timer__start(&t);
+	for (i = 0; i < READS; i++) {
+		seed = seed * 1103515245 + 12345;
+		cl_git_pass(git_odb_read(&obj, odb,
+			git_array_get(g_ids, seed % git_array_size(g_ids))));
+		git_odb_object_free(obj);
+	}
+	perf__timer__stop(&t);
+
+	perf__timer__report(&t, "%s: %u random reads", mode, READS);
+
+	git_odb_free(odb);
+	git_repository_free(repo);
+}
+
+void test_perf_mwindow__random_reads(void)
+{
+	cl_assert(git_array_size(g_ids) > 0);
+
+	random_reads("windowed");
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_ENABLE_MWINDOW_FULL_MAP, 1));
+	random_reads("full map");
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_MWINDOW_ADVICE, GIT_MWINDOW_ADVICE_RANDOM));
+	random_reads("full map, random advice");
+}
@@ -0,0 +1,106 @@
+#include "clar_libgit2.h"
+#include "helper__perf__timer.h"
+
+/* This test needs a large repository with many similar objects,
+ * whose path is given in GITTEST_PERF_REPO. It packs every object
+ * reachable from HEAD with an increasing number of threads, which
+ * shows how the delta search scales, and then packs them again and
+ * again like a server would, with and without the delta index cache.
+ */
+
+static git_repository *g_repo;
+
+void test_perf_packbuilder__initialize(void)
+{
+	char *path = cl_getenv("GITTEST_PERF_REPO");
+
+	if (!path)
+		cl_skip();
+
+	cl_git_pass(git_repository_open(&g_repo, path));
+	git__free(path);
+}
+
+void test_perf_packbuilder__cleanup(void)
+{
+	git_repository_free(g_repo);
+	g_repo = NULL;
+}
+
+static void pack_with_threads(unsigned int threads)
+{
+	git_packbuilder *pb;
+	git_revwalk *walk;
+	git_buf buf = GIT_BUF_INIT;
+	perf_timer t_walk = PERF_TIMER_INIT;
+	perf_timer t_pack = PERF_TIMER_INIT;
+
+	perf__timer__start(&t_walk);
+	cl_git_pass(git_packbuilder_new(&pb, g_repo));
+	cl_assert_equal_i(threads, git_packbuilder_set_threads(pb, threads));
+	cl_git_pass(git_revwalk_new(&walk, g_repo));
+	cl_git_pass(git_revwalk_push_head(walk));
+	cl_git_pass(git_packbuilder_insert_walk(pb, walk));
+	perf__timer__stop(&t_walk);
+
+	perf__timer__start(&t_pack);
+	cl_git_pass(git_packbuilder_write_buf(&buf, pb));
+	perf__timer__stop(&t_pack);
+
+	perf__timer__report(&t_walk, "%2u threads: insert %u objects",
+		threads, (unsigned int)git_packbuilder_object_count(pb));
+	perf__timer__report(&t_pack, "%2u threads: search deltas and write", threads);
+
+	git_buf_free(&buf);
+	git_revwalk_free(walk);
+	git_packbuilder_free(pb);
+}
+
+void test_perf_packbuilder__threads(void)
+{
+#ifdef GIT_THREADS
+	unsigned int threads, max = (unsigned int)git_online_cpus();
+
+	for (threads = 1; threads < max; threads *= 2)
+		pack_with_threads(threads);
+	pack_with_threads(max);
+#else
+	pack_with_threads(1);
+#endif
+}
+
+static void pack_repeatedly(const char *name)
+{
+	git_packbuilder *pb;
+	git_revwalk *walk;
+	git_buf buf = GIT_BUF_INIT;
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		perf_timer t = PERF_TIMER_INIT;
+
+		perf__timer__start(&t);
+		cl_git_pass(git_packbuilder_new(&pb, g_repo));
+		cl_git_pass(git_revwalk_new(&walk, g_repo));
+		cl_git_pass(git_revwalk_push_head(walk));
+		cl_git_pass(git_packbuilder_insert_walk(pb, walk));
+		cl_git_pass(git_packbuilder_write_buf(&buf, pb));
+		perf__timer__stop(&t);
+
+		perf__timer__report(&t, "%s: pack %d", name, i + 1);
+
+		git_buf_free(&buf);
+		git_revwalk_free(walk);
+		git_packbuilder_free(pb);
+	}
+}
+
+void test_perf_packbuilder__delta_index_cache(void)
+{
+	pack_repeatedly("no cache");
+
+	cl_git_pass(git_libgit2_opts(
+		GIT_OPT_SET_DELTA_INDEX_CACHE_MAX_SIZE, (size_t)(256 * 1024 * 1024)));
+	pack_repeatedly("256MB cache");
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_DELTA_INDEX_CACHE_MAX_SIZE, (size_t)0));
+}
@@ -0,0 +1,122 @@
+#include "clar_libgit2.h"
+#include "thread_helpers.h"
+#include "array.h"
+#include "odb.h"
+
+/*
+ * Many threads read every object of two packed repositories, with
+ * windows small enough that they keep evicting each other's.
+ * tests/perf/mwindow.c times the reads.
+ */
+
+#define THREADS 8
+#define ROUNDS 2
+
+static const char *g_fixtures[] = { "testrepo.git", "bitmap.git" };
+static git_array_t(git_oid) g_ids[2];
+static int g_shared;
+
+static size_t g_window_size, g_mapped_limit;
+
+static int collect_id(const git_oid *id, void *payload)
+{
+	git_oid *out = git_array_alloc(*(git_array_t(git_oid) *)payload);
+	GITERR_CHECK_ALLOC(out);
+
+	git_oid_cpy(out, id);
+	return 0;
+}
+
+void test_threads_mwindow__initialize(void)
+{
+	git_repository *repo;
+	git_odb *odb;
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(g_fixtures); i++) {
+		cl_git_pass(git_repository_open(&repo, cl_fixture(g_fixtures[i])));
+		cl_git_pass(git_repository_odb(&odb, repo));
+		cl_git_pass(git_odb_foreach(odb, collect_id, &g_ids[i]));
+		git_odb_free(odb);
+		git_repository_free(repo);
+	}
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_MWINDOW_SIZE, &g_window_size));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_MWINDOW_MAPPED_LIMIT, &g_mapped_limit));
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_MWINDOW_SIZE, (size_t)128 * 1024));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_MWINDOW_MAPPED_LIMIT, (size_t)128 * 1024));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_ENABLE_CACHING, 0));
+}
+
+void test_threads_mwindow__cleanup(void)
+{
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(g_fixtures); i++)
+		git_array_clear(g_ids[i]);
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_MWINDOW_SIZE, g_window_size));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_MWINDOW_MAPPED_LIMIT, g_mapped_limit));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_ENABLE_CACHING, 1));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_ENABLE_MWINDOW_FULL_MAP, 0));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_MWINDOW_ADVICE, GIT_MWINDOW_ADVICE_NORMAL));
+}
+
+static void *read_objects(void *arg)
+{
+	int which = g_shared ? 0 : *(int *)arg % 2, round;
+	git_repository *repo;
+	git_odb *odb;
+	git_odb_object *obj;
+	git_oid check;
+	size_t i;
+
+	cl_git_pass(git_repository_open(&repo, cl_fixture(g_fixtures[which])));
+	cl_git_pass(git_repository_odb(&odb, repo));
+
+	for (round = 0; round < ROUNDS; round++) {
+		for (i = 0; i < git_array_size(g_ids[which]); i++) {
+			git_oid *id = git_array_get(g_ids[which], i);
+
+			cl_git_pass(git_odb_read(&obj, odb, id));
+			cl_git_pass(git_odb_hash(&check, git_odb_object_data(obj),
+				git_odb_object_size(obj), git_odb_object_type(obj)));
+			cl_assert_equal_oid(id, &check);
+			git_odb_object_free(obj);
+		}
+	}
+
+	git_odb_free(odb);
+	git_repository_free(repo);
+
+	giterr_clear();
+	return arg;
+}
+
+static void run_readers(void)
+{
+	run_in_parallel(1, THREADS, read_objects, NULL, NULL);
+}
+
+void test_threads_mwindow__same_pack(void)
+{
+	g_shared = 1;
+	run_readers();
+}
+
+void test_threads_mwindow__unrelated_packs(void)
+{
+	g_shared = 0;
+	run_readers();
+}
+
+void test_threads_mwindow__full_map(void)
+{
+	cl_git_pass(git_libgit2_opts(GIT_OPT_ENABLE_MWINDOW_FULL_MAP, 1));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_MWINDOW_ADVICE, GIT_MWINDOW_ADVICE_RANDOM));
+	cl_git_fail(git_libgit2_opts(GIT_OPT_SET_MWINDOW_ADVICE, 42));
+
+	g_shared = 0;
+	run_readers();
+}